@@ -27,8 +27,11 @@
 
 #include <gst/gst.h>
 #include <string.h>
+#include <time.h>
 
 #include "gstomx.h"
+#include "gstomxtracer.h"
+#include "gstomxtracefile.h"
 #include "gstomxmjpegdec.h"
 #include "gstomxmpeg2videodec.h"
 #include "gstomxmpeg4videodec.h"
@@ -49,6 +52,67 @@ GST_DEBUG_CATEGORY (gstomx_debug);
 G_LOCK_DEFINE_STATIC (core_handles);
 static GHashTable *core_handles;
 
+/* Set once in plugin_init() */
+gboolean _gst_omx_profile_enabled = FALSE;
+
+/* Seconds idle components stay in a core's pool by default */
+#define DEFAULT_POOL_IDLE_TIMEOUT 10
+
+/* Admission control for components of which only a limited number
+ * can exist at the same time, configured with max-instances in
+ * gstomx.conf. Elements that don't get one of the instance slots post
+ * an omx-resource-busy element message and wait for a slot up to
+ * their admission-timeout, higher admission-priority first, and fail
+ * with GST_RESOURCE_ERROR_BUSY afterwards. The slot is taken in the
+ * NULL to READY state change, so by default they don't wait at all.
+ * Idle pooled components hold their slots until somebody else needs
+ * them. */
+struct _GstOMXAdmission
+{
+  guint max_instances; /* 0 for no limit */
+  guint n_instances;
+  /* GstOMXAdmissionWaiter*, highest priority first */
+  GList *waiters;
+};
+
+typedef struct
+{
+  gint priority;
+  GCond cond;
+  gboolean admitted;
+} GstOMXAdmissionWaiter;
+
+/* "core-name/component-name" to GstOMXAdmission*, entries are
+ * never removed. Protected by admissions_lock */
+static GMutex admissions_lock;
+static GHashTable *admissions;
+
+/* Called from the system clock's thread once a resident
+ * core has been idle for its idle timeout
+ *
+ * NOTE: Uses core->lock */
+static gboolean
+gst_omx_core_idle_timeout (GstClock * clock, GstClockTime time,
+    GstClockID id, gpointer user_data)
+{
+  GstOMXCore *core = user_data;
+
+  g_mutex_lock (&core->lock);
+  /* Somebody might have used the core in the meantime */
+  if (core->idle_id == id) {
+    if (core->user_count == 0 && core->initialized) {
+      GST_DEBUG ("Deinit idle core %p", core);
+      core->deinit ();
+      core->initialized = FALSE;
+    }
+    gst_clock_id_unref (core->idle_id);
+    core->idle_id = NULL;
+  }
+  g_mutex_unlock (&core->lock);
+
+  return TRUE;
+}
+
 GstOMXCore *
 gst_omx_core_acquire (const gchar * filename)
 {
@@ -64,6 +128,7 @@ gst_omx_core_acquire (const gchar * filename)
     core = g_slice_new0 (GstOMXCore);
     g_mutex_init (&core->lock);
     core->user_count = 0;
+    g_queue_init (&core->pool);
     g_hash_table_insert (core_handles, g_strdup (filename), core);
 
     /* Hack for the Broadcom OpenMAX IL implementation */
@@ -133,7 +198,12 @@ gst_omx_core_acquire (const gchar * filename)
 
   g_mutex_lock (&core->lock);
   core->user_count++;
-  if (core->user_count == 1) {
+  if (core->idle_id) {
+    gst_clock_id_unschedule (core->idle_id);
+    gst_clock_id_unref (core->idle_id);
+    core->idle_id = NULL;
+  }
+  if (core->user_count == 1 && !core->initialized) {
     OMX_ERRORTYPE err;
 
     err = core->init ();
@@ -142,6 +212,7 @@ gst_omx_core_acquire (const gchar * filename)
       g_mutex_unlock (&core->lock);
       goto error;
     }
+    core->initialized = TRUE;
 
     GST_DEBUG ("Successfully initialized core '%s'", filename);
   }
@@ -189,8 +260,22 @@ gst_omx_core_release (GstOMXCore * core)
 
   core->user_count--;
   if (core->user_count == 0) {
-    GST_DEBUG ("Deinit core %p", core);
-    core->deinit ();
+    if (!core->resident) {
+      GST_DEBUG ("Deinit core %p", core);
+      core->deinit ();
+      core->initialized = FALSE;
+    } else if (core->idle_timeout != 0) {
+      GstClock *clock = gst_system_clock_obtain ();
+
+      GST_DEBUG ("Deinit resident core %p in %" GST_TIME_FORMAT " if idle",
+          core, GST_TIME_ARGS (core->idle_timeout));
+      core->idle_id =
+          gst_clock_new_single_shot_id (clock,
+          gst_clock_get_time (clock) + core->idle_timeout);
+      gst_clock_id_wait_async (core->idle_id, gst_omx_core_idle_timeout,
+          core, NULL);
+      gst_object_unref (clock);
+    }
   }
 
   g_mutex_unlock (&core->lock);
@@ -198,334 +283,1161 @@ gst_omx_core_release (GstOMXCore * core)
   G_UNLOCK (core_handles);
 }
 
-/* NOTE: comp->messages_lock will be used */
+/* Makes the core stay initialized while it has no users, forever or
+ * until it was idle for idle_timeout. Loads and initializes it right
+ * away so that the first element using it doesn't have to.
+ *
+ * NOTE: Uses core->lock */
 static void
-gst_omx_component_flush_messages (GstOMXComponent * comp)
+gst_omx_core_make_resident (const gchar * filename, GstClockTime idle_timeout)
 {
-  GstOMXMessage *msg;
+  GstOMXCore *core;
 
-  g_mutex_lock (&comp->messages_lock);
-  while ((msg = g_queue_pop_head (&comp->messages))) {
-    g_slice_free (GstOMXMessage, msg);
-  }
-  g_mutex_unlock (&comp->messages_lock);
-}
+  core = gst_omx_core_acquire (filename);
+  if (!core)
+    return;
 
-/* NOTE: Call with comp->lock, comp->messages_lock will be used */
-static void
-gst_omx_component_handle_messages (GstOMXComponent * comp)
-{
-  GstOMXMessage *msg;
+  g_mutex_lock (&core->lock);
+  /* Staying around forever wins over any timeout */
+  if (!core->resident || (core->idle_timeout != 0 && (idle_timeout == 0
+              || idle_timeout > core->idle_timeout)))
+    core->idle_timeout = idle_timeout;
+  core->resident = TRUE;
+  g_mutex_unlock (&core->lock);
 
-  g_mutex_lock (&comp->messages_lock);
-  while ((msg = g_queue_pop_head (&comp->messages))) {
-    g_mutex_unlock (&comp->messages_lock);
+  GST_DEBUG ("Core '%s' is resident, idle timeout %" GST_TIME_FORMAT,
+      filename, GST_TIME_ARGS (core->idle_timeout));
 
-    switch (msg->type) {
-      case GST_OMX_MESSAGE_STATE_SET:{
-        GST_INFO_OBJECT (comp->parent, "%s state change to %s finished",
-            comp->name, gst_omx_state_to_string (msg->content.state_set.state));
-        comp->state = msg->content.state_set.state;
-        if (comp->state == comp->pending_state)
-          comp->pending_state = OMX_StateInvalid;
-        break;
-      }
-      case GST_OMX_MESSAGE_FLUSH:{
-        GstOMXPort *port = NULL;
-        OMX_U32 index = msg->content.flush.port;
+  gst_omx_core_release (core);
+}
 
-        port = gst_omx_component_get_port (comp, index);
-        if (!port)
-          break;
+/* Takes an idle component with the given pool key out of the
+ * core's pool. The component keeps its reference to the core.
+ *
+ * NOTE: Uses core->lock */
+static GstOMXComponent *
+gst_omx_core_take_pooled_component (GstOMXCore * core, const gchar * pool_key)
+{
+  GstOMXComponent *comp = NULL;
+  GList *l;
 
-        GST_DEBUG_OBJECT (comp->parent, "%s port %u flushed", comp->name,
-            port->index);
+  g_mutex_lock (&core->lock);
+  for (l = core->pool.head; l; l = l->next) {
+    GstOMXComponent *tmp = l->data;
 
-        if (port->flushing) {
-          port->flushed = TRUE;
-        } else {
-          GST_ERROR_OBJECT (comp->parent, "%s port %u was not flushing",
-              comp->name, port->index);
-        }
+    if (g_str_equal (tmp->pool_key, pool_key)) {
+      comp = tmp;
+      g_queue_delete_link (&core->pool, l);
+      break;
+    }
+  }
+  g_mutex_unlock (&core->lock);
 
-        break;
-      }
-      case GST_OMX_MESSAGE_ERROR:{
-        OMX_ERRORTYPE error = msg->content.error.error;
+  return comp;
+}
 
-        if (error == OMX_ErrorNone)
-          break;
+/* Frees components that were taken out of a core's pool
+ *
+ * NOTE: Uses core->lock, comp->lock and comp->messages_lock */
+static void
+gst_omx_core_free_components (GList * comps, const gchar * reason)
+{
+  GList *l;
 
-        GST_ERROR_OBJECT (comp->parent, "%s got error: %s (0x%08x)", comp->name,
-            gst_omx_error_to_string (error), error);
+  for (l = comps; l; l = l->next) {
+    GstOMXComponent *comp = l->data;
 
-        /* We only set the first error ever from which
-         * we can't recover anymore.
-         */
-        if (comp->last_error == OMX_ErrorNone)
-          comp->last_error = error;
-        g_cond_broadcast (&comp->messages_cond);
+    GST_DEBUG ("Freeing pooled component %p %s %s", comp, comp->name, reason);
+    comp->pool_size = 0;
+    gst_omx_component_free (comp);
+  }
+  g_list_free (comps);
+}
 
-        break;
-      }
-      case GST_OMX_MESSAGE_PORT_ENABLE:{
-        GstOMXPort *port = NULL;
-        OMX_U32 index = msg->content.port_enable.port;
-        OMX_BOOL enable = msg->content.port_enable.enable;
+static gboolean gst_omx_core_pool_expired (GstClock * clock,
+    GstClockTime time, GstClockID id, gpointer user_data);
 
-        port = gst_omx_component_get_port (comp, index);
-        if (!port)
-          break;
+/* Makes sure that gst_omx_core_pool_expired() is called when the
+ * first component in the core's pool expires
+ *
+ * NOTE: Must be called while holding core->lock */
+static void
+gst_omx_core_schedule_pool_expiry_unlocked (GstOMXCore * core)
+{
+  GstClockTime first = GST_CLOCK_TIME_NONE;
+  GstClock *clock;
+  GList *l;
 
-        GST_DEBUG_OBJECT (comp->parent, "%s port %u %s", comp->name,
-            port->index, (enable ? "enabled" : "disabled"));
+  for (l = core->pool.head; l; l = l->next) {
+    GstOMXComponent *tmp = l->data;
 
-        if (enable)
-          port->enabled_pending = FALSE;
-        else
-          port->disabled_pending = FALSE;
-        break;
-      }
-      case GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED:{
-        gint i, n;
-        OMX_U32 index = msg->content.port_settings_changed.port;
-        GList *outports = NULL, *l, *k;
+    if (GST_CLOCK_TIME_IS_VALID (tmp->pool_expiry)
+        && (!GST_CLOCK_TIME_IS_VALID (first) || tmp->pool_expiry < first))
+      first = tmp->pool_expiry;
+  }
 
-        GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port %u)",
-            comp->name, index);
+  if (core->pool_expiry_id) {
+    if (gst_clock_id_get_time (core->pool_expiry_id) == first)
+      return;
+    gst_clock_id_unschedule (core->pool_expiry_id);
+    gst_clock_id_unref (core->pool_expiry_id);
+    core->pool_expiry_id = NULL;
+  }
 
-        /* FIXME: This probably can be done better */
+  if (!GST_CLOCK_TIME_IS_VALID (first))
+    return;
 
-        /* Now update the ports' states */
-        n = (comp->ports ? comp->ports->len : 0);
-        for (i = 0; i < n; i++) {
-          GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+  clock = gst_system_clock_obtain ();
+  core->pool_expiry_id = gst_clock_new_single_shot_id (clock, first);
+  gst_clock_id_wait_async (core->pool_expiry_id, gst_omx_core_pool_expired,
+      core, NULL);
+  gst_object_unref (clock);
+}
 
-          if (index == OMX_ALL || index == port->index) {
-            port->settings_cookie++;
-            gst_omx_port_update_port_definition (port, NULL);
-            if (port->port_def.eDir == OMX_DirOutput && !port->tunneled)
-              outports = g_list_prepend (outports, port);
-          }
-        }
+/* Called from the system clock's thread once the first component
+ * in a core's pool expired. Freeing the last of them releases the
+ * core, so that it is deinitialized if nobody else uses it
+ *
+ * NOTE: Uses core->lock, comp->lock and comp->messages_lock */
+static gboolean
+gst_omx_core_pool_expired (GstClock * clock, GstClockTime time,
+    GstClockID id, gpointer user_data)
+{
+  GstOMXCore *core = user_data;
+  GList *comps = NULL, *l, *next;
 
-        for (k = outports; k; k = k->next) {
-          gboolean found = FALSE;
+  g_mutex_lock (&core->lock);
+  /* The pool might have changed in the meantime */
+  if (core->pool_expiry_id != id) {
+    g_mutex_unlock (&core->lock);
+    return TRUE;
+  }
+  gst_clock_id_unref (core->pool_expiry_id);
+  core->pool_expiry_id = NULL;
 
-          for (l = comp->pending_reconfigure_outports; l; l = l->next) {
-            if (l->data == k->data) {
-              found = TRUE;
-              break;
-            }
-          }
+  for (l = core->pool.head; l; l = next) {
+    GstOMXComponent *tmp = l->data;
 
-          if (!found)
-            comp->pending_reconfigure_outports =
-                g_list_prepend (comp->pending_reconfigure_outports, k->data);
-        }
+    next = l->next;
+    if (GST_CLOCK_TIME_IS_VALID (tmp->pool_expiry)
+        && tmp->pool_expiry <= time) {
+      comps = g_list_prepend (comps, tmp);
+      g_queue_delete_link (&core->pool, l);
+    }
+  }
+  gst_omx_core_schedule_pool_expiry_unlocked (core);
+  g_mutex_unlock (&core->lock);
 
-        g_list_free (outports);
+  gst_omx_core_free_components (comps, "after its idle timeout");
 
-        break;
-      }
-      case GST_OMX_MESSAGE_BUFFER_FLAG:{
-        GstOMXPort *port = NULL;
-        OMX_U32 index = msg->content.buffer_flag.port;
-        OMX_U32 flags = msg->content.buffer_flag.flags;
+  return TRUE;
+}
 
-        port = gst_omx_component_get_port (comp, index);
-        if (!port)
-          break;
+/* Frees the idle components of component_name in the core's pool
+ * to give their instance slots up.
+ *
+ * NOTE: Uses core->lock, comp->lock and comp->messages_lock */
+static void
+gst_omx_core_free_pooled_components (GstOMXCore * core,
+    const gchar * component_name)
+{
+  GList *comps = NULL, *l, *next;
+  gchar *prefix;
 
-        GST_DEBUG_OBJECT (comp->parent, "%s port %u got buffer flags 0x%08x",
-            comp->name, port->index, flags);
-        if ((flags & OMX_BUFFERFLAG_EOS)
-            && port->port_def.eDir == OMX_DirOutput)
-          port->eos = TRUE;
+  prefix = g_strconcat (component_name, "/", NULL);
+  g_mutex_lock (&core->lock);
+  for (l = core->pool.head; l; l = next) {
+    GstOMXComponent *tmp = l->data;
 
-        break;
-      }
-      case GST_OMX_MESSAGE_BUFFER_DONE:{
-        GstOMXBuffer *buf = msg->content.buffer_done.buffer->pAppPrivate;
-        GstOMXPort *port;
-        GstOMXComponent *comp;
-
-        port = buf->port;
-        comp = port->comp;
-
-        if (msg->content.buffer_done.empty) {
-          /* Input buffer is empty again and can be used to contain new input */
-          GST_LOG_OBJECT (comp->parent, "%s port %u emptied buffer %p (%p)",
-              comp->name, port->index, buf, buf->omx_buf->pBuffer);
-
-          /* Reset offset and filled length */
-          buf->omx_buf->nOffset = 0;
-          buf->omx_buf->nFilledLen = 0;
-
-          /* Reset all flags, some implementations don't
-           * reset them themselves and the flags are not
-           * valid anymore after the buffer was consumed
-           */
-          buf->omx_buf->nFlags = 0;
-        } else {
-          /* Output buffer contains output now or
-           * the port was flushed */
-          GST_LOG_OBJECT (comp->parent, "%s port %u filled buffer %p (%p)",
-              comp->name, port->index, buf, buf->omx_buf->pBuffer);
-
-          if ((buf->omx_buf->nFlags & OMX_BUFFERFLAG_EOS)
-              && port->port_def.eDir == OMX_DirOutput)
-            port->eos = TRUE;
-        }
+    next = l->next;
+    if (g_str_has_prefix (tmp->pool_key, prefix)) {
+      comps = g_list_prepend (comps, tmp);
+      g_queue_delete_link (&core->pool, l);
+    }
+  }
+  g_mutex_unlock (&core->lock);
+  g_free (prefix);
 
-        buf->used = FALSE;
+  gst_omx_core_free_components (comps, "for another instance");
+}
 
-        g_queue_push_tail (&port->pending_buffers, buf);
+/* Limits the number of components named component_name of the core
+ * that can exist at the same time. Several elements can use the same
+ * component, the first limit configured for it is kept.
+ *
+ * NOTE: Uses admissions_lock */
+static void
+gst_omx_admission_set_limit (const gchar * core_name,
+    const gchar * component_name, guint max_instances)
+{
+  GstOMXAdmission *admission;
+  gchar *key;
 
-        break;
-      }
-      default:{
-        g_assert_not_reached ();
-        break;
-      }
-    }
+  if (max_instances == 0)
+    return;
 
-    g_slice_free (GstOMXMessage, msg);
+  key = g_strconcat (core_name, "/", component_name, NULL);
 
-    g_mutex_lock (&comp->messages_lock);
+  g_mutex_lock (&admissions_lock);
+  if (!admissions)
+    admissions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  admission = g_hash_table_lookup (admissions, key);
+  if (admission) {
+    if (admission->max_instances != max_instances)
+      GST_WARNING ("Ignoring limit of %u instances of '%s' from core '%s', "
+          "already limited to %u", max_instances, component_name, core_name,
+          admission->max_instances);
+    g_mutex_unlock (&admissions_lock);
+    g_free (key);
+    return;
   }
 
-  g_mutex_unlock (&comp->messages_lock);
+  admission = g_slice_new0 (GstOMXAdmission);
+  admission->max_instances = max_instances;
+  g_hash_table_insert (admissions, key, admission);
+
+  GST_DEBUG ("At most %u instances of '%s' from core '%s'", max_instances,
+      component_name, core_name);
+  g_mutex_unlock (&admissions_lock);
 }
 
-/* NOTE: comp->messages_lock will be used */
 static void
-gst_omx_component_send_message (GstOMXComponent * comp, GstOMXMessage * msg)
+gst_omx_admission_post_busy (GstObject * parent, const gchar * component_name,
+    guint max_instances, guint n_waiting, gint priority)
 {
-  g_mutex_lock (&comp->messages_lock);
-  if (msg)
-    g_queue_push_tail (&comp->messages, msg);
-  g_cond_broadcast (&comp->messages_cond);
-  g_mutex_unlock (&comp->messages_lock);
+  GstStructure *s;
+
+  GST_WARNING_OBJECT (parent, "All %u instances of %s are in use, %u other "
+      "elements waiting", max_instances, component_name, n_waiting);
+
+  s = gst_structure_new ("omx-resource-busy",
+      "component", G_TYPE_STRING, component_name,
+      "max-instances", G_TYPE_UINT, max_instances,
+      "waiting", G_TYPE_UINT, n_waiting,
+      "priority", G_TYPE_INT, priority, NULL);
+  gst_element_post_message (GST_ELEMENT_CAST (parent),
+      gst_message_new_element (parent, s));
 }
 
-static OMX_ERRORTYPE
-EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
-    OMX_U32 nData1, OMX_U32 nData2, OMX_PTR pEventData)
+/* Takes an instance slot of component_name if its number is limited,
+ * waiting up to timeout (GST_CLOCK_TIME_NONE for ever) if all are in
+ * use. *admission is set to what has to be released again with
+ * gst_omx_admission_release(), or NULL if there is no limit. Returns
+ * FALSE after posting an error if no slot was free in time.
+ *
+ * NOTE: Uses admissions_lock and core->lock */
+static gboolean
+gst_omx_admission_acquire (GstObject * parent, GstOMXCore * core,
+    const gchar * core_name, const gchar * component_name, gint priority,
+    GstClockTime timeout, GstOMXAdmission ** admission)
 {
-  GstOMXComponent *comp = (GstOMXComponent *) pAppData;
+  GstOMXAdmissionWaiter waiter;
+  GstOMXAdmission *tmp;
+  gint64 wait_until = -1;
+  guint max_instances, n_waiting;
+  gchar *key;
+  GList *l;
 
-  switch (eEvent) {
-    case OMX_EventCmdComplete:
-    {
-      OMX_COMMANDTYPE cmd = (OMX_COMMANDTYPE) nData1;
+  *admission = NULL;
 
-      GST_DEBUG_OBJECT (comp->parent, "%s %s command complete (%d)",
-          comp->name, gst_omx_command_to_string (cmd), cmd);
+  key = g_strconcat (core_name, "/", component_name, NULL);
+  g_mutex_lock (&admissions_lock);
+  tmp = (admissions ? g_hash_table_lookup (admissions, key) : NULL);
+  g_free (key);
 
-      switch (cmd) {
-        case OMX_CommandStateSet:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+  if (!tmp || tmp->max_instances == 0) {
+    g_mutex_unlock (&admissions_lock);
+    return TRUE;
+  }
 
-          msg->type = GST_OMX_MESSAGE_STATE_SET;
-          msg->content.state_set.state = nData2;
+  if (tmp->n_instances >= tmp->max_instances) {
+    g_mutex_unlock (&admissions_lock);
+    gst_omx_core_free_pooled_components (core, component_name);
+    g_mutex_lock (&admissions_lock);
+  }
 
-          GST_DEBUG_OBJECT (comp->parent, "%s state change to %s finished",
-              comp->name,
-              gst_omx_state_to_string (msg->content.state_set.state));
+  /* Don't overtake anybody who is already waiting */
+  if (tmp->n_instances < tmp->max_instances && !tmp->waiters) {
+    tmp->n_instances++;
+    g_mutex_unlock (&admissions_lock);
+    *admission = tmp;
+    return TRUE;
+  }
 
-          gst_omx_component_send_message (comp, msg);
-          break;
-        }
-        case OMX_CommandFlush:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+  max_instances = tmp->max_instances;
+  n_waiting = g_list_length (tmp->waiters);
+  g_mutex_unlock (&admissions_lock);
 
-          msg->type = GST_OMX_MESSAGE_FLUSH;
-          msg->content.flush.port = nData2;
-          GST_DEBUG_OBJECT (comp->parent, "%s port %u flushed", comp->name,
-              msg->content.flush.port);
+  /* Tell the application right away, it might want to stop
+   * something else instead of letting us wait */
+  gst_omx_admission_post_busy (parent, component_name, max_instances,
+      n_waiting, priority);
 
-          gst_omx_component_send_message (comp, msg);
-          break;
-        }
-        case OMX_CommandPortEnable:
-        case OMX_CommandPortDisable:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+  if (timeout == 0)
+    goto busy;
 
-          msg->type = GST_OMX_MESSAGE_PORT_ENABLE;
-          msg->content.port_enable.port = nData2;
-          msg->content.port_enable.enable = (cmd == OMX_CommandPortEnable);
-          GST_DEBUG_OBJECT (comp->parent, "%s port %u %s", comp->name,
-              msg->content.port_enable.port,
-              (msg->content.port_enable.enable ? "enabled" : "disabled"));
+  if (timeout != GST_CLOCK_TIME_NONE)
+    wait_until =
+        g_get_monotonic_time () + timeout / (GST_SECOND / G_TIME_SPAN_SECOND);
 
-          gst_omx_component_send_message (comp, msg);
-          break;
-        }
-        default:
-          break;
-      }
-      break;
+  waiter.priority = priority;
+  waiter.admitted = FALSE;
+  g_cond_init (&waiter.cond);
+
+  g_mutex_lock (&admissions_lock);
+  if (tmp->n_instances < tmp->max_instances && !tmp->waiters) {
+    tmp->n_instances++;
+    waiter.admitted = TRUE;
+  } else {
+    for (l = tmp->waiters; l; l = l->next) {
+      if (((GstOMXAdmissionWaiter *) l->data)->priority < priority)
+        break;
     }
-    case OMX_EventError:
-    {
-      GstOMXMessage *msg;
+    tmp->waiters = g_list_insert_before (tmp->waiters, l, &waiter);
 
-      /* Yes, this really happens... */
-      if (nData1 == OMX_ErrorNone)
+    while (!waiter.admitted) {
+      if (wait_until == -1)
+        g_cond_wait (&waiter.cond, &admissions_lock);
+      else if (!g_cond_wait_until (&waiter.cond, &admissions_lock, wait_until))
         break;
+    }
+    /* gst_omx_admission_release() removes admitted waiters */
+    if (!waiter.admitted)
+      tmp->waiters = g_list_remove (tmp->waiters, &waiter);
+  }
+  g_mutex_unlock (&admissions_lock);
+  g_cond_clear (&waiter.cond);
 
-      msg = g_slice_new (GstOMXMessage);
+  if (waiter.admitted) {
+    GST_DEBUG_OBJECT (parent, "Got an instance slot of %s", component_name);
+    *admission = tmp;
+    return TRUE;
+  }
 
-      msg->type = GST_OMX_MESSAGE_ERROR;
-      msg->content.error.error = nData1;
-      GST_ERROR_OBJECT (comp->parent, "%s got error: %s (0x%08x)", comp->name,
-          gst_omx_error_to_string (msg->content.error.error),
-          msg->content.error.error);
+busy:
+  GST_ELEMENT_ERROR (GST_ELEMENT_CAST (parent), RESOURCE, BUSY,
+      ("All %u instances of the hardware codec are in use", max_instances),
+      ("No instance slot of %s became free", component_name));
+  return FALSE;
+}
 
-      gst_omx_component_send_message (comp, msg);
-      break;
-    }
-    case OMX_EventPortSettingsChanged:
-    {
-      GstOMXMessage *msg = g_slice_new (GstOMXMessage);
-      OMX_U32 index;
+/* Gives an instance slot back, to the first waiter if any.
+ *
+ * NOTE: Uses admissions_lock */
+static void
+gst_omx_admission_release (GstOMXAdmission * admission)
+{
+  GstOMXAdmissionWaiter *waiter;
+
+  g_mutex_lock (&admissions_lock);
+  admission->n_instances--;
+  if (admission->waiters) {
+    waiter = admission->waiters->data;
+    admission->waiters =
+        g_list_delete_link (admission->waiters, admission->waiters);
+    admission->n_instances++;
+    waiter->admitted = TRUE;
+    g_cond_signal (&waiter->cond);
+  }
+  g_mutex_unlock (&admissions_lock);
+}
 
-      if (!(comp->hacks &
-              GST_OMX_HACK_EVENT_PORT_SETTINGS_CHANGED_NDATA_PARAMETER_SWAP)) {
-        index = nData1;
-      } else {
-        index = nData2;
-      }
+/* NOTE: Uses admissions_lock */
+static gboolean
+gst_omx_admission_has_waiters (GstOMXAdmission * admission)
+{
+  gboolean ret;
 
+  g_mutex_lock (&admissions_lock);
+  ret = (admission->waiters != NULL);
+  g_mutex_unlock (&admissions_lock);
 
-      if (index == 0
-          && (comp->hacks &
-              GST_OMX_HACK_EVENT_PORT_SETTINGS_CHANGED_PORT_0_TO_1))
-        index = 1;
+  return ret;
+}
 
+/* Room for the control messages (state changes, flushes, port
+ * enable/disable, errors...) that can be pending at the same time,
+ * in addition to the buffer done messages */
+#define MESSAGE_RING_CONTROL_SIZE 16
 
-      msg->type = GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED;
-      msg->content.port_settings_changed.port = index;
-      GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port index: %d)",
-          comp->name, msg->content.port_settings_changed.port);
+/* NOTE: Must be called while holding comp->lock */
+static void
+gst_omx_component_create_message_ring (GstOMXComponent * comp)
+{
+  GstOMXRing *ring;
+  guint n = 0;
+  gint i;
+
+  /* Every buffer can only be owned by the component once, so
+   * this is the maximum number of buffer done messages that can
+   * be pending. Leave some headroom for ports that get more buffers
+   * after a reconfiguration, everything that does not fit later
+   * goes to the overflow queue */
+  for (i = 0; i < comp->ports->len; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    n += port->port_def.nBufferCountActual;
+  }
+
+  ring =
+      gst_omx_ring_new (sizeof (GstOMXMessage),
+      2 * n + MESSAGE_RING_CONTROL_SIZE);
+
+  GST_DEBUG_OBJECT (comp->parent, "%s created message ring with %u slots",
+      comp->name, gst_omx_ring_get_size (ring));
+
+  g_atomic_pointer_set (&comp->message_ring, ring);
+}
+
+/* NOTE: comp->messages_lock will be used if the ring is empty */
+static gboolean
+gst_omx_component_pop_message (GstOMXComponent * comp, GstOMXMessage * msg)
+{
+  GstOMXRing *ring;
+  GstOMXMessage *tmp;
+
+  ring = g_atomic_pointer_get (&comp->message_ring);
+  if (ring && gst_omx_ring_pop (ring, msg))
+    return TRUE;
+
+  if (g_atomic_int_get (&comp->n_overflow_messages) == 0)
+    return FALSE;
+
+  g_mutex_lock (&comp->messages_lock);
+  tmp = g_queue_pop_head (&comp->messages);
+  if (tmp)
+    g_atomic_int_add (&comp->n_overflow_messages, -1);
+  g_mutex_unlock (&comp->messages_lock);
+
+  if (!tmp)
+    return FALSE;
+
+  *msg = *tmp;
+  g_slice_free (GstOMXMessage, tmp);
+
+  return TRUE;
+}
+
+/* Only checks for control messages, the buffers returned by the
+ * component are in the ports' done_ring.
+ *
+ * Only a snapshot unless called with comp->lock, nobody else
+ * can take messages out then */
+static gboolean
+gst_omx_component_has_messages (GstOMXComponent * comp)
+{
+  GstOMXRing *ring;
+
+  ring = g_atomic_pointer_get (&comp->message_ring);
+
+  return (ring && !gst_omx_ring_is_empty (ring))
+      || g_atomic_int_get (&comp->n_overflow_messages) > 0;
+}
+
+/* NOTE: Can be called without any locks */
+static OMX_ERRORTYPE
+gst_omx_component_peek_last_error (GstOMXComponent * comp)
+{
+  return (OMX_ERRORTYPE) g_atomic_int_get ((gint *) & comp->last_error);
+}
+
+/* Returns the cookie that is increased whenever the waiters of
+ * port, or of the whole component if port is NULL, are woken up */
+static gint
+gst_omx_component_get_wakeup_cookie (GstOMXComponent * comp,
+    GstOMXPort * port)
+{
+  return g_atomic_int_get (port ? &port->wakeup_cookie : &comp->wakeup_cookie);
+}
+
+/* Returns the port a message is about or NULL if it
+ * concerns the whole component */
+static GstOMXPort *
+gst_omx_component_get_message_port (GstOMXComponent * comp,
+    GstOMXMessage * msg)
+{
+  switch (msg->type) {
+    case GST_OMX_MESSAGE_FLUSH:
+      return gst_omx_component_get_port (comp, msg->content.flush.port);
+    case GST_OMX_MESSAGE_PORT_ENABLE:
+      return gst_omx_component_get_port (comp, msg->content.port_enable.port);
+    case GST_OMX_MESSAGE_BUFFER_FLAG:
+      return gst_omx_component_get_port (comp, msg->content.buffer_flag.port);
+    case GST_OMX_MESSAGE_BUFFER_DONE:{
+      GstOMXBuffer *buf = msg->content.buffer_done.buffer->pAppPrivate;
+
+      return (buf ? buf->port : NULL);
+    }
+    default:
+      return NULL;
+  }
+}
+
+/* Wakes up the threads waiting for messages of port, or
+ * everybody if port is NULL.
+ *
+ * NOTE: Uses comp->messages_lock if somebody is waiting */
+static void
+gst_omx_component_wake_waiters (GstOMXComponent * comp, GstOMXPort * port)
+{
+  gint i, n;
+
+  /* Waiters announce themselves before checking the wakeup cookie
+   * under messages_lock, so either they see the new cookie or
+   * we see them here and they will get the broadcast */
+  if (port) {
+    g_atomic_int_inc (&port->wakeup_cookie);
+    if (g_atomic_int_get (&port->n_waiters) > 0) {
+      g_mutex_lock (&comp->messages_lock);
+      g_cond_broadcast (&port->messages_cond);
+      g_mutex_unlock (&comp->messages_lock);
+    }
+    return;
+  }
+
+  g_atomic_int_inc (&comp->wakeup_cookie);
+  n = (comp->ports ? comp->ports->len : 0);
+  for (i = 0; i < n; i++) {
+    GstOMXPort *tmp = g_ptr_array_index (comp->ports, i);
+
+    g_atomic_int_inc (&tmp->wakeup_cookie);
+  }
+
+  if (g_atomic_int_get (&comp->n_waiters) == 0)
+    return;
+
+  g_mutex_lock (&comp->messages_lock);
+  g_cond_broadcast (&comp->messages_cond);
+  n = (comp->ports ? comp->ports->len : 0);
+  for (i = 0; i < n; i++) {
+    GstOMXPort *tmp = g_ptr_array_index (comp->ports, i);
+
+    g_cond_broadcast (&tmp->messages_cond);
+  }
+  g_mutex_unlock (&comp->messages_lock);
+}
+
+/* NOTE: comp->messages_lock will be used */
+static void
+gst_omx_component_flush_messages (GstOMXComponent * comp)
+{
+  GstOMXMessage msg;
+
+  while (gst_omx_component_pop_message (comp, &msg)) {
+    /* Just drop it */
+  }
+}
+
+static guint
+gst_omx_latency_bucket (guint64 us)
+{
+  guint msb;
+
+  if (us < 4)
+    return us;
+
+  msb = g_bit_storage (us) - 1;
+
+  return MIN ((msb - 1) * 4 + ((us >> (msb - 2)) & 3),
+      GST_OMX_LATENCY_BUCKETS - 1);
+}
+
+/* Upper bound of the bucket in microseconds */
+static guint64
+gst_omx_latency_bucket_max (guint bucket)
+{
+  guint shift;
+
+  if (bucket < 4)
+    return bucket;
+
+  shift = bucket / 4 - 1;
+
+  return (((guint64) (4 + bucket % 4) + 1) << shift) - 1;
+}
+
+/* Records that buf was passed to the component at time.
+ *
+ * NOTE: Must be called while holding port->lock */
+static void
+gst_omx_port_stats_submit (GstOMXPort * port, GstOMXBuffer * buf,
+    GstClockTime time)
+{
+  GstOMXPortStats *stats = &port->stats;
+
+  buf->submit_time = time;
+
+  if (!GST_CLOCK_TIME_IS_VALID (stats->first_submit))
+    stats->first_submit = time;
+  if (port->port_def.eDir == OMX_DirInput)
+    stats->n_bytes += buf->omx_buf->nFilledLen;
+
+  stats->in_flight++;
+  stats->max_in_flight = MAX (stats->max_in_flight, stats->in_flight);
+
+  if (GST_OMX_TRACER_IS_ENABLED ())
+    gst_omx_tracer_buffer_released (port, buf, time);
+  if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+    gst_omx_trace_file_buffer_begin (port, buf, "component", time);
+}
+
+/* NOTE: Must be called while holding port->lock */
+static void
+gst_omx_port_stats_done (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXPortStats *stats = &port->stats;
+  GstClockTime now, latency;
+
+  if (!GST_CLOCK_TIME_IS_VALID (buf->submit_time))
+    return;
+
+  now = gst_util_get_timestamp ();
+  latency = now - buf->submit_time;
+  stats->latency[gst_omx_latency_bucket (latency / GST_USECOND)]++;
+  buf->submit_time = GST_CLOCK_TIME_NONE;
+
+  if (port->port_def.eDir == OMX_DirOutput)
+    stats->n_bytes += buf->omx_buf->nFilledLen;
+  stats->n_buffers++;
+  stats->last_done = now;
+  stats->in_flight--;
+
+  if (GST_OMX_TRACER_IS_ENABLED ())
+    gst_omx_tracer_buffer_done (port, buf, now, latency);
+  if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+    gst_omx_trace_file_buffer_end (port, buf, "component", now);
+}
+
+/* Undoes gst_omx_port_stats_submit() for a buffer that the
+ * component did not accept
+ *
+ * NOTE: Must be called while holding port->lock */
+static void
+gst_omx_port_stats_cancel (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXPortStats *stats = &port->stats;
+
+  buf->submit_time = GST_CLOCK_TIME_NONE;
+
+  if (port->port_def.eDir == OMX_DirInput)
+    stats->n_bytes -= buf->omx_buf->nFilledLen;
+  stats->in_flight--;
+
+  if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+    gst_omx_trace_file_buffer_end (port, buf, "component",
+        gst_util_get_timestamp ());
+}
+
+/* NOTE: Must be called while holding port->lock */
+static void
+gst_omx_port_buffer_done (GstOMXPort * port, GstOMXBuffer * buf,
+    gboolean empty)
+{
+  GstOMXComponent *comp = port->comp;
+
+  gst_omx_port_stats_done (port, buf);
+
+  if (empty) {
+    /* Input buffer is empty again and can be used to contain new input */
+    GST_LOG_OBJECT (comp->parent, "%s port %u emptied buffer %p (%p)",
+        comp->name, port->index, buf, buf->omx_buf->pBuffer);
+
+    /* Reset offset and filled length */
+    buf->omx_buf->nOffset = 0;
+    buf->omx_buf->nFilledLen = 0;
+
+    /* Reset all flags, some implementations don't
+     * reset them themselves and the flags are not
+     * valid anymore after the buffer was consumed
+     */
+    buf->omx_buf->nFlags = 0;
+  } else {
+    /* Output buffer contains output now or
+     * the port was flushed */
+    GST_LOG_OBJECT (comp->parent, "%s port %u filled buffer %p (%p)",
+        comp->name, port->index, buf, buf->omx_buf->pBuffer);
+
+    if ((buf->omx_buf->nFlags & OMX_BUFFERFLAG_EOS)
+        && port->port_def.eDir == OMX_DirOutput)
+      port->eos = TRUE;
+  }
+
+  g_atomic_int_set (&buf->used, FALSE);
+
+  g_queue_push_tail (&port->pending_buffers, buf);
+}
+
+/* Moves the buffers the component returned from the port's
+ * done_ring to its pending_buffers.
+ *
+ * NOTE: Must be called while holding port->lock */
+static void
+gst_omx_port_handle_done_buffers (GstOMXPort * port)
+{
+  GstOMXBuffer *buf;
+
+  if (!port->done_ring)
+    return;
+
+  while (gst_omx_ring_pop (port->done_ring, &buf))
+    gst_omx_port_buffer_done (port, buf, port->port_def.eDir == OMX_DirInput);
+}
+
+/* NOTE: Call with comp->lock but without any port->lock, the
+ * port locks and comp->messages_lock will be used */
+static void
+gst_omx_component_handle_messages (GstOMXComponent * comp)
+{
+  GstOMXMessage message, *msg = &message;
+  gint i, n;
+
+  while (gst_omx_component_pop_message (comp, msg)) {
+    switch (msg->type) {
+      case GST_OMX_MESSAGE_STATE_SET:{
+        GST_INFO_OBJECT (comp->parent, "%s state change to %s finished",
+            comp->name, gst_omx_state_to_string (msg->content.state_set.state));
+        if (GST_OMX_TRACER_IS_ENABLED ())
+          gst_omx_tracer_state_changed (comp, comp->state,
+              msg->content.state_set.state,
+              gst_util_get_timestamp () - comp->state_change_time);
+        comp->state = msg->content.state_set.state;
+        if (comp->state == comp->pending_state)
+          comp->pending_state = OMX_StateInvalid;
+        break;
+      }
+      case GST_OMX_MESSAGE_FLUSH:{
+        OMX_U32 index = msg->content.flush.port;
+        gint i, n;
+
+        /* Completion of OMX_CommandFlush(OMX_ALL) is usually reported
+         * per port, but some components report it once for OMX_ALL */
+        n = (comp->ports ? comp->ports->len : 0);
+        for (i = 0; i < n; i++) {
+          GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+          if (index != OMX_ALL && index != port->index)
+            continue;
+
+          GST_DEBUG_OBJECT (comp->parent, "%s port %u flushed", comp->name,
+              port->index);
+
+          if (port->flushing) {
+            g_mutex_lock (&port->lock);
+            port->flushed = TRUE;
+            g_mutex_unlock (&port->lock);
+            gst_omx_component_wake_waiters (comp, port);
+          } else if (index != OMX_ALL) {
+            GST_ERROR_OBJECT (comp->parent, "%s port %u was not flushing",
+                comp->name, port->index);
+          }
+        }
+
+        break;
+      }
+      case GST_OMX_MESSAGE_ERROR:{
+        OMX_ERRORTYPE error = msg->content.error.error;
+
+        if (error == OMX_ErrorNone)
+          break;
+
+        GST_ERROR_OBJECT (comp->parent, "%s got error: %s (0x%08x)", comp->name,
+            gst_omx_error_to_string (error), error);
+
+        /* We only set the first error ever from which
+         * we can't recover anymore.
+         */
+        if (comp->last_error == OMX_ErrorNone)
+          g_atomic_int_set ((gint *) & comp->last_error, error);
+        gst_omx_component_wake_waiters (comp, NULL);
+
+        break;
+      }
+      case GST_OMX_MESSAGE_PORT_ENABLE:{
+        GstOMXPort *port = NULL;
+        OMX_U32 index = msg->content.port_enable.port;
+        OMX_BOOL enable = msg->content.port_enable.enable;
+
+        port = gst_omx_component_get_port (comp, index);
+        if (!port)
+          break;
+
+        GST_DEBUG_OBJECT (comp->parent, "%s port %u %s", comp->name,
+            port->index, (enable ? "enabled" : "disabled"));
+
+        g_mutex_lock (&port->lock);
+        if (enable)
+          port->enabled_pending = FALSE;
+        else
+          port->disabled_pending = FALSE;
+        g_mutex_unlock (&port->lock);
+        gst_omx_component_wake_waiters (comp, port);
+        break;
+      }
+      case GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED:{
+        gint i, n;
+        OMX_U32 index = msg->content.port_settings_changed.port;
+        OMX_U32 param = msg->content.port_settings_changed.index;
+        GList *outports = NULL, *l, *k;
+
+        GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port %u)",
+            comp->name, index);
+
+        /* FIXME: This probably can be done better */
+
+        /* Now update the ports' states */
+        n = (comp->ports ? comp->ports->len : 0);
+        for (i = 0; i < n; i++) {
+          GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+          if (index == OMX_ALL || index == port->index) {
+            g_mutex_lock (&port->lock);
+            port->settings_cookie++;
+            if (param != OMX_IndexConfigCommonOutputCrop
+                && param != OMX_IndexConfigCommonScale)
+              port->settings_changed_buffers = TRUE;
+            g_mutex_unlock (&port->lock);
+            /* The new definition is queried by whoever reconfigures
+             * the port, not while holding comp->lock here */
+            if (GST_OMX_TRACER_IS_ENABLED ())
+              gst_omx_tracer_port_settings (port, "settings-changed");
+            if (port->port_def.eDir == OMX_DirOutput && !port->tunneled)
+              outports = g_list_prepend (outports, port);
+          }
+        }
+
+        for (k = outports; k; k = k->next) {
+          gboolean found = FALSE;
+
+          for (l = comp->pending_reconfigure_outports; l; l = l->next) {
+            if (l->data == k->data) {
+              found = TRUE;
+              break;
+            }
+          }
+
+          if (!found) {
+            comp->pending_reconfigure_outports =
+                g_list_prepend (comp->pending_reconfigure_outports, k->data);
+            g_atomic_int_inc (&comp->n_pending_reconfigure_outports);
+          }
+        }
+
+        g_list_free (outports);
+
+        /* Threads that only hold their port's lock might have
+         * checked the settings before they were updated */
+        gst_omx_component_wake_waiters (comp, NULL);
+
+        break;
+      }
+      case GST_OMX_MESSAGE_BUFFER_FLAG:{
+        GstOMXPort *port = NULL;
+        OMX_U32 index = msg->content.buffer_flag.port;
+        OMX_U32 flags = msg->content.buffer_flag.flags;
+
+        port = gst_omx_component_get_port (comp, index);
+        if (!port)
+          break;
+
+        GST_DEBUG_OBJECT (comp->parent, "%s port %u got buffer flags 0x%08x",
+            comp->name, port->index, flags);
+        if ((flags & OMX_BUFFERFLAG_EOS)
+            && port->port_def.eDir == OMX_DirOutput) {
+          g_mutex_lock (&port->lock);
+          port->eos = TRUE;
+          g_mutex_unlock (&port->lock);
+          gst_omx_component_wake_waiters (comp, port);
+        }
+
+        break;
+      }
+      case GST_OMX_MESSAGE_BUFFER_DONE:{
+        GstOMXBuffer *buf = msg->content.buffer_done.buffer->pAppPrivate;
+        GstOMXPort *port = buf->port;
+
+        g_mutex_lock (&port->lock);
+        gst_omx_port_buffer_done (port, buf, msg->content.buffer_done.empty);
+        g_mutex_unlock (&port->lock);
+        gst_omx_component_wake_waiters (comp, port);
+        break;
+      }
+      default:{
+        g_assert_not_reached ();
+        break;
+      }
+    }
+  }
+
+  /* Buffers returned by the component bypass the message queue,
+   * pick them up after the control messages so that buffers
+   * following a flush or settings change are seen after it */
+  n = (comp->ports ? comp->ports->len : 0);
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    g_mutex_lock (&port->lock);
+    gst_omx_port_handle_done_buffers (port);
+    g_mutex_unlock (&port->lock);
+  }
+}
+
+/* Handles the buffers returned to port and, if there are any,
+ * the pending control messages of the component.
+ *
+ * NOTE: Must be called while holding port->lock, which is released
+ * while handling control messages. Uses comp->lock for those */
+static void
+gst_omx_port_handle_messages (GstOMXPort * port)
+{
+  GstOMXComponent *comp = port->comp;
+
+  if (gst_omx_component_has_messages (comp)) {
+    g_mutex_unlock (&port->lock);
+    g_mutex_lock (&comp->lock);
+    gst_omx_component_handle_messages (comp);
+    g_mutex_unlock (&comp->lock);
+    g_mutex_lock (&port->lock);
+  }
+
+  gst_omx_port_handle_done_buffers (port);
+}
+
+/* TRUE if all buffers of the port are back from the component
+ * and were not acquired by anybody yet.
+ *
+ * NOTE: Uses port->lock */
+static gboolean
+gst_omx_port_has_all_buffers (GstOMXPort * port)
+{
+  gboolean ret;
+
+  g_mutex_lock (&port->lock);
+  ret = (!port->buffers
+      || port->buffers->len <= g_queue_get_length (&port->pending_buffers));
+  g_mutex_unlock (&port->lock);
+
+  return ret;
+}
+
+/* Copies msg, which can be on the stack, and wakes up the
+ * threads waiting for the port the message is about.
+ *
+ * NOTE: comp->messages_lock will be used if somebody is waiting
+ * or the message ring is full */
+static void
+gst_omx_component_send_message (GstOMXComponent * comp, GstOMXMessage * msg)
+{
+  GstOMXRing *ring;
+
+  ring = g_atomic_pointer_get (&comp->message_ring);
+
+  /* Keep the order of messages, once something went to the
+   * overflow queue everything else has to go there too until
+   * it was emptied again */
+  if (!ring || g_atomic_int_get (&comp->n_overflow_messages) > 0
+      || !gst_omx_ring_push (ring, msg)) {
+    if (ring)
+      GST_DEBUG_OBJECT (comp->parent, "%s message ring full", comp->name);
+
+    g_mutex_lock (&comp->messages_lock);
+    g_queue_push_tail (&comp->messages, g_slice_dup (GstOMXMessage, msg));
+    g_atomic_int_inc (&comp->n_overflow_messages);
+    g_mutex_unlock (&comp->messages_lock);
+  }
+
+  gst_omx_component_wake_waiters (comp,
+      gst_omx_component_get_message_port (comp, msg));
+}
+
+/* Waits until the waiters of port (or of the whole component if
+ * port is NULL) are woken up after *cookie was taken, or until
+ * wait_until (monotonic time in microseconds, -1 for no timeout) has
+ * passed. Afterwards *cookie is updated and all pending messages are
+ * handled. Returns FALSE on timeout.
+ *
+ * NOTE: Must be called while holding lock, which is either comp->lock
+ * or port->lock and is released while waiting. Uses comp->messages_lock */
+static gboolean
+gst_omx_component_wait_message (GstOMXComponent * comp, GstOMXPort * port,
+    GMutex * lock, gint * cookie, gint64 wait_until)
+{
+  GCond *cond = (port ? &port->messages_cond : &comp->messages_cond);
+  gboolean signalled = TRUE;
+
+  g_assert (lock == &comp->lock || (port && lock == &port->lock));
+
+  g_atomic_int_inc (&comp->n_waiters);
+  if (port)
+    g_atomic_int_inc (&port->n_waiters);
+  g_mutex_lock (&comp->messages_lock);
+  /* Nobody can wake us up without taking messages_lock now */
+  if (*cookie == gst_omx_component_get_wakeup_cookie (comp, port)
+      && !gst_omx_component_has_messages (comp)) {
+    g_mutex_unlock (lock);
+    if (wait_until == -1) {
+      g_cond_wait (cond, &comp->messages_lock);
+    } else {
+      signalled = g_cond_wait_until (cond, &comp->messages_lock, wait_until);
+    }
+    g_mutex_unlock (&comp->messages_lock);
+    g_mutex_lock (lock);
+  } else {
+    g_mutex_unlock (&comp->messages_lock);
+  }
+  if (port)
+    g_atomic_int_add (&port->n_waiters, -1);
+  g_atomic_int_add (&comp->n_waiters, -1);
+
+  *cookie = gst_omx_component_get_wakeup_cookie (comp, port);
+
+  if (signalled) {
+    if (lock == &comp->lock)
+      gst_omx_component_handle_messages (comp);
+    else
+      gst_omx_port_handle_messages (port);
+  }
+
+  return signalled;
+}
+
+/* Hands a buffer returned by the component straight to its port
+ * without going through the message queue. Returns FALSE if this
+ * was not possible.
+ *
+ * NOTE: Never blocks, comp->messages_lock is only taken if
+ * somebody waits for the port */
+static gboolean
+gst_omx_port_post_done_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXRing *ring;
+
+  ring = g_atomic_pointer_get (&port->done_ring);
+  if (!ring || !gst_omx_ring_push (ring, &buf))
+    return FALSE;
+
+  gst_omx_component_wake_waiters (port->comp, port);
+
+  return TRUE;
+}
+
+static OMX_ERRORTYPE
+EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
+    OMX_U32 nData1, OMX_U32 nData2, OMX_PTR pEventData)
+{
+  GstOMXComponent *comp = (GstOMXComponent *) pAppData;
+
+  switch (eEvent) {
+    case OMX_EventCmdComplete:
+    {
+      OMX_COMMANDTYPE cmd = (OMX_COMMANDTYPE) nData1;
+
+      GST_DEBUG_OBJECT (comp->parent, "%s %s command complete (%d)",
+          comp->name, gst_omx_command_to_string (cmd), cmd);
 
-      gst_omx_component_send_message (comp, msg);
+      switch (cmd) {
+        case OMX_CommandStateSet:{
+          GstOMXMessage msg;
+
+          msg.type = GST_OMX_MESSAGE_STATE_SET;
+          msg.content.state_set.state = nData2;
+
+          GST_DEBUG_OBJECT (comp->parent, "%s state change to %s finished",
+              comp->name, gst_omx_state_to_string (msg.content.state_set.state));
+
+          gst_omx_component_send_message (comp, &msg);
+          break;
+        }
+        case OMX_CommandFlush:{
+          GstOMXMessage msg;
+
+          msg.type = GST_OMX_MESSAGE_FLUSH;
+          msg.content.flush.port = nData2;
+          GST_DEBUG_OBJECT (comp->parent, "%s port %u flushed", comp->name,
+              msg.content.flush.port);
+
+          gst_omx_component_send_message (comp, &msg);
+          break;
+        }
+        case OMX_CommandPortEnable:
+        case OMX_CommandPortDisable:{
+          GstOMXMessage msg;
+
+          msg.type = GST_OMX_MESSAGE_PORT_ENABLE;
+          msg.content.port_enable.port = nData2;
+          msg.content.port_enable.enable = (cmd == OMX_CommandPortEnable);
+          GST_DEBUG_OBJECT (comp->parent, "%s port %u %s", comp->name,
+              msg.content.port_enable.port,
+              (msg.content.port_enable.enable ? "enabled" : "disabled"));
+
+          gst_omx_component_send_message (comp, &msg);
+          break;
+        }
+        default:
+          break;
+      }
       break;
     }
-    case OMX_EventBufferFlag:{
-      GstOMXMessage *msg;
+    case OMX_EventError:
+    {
+      GstOMXMessage msg;
+
+      /* Yes, this really happens... */
+      if (nData1 == OMX_ErrorNone)
+        break;
+
+      msg.type = GST_OMX_MESSAGE_ERROR;
+      msg.content.error.error = nData1;
+      GST_ERROR_OBJECT (comp->parent, "%s got error: %s (0x%08x)", comp->name,
+          gst_omx_error_to_string (msg.content.error.error),
+          msg.content.error.error);
+
+      gst_omx_component_send_message (comp, &msg);
+      break;
+    }
+    case OMX_EventPortSettingsChanged:
+    {
+      GstOMXMessage msg;
+      OMX_U32 index, param;
+
+      if (!(comp->hacks &
+              GST_OMX_HACK_EVENT_PORT_SETTINGS_CHANGED_NDATA_PARAMETER_SWAP)) {
+        index = nData1;
+        param = nData2;
+      } else {
+        index = nData2;
+        param = nData1;
+      }
+
+
+      if (index == 0
+          && (comp->hacks &
+              GST_OMX_HACK_EVENT_PORT_SETTINGS_CHANGED_PORT_0_TO_1))
+        index = 1;
+
 
-      msg = g_slice_new (GstOMXMessage);
+      msg.type = GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED;
+      msg.content.port_settings_changed.port = index;
+      msg.content.port_settings_changed.index = param;
+      GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port index: %d, "
+          "parameter 0x%08x)", comp->name,
+          msg.content.port_settings_changed.port,
+          (guint) msg.content.port_settings_changed.index);
+
+      gst_omx_component_send_message (comp, &msg);
+      break;
+    }
+    case OMX_EventBufferFlag:{
+      GstOMXMessage msg;
 
-      msg->type = GST_OMX_MESSAGE_BUFFER_FLAG;
-      msg->content.buffer_flag.port = nData1;
-      msg->content.buffer_flag.flags = nData2;
+      msg.type = GST_OMX_MESSAGE_BUFFER_FLAG;
+      msg.content.buffer_flag.port = nData1;
+      msg.content.buffer_flag.flags = nData2;
       GST_DEBUG_OBJECT (comp->parent, "%s port %u got buffer flags 0x%08x",
-          comp->name, msg->content.buffer_flag.port,
-          msg->content.buffer_flag.flags);
+          comp->name, msg.content.buffer_flag.port,
+          msg.content.buffer_flag.flags);
 
-      gst_omx_component_send_message (comp, msg);
+      gst_omx_component_send_message (comp, &msg);
       break;
     }
     case OMX_EventPortFormatDetected:
@@ -544,7 +1456,7 @@ EmptyBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 {
   GstOMXBuffer *buf;
   GstOMXComponent *comp;
-  GstOMXMessage *msg;
+  GstOMXMessage msg;
 
   buf = pBuffer->pAppPrivate;
   if (!buf) {
@@ -561,17 +1473,27 @@ EmptyBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 
   comp = buf->port->comp;
 
-  msg = g_slice_new (GstOMXMessage);
-  msg->type = GST_OMX_MESSAGE_BUFFER_DONE;
-  msg->content.buffer_done.component = hComponent;
-  msg->content.buffer_done.app_data = pAppData;
-  msg->content.buffer_done.buffer = pBuffer;
-  msg->content.buffer_done.empty = OMX_TRUE;
-
   GST_LOG_OBJECT (comp->parent, "%s port %u emptied buffer %p (%p)",
       comp->name, buf->port->index, buf, buf->omx_buf->pBuffer);
 
-  gst_omx_component_send_message (comp, msg);
+  if (buf->port->buffer_done_func)
+    buf->port->buffer_done_func (buf->port, buf, buf->port->buffer_done_data);
+
+  if (gst_omx_port_post_done_buffer (buf->port, buf))
+    return OMX_ErrorNone;
+
+  /* The ring has room for all buffers of the port, so this
+   * should not happen. Keep the buffer anyway */
+  GST_WARNING_OBJECT (comp->parent, "%s port %u has no room for returned "
+      "buffer %p", comp->name, buf->port->index, buf);
+
+  msg.type = GST_OMX_MESSAGE_BUFFER_DONE;
+  msg.content.buffer_done.component = hComponent;
+  msg.content.buffer_done.app_data = pAppData;
+  msg.content.buffer_done.buffer = pBuffer;
+  msg.content.buffer_done.empty = OMX_TRUE;
+
+  gst_omx_component_send_message (comp, &msg);
 
   return OMX_ErrorNone;
 }
@@ -582,7 +1504,7 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 {
   GstOMXBuffer *buf;
   GstOMXComponent *comp;
-  GstOMXMessage *msg;
+  GstOMXMessage msg;
 
   buf = pBuffer->pAppPrivate;
   if (!buf) {
@@ -599,17 +1521,27 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 
   comp = buf->port->comp;
 
-  msg = g_slice_new (GstOMXMessage);
-  msg->type = GST_OMX_MESSAGE_BUFFER_DONE;
-  msg->content.buffer_done.component = hComponent;
-  msg->content.buffer_done.app_data = pAppData;
-  msg->content.buffer_done.buffer = pBuffer;
-  msg->content.buffer_done.empty = OMX_FALSE;
-
   GST_LOG_OBJECT (comp->parent, "%s port %u filled buffer %p (%p)", comp->name,
       buf->port->index, buf, buf->omx_buf->pBuffer);
 
-  gst_omx_component_send_message (comp, msg);
+  if (buf->port->buffer_done_func)
+    buf->port->buffer_done_func (buf->port, buf, buf->port->buffer_done_data);
+
+  if (gst_omx_port_post_done_buffer (buf->port, buf))
+    return OMX_ErrorNone;
+
+  /* The ring has room for all buffers of the port, so this
+   * should not happen. Keep the buffer anyway */
+  GST_WARNING_OBJECT (comp->parent, "%s port %u has no room for returned "
+      "buffer %p", comp->name, buf->port->index, buf);
+
+  msg.type = GST_OMX_MESSAGE_BUFFER_DONE;
+  msg.content.buffer_done.component = hComponent;
+  msg.content.buffer_done.app_data = pAppData;
+  msg.content.buffer_done.buffer = pBuffer;
+  msg.content.buffer_done.empty = OMX_FALSE;
+
+  gst_omx_component_send_message (comp, &msg);
 
   return OMX_ErrorNone;
 }
@@ -617,24 +1549,74 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 static OMX_CALLBACKTYPE callbacks =
     { EventHandler, EmptyBufferDone, FillBufferDone };
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* If pool_size is not 0 an idle component of the same name and role
+ * is taken from the core's pool if there is one, and freeing the
+ * component puts it back into the pool as long as the pool has less
+ * than pool_size of them. It is freed for real after it was in the
+ * pool for pool_idle_timeout, unless that is 0. The ports of pooled
+ * components get their initial definitions back when they are added.
+ *
+ * NOTE: Uses comp->lock, comp->messages_lock and core->lock */
 GstOMXComponent *
 gst_omx_component_new (GstObject * parent, const gchar * core_name,
-    const gchar * component_name, const gchar * component_role, guint64 hacks)
+    const gchar * component_name, const gchar * component_role, guint64 hacks,
+    guint pool_size, GstClockTime pool_idle_timeout, gint admission_priority,
+    GstClockTime admission_timeout)
 {
   OMX_ERRORTYPE err;
   GstOMXCore *core;
   GstOMXComponent *comp;
+  GstOMXAdmission *admission;
   const gchar *dot;
+  gchar *pool_key;
   gint retry = 1;
 
+  if (hacks & GST_OMX_HACK_NO_COMPONENT_ROLE)
+    component_role = NULL;
+
+  pool_key =
+      g_strconcat (component_name, "/", (component_role ? component_role : ""),
+      NULL);
+
 reinit:
   core = gst_omx_core_acquire (core_name);
-  if (!core)
+  if (!core) {
+    g_free (pool_key);
+    return NULL;
+  }
+
+  if (pool_size > 0
+      && (comp = gst_omx_core_take_pooled_component (core, pool_key))) {
+    /* The pooled component still holds its own reference */
+    gst_omx_core_release (core);
+    g_free (pool_key);
+
+    GST_DEBUG_OBJECT (parent, "Reusing pooled component handle %p (%s) from "
+        "core '%s'", comp->handle, component_name, core_name);
+    comp->parent = gst_object_ref (parent);
+    comp->hacks = hacks;
+    comp->pool_size = pool_size;
+    comp->pool_idle_timeout = pool_idle_timeout;
+
+    goto done;
+  }
+
+  if (!gst_omx_admission_acquire (parent, core, core_name, component_name,
+          admission_priority, admission_timeout, &admission)) {
+    gst_omx_core_release (core);
+    g_free (pool_key);
     return NULL;
+  }
 
   comp = g_slice_new0 (GstOMXComponent);
   comp->core = core;
+  comp->admission = admission;
+  comp->pool_key = pool_key;
+  comp->pool_size = pool_size;
+  comp->pool_idle_timeout = pool_idle_timeout;
+  comp->pool_expiry = GST_CLOCK_TIME_NONE;
+  comp->default_port_defs =
+      g_array_new (FALSE, FALSE, sizeof (OMX_PARAM_PORTDEFINITIONTYPE));
 
   if ((dot = g_strrstr (component_name, ".")))
     comp->name = g_strdup (dot + 1);
@@ -648,11 +1630,15 @@ reinit:
     GST_ERROR_OBJECT (parent,
         "Failed to get component handle '%s' from core '%s': 0x%08x",
         component_name, core_name, err);
+    if (admission)
+      gst_omx_admission_release (admission);
     gst_omx_core_release (core);
     g_free (comp->name);
+    g_array_free (comp->default_port_defs, TRUE);
     g_slice_free (GstOMXComponent, comp);
     if (retry-- > 0)
       goto reinit;
+    g_free (pool_key);
     return NULL;
   }
   GST_DEBUG_OBJECT (parent,
@@ -674,7 +1660,7 @@ reinit:
   comp->last_error = OMX_ErrorNone;
 
   /* Set component role if any */
-  if (component_role && !(hacks & GST_OMX_HACK_NO_COMPONENT_ROLE)) {
+  if (component_role) {
     OMX_PARAM_COMPONENTROLETYPE param;
 
     GST_OMX_INIT_STRUCT (&param);
@@ -689,11 +1675,13 @@ reinit:
 
     /* If setting the role failed this component is unusable */
     if (err != OMX_ErrorNone) {
+      comp->pool_size = 0;
       gst_omx_component_free (comp);
       return NULL;
     }
   }
 
+done:
   OMX_GetState (comp->handle, &comp->state);
 
   g_mutex_lock (&comp->lock);
@@ -703,7 +1691,86 @@ reinit:
   return comp;
 }
 
-/* NOTE: Uses comp->messages_lock */
+/* Puts comp into its core's pool if pooling is enabled for it, it is
+ * back in Loaded state without errors and the pool has room. The
+ * ports must be freed already. Returns FALSE if comp has to be freed.
+ *
+ * NOTE: Uses comp->lock, comp->messages_lock and core->lock */
+static gboolean
+gst_omx_component_pool_release (GstOMXComponent * comp)
+{
+  GstOMXCore *core = comp->core;
+  GstObject *parent = NULL;
+  guint n = 0;
+  GList *l;
+
+  if (comp->pool_size == 0)
+    return FALSE;
+
+  /* Somebody needs the instance slot more than the pool */
+  if (comp->admission && gst_omx_admission_has_waiters (comp->admission))
+    return FALSE;
+
+  g_mutex_lock (&comp->lock);
+  gst_omx_component_handle_messages (comp);
+
+  if (comp->state != OMX_StateLoaded
+      || comp->pending_state != OMX_StateInvalid
+      || comp->last_error != OMX_ErrorNone) {
+    GST_DEBUG_OBJECT (comp->parent, "Not pooling %s in state %s: %s",
+        comp->name, gst_omx_state_to_string (comp->state),
+        gst_omx_error_to_string (comp->last_error));
+    g_mutex_unlock (&comp->lock);
+    return FALSE;
+  }
+
+  /* Start over like a new component, the message
+   * ring is created again for the next user's ports */
+  gst_omx_component_flush_messages (comp);
+  if (comp->message_ring) {
+    gst_omx_ring_free (comp->message_ring);
+    comp->message_ring = NULL;
+  }
+  g_list_free (comp->pending_reconfigure_outports);
+  comp->pending_reconfigure_outports = NULL;
+  g_atomic_int_set (&comp->n_pending_reconfigure_outports, 0);
+  g_mutex_unlock (&comp->lock);
+
+  g_mutex_lock (&core->lock);
+  for (l = core->pool.head; l; l = l->next) {
+    GstOMXComponent *tmp = l->data;
+
+    if (g_str_equal (tmp->pool_key, comp->pool_key))
+      n++;
+  }
+  if (n < comp->pool_size) {
+    GST_INFO_OBJECT (comp->parent, "Returning component %p %s to the pool",
+        comp, comp->name);
+    parent = comp->parent;
+    comp->parent = NULL;
+    g_queue_push_tail (&core->pool, comp);
+
+    if (comp->pool_idle_timeout != 0) {
+      GstClock *clock = gst_system_clock_obtain ();
+
+      comp->pool_expiry = gst_clock_get_time (clock) + comp->pool_idle_timeout;
+      gst_object_unref (clock);
+    } else {
+      comp->pool_expiry = GST_CLOCK_TIME_NONE;
+    }
+    gst_omx_core_schedule_pool_expiry_unlocked (core);
+  }
+  g_mutex_unlock (&core->lock);
+
+  if (!parent)
+    return FALSE;
+
+  gst_object_unref (parent);
+
+  return TRUE;
+}
+
+/* NOTE: Uses comp->lock, comp->messages_lock and core->lock */
 void
 gst_omx_component_free (GstOMXComponent * comp)
 {
@@ -722,25 +1789,50 @@ gst_omx_component_free (GstOMXComponent * comp)
       g_assert (port->buffers == NULL);
       g_assert (g_queue_get_length (&port->pending_buffers) == 0);
 
+      if (port->done_ring)
+        gst_omx_ring_free (port->done_ring);
+      g_cond_clear (&port->messages_cond);
+      g_mutex_clear (&port->lock);
       g_slice_free (GstOMXPort, port);
     }
+    g_ptr_array_set_size (comp->ports, 0);
+    comp->n_in_ports = 0;
+    comp->n_out_ports = 0;
+  }
+
+  if (gst_omx_component_pool_release (comp))
+    return;
+
+  if (comp->ports) {
     g_ptr_array_unref (comp->ports);
     comp->ports = NULL;
   }
 
   comp->core->free_handle (comp->handle);
+  if (comp->admission)
+    gst_omx_admission_release (comp->admission);
   gst_omx_core_release (comp->core);
 
   gst_omx_component_flush_messages (comp);
+  if (comp->message_ring) {
+    gst_omx_ring_free (comp->message_ring);
+    comp->message_ring = NULL;
+  }
 
   g_cond_clear (&comp->messages_cond);
   g_mutex_clear (&comp->messages_lock);
   g_mutex_clear (&comp->lock);
 
-  gst_object_unref (comp->parent);
+  /* Pooled components have no parent */
+  if (comp->parent)
+    gst_object_unref (comp->parent);
 
   g_free (comp->name);
   comp->name = NULL;
+  g_free (comp->pool_key);
+  comp->pool_key = NULL;
+  g_array_free (comp->default_port_defs, TRUE);
+  comp->default_port_defs = NULL;
 
   g_slice_free (GstOMXComponent, comp);
 }
@@ -781,11 +1873,21 @@ gst_omx_component_set_state (GstOMXComponent * comp, OMX_STATETYPE state)
       && state < old_state) {
     g_list_free (comp->pending_reconfigure_outports);
     comp->pending_reconfigure_outports = NULL;
+    g_atomic_int_set (&comp->n_pending_reconfigure_outports, 0);
     /* Notify all inports that are still waiting */
-    gst_omx_component_send_message (comp, NULL);
+    gst_omx_component_wake_waiters (comp, NULL);
   }
 
+  /* All ports are known and configured now */
+  if (!comp->message_ring)
+    gst_omx_component_create_message_ring (comp);
+
+  comp->state_change_time = gst_util_get_timestamp ();
+  /* pending_state is set already, so nobody else starts
+   * the same state change meanwhile */
+  g_mutex_unlock (&comp->lock);
   err = OMX_SendCommand (comp->handle, OMX_CommandStateSet, state, NULL);
+  g_mutex_lock (&comp->lock);
   /* No need to check if anything has changed here */
 
 done:
@@ -808,6 +1910,7 @@ gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout)
   OMX_STATETYPE ret;
   gint64 wait_until = -1;
   gboolean signalled = TRUE;
+  gint cookie;
 
   g_return_val_if_fail (comp != NULL, OMX_StateInvalid);
 
@@ -842,25 +1945,13 @@ gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout)
     GST_DEBUG_OBJECT (comp->parent, "%s waiting for signal", comp->name);
   }
 
+  cookie = gst_omx_component_get_wakeup_cookie (comp, NULL);
   gst_omx_component_handle_messages (comp);
   while (signalled && comp->last_error == OMX_ErrorNone
       && comp->pending_state != OMX_StateInvalid) {
-    g_mutex_lock (&comp->messages_lock);
-    g_mutex_unlock (&comp->lock);
-    if (!g_queue_is_empty (&comp->messages)) {
-      signalled = TRUE;
-    } else if (timeout == GST_CLOCK_TIME_NONE) {
-      g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-      signalled = TRUE;
-    } else {
-      signalled =
-          g_cond_wait_until (&comp->messages_cond, &comp->messages_lock,
-          wait_until);
-    }
-    g_mutex_unlock (&comp->messages_lock);
-    g_mutex_lock (&comp->lock);
-    if (signalled)
-      gst_omx_component_handle_messages (comp);
+    signalled =
+        gst_omx_component_wait_message (comp, NULL, &comp->lock, &cookie,
+        wait_until);
   };
 
   if (signalled) {
@@ -911,6 +2002,26 @@ gst_omx_component_add_port (GstOMXComponent * comp, guint32 index)
 
   GST_DEBUG_OBJECT (comp->parent, "%s adding port %u", comp->name, index);
 
+  /* A component from the pool still has the settings of its
+   * previous user */
+  n = comp->default_port_defs->len;
+  for (i = 0; i < n; i++) {
+    OMX_PARAM_PORTDEFINITIONTYPE *default_port_def =
+        &g_array_index (comp->default_port_defs, OMX_PARAM_PORTDEFINITIONTYPE,
+        i);
+
+    if (default_port_def->nPortIndex != index)
+      continue;
+
+    port_def = *default_port_def;
+    err = gst_omx_component_set_parameter (comp, OMX_IndexParamPortDefinition,
+        &port_def);
+    if (err != OMX_ErrorNone)
+      GST_WARNING_OBJECT (comp->parent, "%s failed to reset port %u: %s "
+          "(0x%08x)", comp->name, index, gst_omx_error_to_string (err), err);
+    break;
+  }
+
   GST_OMX_INIT_STRUCT (&port_def);
   port_def.nPortIndex = index;
 
@@ -922,6 +2033,9 @@ gst_omx_component_add_port (GstOMXComponent * comp, guint32 index)
     return NULL;
   }
 
+  if (i == n)
+    g_array_append_val (comp->default_port_defs, port_def);
+
   port = g_slice_new0 (GstOMXPort);
   port->comp = comp;
   port->index = index;
@@ -930,7 +2044,11 @@ gst_omx_component_add_port (GstOMXComponent * comp, guint32 index)
 
   port->port_def = port_def;
 
+  g_mutex_init (&port->lock);
   g_queue_init (&port->pending_buffers);
+  g_cond_init (&port->messages_cond);
+  port->stats.first_submit = GST_CLOCK_TIME_NONE;
+  port->stats.last_done = GST_CLOCK_TIME_NONE;
   port->flushing = TRUE;
   port->flushed = FALSE;
   port->enabled_pending = FALSE;
@@ -1183,11 +2301,13 @@ gst_omx_port_get_port_definition (GstOMXPort * port,
   return err;
 }
 
+/* NOTE: Uses port->lock, must not be called while holding it */
 OMX_ERRORTYPE
 gst_omx_port_update_port_definition (GstOMXPort * port,
     OMX_PARAM_PORTDEFINITIONTYPE * port_def)
 {
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  OMX_PARAM_PORTDEFINITIONTYPE tmp;
   GstOMXComponent *comp;
 
   g_return_val_if_fail (port != NULL, FALSE);
@@ -1206,41 +2326,176 @@ gst_omx_port_update_port_definition (GstOMXPort * port,
         port_def);
   }
 
-  gst_omx_component_get_parameter (comp, OMX_IndexParamPortDefinition,
-      &port->port_def);
+  GST_OMX_INIT_STRUCT (&tmp);
+  tmp.nPortIndex = port->index;
+  if (gst_omx_component_get_parameter (comp, OMX_IndexParamPortDefinition,
+          &tmp) == OMX_ErrorNone) {
+    g_mutex_lock (&port->lock);
+    port->port_def = tmp;
+    g_mutex_unlock (&port->lock);
+  }
+
+  GST_DEBUG_OBJECT (comp->parent, "Updated %s port %u definition: %s (0x%08x)",
+      comp->name, port->index, gst_omx_error_to_string (err), err);
+
+  return err;
+}
+
+/* Updates the port definition from the component like
+ * gst_omx_port_update_port_definition() without holding comp->lock
+ * while the component is queried.
+ *
+ * NOTE: Must be called while holding comp->lock, which is
+ * released meanwhile */
+static void
+gst_omx_port_update_port_definition_unlocked (GstOMXPort * port)
+{
+  GstOMXComponent *comp = port->comp;
+
+  g_mutex_unlock (&comp->lock);
+  gst_omx_port_update_port_definition (port, NULL);
+  g_mutex_lock (&comp->lock);
+}
+
+/* Takes up to max_bufs buffers from the head of pending_buffers. A
+ * NULL buffer queued by gst_omx_port_signal_eos() is only returned
+ * on its own.
+ *
+ * NOTE: Must be called while holding port->lock */
+static guint
+gst_omx_port_pop_pending_buffers (GstOMXPort * port, GstOMXBuffer ** bufs,
+    guint max_bufs)
+{
+  guint n = 0;
+
+  if (!g_queue_is_empty (&port->pending_buffers)
+      && !g_queue_peek_head (&port->pending_buffers)) {
+    bufs[n++] = g_queue_pop_head (&port->pending_buffers);
+    return n;
+  }
+
+  while (n < max_bufs && g_queue_peek_head (&port->pending_buffers))
+    bufs[n++] = g_queue_pop_head (&port->pending_buffers);
+
+  return n;
+}
+
+static GstOMXAcquireBufferReturn gst_omx_port_acquire_buffers_until (GstOMXPort
+    * port, GstOMXBuffer ** bufs, guint max_bufs, guint * n_bufs,
+    gint64 wait_until);
+
+/* NOTE: Uses port->lock and comp->messages_lock, comp->lock
+ * only if there are control messages to handle */
+GstOMXAcquireBufferReturn
+gst_omx_port_acquire_buffer (GstOMXPort * port, GstOMXBuffer ** buf)
+{
+  guint n_bufs;
+
+  g_return_val_if_fail (buf != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
+
+  *buf = NULL;
+
+  return gst_omx_port_acquire_buffers_until (port, buf, 1, &n_bufs, -1);
+}
+
+/* Like gst_omx_port_acquire_buffer() but never waits. Returns
+ * GST_OMX_ACQUIRE_BUFFER_TIMEOUT if no buffer is pending right now,
+ * the other return values have the same meaning.
+ *
+ * NOTE: Uses port->lock and comp->messages_lock, comp->lock
+ * only if there are control messages to handle */
+GstOMXAcquireBufferReturn
+gst_omx_port_try_acquire_buffer (GstOMXPort * port, GstOMXBuffer ** buf)
+{
+  guint n_bufs;
+
+  g_return_val_if_fail (buf != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
+
+  *buf = NULL;
+
+  return gst_omx_port_acquire_buffers_until (port, buf, 1, &n_bufs, 0);
+}
+
+/* Like gst_omx_port_acquire_buffer() but waits at most timeout in
+ * total, also while waiting for output ports to be reconfigured.
+ * Returns GST_OMX_ACQUIRE_BUFFER_TIMEOUT if no buffer became available
+ * in time. A timeout of 0 does not wait at all, GST_CLOCK_TIME_NONE
+ * waits forever.
+ *
+ * NOTE: Uses port->lock and comp->messages_lock, comp->lock
+ * only if there are control messages to handle */
+GstOMXAcquireBufferReturn
+gst_omx_port_acquire_buffer_timeout (GstOMXPort * port, GstOMXBuffer ** buf,
+    GstClockTime timeout)
+{
+  gint64 wait_until = -1;
+  guint n_bufs;
+
+  g_return_val_if_fail (buf != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
+
+  *buf = NULL;
+
+  if (timeout != GST_CLOCK_TIME_NONE) {
+    gint64 add = timeout / (GST_SECOND / G_TIME_SPAN_SECOND);
 
-  GST_DEBUG_OBJECT (comp->parent, "Updated %s port %u definition: %s (0x%08x)",
-      comp->name, port->index, gst_omx_error_to_string (err), err);
+    wait_until = (add == 0 ? 0 : g_get_monotonic_time () + add);
+  }
 
-  return err;
+  return gst_omx_port_acquire_buffers_until (port, buf, 1, &n_bufs,
+      wait_until);
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* Like gst_omx_port_acquire_buffer() but takes up to max_bufs buffers
+ * with one lock acquisition. Waits until at least one buffer is
+ * available and then takes the ones that are pending without waiting
+ * for more. *n_bufs is at least 1 for GST_OMX_ACQUIRE_BUFFER_OK and
+ * 0 otherwise.
+ *
+ * NOTE: Uses port->lock and comp->messages_lock, comp->lock
+ * only if there are control messages to handle */
 GstOMXAcquireBufferReturn
-gst_omx_port_acquire_buffer (GstOMXPort * port, GstOMXBuffer ** buf)
+gst_omx_port_acquire_buffers (GstOMXPort * port, GstOMXBuffer ** bufs,
+    guint max_bufs, guint * n_bufs)
+{
+  return gst_omx_port_acquire_buffers_until (port, bufs, max_bufs, n_bufs,
+      -1);
+}
+
+/* wait_until is the monotonic time in microseconds until which
+ * to wait, -1 to wait forever and 0 to not wait at all */
+static GstOMXAcquireBufferReturn
+gst_omx_port_acquire_buffers_until (GstOMXPort * port, GstOMXBuffer ** bufs,
+    guint max_bufs, guint * n_bufs, gint64 wait_until)
 {
   GstOMXAcquireBufferReturn ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
   GstOMXComponent *comp;
   OMX_ERRORTYPE err;
-  GstOMXBuffer *_buf = NULL;
+  guint i, n = 0;
+  gint cookie;
+  gint64 prof = GST_OMX_PROFILE_START ();
+
+  g_return_val_if_fail (n_bufs != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
+
+  *n_bufs = 0;
 
   g_return_val_if_fail (port != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
   g_return_val_if_fail (!port->tunneled, GST_OMX_ACQUIRE_BUFFER_ERROR);
-  g_return_val_if_fail (buf != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
-
-  *buf = NULL;
+  g_return_val_if_fail (bufs != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
+  g_return_val_if_fail (max_bufs > 0, GST_OMX_ACQUIRE_BUFFER_ERROR);
 
   comp = port->comp;
 
-  g_mutex_lock (&comp->lock);
-  GST_DEBUG_OBJECT (comp->parent, "Acquiring %s buffer from port %u",
-      comp->name, port->index);
+  g_mutex_lock (&port->lock);
+  GST_DEBUG_OBJECT (comp->parent, "Acquiring up to %u %s buffers from port %u",
+      max_bufs, comp->name, port->index);
+
+  cookie = gst_omx_component_get_wakeup_cookie (comp, port);
 
 retry:
-  gst_omx_component_handle_messages (comp);
+  gst_omx_port_handle_messages (port);
 
   /* Check if the component is in an error state */
-  if ((err = comp->last_error) != OMX_ErrorNone) {
+  if ((err = gst_omx_component_peek_last_error (comp)) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (comp->parent, "Component %s is in error state: %s",
         comp->name, gst_omx_error_to_string (err));
     ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
@@ -1259,19 +2514,18 @@ retry:
    * or buffers are returned to be filled as usual.
    */
   if (port->port_def.eDir == OMX_DirInput) {
-    if (comp->pending_reconfigure_outports) {
-      gst_omx_component_handle_messages (comp);
-      while (comp->pending_reconfigure_outports &&
-          (err = comp->last_error) == OMX_ErrorNone && !port->flushing) {
+    if (g_atomic_int_get (&comp->n_pending_reconfigure_outports) > 0) {
+      while (g_atomic_int_get (&comp->n_pending_reconfigure_outports) > 0
+          && gst_omx_component_peek_last_error (comp) == OMX_ErrorNone
+          && !port->flushing) {
+        if (wait_until != -1 && g_get_monotonic_time () >= wait_until) {
+          ret = GST_OMX_ACQUIRE_BUFFER_TIMEOUT;
+          goto done;
+        }
         GST_DEBUG_OBJECT (comp->parent,
             "Waiting for %s output ports to reconfigure", comp->name);
-        g_mutex_lock (&comp->messages_lock);
-        g_mutex_unlock (&comp->lock);
-        if (g_queue_is_empty (&comp->messages))
-          g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-        g_mutex_unlock (&comp->messages_lock);
-        g_mutex_lock (&comp->lock);
-        gst_omx_component_handle_messages (comp);
+        gst_omx_component_wait_message (comp, port, &port->lock, &cookie,
+            wait_until);
       }
       goto retry;
     }
@@ -1295,7 +2549,7 @@ retry:
       GST_DEBUG_OBJECT (comp->parent,
           "%s output port %u needs reconfiguration but has buffers pending",
           comp->name, port->index);
-      _buf = g_queue_pop_head (&port->pending_buffers);
+      n = gst_omx_port_pop_pending_buffers (port, bufs, max_bufs);
 
       ret = GST_OMX_ACQUIRE_BUFFER_OK;
       goto done;
@@ -1309,7 +2563,7 @@ retry:
     if (!g_queue_is_empty (&port->pending_buffers)) {
       GST_DEBUG_OBJECT (comp->parent, "%s output port %u is EOS but has "
           "buffers pending", comp->name, port->index);
-      _buf = g_queue_pop_head (&port->pending_buffers);
+      n = gst_omx_port_pop_pending_buffers (port, bufs, max_bufs);
 
       ret = GST_OMX_ACQUIRE_BUFFER_OK;
       goto done;
@@ -1329,24 +2583,26 @@ retry:
    * arrives, an error happens, the port is flushing
    * or the port needs to be reconfigured.
    */
-  gst_omx_component_handle_messages (comp);
   if (g_queue_is_empty (&port->pending_buffers)) {
     GST_DEBUG_OBJECT (comp->parent, "Queue of %s port %u is empty",
         comp->name, port->index);
-    g_mutex_lock (&comp->messages_lock);
-    g_mutex_unlock (&comp->lock);
-    if (g_queue_is_empty (&comp->messages))
-      g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-    g_mutex_unlock (&comp->messages_lock);
-    g_mutex_lock (&comp->lock);
-    gst_omx_component_handle_messages (comp);
+    if (wait_until != -1 && g_get_monotonic_time () >= wait_until) {
+      GST_DEBUG_OBJECT (comp->parent, "Timed out waiting for a buffer on %s "
+          "port %u", comp->name, port->index);
+      ret = GST_OMX_ACQUIRE_BUFFER_TIMEOUT;
+      goto done;
+    }
+    /* After a timeout the retry handles any messages that
+     * arrived meanwhile before giving up */
+    gst_omx_component_wait_message (comp, port, &port->lock, &cookie,
+        wait_until);
 
     /* And now check everything again and maybe get a buffer */
     goto retry;
   } else {
     GST_DEBUG_OBJECT (comp->parent, "%s port %u has pending buffers",
         comp->name, port->index);
-    _buf = g_queue_pop_head (&port->pending_buffers);
+    n = gst_omx_port_pop_pending_buffers (port, bufs, max_bufs);
     ret = GST_OMX_ACQUIRE_BUFFER_OK;
     goto done;
   }
@@ -1355,40 +2611,51 @@ retry:
   goto retry;
 
 done:
-  g_mutex_unlock (&comp->lock);
+  g_mutex_unlock (&port->lock);
+
+  for (i = 0; i < n; i++) {
+    GstOMXBuffer *_buf = bufs[i];
+
+    if (_buf)
+      g_assert (_buf == _buf->omx_buf->pAppPrivate);
 
-  if (_buf) {
-    g_assert (_buf == _buf->omx_buf->pAppPrivate);
-    *buf = _buf;
+    GST_DEBUG_OBJECT (comp->parent, "Acquired buffer %p (%p) from %s port %u",
+        _buf, (_buf ? _buf->omx_buf->pBuffer : NULL), comp->name,
+        port->index);
+    if (_buf && GST_OMX_TRACE_FILE_IS_ENABLED ())
+      gst_omx_trace_file_buffer_begin (port, _buf, "app",
+          gst_util_get_timestamp ());
   }
+  *n_bufs = n;
+
+  GST_DEBUG_OBJECT (comp->parent, "Acquired %u buffers from %s port %u: %d",
+      n, comp->name, port->index, ret);
 
-  GST_DEBUG_OBJECT (comp->parent, "Acquired buffer %p (%p) from %s port %u: %d",
-      _buf, (_buf ? _buf->omx_buf->pBuffer : NULL), comp->name, port->index,
-      ret);
+  gst_omx_port_profile_add (port, GST_OMX_PROFILE_ACQUIRE, prof);
 
   return ret;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
-OMX_ERRORTYPE
-gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+/* Checks if buf can be passed to the component and marks it as owned
+ * by the component if so, the caller has to pass it with
+ * gst_omx_port_submit_buffers() then. Otherwise buf is returned to
+ * the port, and *err is set if that happened because of an error.
+ *
+ * NOTE: Must be called while holding port->lock */
+static gboolean
+gst_omx_port_prepare_submit (GstOMXPort * port, GstOMXBuffer * buf,
+    OMX_ERRORTYPE * err)
 {
-  GstOMXComponent *comp;
-  OMX_ERRORTYPE err = OMX_ErrorNone;
-
-  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
-  g_return_val_if_fail (!port->tunneled, GST_OMX_ACQUIRE_BUFFER_ERROR);
-  g_return_val_if_fail (buf != NULL, OMX_ErrorUndefined);
-  g_return_val_if_fail (buf->port == port, OMX_ErrorUndefined);
-
-  comp = port->comp;
+  GstOMXComponent *comp = port->comp;
 
-  g_mutex_lock (&comp->lock);
+  *err = OMX_ErrorNone;
 
   GST_DEBUG_OBJECT (comp->parent, "Releasing buffer %p (%p) to %s port %u",
       buf, buf->omx_buf->pBuffer, comp->name, port->index);
 
-  gst_omx_component_handle_messages (comp);
+  if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+    gst_omx_trace_file_buffer_end (port, buf, "app",
+        gst_util_get_timestamp ());
 
   if (port->port_def.eDir == OMX_DirOutput) {
     /* Reset all flags, some implementations don't
@@ -1402,66 +2669,427 @@ gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
     buf->omx_buf->nFilledLen = 0;
   }
 
-  if ((err = comp->last_error) != OMX_ErrorNone) {
+  if ((*err = gst_omx_component_peek_last_error (comp)) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (comp->parent, "Component %s is in error state: %s "
-        "(0x%08x)", comp->name, gst_omx_error_to_string (err), err);
+        "(0x%08x)", comp->name, gst_omx_error_to_string (*err), *err);
     g_queue_push_tail (&port->pending_buffers, buf);
-    gst_omx_component_send_message (comp, NULL);
-    goto done;
+    gst_omx_component_wake_waiters (comp, port);
+    return FALSE;
   }
 
   if (port->flushing) {
     GST_DEBUG_OBJECT (comp->parent, "%s port %u is flushing, not releasing "
         "buffer", comp->name, port->index);
     g_queue_push_tail (&port->pending_buffers, buf);
-    gst_omx_component_send_message (comp, NULL);
-    goto done;
+    gst_omx_component_wake_waiters (comp, port);
+    return FALSE;
   }
 
   g_assert (buf == buf->omx_buf->pAppPrivate);
 
   /* FIXME: What if the settings cookies don't match? */
 
-  buf->used = TRUE;
+  /* The component can return the buffer before
+   * {Empty,Fill}ThisBuffer returns */
+  g_atomic_int_set (&buf->used, TRUE);
+  gst_omx_port_stats_submit (port, buf, gst_util_get_timestamp ());
+  g_atomic_int_inc (&port->submitting);
 
-  if (port->port_def.eDir == OMX_DirInput) {
-    err = OMX_EmptyThisBuffer (comp->handle, buf->omx_buf);
-  } else {
-    err = OMX_FillThisBuffer (comp->handle, buf->omx_buf);
+  return TRUE;
+}
+
+/* Passes the buffers prepared with gst_omx_port_prepare_submit() to
+ * the component, in order. Stops at the first buffer the component
+ * does not accept and returns it and the following ones to the port.
+ *
+ * The vendor library can take a while or call back synchronously, so
+ * this is called without any of our locks held.
+ *
+ * NOTE: Uses port->lock only if the component did not accept a buffer,
+ * comp->messages_lock if somebody is waiting */
+static OMX_ERRORTYPE
+gst_omx_port_submit_buffers (GstOMXPort * port, GstOMXBuffer ** bufs,
+    guint n_bufs)
+{
+  GstOMXComponent *comp = port->comp;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  guint i, j;
+
+  for (i = 0; i < n_bufs; i++) {
+    GstOMXBuffer *buf = bufs[i];
+
+    if (port->port_def.eDir == OMX_DirInput)
+      err = OMX_EmptyThisBuffer (comp->handle, buf->omx_buf);
+    else
+      err = OMX_FillThisBuffer (comp->handle, buf->omx_buf);
+
+    GST_DEBUG_OBJECT (comp->parent, "Released buffer %p to %s port %u: %s "
+        "(0x%08x)", buf, comp->name, port->index,
+        gst_omx_error_to_string (err), err);
+
+    if (err != OMX_ErrorNone)
+      break;
+  }
+
+  if (i < n_bufs) {
+    g_mutex_lock (&port->lock);
+    for (j = i; j < n_bufs; j++) {
+      g_atomic_int_set (&bufs[j]->used, FALSE);
+      gst_omx_port_stats_cancel (port, bufs[j]);
+      g_queue_push_tail (&port->pending_buffers, bufs[j]);
+    }
+    g_mutex_unlock (&port->lock);
+  }
+
+  /* Wake up flushes waiting for the last submission, and
+   * acquirers if buffers were returned */
+  if (g_atomic_int_add (&port->submitting, -(gint) n_bufs) == (gint) n_bufs
+      || i < n_bufs)
+    gst_omx_component_wake_waiters (comp, port);
+
+  return err;
+}
+
+/* NOTE: Uses port->lock and comp->messages_lock, comp->lock
+ * only if there are control messages to handle */
+OMX_ERRORTYPE
+gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  g_return_val_if_fail (buf != NULL, OMX_ErrorUndefined);
+
+  return gst_omx_port_release_buffers (port, &buf, 1);
+}
+
+/* Releases n_bufs buffers, in order, with one lock acquisition.
+ * Stops at the first buffer that can't be passed to the component
+ * and returns the following ones to the port.
+ *
+ * NOTE: Uses port->lock and comp->messages_lock, comp->lock
+ * only if there are control messages to handle */
+OMX_ERRORTYPE
+gst_omx_port_release_buffers (GstOMXPort * port, GstOMXBuffer ** bufs,
+    guint n_bufs)
+{
+  GstOMXComponent *comp;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  gint64 prof = GST_OMX_PROFILE_START ();
+  GstOMXBuffer **submit;
+  guint i, n_submit = 0;
+
+  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (!port->tunneled, OMX_ErrorUndefined);
+  g_return_val_if_fail (bufs != NULL || n_bufs == 0, OMX_ErrorUndefined);
+  for (i = 0; i < n_bufs; i++) {
+    g_return_val_if_fail (bufs[i] != NULL, OMX_ErrorUndefined);
+    g_return_val_if_fail (bufs[i]->port == port, OMX_ErrorUndefined);
+  }
+
+  comp = port->comp;
+  submit = g_newa (GstOMXBuffer *, MAX (n_bufs, 1));
+
+  g_mutex_lock (&port->lock);
+
+  gst_omx_port_handle_messages (port);
+
+  for (i = 0; i < n_bufs; i++) {
+    if (gst_omx_port_prepare_submit (port, bufs[i], &err))
+      submit[n_submit++] = bufs[i];
+    else if (err != OMX_ErrorNone)
+      break;
+  }
+
+  if (err != OMX_ErrorNone && i + 1 < n_bufs) {
+    GST_DEBUG_OBJECT (comp->parent, "Returning %u unreleased buffers to %s "
+        "port %u", n_bufs - i - 1, comp->name, port->index);
+    for (i = i + 1; i < n_bufs; i++)
+      g_queue_push_tail (&port->pending_buffers, bufs[i]);
+    gst_omx_component_wake_waiters (comp, port);
+  }
+
+  gst_omx_port_handle_messages (port);
+  g_mutex_unlock (&port->lock);
+
+  if (n_submit > 0) {
+    OMX_ERRORTYPE tmp = gst_omx_port_submit_buffers (port, submit, n_submit);
+
+    if (err == OMX_ErrorNone)
+      err = tmp;
+  }
+
+  gst_omx_port_profile_add (port, GST_OMX_PROFILE_RELEASE, prof);
+
+  return err;
+}
+
+/* Gives n_bufs acquired buffers back to the port without passing them
+ * to the component, they can be acquired again. Callers can acquire
+ * more buffers than they end up needing and return the rest this way,
+ * also ones they already filled. Their content is dropped.
+ *
+ * NOTE: Uses port->lock and comp->messages_lock */
+void
+gst_omx_port_return_buffers (GstOMXPort * port, GstOMXBuffer ** bufs,
+    guint n_bufs)
+{
+  GstOMXComponent *comp;
+  guint i;
+
+  g_return_if_fail (port != NULL);
+  g_return_if_fail (bufs != NULL || n_bufs == 0);
+  for (i = 0; i < n_bufs; i++) {
+    g_return_if_fail (bufs[i] != NULL);
+    g_return_if_fail (bufs[i]->port == port);
+  }
+
+  if (n_bufs == 0)
+    return;
+
+  comp = port->comp;
+
+  g_mutex_lock (&port->lock);
+  for (i = 0; i < n_bufs; i++) {
+    GST_LOG_OBJECT (comp->parent, "Returning unused buffer %p to %s port %u",
+        bufs[i], comp->name, port->index);
+
+    if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+      gst_omx_trace_file_buffer_end (port, bufs[i], "app",
+          gst_util_get_timestamp ());
+
+    bufs[i]->omx_buf->nFilledLen = 0;
+    bufs[i]->omx_buf->nFlags = 0;
+    g_queue_push_tail (&port->pending_buffers, bufs[i]);
+  }
+  g_mutex_unlock (&port->lock);
+
+  gst_omx_component_wake_waiters (comp, port);
+}
+
+/* Makes the next gst_omx_port_acquire_buffer() on port return
+ * GST_OMX_ACQUIRE_BUFFER_OK with a NULL buffer, which is used to
+ * signal EOS for components that can't handle empty EOS buffers.
+ *
+ * NOTE: Uses port->lock and comp->messages_lock */
+void
+gst_omx_port_signal_eos (GstOMXPort * port)
+{
+  g_return_if_fail (port != NULL);
+
+  g_mutex_lock (&port->lock);
+  g_queue_push_tail (&port->pending_buffers, NULL);
+  g_mutex_unlock (&port->lock);
+
+  gst_omx_component_wake_waiters (port->comp, port);
+}
+
+/* Waits until the buffers that were taken to be passed to the
+ * component before port started flushing were passed, so that a
+ * following flush or disable command covers them too. The calls
+ * don't depend on anything the component waits for, no timeout
+ * is needed.
+ *
+ * NOTE: Must be called while holding comp->lock, which is released
+ * while waiting. Uses comp->messages_lock */
+static void
+gst_omx_port_wait_submitted (GstOMXPort * port)
+{
+  GstOMXComponent *comp = port->comp;
+  gint cookie;
+
+  cookie = gst_omx_component_get_wakeup_cookie (comp, port);
+  while (g_atomic_int_get (&port->submitting) > 0) {
+    GST_DEBUG_OBJECT (comp->parent, "Waiting for %d buffers being passed "
+        "to %s port %u", g_atomic_int_get (&port->submitting), comp->name,
+        port->index);
+    gst_omx_component_wait_message (comp, port, &comp->lock, &cookie, -1);
+  }
+}
+
+/* Waits until the component completed the flush command for port
+ * and returned all its buffers, or until wait_until (monotonic time
+ * in microseconds, -1 for no timeout) has passed.
+ *
+ * NOTE: Must be called while holding comp->lock */
+static OMX_ERRORTYPE
+gst_omx_port_wait_flushed (GstOMXPort * port, gint64 wait_until)
+{
+  GstOMXComponent *comp = port->comp;
+  OMX_ERRORTYPE last_error = OMX_ErrorNone;
+  gboolean signalled = TRUE;
+  gint cookie;
+
+  /* Retry until timeout or until an error happend or
+   * until all buffers were released by the component and
+   * the flush command completed */
+  cookie = gst_omx_component_get_wakeup_cookie (comp, port);
+  gst_omx_component_handle_messages (comp);
+  while (signalled && last_error == OMX_ErrorNone && !port->flushed
+      && !gst_omx_port_has_all_buffers (port)) {
+    signalled =
+        gst_omx_component_wait_message (comp, port, &comp->lock, &cookie,
+        wait_until);
+    last_error = comp->last_error;
+  }
+  g_mutex_lock (&port->lock);
+  port->flushed = FALSE;
+  g_mutex_unlock (&port->lock);
+
+  GST_DEBUG_OBJECT (comp->parent, "%s port %d flushed", comp->name,
+      port->index);
+  if (last_error != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (comp->parent,
+        "Got error while flushing %s port %u: %s (0x%08x)", comp->name,
+        port->index, gst_omx_error_to_string (last_error), last_error);
+    return last_error;
+  } else if (!signalled) {
+    GST_ERROR_OBJECT (comp->parent, "Timeout while flushing %s port %u",
+        comp->name, port->index);
+    return OMX_ErrorTimeout;
+  }
+
+  return OMX_ErrorNone;
+}
+
+/* NOTE: Uses comp->lock and comp->messages_lock */
+OMX_ERRORTYPE
+gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
+    gboolean flush)
+{
+  GstOMXComponent *comp;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
+
+  comp = port->comp;
+
+  g_mutex_lock (&comp->lock);
+
+  GST_DEBUG_OBJECT (comp->parent, "Setting %s port %d to %sflushing",
+      comp->name, port->index, (flush ? "" : "not "));
+
+  gst_omx_component_handle_messages (comp);
+
+  if (! !flush == ! !port->flushing) {
+    GST_DEBUG_OBJECT (comp->parent, "%s port %u was %sflushing already",
+        comp->name, port->index, (flush ? "" : "not "));
+    goto done;
+  }
+
+  if ((err = comp->last_error) != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (comp->parent, "Component %s is in error state: %s "
+        "(0x%08x)", comp->name, gst_omx_error_to_string (err), err);
+    goto done;
+  }
+
+  g_mutex_lock (&port->lock);
+  port->flushing = flush;
+  if (flush)
+    port->flushed = FALSE;
+  g_mutex_unlock (&port->lock);
+
+  if (flush) {
+    gint64 wait_until = -1;
+
+    gst_omx_component_wake_waiters (comp, port);
+    gst_omx_port_wait_submitted (port);
+
+    /* Now flush the port */
+
+    g_mutex_unlock (&comp->lock);
+    err = OMX_SendCommand (comp->handle, OMX_CommandFlush, port->index, NULL);
+    g_mutex_lock (&comp->lock);
+
+    if (err != OMX_ErrorNone) {
+      GST_ERROR_OBJECT (comp->parent,
+          "Error sending flush command to %s port %u: %s (0x%08x)", comp->name,
+          port->index, gst_omx_error_to_string (err), err);
+      goto done;
+    }
+
+    if ((err = comp->last_error) != OMX_ErrorNone) {
+      GST_ERROR_OBJECT (comp->parent,
+          "Component %s is in error state: %s (0x%08x)", comp->name,
+          gst_omx_error_to_string (err), err);
+      goto done;
+    }
+
+    if (! !port->flushing != ! !flush) {
+      GST_ERROR_OBJECT (comp->parent, "%s: another flush happened in the "
+          " meantime", comp->name);
+      goto done;
+    }
+
+    if (timeout != GST_CLOCK_TIME_NONE) {
+      gint64 add = timeout / (GST_SECOND / G_TIME_SPAN_SECOND);
+
+      if (add == 0) {
+        if (!port->flushed || !gst_omx_port_has_all_buffers (port))
+          err = OMX_ErrorTimeout;
+        goto done;
+      }
+
+      wait_until = g_get_monotonic_time () + add;
+      GST_DEBUG_OBJECT (comp->parent, "%s waiting for %" G_GINT64_FORMAT "us",
+          comp->name, add);
+    } else {
+      GST_DEBUG_OBJECT (comp->parent, "%s waiting for signal", comp->name);
+    }
+
+    if ((err = gst_omx_port_wait_flushed (port, wait_until)) != OMX_ErrorNone)
+      goto done;
   }
-  GST_DEBUG_OBJECT (comp->parent, "Released buffer %p to %s port %u: %s "
-      "(0x%08x)", buf, comp->name, port->index, gst_omx_error_to_string (err),
-      err);
+
+  /* Reset EOS flag */
+  g_mutex_lock (&port->lock);
+  port->eos = FALSE;
+  g_mutex_unlock (&port->lock);
 
 done:
+  gst_omx_port_update_port_definition_unlocked (port);
+
+  GST_DEBUG_OBJECT (comp->parent, "Set %s port %u to %sflushing: %s (0x%08x)",
+      comp->name, port->index, (flush ? "" : "not "),
+      gst_omx_error_to_string (err), err);
   gst_omx_component_handle_messages (comp);
   g_mutex_unlock (&comp->lock);
 
   return err;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* Sets all ports of comp to flushing or not flushing like
+ * gst_omx_port_set_flushing(). Flushing sends a single
+ * OMX_CommandFlush for all ports and then waits for all of them,
+ * so the component flushes the ports in parallel instead of one
+ * command round-trip per port.
+ *
+ * NOTE: Uses comp->lock and comp->messages_lock */
 OMX_ERRORTYPE
-gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
+gst_omx_component_set_flushing (GstOMXComponent * comp, GstClockTime timeout,
     gboolean flush)
 {
-  GstOMXComponent *comp;
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gboolean changed = FALSE;
+  gint i, n;
 
-  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
-
-  comp = port->comp;
+  g_return_val_if_fail (comp != NULL, OMX_ErrorUndefined);
 
   g_mutex_lock (&comp->lock);
 
-  GST_DEBUG_OBJECT (comp->parent, "Setting %s port %d to %sflushing",
-      comp->name, port->index, (flush ? "" : "not "));
+  GST_DEBUG_OBJECT (comp->parent, "Setting %s to %sflushing", comp->name,
+      (flush ? "" : "not "));
 
   gst_omx_component_handle_messages (comp);
 
-  if (! !flush == ! !port->flushing) {
-    GST_DEBUG_OBJECT (comp->parent, "%s port %u was %sflushing already",
-        comp->name, port->index, (flush ? "" : "not "));
+  n = (comp->ports ? comp->ports->len : 0);
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    if (! !flush != ! !port->flushing)
+      changed = TRUE;
+  }
+
+  if (!changed) {
+    GST_DEBUG_OBJECT (comp->parent, "%s was %sflushing already", comp->name,
+        (flush ? "" : "not "));
     goto done;
   }
 
@@ -1471,23 +3099,31 @@ gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
     goto done;
   }
 
-  port->flushing = flush;
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    g_mutex_lock (&port->lock);
+    port->flushing = flush;
+    if (flush)
+      port->flushed = FALSE;
+    g_mutex_unlock (&port->lock);
+  }
+
   if (flush) {
     gint64 wait_until = -1;
-    gboolean signalled;
-    OMX_ERRORTYPE last_error;
 
-    gst_omx_component_send_message (comp, NULL);
+    gst_omx_component_wake_waiters (comp, NULL);
+    for (i = 0; i < n; i++)
+      gst_omx_port_wait_submitted (g_ptr_array_index (comp->ports, i));
 
-    /* Now flush the port */
-    port->flushed = FALSE;
-
-    err = OMX_SendCommand (comp->handle, OMX_CommandFlush, port->index, NULL);
+    g_mutex_unlock (&comp->lock);
+    err = OMX_SendCommand (comp->handle, OMX_CommandFlush, OMX_ALL, NULL);
+    g_mutex_lock (&comp->lock);
 
     if (err != OMX_ErrorNone) {
       GST_ERROR_OBJECT (comp->parent,
-          "Error sending flush command to %s port %u: %s (0x%08x)", comp->name,
-          port->index, gst_omx_error_to_string (err), err);
+          "Error sending flush command to %s: %s (0x%08x)", comp->name,
+          gst_omx_error_to_string (err), err);
       goto done;
     }
 
@@ -1498,20 +3134,30 @@ gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
       goto done;
     }
 
-    if (! !port->flushing != ! !flush) {
-      GST_ERROR_OBJECT (comp->parent, "%s: another flush happened in the "
-          " meantime", comp->name);
-      goto done;
+    for (i = 0; i < n; i++) {
+      GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+      if (! !port->flushing != ! !flush) {
+        GST_ERROR_OBJECT (comp->parent, "%s: another flush happened in the "
+            " meantime", comp->name);
+        goto done;
+      }
     }
 
+    /* All ports share the deadline, the component works on all
+     * of them while we wait for the first one */
     if (timeout != GST_CLOCK_TIME_NONE) {
       gint64 add = timeout / (GST_SECOND / G_TIME_SPAN_SECOND);
 
       if (add == 0) {
-        if (!port->flushed || (port->buffers
-                && port->buffers->len >
-                g_queue_get_length (&port->pending_buffers)))
-          err = OMX_ErrorTimeout;
+        for (i = 0; i < n; i++) {
+          GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+          if (!port->flushed || !gst_omx_port_has_all_buffers (port)) {
+            err = OMX_ErrorTimeout;
+            break;
+          }
+        }
         goto done;
       }
 
@@ -1522,71 +3168,38 @@ gst_omx_port_set_flushing (GstOMXPort * port, GstClockTime timeout,
       GST_DEBUG_OBJECT (comp->parent, "%s waiting for signal", comp->name);
     }
 
-    /* Retry until timeout or until an error happend or
-     * until all buffers were released by the component and
-     * the flush command completed */
-    signalled = TRUE;
-    last_error = OMX_ErrorNone;
-    gst_omx_component_handle_messages (comp);
-    while (signalled && last_error == OMX_ErrorNone && !port->flushed
-        && port->buffers
-        && port->buffers->len > g_queue_get_length (&port->pending_buffers)) {
-      g_mutex_lock (&comp->messages_lock);
-      g_mutex_unlock (&comp->lock);
-
-      if (!g_queue_is_empty (&comp->messages)) {
-        signalled = TRUE;
-      } else if (timeout == GST_CLOCK_TIME_NONE) {
-        g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-        signalled = TRUE;
-      } else {
-        signalled =
-            g_cond_wait_until (&comp->messages_cond, &comp->messages_lock,
-            wait_until);
-      }
-
-      g_mutex_unlock (&comp->messages_lock);
-      g_mutex_lock (&comp->lock);
-
-      if (signalled)
-        gst_omx_component_handle_messages (comp);
-
-      last_error = comp->last_error;
-    }
-    port->flushed = FALSE;
+    for (i = 0; i < n; i++) {
+      GstOMXPort *port = g_ptr_array_index (comp->ports, i);
 
-    GST_DEBUG_OBJECT (comp->parent, "%s port %d flushed", comp->name,
-        port->index);
-    if (last_error != OMX_ErrorNone) {
-      GST_ERROR_OBJECT (comp->parent,
-          "Got error while flushing %s port %u: %s (0x%08x)", comp->name,
-          port->index, gst_omx_error_to_string (last_error), last_error);
-      err = last_error;
-      goto done;
-    } else if (!signalled) {
-      GST_ERROR_OBJECT (comp->parent, "Timeout while flushing %s port %u",
-          comp->name, port->index);
-      err = OMX_ErrorTimeout;
-      goto done;
+      if ((err = gst_omx_port_wait_flushed (port, wait_until)) != OMX_ErrorNone)
+        goto done;
     }
   }
 
-  /* Reset EOS flag */
-  port->eos = FALSE;
+  /* Reset EOS flags */
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    g_mutex_lock (&port->lock);
+    port->eos = FALSE;
+    g_mutex_unlock (&port->lock);
+  }
 
 done:
-  gst_omx_port_update_port_definition (port, NULL);
+  for (i = 0; i < n; i++)
+    gst_omx_port_update_port_definition_unlocked (g_ptr_array_index
+        (comp->ports, i));
 
-  GST_DEBUG_OBJECT (comp->parent, "Set %s port %u to %sflushing: %s (0x%08x)",
-      comp->name, port->index, (flush ? "" : "not "),
-      gst_omx_error_to_string (err), err);
+  GST_DEBUG_OBJECT (comp->parent, "Set %s to %sflushing: %s (0x%08x)",
+      comp->name, (flush ? "" : "not "), gst_omx_error_to_string (err), err);
   gst_omx_component_handle_messages (comp);
   g_mutex_unlock (&comp->lock);
 
   return err;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses port->lock and comp->messages_lock, comp->lock
+ * only if there are control messages to handle */
 gboolean
 gst_omx_port_is_flushing (GstOMXPort * port)
 {
@@ -1597,10 +3210,10 @@ gst_omx_port_is_flushing (GstOMXPort * port)
 
   comp = port->comp;
 
-  g_mutex_lock (&comp->lock);
-  gst_omx_component_handle_messages (port->comp);
+  g_mutex_lock (&port->lock);
+  gst_omx_port_handle_messages (port);
   flushing = port->flushing;
-  g_mutex_unlock (&comp->lock);
+  g_mutex_unlock (&port->lock);
 
   GST_DEBUG_OBJECT (comp->parent, "%s port %u is flushing: %d", comp->name,
       port->index, flushing);
@@ -1638,7 +3251,7 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
    * buffers after the port configuration was done and to
    * update the buffer size
    */
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   g_return_val_if_fail (n != -1 || (!buffers
           && !images), OMX_ErrorBadParameter);
@@ -1653,8 +3266,19 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
       "Allocating %d buffers of size %u for %s port %u", n,
       port->port_def.nBufferSize, comp->name, port->index);
 
+  /* None of the port's buffers is owned by the component at
+   * this point, nothing can be posted while replacing the ring */
+  if (!port->done_ring || gst_omx_ring_get_size (port->done_ring) < n) {
+    if (port->done_ring)
+      gst_omx_ring_free (port->done_ring);
+    g_atomic_pointer_set (&port->done_ring,
+        gst_omx_ring_new (sizeof (GstOMXBuffer *), n));
+  }
+
+  g_mutex_lock (&port->lock);
   if (!port->buffers)
     port->buffers = g_ptr_array_sized_new (n);
+  g_mutex_unlock (&port->lock);
 
   l = (buffers ? buffers : images);
   for (i = 0; i < n; i++) {
@@ -1663,9 +3287,10 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
     buf = g_slice_new0 (GstOMXBuffer);
     buf->port = port;
     buf->used = FALSE;
+    buf->submit_time = GST_CLOCK_TIME_NONE;
     buf->settings_cookie = port->settings_cookie;
-    g_ptr_array_add (port->buffers, buf);
 
+    g_mutex_unlock (&comp->lock);
     if (buffers) {
       err =
           OMX_UseBuffer (comp->handle, &buf->omx_buf, port->index, buf,
@@ -1682,6 +3307,12 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
           port->port_def.nBufferSize);
       buf->eglimage = FALSE;
     }
+    g_mutex_lock (&comp->lock);
+
+    /* Only add it now, omx_buf is NULL until here */
+    g_mutex_lock (&port->lock);
+    g_ptr_array_add (port->buffers, buf);
+    g_mutex_unlock (&port->lock);
 
     if (err != OMX_ErrorNone) {
       GST_ERROR_OBJECT (comp->parent,
@@ -1697,7 +3328,9 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
     g_assert (buf->omx_buf->pAppPrivate == buf);
 
     /* In the beginning all buffers are not owned by the component */
+    g_mutex_lock (&port->lock);
     g_queue_push_tail (&port->pending_buffers, buf);
+    g_mutex_unlock (&port->lock);
     if (buffers || images)
       l = l->next;
   }
@@ -1705,7 +3338,7 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
   gst_omx_component_handle_messages (comp);
 
 done:
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   GST_INFO_OBJECT (comp->parent, "Allocated buffers for %s port %u: %s "
       "(0x%08x)", comp->name, port->index, gst_omx_error_to_string (err), err);
@@ -1768,6 +3401,7 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
 {
   GstOMXComponent *comp;
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  GPtrArray *buffers;
   gint i, n;
 
   g_return_val_if_fail (!port->tunneled, OMX_ErrorBadParameter);
@@ -1791,16 +3425,24 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
     /* We still try to deallocate all buffers */
   }
 
+  /* Take the buffers from the port first, nobody can see
+   * them anymore while comp->lock is released below */
+  g_mutex_lock (&port->lock);
+  g_queue_clear (&port->pending_buffers);
+  buffers = port->buffers;
+  port->buffers = NULL;
+  g_mutex_unlock (&port->lock);
+
   /* We only allow deallocation of buffers after they
    * were all released from the port, either by flushing
    * the port or by disabling it.
    */
-  n = port->buffers->len;
+  n = buffers->len;
   for (i = 0; i < n; i++) {
-    GstOMXBuffer *buf = g_ptr_array_index (port->buffers, i);
+    GstOMXBuffer *buf = g_ptr_array_index (buffers, i);
     OMX_ERRORTYPE tmp = OMX_ErrorNone;
 
-    if (buf->used) {
+    if (g_atomic_int_get (&buf->used)) {
       GST_ERROR_OBJECT (comp->parent, "Trying to free used buffer %p of %s "
           "port %u", buf, comp->name, port->index);
     }
@@ -1817,7 +3459,9 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
       GST_DEBUG_OBJECT (comp->parent, "%s: deallocating buffer %p (%p)",
           comp->name, buf, buf->omx_buf->pBuffer);
 
+      g_mutex_unlock (&comp->lock);
       tmp = OMX_FreeBuffer (comp->handle, port->index, buf->omx_buf);
+      g_mutex_lock (&comp->lock);
 
       if (tmp != OMX_ErrorNone) {
         GST_ERROR_OBJECT (comp->parent,
@@ -1829,14 +3473,25 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
     }
     g_slice_free (GstOMXBuffer, buf);
   }
-  g_queue_clear (&port->pending_buffers);
-  g_ptr_array_unref (port->buffers);
-  port->buffers = NULL;
+  g_ptr_array_unref (buffers);
+
+  g_mutex_lock (&port->lock);
+  /* Drop what the component returned after the last
+   * handle_messages(), the buffers are gone now */
+  if (port->done_ring) {
+    GstOMXBuffer *tmp;
+
+    while (gst_omx_ring_pop (port->done_ring, &tmp));
+  }
+  /* The dropped buffers and the ones the component did not
+   * return are not counted as done, but none is in flight now */
+  port->stats.in_flight = 0;
+  g_mutex_unlock (&port->lock);
 
   gst_omx_component_handle_messages (comp);
 
 done:
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   GST_DEBUG_OBJECT (comp->parent, "Deallocated buffers of %s port %u: %s "
       "(0x%08x)", comp->name, port->index, gst_omx_error_to_string (err), err);
@@ -1887,10 +3542,11 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
       port->index, (enabled ? "enabled" : "disabled"));
 
   /* Check if the port is already enabled/disabled first */
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
   if (! !port->port_def.bEnabled == ! !enabled)
     goto done;
 
+  g_mutex_lock (&port->lock);
   if (enabled)
     port->enabled_pending = TRUE;
   else
@@ -1902,7 +3558,12 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
      * the component anymore */
     port->flushing = TRUE;
   }
+  g_mutex_unlock (&port->lock);
+
+  if (!enabled)
+    gst_omx_port_wait_submitted (port);
 
+  g_mutex_unlock (&comp->lock);
   if (enabled)
     err =
         OMX_SendCommand (comp->handle, OMX_CommandPortEnable, port->index,
@@ -1911,6 +3572,7 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
     err =
         OMX_SendCommand (comp->handle, OMX_CommandPortDisable,
         port->index, NULL);
+  g_mutex_lock (&comp->lock);
 
   if (err != OMX_ErrorNone) {
     GST_ERROR_OBJECT (comp->parent,
@@ -1928,7 +3590,7 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
 done:
   gst_omx_component_handle_messages (comp);
 
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   GST_INFO_OBJECT (comp->parent, "Set %s port %u to %s%s: %s (0x%08x)",
       comp->name, port->index, (err == OMX_ErrorNone ? "" : "not "),
@@ -1946,6 +3608,7 @@ gst_omx_port_wait_buffers_released_unlocked (GstOMXPort * port,
   OMX_ERRORTYPE last_error;
   gint64 wait_until = -1;
   gboolean signalled;
+  gint cookie;
 
   comp = port->comp;
 
@@ -1964,8 +3627,7 @@ gst_omx_port_wait_buffers_released_unlocked (GstOMXPort * port,
     gint64 add = timeout / (GST_SECOND / G_TIME_SPAN_SECOND);
 
     if (add == 0) {
-      if (port->buffers
-          && port->buffers->len > g_queue_get_length (&port->pending_buffers))
+      if (!gst_omx_port_has_all_buffers (port))
         err = OMX_ErrorTimeout;
       goto done;
     }
@@ -1980,26 +3642,13 @@ gst_omx_port_wait_buffers_released_unlocked (GstOMXPort * port,
   /* Wait until all buffers are released by the port */
   signalled = TRUE;
   last_error = OMX_ErrorNone;
+  cookie = gst_omx_component_get_wakeup_cookie (comp, port);
   gst_omx_component_handle_messages (comp);
-  while (signalled && last_error == OMX_ErrorNone && (port->buffers
-          && port->buffers->len >
-          g_queue_get_length (&port->pending_buffers))) {
-    g_mutex_lock (&comp->messages_lock);
-    g_mutex_unlock (&comp->lock);
-    if (!g_queue_is_empty (&comp->messages)) {
-      signalled = TRUE;
-    } else if (timeout != GST_CLOCK_TIME_NONE) {
-      signalled =
-          g_cond_wait_until (&comp->messages_cond, &comp->messages_lock,
-          wait_until);
-    } else {
-      signalled = TRUE;
-      g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-    }
-    g_mutex_unlock (&comp->messages_lock);
-    g_mutex_lock (&comp->lock);
-    if (signalled)
-      gst_omx_component_handle_messages (comp);
+  while (signalled && last_error == OMX_ErrorNone
+      && !gst_omx_port_has_all_buffers (port)) {
+    signalled =
+        gst_omx_component_wait_message (comp, port, &comp->lock, &cookie,
+        wait_until);
     last_error = comp->last_error;
   }
 
@@ -2020,7 +3669,7 @@ gst_omx_port_wait_buffers_released_unlocked (GstOMXPort * port,
 done:
   gst_omx_component_handle_messages (comp);
 
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   GST_DEBUG_OBJECT (comp->parent,
       "Waited for %s port %u to release all buffers: %s (0x%08x)", comp->name,
@@ -2044,6 +3693,21 @@ gst_omx_port_wait_buffers_released (GstOMXPort * port, GstClockTime timeout)
   return err;
 }
 
+/* Sets a function that is called for every buffer the component
+ * returns on port, e.g. to release what the buffer pointed to as soon
+ * as possible. It is called from the component's callback without any
+ * locks and must neither block nor call any port functions.
+ *
+ * NOTE: Must only be called while none of the port's buffers are
+ * with the component */
+void
+gst_omx_port_set_buffer_done_func (GstOMXPort * port,
+    GstOMXBufferDoneFunc func, gpointer user_data)
+{
+  port->buffer_done_func = func;
+  port->buffer_done_data = user_data;
+}
+
 /* NOTE: Uses comp->lock and comp->messages_lock */
 OMX_ERRORTYPE
 gst_omx_port_set_enabled (GstOMXPort * port, gboolean enabled)
@@ -2059,6 +3723,8 @@ gst_omx_port_set_enabled (GstOMXPort * port, gboolean enabled)
   return err;
 }
 
+/* NOTE: Must be called while holding comp->lock, which is released
+ * while passing the buffers to the component */
 static OMX_ERRORTYPE
 gst_omx_port_populate_unlocked (GstOMXPort * port)
 {
@@ -2089,12 +3755,15 @@ gst_omx_port_populate_unlocked (GstOMXPort * port)
   }
 
   if (port->port_def.eDir == OMX_DirOutput && port->buffers && !port->tunneled) {
-    /* Enqueue all buffers for the component to fill */
-    while ((buf = g_queue_pop_head (&port->pending_buffers))) {
-      if (!buf)
-        continue;
+    GstOMXBuffer **bufs;
+    guint n = 0;
 
-      g_assert (!buf->used);
+    g_mutex_lock (&port->lock);
+    /* Enqueue all buffers for the component to fill */
+    bufs = g_newa (GstOMXBuffer *, port->buffers->len + 1);
+    while (!port->flushing
+        && (buf = g_queue_pop_head (&port->pending_buffers))) {
+      g_assert (!g_atomic_int_get (&buf->used));
 
       /* Reset all flags, some implementations don't
        * reset them themselves and the flags are not
@@ -2102,24 +3771,29 @@ gst_omx_port_populate_unlocked (GstOMXPort * port)
        */
       buf->omx_buf->nFlags = 0;
 
-      buf->used = TRUE;
-
-      err = OMX_FillThisBuffer (comp->handle, buf->omx_buf);
+      g_atomic_int_set (&buf->used, TRUE);
+      gst_omx_port_stats_submit (port, buf, gst_util_get_timestamp ());
+      bufs[n++] = buf;
+    }
+    g_atomic_int_add (&port->submitting, n);
+    g_mutex_unlock (&port->lock);
 
-      if (err != OMX_ErrorNone) {
-        GST_ERROR_OBJECT (comp->parent,
-            "Failed to pass buffer %p (%p) to %s port %u: %s (0x%08x)", buf,
-            buf->omx_buf->pBuffer, comp->name, port->index,
+    if (n > 0) {
+      g_mutex_unlock (&comp->lock);
+      err = gst_omx_port_submit_buffers (port, bufs, n);
+      g_mutex_lock (&comp->lock);
+      if (err != OMX_ErrorNone)
+        GST_ERROR_OBJECT (comp->parent, "Failed to pass buffers to %s port "
+            "%u: %s (0x%08x)", comp->name, port->index,
             gst_omx_error_to_string (err), err);
-        goto done;
-      }
-      GST_DEBUG_OBJECT (comp->parent, "Passed buffer %p (%p) to component %s",
-          buf, buf->omx_buf->pBuffer, comp->name);
+      else
+        GST_DEBUG_OBJECT (comp->parent, "Passed %u buffers to component %s",
+            n, comp->name);
     }
   }
 
 done:
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   GST_DEBUG_OBJECT (comp->parent, "Populated %s port %u: %s (0x%08x)",
       comp->name, port->index, gst_omx_error_to_string (err), err);
@@ -2153,11 +3827,12 @@ gst_omx_port_wait_enabled_unlocked (GstOMXPort * port, GstClockTime timeout)
   gboolean signalled;
   OMX_ERRORTYPE last_error;
   gboolean enabled;
+  gint cookie;
 
   comp = port->comp;
 
   /* Check the current port status */
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   if (port->enabled_pending)
     enabled = TRUE;
@@ -2196,32 +3871,22 @@ gst_omx_port_wait_enabled_unlocked (GstOMXPort * port, GstClockTime timeout)
   /* And now wait until the enable/disable command is finished */
   signalled = TRUE;
   last_error = OMX_ErrorNone;
-  gst_omx_port_update_port_definition (port, NULL);
+  cookie = gst_omx_component_get_wakeup_cookie (comp, port);
+  gst_omx_port_update_port_definition_unlocked (port);
   gst_omx_component_handle_messages (comp);
   while (signalled && last_error == OMX_ErrorNone &&
       (! !port->port_def.bEnabled != ! !enabled || port->enabled_pending
           || port->disabled_pending)) {
-    g_mutex_lock (&comp->messages_lock);
-    g_mutex_unlock (&comp->lock);
-    if (!g_queue_is_empty (&comp->messages)) {
-      signalled = TRUE;
-    } else if (timeout != GST_CLOCK_TIME_NONE) {
-      signalled =
-          g_cond_wait_until (&comp->messages_cond, &comp->messages_lock,
-          wait_until);
-    } else {
-      signalled = TRUE;
-      g_cond_wait (&comp->messages_cond, &comp->messages_lock);
-    }
-    g_mutex_unlock (&comp->messages_lock);
-    g_mutex_lock (&comp->lock);
-    if (signalled)
-      gst_omx_component_handle_messages (comp);
+    signalled =
+        gst_omx_component_wait_message (comp, port, &comp->lock, &cookie,
+        wait_until);
     last_error = comp->last_error;
-    gst_omx_port_update_port_definition (port, NULL);
+    gst_omx_port_update_port_definition_unlocked (port);
   }
+  g_mutex_lock (&port->lock);
   port->enabled_pending = FALSE;
   port->disabled_pending = FALSE;
+  g_mutex_unlock (&port->lock);
 
   if (!signalled) {
     GST_ERROR_OBJECT (comp->parent,
@@ -2237,16 +3902,18 @@ gst_omx_port_wait_enabled_unlocked (GstOMXPort * port, GstClockTime timeout)
     err = last_error;
   } else {
     if (enabled) {
+      g_mutex_lock (&port->lock);
       port->flushing = FALSE;
       /* Reset EOS flag */
       port->eos = FALSE;
+      g_mutex_unlock (&port->lock);
     }
   }
 
   gst_omx_component_handle_messages (comp);
 
 done:
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   GST_INFO_OBJECT (comp->parent, "%s port %u is %s%s: %s (0x%08x)", comp->name,
       port->index, (err == OMX_ErrorNone ? "" : "not "),
@@ -2309,7 +3976,13 @@ gst_omx_port_mark_reconfigured (GstOMXPort * port)
   if ((err = comp->last_error) != OMX_ErrorNone)
     goto done;
 
+  g_mutex_lock (&port->lock);
   port->configured_settings_cookie = port->settings_cookie;
+  port->settings_changed_buffers = FALSE;
+  g_mutex_unlock (&port->lock);
+
+  if (GST_OMX_TRACER_IS_ENABLED ())
+    gst_omx_tracer_port_settings (port, "reconfigured");
 
   if (port->port_def.eDir == OMX_DirOutput) {
     GList *l;
@@ -2318,15 +3991,17 @@ gst_omx_port_mark_reconfigured (GstOMXPort * port)
       if (l->data == (gpointer) port) {
         comp->pending_reconfigure_outports =
             g_list_delete_link (comp->pending_reconfigure_outports, l);
+        g_atomic_int_add (&comp->n_pending_reconfigure_outports, -1);
         break;
       }
     }
+    /* Notify the inports waiting for the reconfiguration */
     if (!comp->pending_reconfigure_outports)
-      gst_omx_component_send_message (comp, NULL);
+      gst_omx_component_wake_waiters (comp, NULL);
   }
 
 done:
-  gst_omx_port_update_port_definition (port, NULL);
+  gst_omx_port_update_port_definition_unlocked (port);
 
   GST_INFO_OBJECT (comp->parent, "Marked %s port %u as reconfigured: %s "
       "(0x%08x)", comp->name, port->index, gst_omx_error_to_string (err), err);
@@ -2336,6 +4011,217 @@ done:
   return err;
 }
 
+/* Returns TRUE if the buffers of port stay valid for the settings
+ * the component changed since the last reconfiguration, so the port
+ * can be reconfigured without disabling it and reallocating them.
+ * This is the case if only the crop rectangle or the scaling changed,
+ * or if the component supports settings changes in place and the
+ * buffers are still large and many enough.
+ *
+ * NOTE: Uses comp->lock and port->lock */
+gboolean
+gst_omx_port_can_reconfigure_in_place (GstOMXPort * port)
+{
+  GstOMXComponent *comp;
+  gboolean ret = FALSE;
+  guint i;
+
+  g_return_val_if_fail (port != NULL, FALSE);
+
+  comp = port->comp;
+
+  gst_omx_port_update_port_definition (port, NULL);
+
+  g_mutex_lock (&comp->lock);
+  gst_omx_component_handle_messages (comp);
+  g_mutex_lock (&port->lock);
+
+  if (!port->port_def.bEnabled || !port->buffers || port->buffers->len == 0)
+    goto done;
+
+  if (!port->settings_changed_buffers) {
+    ret = TRUE;
+    goto done;
+  }
+
+  if (!(comp->hacks & GST_OMX_HACK_PORT_SETTINGS_CHANGED_IN_PLACE))
+    goto done;
+
+  /* The number of buffers can't be changed on an enabled port */
+  if (port->port_def.nBufferCountActual != port->buffers->len
+      || port->port_def.nBufferCountMin > port->buffers->len)
+    goto done;
+
+  for (i = 0; i < port->buffers->len; i++) {
+    GstOMXBuffer *buf = g_ptr_array_index (port->buffers, i);
+
+    if (buf->omx_buf->nAllocLen < port->port_def.nBufferSize)
+      goto done;
+  }
+
+  ret = TRUE;
+
+done:
+  GST_DEBUG_OBJECT (comp->parent, "%s port %u can %sbe reconfigured in place "
+      "(%u buffers of %u bytes needed)", comp->name, port->index,
+      (ret ? "" : "not "), (guint) port->port_def.nBufferCountActual,
+      (guint) port->port_def.nBufferSize);
+
+  g_mutex_unlock (&port->lock);
+  g_mutex_unlock (&comp->lock);
+
+  return ret;
+}
+
+static guint64
+gst_omx_port_stats_percentile (const GstOMXPortStats * stats, guint64 total,
+    guint percent)
+{
+  guint64 needed, sum = 0;
+  guint i;
+
+  if (total == 0)
+    return 0;
+
+  needed = (total * percent + 99) / 100;
+  for (i = 0; i < GST_OMX_LATENCY_BUCKETS; i++) {
+    sum += stats->latency[i];
+    if (sum >= needed)
+      break;
+  }
+
+  return gst_omx_latency_bucket_max (MIN (i, GST_OMX_LATENCY_BUCKETS - 1));
+}
+
+/* Adds the statistics of port to s, with field names starting
+ * with prefix. Latencies are in microseconds, rates are averages
+ * since the first buffer was passed to the component.
+ *
+ * NOTE: Uses port->lock */
+static void
+gst_omx_port_add_stats (GstOMXPort * port, GstStructure * s,
+    const gchar * prefix)
+{
+  GstOMXPortStats stats;
+  gdouble elapsed = 0.0;
+  guint64 total = 0;
+  gchar *name;
+  guint i;
+
+  g_return_if_fail (port != NULL);
+  g_return_if_fail (s != NULL);
+  g_return_if_fail (prefix != NULL);
+
+  g_mutex_lock (&port->lock);
+  stats = port->stats;
+  g_mutex_unlock (&port->lock);
+
+  for (i = 0; i < GST_OMX_LATENCY_BUCKETS; i++)
+    total += stats.latency[i];
+  if (GST_CLOCK_TIME_IS_VALID (stats.first_submit)
+      && GST_CLOCK_TIME_IS_VALID (stats.last_done)
+      && stats.last_done > stats.first_submit)
+    elapsed = (gdouble) (stats.last_done - stats.first_submit) / GST_SECOND;
+
+#define SET_FIELD(field, type, value) G_STMT_START { \
+    name = g_strconcat (prefix, "-", field, NULL); \
+    gst_structure_set (s, name, type, value, NULL); \
+    g_free (name); \
+  } G_STMT_END
+
+  SET_FIELD ("buffers", G_TYPE_UINT64, stats.n_buffers);
+  SET_FIELD ("bytes", G_TYPE_UINT64, stats.n_bytes);
+  SET_FIELD ("buffers-per-second", G_TYPE_DOUBLE,
+      (elapsed > 0.0 ? stats.n_buffers / elapsed : 0.0));
+  SET_FIELD ("bytes-per-second", G_TYPE_DOUBLE,
+      (elapsed > 0.0 ? stats.n_bytes / elapsed : 0.0));
+  SET_FIELD ("in-flight", G_TYPE_UINT, stats.in_flight);
+  SET_FIELD ("max-in-flight", G_TYPE_UINT, stats.max_in_flight);
+  SET_FIELD ("latency-p50", G_TYPE_UINT64,
+      gst_omx_port_stats_percentile (&stats, total, 50));
+  SET_FIELD ("latency-p95", G_TYPE_UINT64,
+      gst_omx_port_stats_percentile (&stats, total, 95));
+  SET_FIELD ("latency-p99", G_TYPE_UINT64,
+      gst_omx_port_stats_percentile (&stats, total, 99));
+
+  if (GST_OMX_PROFILE_IS_ENABLED ()) {
+    static const gchar *sections[GST_OMX_PROFILE_N_SECTIONS] = {
+      "acquire", "release", "fill-buffer", "copy-frame",
+      "find-nearest-frame", "finish-and-push"
+    };
+    gchar *field;
+
+    for (i = 0; i < GST_OMX_PROFILE_N_SECTIONS; i++) {
+      if (stats.profile_calls[i] == 0)
+        continue;
+      field = g_strconcat ("profile-", sections[i], "-ns", NULL);
+      SET_FIELD (field, G_TYPE_UINT64, stats.profile_time[i]);
+      g_free (field);
+      field = g_strconcat ("profile-", sections[i], "-calls", NULL);
+      SET_FIELD (field, G_TYPE_UINT64, stats.profile_calls[i]);
+      g_free (field);
+    }
+  }
+
+#undef SET_FIELD
+}
+
+/* Returns a new "omx-stats" structure for the stats property of
+ * the element classes, with the fields of in_port prefixed by "in"
+ * and the ones of out_port by "out". Either port can be NULL.
+ *
+ * NOTE: Must be called while holding the element's object lock,
+ * which keeps the ports from being freed */
+GstStructure *
+gst_omx_port_get_stats_structure (GstOMXPort * in_port, GstOMXPort * out_port)
+{
+  GstStructure *s = gst_structure_new_empty ("omx-stats");
+
+  if (in_port)
+    gst_omx_port_add_stats (in_port, s, "in");
+  if (out_port)
+    gst_omx_port_add_stats (out_port, s, "out");
+
+  return s;
+}
+
+/* Returns the CPU time of the calling thread in ns, or -1 if it
+ * can't be measured. Wall clock time is no replacement, it would
+ * count the time spent blocking as work */
+gint64
+gst_omx_profile_now (void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    return (gint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+#endif
+
+  return -1;
+}
+
+/* Adds the CPU time since start, a GST_OMX_PROFILE_START() value,
+ * to section of port. Does nothing if start is 0.
+ *
+ * NOTE: Uses port->lock */
+void
+gst_omx_port_profile_add (GstOMXPort * port, GstOMXProfileSection section,
+    gint64 start)
+{
+  gint64 elapsed;
+
+  if (start == 0)
+    return;
+
+  elapsed = gst_omx_profile_now () - start;
+
+  g_mutex_lock (&port->lock);
+  port->stats.profile_time[section] += MAX (elapsed, 0);
+  port->stats.profile_calls[section]++;
+  g_mutex_unlock (&port->lock);
+}
+
 typedef GType (*GGetTypeFunction) (void);
 
 static const GGetTypeFunction types[] = {
@@ -2466,6 +4352,21 @@ gst_omx_error_to_string (OMX_ERRORTYPE err)
   }
 }
 
+/* Returns TRUE if a component that reported err is expected to work
+ * again after it was replaced by a new instance, as opposed to errors
+ * caused by how it was used */
+gboolean
+gst_omx_error_is_recoverable (OMX_ERRORTYPE err)
+{
+  switch (err) {
+    case OMX_ErrorHardware:
+    case OMX_ErrorStreamCorrupt:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
 const gchar *
 gst_omx_state_to_string (OMX_STATETYPE state)
 {
@@ -2555,6 +4456,8 @@ gst_omx_parse_hacks (gchar ** hacks)
       hacks_flags |= GST_OMX_HACK_RENESAS_ENCMC_STRIDE_ALIGN;
     else if (g_str_equal (*hacks, "renesas-encmc-max-nbuffersize"))
       hacks_flags |= GST_OMX_HACK_RENESAS_ENCMC_MAX_NBUFFERSIZE;
+    else if (g_str_equal (*hacks, "port-settings-changed-in-place"))
+      hacks_flags |= GST_OMX_HACK_PORT_SETTINGS_CHANGED_IN_PLACE;
     else
       GST_WARNING ("Unknown hack: %s", *hacks);
     hacks++;
@@ -2581,7 +4484,8 @@ _class_init (gpointer g_class, gpointer data)
   const gchar *element_name = data;
   GError *err;
   gchar *core_name, *component_name, *component_role;
-  gint in_port_index, out_port_index;
+  gint in_port_index, out_port_index, pool_size, pool_idle_timeout;
+  gint admission_timeout;
   gchar *template_caps;
   GstPadTemplate *templ;
   GstCaps *caps;
@@ -2711,6 +4615,46 @@ _class_init (gpointer g_class, gpointer data)
 
     class_data->hacks = gst_omx_parse_hacks (hacks);
   }
+
+  /* Number of idle components to keep for reuse, none by default */
+  err = NULL;
+  pool_size = g_key_file_get_integer (config, element_name, "pool-size", &err);
+  if (err != NULL) {
+    pool_size = 0;
+    g_error_free (err);
+  } else {
+    GST_DEBUG ("Using pool-size %d for element '%s'", pool_size,
+        element_name);
+  }
+  class_data->pool_size = MAX (pool_size, 0);
+
+  /* Seconds an idle component stays in the pool, 0 for ever */
+  err = NULL;
+  pool_idle_timeout =
+      g_key_file_get_integer (config, element_name, "pool-idle-timeout", &err);
+  if (err != NULL) {
+    pool_idle_timeout = DEFAULT_POOL_IDLE_TIMEOUT;
+    g_error_free (err);
+  }
+  class_data->pool_idle_timeout = MAX (pool_idle_timeout, 0) * GST_SECOND;
+
+  /* When all instances of the component are in use, wait up to
+   * admission-timeout milliseconds (-1 for ever, 0 by default) for a
+   * free one, elements with higher admission-priority first. This
+   * blocks the NULL to READY state change */
+  class_data->admission_priority =
+      g_key_file_get_integer (config, element_name, "admission-priority", NULL);
+  err = NULL;
+  admission_timeout =
+      g_key_file_get_integer (config, element_name, "admission-timeout", &err);
+  if (err != NULL) {
+    admission_timeout = 0;
+    g_error_free (err);
+  }
+  if (admission_timeout < 0)
+    class_data->admission_timeout = GST_CLOCK_TIME_NONE;
+  else
+    class_data->admission_timeout = admission_timeout * GST_MSECOND;
 }
 
 static gboolean
@@ -2730,6 +4674,15 @@ plugin_init (GstPlugin * plugin)
 
   GST_DEBUG_CATEGORY_INIT (gstomx_debug, "omx", 0, "gst-omx");
 
+  if (!gst_omx_tracer_register (plugin))
+    GST_WARNING ("Failed to register the omxstats tracer");
+  gst_omx_trace_file_init ();
+  if (g_getenv ("GST_OMX_PROFILE")) {
+    _gst_omx_profile_enabled = (gst_omx_profile_now () >= 0);
+    if (!_gst_omx_profile_enabled)
+      GST_WARNING ("Can't measure thread CPU time, not profiling");
+  }
+
   /* Set the default path of gstomx.conf */
   g_setenv (*env_config_name, "/etc", FALSE);
 
@@ -2779,7 +4732,7 @@ plugin_init (GstPlugin * plugin)
     GTypeInfo type_info = { 0, };
     GType type, subtype;
     gchar *type_name, *core_name, *component_name;
-    gint rank;
+    gint rank, max_instances;
 
     GST_DEBUG ("Registering element '%s'", elements[i]);
 
@@ -2863,7 +4816,36 @@ plugin_init (GstPlugin * plugin)
     }
     subtype = g_type_register_static (type, type_name, &type_info, 0);
     g_free (type_name);
-    ret |= gst_element_register (plugin, elements[i], rank, subtype);
+    if (!gst_element_register (plugin, elements[i], rank, subtype))
+      continue;
+    ret = TRUE;
+
+    /* Load and initialize resident cores now instead of
+     * when the first element is opened */
+    if (g_key_file_get_boolean (config, elements[i], "core-resident", NULL)) {
+      gint idle_timeout;
+
+      idle_timeout =
+          g_key_file_get_integer (config, elements[i], "core-idle-timeout",
+          NULL);
+      core_name =
+          g_key_file_get_string (config, elements[i], "core-name", NULL);
+      gst_omx_core_make_resident (core_name,
+          MAX (idle_timeout, 0) * GST_SECOND);
+      g_free (core_name);
+    }
+
+    max_instances =
+        g_key_file_get_integer (config, elements[i], "max-instances", NULL);
+    if (max_instances > 0) {
+      core_name =
+          g_key_file_get_string (config, elements[i], "core-name", NULL);
+      component_name =
+          g_key_file_get_string (config, elements[i], "component-name", NULL);
+      gst_omx_admission_set_limit (core_name, component_name, max_instances);
+      g_free (component_name);
+      g_free (core_name);
+    }
   }
   g_strfreev (elements);
 
@@ -53,6 +53,8 @@
 #pragma pack()
 #endif
 
+#include "gstomxring.h"
+
 G_BEGIN_DECLS
 
 #define GST_OMX_INIT_STRUCT(st) G_STMT_START { \
@@ -64,6 +66,12 @@ G_BEGIN_DECLS
   (st)->nVersion.s.nStep = OMX_VERSION_STEP; \
 } G_STMT_END
 
+/* Maximum number of buffers the elements pass to
+ * gst_omx_port_acquire_buffers() and gst_omx_port_release_buffers()
+ * at once
+ */
+#define GST_OMX_MAX_BUFFER_BATCH 8
+
 /* Different hacks that are required to work around
  * bugs in different OpenMAX implementations
  */
@@ -131,6 +139,14 @@ G_BEGIN_DECLS
  */
 #define GST_OMX_HACK_RENESAS_ENCMC_MAX_NBUFFERSIZE                    G_GUINT64_CONSTANT (0x0000000000000400)
 
+/* If the component keeps using the buffers of an output port after
+ * OMX_EventPortSettingsChanged as long as they are large and many
+ * enough for the new settings, so the port does not have to be
+ * disabled and its buffers reallocated, e.g. on resolution
+ * downswitches or repeated SPS.
+ */
+#define GST_OMX_HACK_PORT_SETTINGS_CHANGED_IN_PLACE                   G_GUINT64_CONSTANT (0x0000000000000800)
+
 
 typedef struct _GstOMXCore GstOMXCore;
 typedef struct _GstOMXPort GstOMXPort;
@@ -139,6 +155,13 @@ typedef struct _GstOMXComponent GstOMXComponent;
 typedef struct _GstOMXBuffer GstOMXBuffer;
 typedef struct _GstOMXClassData GstOMXClassData;
 typedef struct _GstOMXMessage GstOMXMessage;
+typedef struct _GstOMXPortStats GstOMXPortStats;
+typedef struct _GstOMXAdmission GstOMXAdmission;
+
+/* Called from the component's callback for every buffer it returned,
+ * see gst_omx_port_set_buffer_done_func() */
+typedef void (*GstOMXBufferDoneFunc) (GstOMXPort * port, GstOMXBuffer * buf,
+    gpointer user_data);
 
 typedef enum {
   /* Everything good and the buffer is valid */
@@ -150,7 +173,9 @@ typedef enum {
   /* The port is EOS */
   GST_OMX_ACQUIRE_BUFFER_EOS,
   /* A fatal error happened */
-  GST_OMX_ACQUIRE_BUFFER_ERROR
+  GST_OMX_ACQUIRE_BUFFER_ERROR,
+  /* No buffer became available in time */
+  GST_OMX_ACQUIRE_BUFFER_TIMEOUT
 } GstOMXAcquireBufferReturn;
 
 struct _GstOMXCore {
@@ -162,6 +187,20 @@ struct _GstOMXCore {
   GMutex lock;
   gint user_count; /* LOCK */
 
+  /* TRUE between a successful init and deinit */
+  gboolean initialized; /* LOCK */
+  /* A resident core is not deinitialized when its last user goes
+   * away, only after idle_timeout if that is not 0 */
+  gboolean resident; /* LOCK */
+  GstClockTime idle_timeout; /* LOCK */
+  GstClockID idle_id; /* LOCK, pending idle timeout */
+
+  /* Idle components in Loaded state that were freed and are
+   * handed out again by gst_omx_component_new(). Each of them
+   * holds a reference to the core */
+  GQueue pool; /* LOCK, contains GstOMXComponent* */
+  GstClockID pool_expiry_id; /* LOCK, pending expiry of pooled components */
+
   /* OpenMAX core library functions, protected with LOCK */
   OMX_ERRORTYPE (*init) (void);
   OMX_ERRORTYPE (*deinit) (void);
@@ -200,6 +239,8 @@ struct _GstOMXMessage {
     } port_enable;
     struct {
       OMX_U32 port;
+      /* OMX_INDEXTYPE of the changed parameter or config */
+      OMX_U32 index;
     } port_settings_changed;
     struct {
       OMX_U32 port;
@@ -214,27 +255,107 @@ struct _GstOMXMessage {
   } content;
 };
 
+/* Latency buckets of GstOMXPortStats. Below 4us every microsecond has
+ * its own bucket, above that every power of two is split in 4 */
+#define GST_OMX_LATENCY_BUCKETS 128
+
+/* Code sections whose CPU time is counted per port if the
+ * GST_OMX_PROFILE environment variable is set and the system
+ * can measure the CPU time of threads */
+typedef enum {
+  GST_OMX_PROFILE_ACQUIRE,
+  GST_OMX_PROFILE_RELEASE,
+  GST_OMX_PROFILE_FILL_BUFFER,
+  GST_OMX_PROFILE_COPY_FRAME,
+  GST_OMX_PROFILE_FIND_NEAREST_FRAME,
+  /* Finishing a frame pushes it, this includes the time
+   * downstream elements spend in the same thread */
+  GST_OMX_PROFILE_FINISH_AND_PUSH,
+  GST_OMX_PROFILE_N_SECTIONS
+} GstOMXProfileSection;
+
+extern gboolean _gst_omx_profile_enabled;
+
+#define GST_OMX_PROFILE_IS_ENABLED() G_UNLIKELY (_gst_omx_profile_enabled)
+
+/* Start of a profiled section, 0 if profiling is disabled */
+#define GST_OMX_PROFILE_START() \
+    (GST_OMX_PROFILE_IS_ENABLED () ? gst_omx_profile_now () : 0)
+
+struct _GstOMXPortStats {
+  /* Buffers the component returned. Bytes are the filled bytes passed
+   * to the component for input ports, and returned by it for output
+   * ports */
+  guint64 n_buffers;
+  guint64 n_bytes;
+  /* First time a buffer was passed to the component and last
+   * time one was returned */
+  GstClockTime first_submit, last_done;
+  /* Buffers the component has right now, and the maximum */
+  guint in_flight, max_in_flight;
+  /* Number of buffers per time between passing them to the
+   * component and getting them back */
+  guint64 latency[GST_OMX_LATENCY_BUCKETS];
+  /* Thread CPU time in ns spent in and number of runs of each
+   * profiled section */
+  guint64 profile_time[GST_OMX_PROFILE_N_SECTIONS];
+  guint64 profile_calls[GST_OMX_PROFILE_N_SECTIONS];
+};
+
 struct _GstOMXPort {
   GstOMXComponent *comp;
   guint32 index;
 
   gboolean tunneled;
 
-  OMX_PARAM_PORTDEFINITIONTYPE port_def;
-  GPtrArray *buffers; /* Contains GstOMXBuffer* */
-  GQueue pending_buffers; /* Contains GstOMXBuffer* */
-  gboolean flushing;
-  gboolean flushed; /* TRUE after OMX_CommandFlush was done */
+  /* Protects the buffer queue of the port, so that passing buffers
+   * to and from the component only needs this lock and the input
+   * and output streaming threads don't block each other.
+   *
+   * The fields marked with LOCK are only changed while holding both
+   * comp->lock and this lock, they can be read with either of them */
+  GMutex lock;
+
+  OMX_PARAM_PORTDEFINITIONTYPE port_def; /* LOCK */
+  GPtrArray *buffers; /* Contains GstOMXBuffer*, LOCK */
+  GQueue pending_buffers; /* Contains GstOMXBuffer*, port->lock only */
+  /* Buffers returned by the component are posted here by the
+   * callbacks, bypassing the component's message queue */
+  GstOMXRing *done_ring; /* Contains GstOMXBuffer* */
+  gboolean flushing; /* LOCK */
+  gboolean flushed; /* TRUE after OMX_CommandFlush was done, LOCK */
   gboolean enabled_pending;  /* TRUE after OMX_Command{En,Dis}able */
-  gboolean disabled_pending; /* was done until it took effect */
-  gboolean eos; /* TRUE after a buffer with EOS flag was received */
+  gboolean disabled_pending; /* was done until it took effect, LOCK */
+  gboolean eos; /* TRUE after a buffer with EOS flag was received, LOCK */
+  /* atomic, buffers that were taken from the port to be passed to the
+   * component while it was not flushing, and whose
+   * {Empty,Fill}ThisBuffer call did not return yet. It is only
+   * increased with port->lock and not while flushing */
+  gint submitting;
+
+  /* Signalled with comp->messages_lock for every message about
+   * this port, and for everything that concerns all ports */
+  GCond messages_cond;
+  gint n_waiters; /* atomic, threads waiting for messages_cond */
+  /* atomic, increased before messages_cond is signalled */
+  gint wakeup_cookie;
 
   /* Increased whenever the settings of these port change.
    * If settings_cookie != configured_settings_cookie
    * the port has to be reconfigured.
    */
-  gint settings_cookie;
-  gint configured_settings_cookie;
+  gint settings_cookie; /* LOCK */
+  gint configured_settings_cookie; /* LOCK */
+  /* TRUE if one of these changes was more than a new crop
+   * rectangle or scaling, which keep the buffers valid */
+  gboolean settings_changed_buffers; /* LOCK */
+
+  GstOMXPortStats stats; /* port->lock only */
+
+  /* Only changed while the component has none of the buffers,
+   * see gst_omx_port_set_buffer_done_func() */
+  GstOMXBufferDoneFunc buffer_done_func;
+  gpointer buffer_done_data;
 };
 
 struct _GstOMXComponent {
@@ -244,38 +365,78 @@ struct _GstOMXComponent {
 
   OMX_HANDLETYPE handle;
   GstOMXCore *core;
+  /* Instance slot if the number of instances is limited */
+  GstOMXAdmission *admission;
 
   guint64 hacks; /* Flags, GST_OMX_HACK_* */
 
+  /* Component name and role, identifies components that can
+   * replace each other in the core's pool */
+  gchar *pool_key;
+  /* Number of idle components with the same pool_key the core keeps
+   * after this one is freed, 0 to really free it */
+  guint pool_size;
+  /* How long it stays in the pool, 0 for ever */
+  GstClockTime pool_idle_timeout;
+  /* When it is freed if still in the pool, protected by core->lock */
+  GstClockTime pool_expiry;
+  /* The port definitions when the ports were first added. A
+   * component taken from the pool gets them back */
+  GArray *default_port_defs; /* Contains OMX_PARAM_PORTDEFINITIONTYPE */
+
   /* Added once, never changed. No locks necessary */
   GPtrArray *ports; /* Contains GstOMXPort* */
   gint n_in_ports, n_out_ports;
 
-  /* Locking order: lock -> messages_lock
+  /* Locking order: lock -> port->lock -> messages_lock
+   *
+   * lock protects the component state and is taken for state changes,
+   * flushing, enabling/disabling ports, buffer (de)allocation and
+   * reconfiguration. Acquiring and releasing buffers only takes the
+   * port's lock, and lock only if control messages are pending.
+   * Never take lock while holding a port->lock and never hold
+   * two port locks at once.
    *
-   * Never hold lock while waiting for messages_cond
-   * Always check that messages is empty before waiting */
+   * Never hold lock or port->lock while waiting for messages_cond.
+   * Take the wakeup cookie before checking the condition that is
+   * waited for and don't wait if it changed since then */
   GMutex lock;
 
-  GQueue messages; /* Queue of GstOMXMessages */
+  /* The OpenMAX callbacks post their messages to message_ring without
+   * allocating or locking. Only if the ring does not exist yet or is
+   * full they are put into the messages queue instead. messages_lock
+   * is only taken by the callbacks if somebody waits for messages_cond.
+   */
+  GstOMXRing *message_ring; /* Contains GstOMXMessage, atomic */
+  GQueue messages; /* Queue of GstOMXMessages that did not fit */
+  gint n_overflow_messages; /* atomic, length of messages */
   GMutex messages_lock;
+  /* Waited on for messages about the component as a whole, threads
+   * waiting for a specific port use the port's messages_cond */
   GCond messages_cond;
+  gint n_waiters; /* atomic, threads waiting here or on any port */
+  gint wakeup_cookie; /* atomic, increased before messages_cond is signalled */
 
   OMX_STATETYPE state;
   /* OMX_StateInvalid if no pending state */
   OMX_STATETYPE pending_state;
-  /* OMX_ErrorNone usually, if different nothing will work */
+  /* When the last state change was requested */
+  GstClockTime state_change_time;
+  /* OMX_ErrorNone usually, if different nothing will work.
+   * Changed with lock, atomic reads are possible without */
   OMX_ERRORTYPE last_error;
 
   GList *pending_reconfigure_outports;
+  /* atomic, length of pending_reconfigure_outports */
+  gint n_pending_reconfigure_outports;
 };
 
 struct _GstOMXBuffer {
   GstOMXPort *port;
   OMX_BUFFERHEADERTYPE *omx_buf;
 
-  /* TRUE if the buffer is used by the port, i.e.
-   * between {Empty,Fill}ThisBuffer and the callback
+  /* atomic, TRUE if the buffer is owned by the component, i.e.
+   * from right before {Empty,Fill}ThisBuffer until the callback
    */
   gboolean used;
 
@@ -287,6 +448,13 @@ struct _GstOMXBuffer {
 
   /* To set specific data for each function */
   void *private_data;
+
+  /* When the buffer was passed to the component, GST_CLOCK_TIME_NONE
+   * while the port has it */
+  GstClockTime submit_time;
+
+  /* Id of the span the trace file last started for this buffer */
+  guint64 trace_span_id;
 };
 
 struct _GstOMXClassData {
@@ -300,11 +468,19 @@ struct _GstOMXClassData {
   guint32 in_port_index, out_port_index;
 
   guint64 hacks;
+
+  guint pool_size;
+  GstClockTime pool_idle_timeout;
+
+  /* Order and time to wait for a free instance slot */
+  gint admission_priority;
+  GstClockTime admission_timeout;
 };
 
 GKeyFile *        gst_omx_get_configuration (void);
 
 const gchar *     gst_omx_error_to_string (OMX_ERRORTYPE err);
+gboolean          gst_omx_error_is_recoverable (OMX_ERRORTYPE err);
 const gchar *     gst_omx_state_to_string (OMX_STATETYPE state);
 const gchar *     gst_omx_command_to_string (OMX_COMMANDTYPE cmd);
 
@@ -314,11 +490,12 @@ GstOMXCore *      gst_omx_core_acquire (const gchar * filename);
 void              gst_omx_core_release (GstOMXCore * core);
 
 
-GstOMXComponent * gst_omx_component_new (GstObject * parent, const gchar *core_name, const gchar *component_name, const gchar * component_role, guint64 hacks);
+GstOMXComponent * gst_omx_component_new (GstObject * parent, const gchar *core_name, const gchar *component_name, const gchar * component_role, guint64 hacks, guint pool_size, GstClockTime pool_idle_timeout, gint admission_priority, GstClockTime admission_timeout);
 void              gst_omx_component_free (GstOMXComponent * comp);
 
 OMX_ERRORTYPE     gst_omx_component_set_state (GstOMXComponent * comp, OMX_STATETYPE state);
 OMX_STATETYPE     gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout);
+OMX_ERRORTYPE     gst_omx_component_set_flushing (GstOMXComponent * comp, GstClockTime timeout, gboolean flush);
 
 OMX_ERRORTYPE     gst_omx_component_get_last_error (GstOMXComponent * comp);
 const gchar *     gst_omx_component_get_last_error_string (GstOMXComponent * comp);
@@ -339,7 +516,13 @@ OMX_ERRORTYPE     gst_omx_port_get_port_definition (GstOMXPort * port, OMX_PARAM
 OMX_ERRORTYPE     gst_omx_port_update_port_definition (GstOMXPort *port, OMX_PARAM_PORTDEFINITIONTYPE *port_definition);
 
 GstOMXAcquireBufferReturn gst_omx_port_acquire_buffer (GstOMXPort *port, GstOMXBuffer **buf);
+GstOMXAcquireBufferReturn gst_omx_port_try_acquire_buffer (GstOMXPort *port, GstOMXBuffer **buf);
+GstOMXAcquireBufferReturn gst_omx_port_acquire_buffer_timeout (GstOMXPort *port, GstOMXBuffer **buf, GstClockTime timeout);
 OMX_ERRORTYPE     gst_omx_port_release_buffer (GstOMXPort *port, GstOMXBuffer *buf);
+GstOMXAcquireBufferReturn gst_omx_port_acquire_buffers (GstOMXPort *port, GstOMXBuffer **bufs, guint max_bufs, guint *n_bufs);
+OMX_ERRORTYPE     gst_omx_port_release_buffers (GstOMXPort *port, GstOMXBuffer **bufs, guint n_bufs);
+void              gst_omx_port_return_buffers (GstOMXPort *port, GstOMXBuffer **bufs, guint n_bufs);
+void              gst_omx_port_signal_eos (GstOMXPort *port);
 
 OMX_ERRORTYPE     gst_omx_port_set_flushing (GstOMXPort *port, GstClockTime timeout, gboolean flush);
 gboolean          gst_omx_port_is_flushing (GstOMXPort *port);
@@ -350,8 +533,15 @@ OMX_ERRORTYPE     gst_omx_port_use_eglimages (GstOMXPort *port, const GList *ima
 OMX_ERRORTYPE     gst_omx_port_deallocate_buffers (GstOMXPort *port);
 OMX_ERRORTYPE     gst_omx_port_populate (GstOMXPort *port);
 OMX_ERRORTYPE     gst_omx_port_wait_buffers_released (GstOMXPort * port, GstClockTime timeout);
+void              gst_omx_port_set_buffer_done_func (GstOMXPort * port, GstOMXBufferDoneFunc func, gpointer user_data);
 
 OMX_ERRORTYPE     gst_omx_port_mark_reconfigured (GstOMXPort * port);
+gboolean          gst_omx_port_can_reconfigure_in_place (GstOMXPort * port);
+
+GstStructure *    gst_omx_port_get_stats_structure (GstOMXPort * in_port, GstOMXPort * out_port);
+
+gint64            gst_omx_profile_now (void);
+void              gst_omx_port_profile_add (GstOMXPort * port, GstOMXProfileSection section, gint64 start);
 
 OMX_ERRORTYPE     gst_omx_port_set_enabled (GstOMXPort * port, gboolean enabled);
 OMX_ERRORTYPE     gst_omx_port_wait_enabled (GstOMXPort * port, GstClockTime timeout);
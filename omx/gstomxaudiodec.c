@@ -31,6 +31,8 @@ GST_DEBUG_CATEGORY_STATIC (gst_omx_audio_dec_debug_category);
 
 /* prototypes */
 static void gst_omx_audio_dec_finalize (GObject * object);
+static void gst_omx_audio_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstStateChangeReturn
 gst_omx_audio_dec_change_state (GstElement * element,
@@ -50,7 +52,8 @@ static GstFlowReturn gst_omx_audio_dec_drain (GstOMXAudioDec * self);
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_STATS
 };
 
 /* class initialization */
@@ -70,6 +73,12 @@ gst_omx_audio_dec_class_init (GstOMXAudioDecClass * klass)
   GstAudioDecoderClass *audio_decoder_class = GST_AUDIO_DECODER_CLASS (klass);
 
   gobject_class->finalize = gst_omx_audio_dec_finalize;
+  gobject_class->get_property = gst_omx_audio_dec_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Buffer latency and throughput statistics of the OpenMAX ports",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_audio_dec_change_state);
@@ -107,7 +116,9 @@ gst_omx_audio_dec_open (GstOMXAudioDec * self)
   self->comp =
       gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
       klass->cdata.component_name, klass->cdata.component_role,
-      klass->cdata.hacks);
+      klass->cdata.hacks, klass->cdata.pool_size,
+      klass->cdata.pool_idle_timeout, klass->cdata.admission_priority,
+      klass->cdata.admission_timeout);
   self->started = FALSE;
 
   if (!self->comp)
@@ -184,8 +195,11 @@ gst_omx_audio_dec_close (GstOMXAudioDec * self)
   if (!gst_omx_audio_dec_shutdown (self))
     return FALSE;
 
+  /* The stats property reads the ports */
+  GST_OBJECT_LOCK (self);
   self->in_port = NULL;
   self->out_port = NULL;
+  GST_OBJECT_UNLOCK (self);
   if (self->comp)
     gst_omx_component_free (self->comp);
   self->comp = NULL;
@@ -193,6 +207,25 @@ gst_omx_audio_dec_close (GstOMXAudioDec * self)
   return TRUE;
 }
 
+static void
+gst_omx_audio_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXAudioDec *self = GST_OMX_AUDIO_DEC (object);
+
+  switch (prop_id) {
+    case PROP_STATS:
+      GST_OBJECT_LOCK (self);
+      g_value_take_boxed (value,
+          gst_omx_port_get_stats_structure (self->in_port, self->out_port));
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static void
 gst_omx_audio_dec_finalize (GObject * object)
 {
@@ -228,10 +261,8 @@ gst_omx_audio_dec_change_state (GstElement * element, GstStateChange transition)
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
-      if (self->in_port)
-        gst_omx_port_set_flushing (self->in_port, 5 * GST_SECOND, TRUE);
-      if (self->out_port)
-        gst_omx_port_set_flushing (self->out_port, 5 * GST_SECOND, TRUE);
+      if (self->comp)
+        gst_omx_component_set_flushing (self->comp, 5 * GST_SECOND, TRUE);
 
       g_mutex_lock (&self->drain_lock);
       self->draining = FALSE;
@@ -282,6 +313,7 @@ gst_omx_audio_dec_loop (GstOMXAudioDec * self)
   GstFlowReturn flow_ret = GST_FLOW_OK;
   GstOMXAcquireBufferReturn acq_return;
   OMX_ERRORTYPE err;
+  gint64 prof;
 
     GstAudioInfo *info =
         gst_audio_decoder_get_audio_info (GST_AUDIO_DECODER (self));
@@ -514,9 +546,11 @@ gst_omx_audio_dec_loop (GstOMXAudioDec * self)
     GST_BUFFER_DURATION (outbuf) = GST_CLOCK_TIME_NONE;
 
 
+    prof = GST_OMX_PROFILE_START ();
     flow_ret =
         gst_audio_decoder_finish_frame (GST_AUDIO_DECODER (self),
         outbuf, n_samples);
+    gst_omx_port_profile_add (port, GST_OMX_PROFILE_FINISH_AND_PUSH, prof);
   }
 
   GST_DEBUG_OBJECT (self, "Finished frame: %s", gst_flow_get_name (flow_ret));
@@ -660,8 +694,7 @@ gst_omx_audio_dec_stop (GstAudioDecoder * decoder)
 
   GST_DEBUG_OBJECT (self, "Stopping decoder");
 
-  gst_omx_port_set_flushing (self->in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->out_port, 5 * GST_SECOND, TRUE);
+  gst_omx_component_set_flushing (self->comp, 5 * GST_SECOND, TRUE);
 
   gst_pad_stop_task (GST_AUDIO_DECODER_SRC_PAD (decoder));
 
@@ -805,8 +838,7 @@ gst_omx_audio_dec_set_format (GstAudioDecoder * decoder, GstCaps *caps)
   }
 
   /* Unset flushing to allow ports to accept data again */
-  gst_omx_port_set_flushing (self->in_port, 5 * GST_SECOND, FALSE);
-  gst_omx_port_set_flushing (self->out_port, 5 * GST_SECOND, FALSE);
+  gst_omx_component_set_flushing (self->comp, 5 * GST_SECOND, FALSE);
 
   if (gst_omx_component_get_last_error (self->comp) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (self, "Component in error state: %s (0x%08x)",
@@ -836,8 +868,7 @@ gst_omx_audio_dec_flush (GstAudioDecoder * decoder, gboolean hard)
 
   gst_omx_audio_dec_drain (self);
 
-  gst_omx_port_set_flushing (self->in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->out_port, 5 * GST_SECOND, TRUE);
+  gst_omx_component_set_flushing (self->comp, 5 * GST_SECOND, TRUE);
 
   /* Wait until the srcpad loop is finished */
   GST_AUDIO_DECODER_STREAM_UNLOCK (self);
@@ -845,8 +876,7 @@ gst_omx_audio_dec_flush (GstAudioDecoder * decoder, gboolean hard)
   GST_PAD_STREAM_UNLOCK (GST_AUDIO_DECODER_SRC_PAD (self));
   GST_AUDIO_DECODER_STREAM_LOCK (self);
 
-  gst_omx_port_set_flushing (self->in_port, 5 * GST_SECOND, FALSE);
-  gst_omx_port_set_flushing (self->out_port, 5 * GST_SECOND, FALSE);
+  gst_omx_component_set_flushing (self->comp, 5 * GST_SECOND, FALSE);
   gst_omx_port_populate (self->out_port);
 
   /* Start the srcpad loop again */
@@ -892,11 +922,20 @@ gst_omx_audio_dec_handle_frame (GstAudioDecoder * decoder, GstBuffer * inbuf)
 
   size = gst_buffer_get_size (inbuf);
   while (offset < size) {
+    GstOMXBuffer *bufs[GST_OMX_MAX_BUFFER_BATCH];
+    guint i, n_bufs, n_chunks, chunk_size;
+
+    /* Take the buffers for all remaining chunks at once */
+    chunk_size = MAX (port->port_def.nBufferSize, 1);
+    n_chunks =
+        MIN ((size - offset + chunk_size - 1) / chunk_size,
+        G_N_ELEMENTS (bufs));
+
     /* Make sure to release the base class stream lock, otherwise
      * _loop() can't call _finish_frame() and we might block forever
      * because no input buffers are released */
     GST_AUDIO_DECODER_STREAM_UNLOCK (self);
-    acq_ret = gst_omx_port_acquire_buffer (port, &buf);
+    acq_ret = gst_omx_port_acquire_buffers (port, bufs, n_chunks, &n_bufs);
 
     if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
       GST_AUDIO_DECODER_STREAM_LOCK (self);
@@ -960,43 +999,51 @@ gst_omx_audio_dec_handle_frame (GstAudioDecoder * decoder, GstBuffer * inbuf)
     }
     GST_AUDIO_DECODER_STREAM_LOCK (self);
 
-    g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && buf != NULL);
+    g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && n_bufs > 0);
 
     if (self->downstream_flow_ret != GST_FLOW_OK) {
-      gst_omx_port_release_buffer (port, buf);
+      gst_omx_port_return_buffers (port, bufs, n_bufs);
       GST_DEBUG_OBJECT (self, "return sth ...");
       return self->downstream_flow_ret;
     }
 
-    if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
-      gst_omx_port_release_buffer (port, buf);
-      goto full_buffer;
-    }
+    /* Buffers that are not needed in the end are
+     * given back to the port afterwards */
+    for (i = 0; i < n_bufs && offset < size; i++) {
+      buf = bufs[i];
+      g_assert (buf != NULL);
 
-    /* Copy the buffer content in chunks of size as requested
-     * by the port */
-    buf->omx_buf->nFilledLen =
-        MIN (size, buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
+      if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
+        gst_omx_port_return_buffers (port, bufs, n_bufs);
+        goto full_buffer;
+      }
 
-    gst_buffer_extract (inbuf, 0,
-        buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
-        buf->omx_buf->nFilledLen);
+      /* Copy the buffer content in chunks of size as requested
+       * by the port */
+      buf->omx_buf->nFilledLen =
+          MIN (size - offset, buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
 
-    if (timestamp != GST_CLOCK_TIME_NONE) {
-      buf->omx_buf->nTimeStamp =
-          gst_util_uint64_scale (timestamp,
-          OMX_TICKS_PER_SECOND, GST_SECOND);
-      self->last_upstream_ts = timestamp;
-    }
-    if (duration != GST_CLOCK_TIME_NONE) {
-      buf->omx_buf->nTimeStamp = self->last_upstream_ts;
-      self->last_upstream_ts += duration;
-    }
+      gst_buffer_extract (inbuf, offset,
+          buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
+          buf->omx_buf->nFilledLen);
 
-    offset += buf->omx_buf->nFilledLen;
-    self->started = TRUE;
+      if (timestamp != GST_CLOCK_TIME_NONE) {
+        buf->omx_buf->nTimeStamp =
+            gst_util_uint64_scale (timestamp,
+            OMX_TICKS_PER_SECOND, GST_SECOND);
+        self->last_upstream_ts = timestamp;
+      }
+      if (duration != GST_CLOCK_TIME_NONE) {
+        buf->omx_buf->nTimeStamp = self->last_upstream_ts;
+        self->last_upstream_ts += duration;
+      }
+
+      offset += buf->omx_buf->nFilledLen;
+      self->started = TRUE;
+    }
 
-    err = gst_omx_port_release_buffer (port, buf);
+    gst_omx_port_return_buffers (port, bufs + i, n_bufs - i);
+    err = gst_omx_port_release_buffers (port, bufs, i);
     if (err != OMX_ErrorNone)
       goto release_error;
   }
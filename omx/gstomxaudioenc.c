@@ -32,6 +32,8 @@ GST_DEBUG_CATEGORY_STATIC (gst_omx_audio_enc_debug_category);
 
 /* prototypes */
 static void gst_omx_audio_enc_finalize (GObject * object);
+static void gst_omx_audio_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstStateChangeReturn
 gst_omx_audio_enc_change_state (GstElement * element,
@@ -51,7 +53,8 @@ static GstFlowReturn gst_omx_audio_enc_drain (GstOMXAudioEnc * self);
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_STATS
 };
 
 /* class initialization */
@@ -71,6 +74,12 @@ gst_omx_audio_enc_class_init (GstOMXAudioEncClass * klass)
   GstAudioEncoderClass *audio_encoder_class = GST_AUDIO_ENCODER_CLASS (klass);
 
   gobject_class->finalize = gst_omx_audio_enc_finalize;
+  gobject_class->get_property = gst_omx_audio_enc_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Buffer latency and throughput statistics of the OpenMAX ports",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_audio_enc_change_state);
@@ -108,7 +117,9 @@ gst_omx_audio_enc_open (GstOMXAudioEnc * self)
   self->enc =
       gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
       klass->cdata.component_name, klass->cdata.component_role,
-      klass->cdata.hacks);
+      klass->cdata.hacks, klass->cdata.pool_size,
+      klass->cdata.pool_idle_timeout, klass->cdata.admission_priority,
+      klass->cdata.admission_timeout);
   self->started = FALSE;
 
   if (!self->enc)
@@ -185,8 +196,11 @@ gst_omx_audio_enc_close (GstOMXAudioEnc * self)
   if (!gst_omx_audio_enc_shutdown (self))
     return FALSE;
 
+  /* The stats property reads the ports */
+  GST_OBJECT_LOCK (self);
   self->enc_in_port = NULL;
   self->enc_out_port = NULL;
+  GST_OBJECT_UNLOCK (self);
   if (self->enc)
     gst_omx_component_free (self->enc);
   self->enc = NULL;
@@ -194,6 +208,26 @@ gst_omx_audio_enc_close (GstOMXAudioEnc * self)
   return TRUE;
 }
 
+static void
+gst_omx_audio_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXAudioEnc *self = GST_OMX_AUDIO_ENC (object);
+
+  switch (prop_id) {
+    case PROP_STATS:
+      GST_OBJECT_LOCK (self);
+      g_value_take_boxed (value,
+          gst_omx_port_get_stats_structure (self->enc_in_port,
+              self->enc_out_port));
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static void
 gst_omx_audio_enc_finalize (GObject * object)
 {
@@ -229,10 +263,8 @@ gst_omx_audio_enc_change_state (GstElement * element, GstStateChange transition)
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
-      if (self->enc_in_port)
-        gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
-      if (self->enc_out_port)
-        gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+      if (self->enc)
+        gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, TRUE);
 
       g_mutex_lock (&self->drain_lock);
       self->draining = FALSE;
@@ -283,6 +315,7 @@ gst_omx_audio_enc_loop (GstOMXAudioEnc * self)
   GstFlowReturn flow_ret = GST_FLOW_OK;
   GstOMXAcquireBufferReturn acq_return;
   OMX_ERRORTYPE err;
+  gint64 prof;
 
   klass = GST_OMX_AUDIO_ENC_GET_CLASS (self);
 
@@ -457,9 +490,11 @@ gst_omx_audio_enc_loop (GstOMXAudioEnc * self)
           gst_util_uint64_scale (buf->omx_buf->nTickCount, GST_SECOND,
           OMX_TICKS_PER_SECOND);
 
+    prof = GST_OMX_PROFILE_START ();
     flow_ret =
         gst_audio_encoder_finish_frame (GST_AUDIO_ENCODER (self),
         outbuf, n_samples);
+    gst_omx_port_profile_add (port, GST_OMX_PROFILE_FINISH_AND_PUSH, prof);
   }
 
   GST_DEBUG_OBJECT (self, "Handled output data");
@@ -599,8 +634,7 @@ gst_omx_audio_enc_stop (GstAudioEncoder * encoder)
 
   GST_DEBUG_OBJECT (self, "Stopping encoder");
 
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+  gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, TRUE);
 
   gst_pad_stop_task (GST_AUDIO_ENCODER_SRC_PAD (encoder));
 
@@ -810,8 +844,7 @@ gst_omx_audio_enc_set_format (GstAudioEncoder * encoder, GstAudioInfo * info)
   }
 
   /* Unset flushing to allow ports to accept data again */
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, FALSE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, FALSE);
+  gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, FALSE);
 
   if (gst_omx_component_get_last_error (self->enc) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (self, "Component in error state: %s (0x%08x)",
@@ -840,8 +873,7 @@ gst_omx_audio_enc_flush (GstAudioEncoder * encoder)
 
   gst_omx_audio_enc_drain (self);
 
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+  gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, TRUE);
 
   /* Wait until the srcpad loop is finished */
   GST_AUDIO_ENCODER_STREAM_UNLOCK (self);
@@ -849,8 +881,7 @@ gst_omx_audio_enc_flush (GstAudioEncoder * encoder)
   GST_PAD_STREAM_UNLOCK (GST_AUDIO_ENCODER_SRC_PAD (self));
   GST_AUDIO_ENCODER_STREAM_LOCK (self);
 
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, FALSE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, FALSE);
+  gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, FALSE);
   gst_omx_port_populate (self->enc_out_port);
 
   /* Start the srcpad loop again */
@@ -896,11 +927,20 @@ gst_omx_audio_enc_handle_frame (GstAudioEncoder * encoder, GstBuffer * inbuf)
 
   size = gst_buffer_get_size (inbuf);
   while (offset < size) {
+    GstOMXBuffer *bufs[GST_OMX_MAX_BUFFER_BATCH];
+    guint i, n_bufs, n_chunks, chunk_size;
+
+    /* Take the buffers for all remaining chunks at once */
+    chunk_size = MAX (port->port_def.nBufferSize, 1);
+    n_chunks =
+        MIN ((size - offset + chunk_size - 1) / chunk_size,
+        G_N_ELEMENTS (bufs));
+
     /* Make sure to release the base class stream lock, otherwise
      * _loop() can't call _finish_frame() and we might block forever
      * because no input buffers are released */
     GST_AUDIO_ENCODER_STREAM_UNLOCK (self);
-    acq_ret = gst_omx_port_acquire_buffer (port, &buf);
+    acq_ret = gst_omx_port_acquire_buffers (port, bufs, n_chunks, &n_bufs);
 
     if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
       GST_AUDIO_ENCODER_STREAM_LOCK (self);
@@ -964,49 +1004,58 @@ gst_omx_audio_enc_handle_frame (GstAudioEncoder * encoder, GstBuffer * inbuf)
     }
     GST_AUDIO_ENCODER_STREAM_LOCK (self);
 
-    g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && buf != NULL);
+    g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && n_bufs > 0);
 
     if (self->downstream_flow_ret != GST_FLOW_OK) {
-      gst_omx_port_release_buffer (port, buf);
+      gst_omx_port_return_buffers (port, bufs, n_bufs);
       return self->downstream_flow_ret;
     }
 
-    if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
-      gst_omx_port_release_buffer (port, buf);
-      goto full_buffer;
-    }
+    /* Buffers that are not needed in the end are
+     * given back to the port afterwards */
+    for (i = 0; i < n_bufs && offset < size; i++) {
+      buf = bufs[i];
+      g_assert (buf != NULL);
 
-    GST_DEBUG_OBJECT (self, "Handling frame at offset %d", offset);
+      if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
+        gst_omx_port_return_buffers (port, bufs, n_bufs);
+        goto full_buffer;
+      }
 
-    /* Copy the buffer content in chunks of size as requested
-     * by the port */
-    buf->omx_buf->nFilledLen =
-        MIN (size - offset, buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
-    gst_buffer_extract (inbuf, offset,
-        buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
-        buf->omx_buf->nFilledLen);
+      GST_DEBUG_OBJECT (self, "Handling frame at offset %d", offset);
 
-    /* Interpolate timestamps if we're passing the buffer
-     * in multiple chunks */
-    if (offset != 0 && duration != GST_CLOCK_TIME_NONE) {
-      timestamp_offset = gst_util_uint64_scale (offset, duration, size);
-    }
+      /* Copy the buffer content in chunks of size as requested
+       * by the port */
+      buf->omx_buf->nFilledLen =
+          MIN (size - offset, buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
+      gst_buffer_extract (inbuf, offset,
+          buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
+          buf->omx_buf->nFilledLen);
 
-    if (timestamp != GST_CLOCK_TIME_NONE) {
-      buf->omx_buf->nTimeStamp =
-          gst_util_uint64_scale (timestamp + timestamp_offset,
-          OMX_TICKS_PER_SECOND, GST_SECOND);
-      self->last_upstream_ts = timestamp + timestamp_offset;
-    }
-    if (duration != GST_CLOCK_TIME_NONE) {
-      buf->omx_buf->nTickCount =
-          gst_util_uint64_scale (buf->omx_buf->nFilledLen, duration, size);
-      self->last_upstream_ts += duration;
+      /* Interpolate timestamps if we're passing the buffer
+       * in multiple chunks */
+      if (offset != 0 && duration != GST_CLOCK_TIME_NONE) {
+        timestamp_offset = gst_util_uint64_scale (offset, duration, size);
+      }
+
+      if (timestamp != GST_CLOCK_TIME_NONE) {
+        buf->omx_buf->nTimeStamp =
+            gst_util_uint64_scale (timestamp + timestamp_offset,
+            OMX_TICKS_PER_SECOND, GST_SECOND);
+        self->last_upstream_ts = timestamp + timestamp_offset;
+      }
+      if (duration != GST_CLOCK_TIME_NONE) {
+        buf->omx_buf->nTickCount =
+            gst_util_uint64_scale (buf->omx_buf->nFilledLen, duration, size);
+        self->last_upstream_ts += duration;
+      }
+
+      offset += buf->omx_buf->nFilledLen;
+      self->started = TRUE;
     }
 
-    offset += buf->omx_buf->nFilledLen;
-    self->started = TRUE;
-    err = gst_omx_port_release_buffer (port, buf);
+    gst_omx_port_return_buffers (port, bufs + i, n_bufs - i);
+    err = gst_omx_port_release_buffers (port, bufs, i);
     if (err != OMX_ErrorNone)
       goto release_error;
   }
@@ -1078,12 +1127,7 @@ gst_omx_audio_enc_sink_event (GstAudioEncoder * encoder, GstEvent * event)
       GST_WARNING_OBJECT (self, "Component does not support empty EOS buffers");
 
       /* Insert a NULL into the queue to signal EOS */
-      g_mutex_lock (&self->enc->lock);
-      g_queue_push_tail (&self->enc_out_port->pending_buffers, NULL);
-      g_mutex_unlock (&self->enc->lock);
-      g_mutex_lock (&self->enc->messages_lock);
-      g_cond_broadcast (&self->enc->messages_cond);
-      g_mutex_unlock (&self->enc->messages_lock);
+      gst_omx_port_signal_eos (self->enc_out_port);
       return TRUE;
     }
 
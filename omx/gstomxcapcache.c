@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Caches what was probed from the components, like the color formats
+ * and profile/levels a port supports, in
+ *
+ *   $XDG_CACHE_HOME/gstreamer-1.0/omx-caps.bin
+ *
+ * so it is not queried again in every negotiation and every process.
+ * Results are keyed by core library, component name and role, port
+ * and kind, and are only used as long as the modification time of the
+ * core library is the one they were stored with.
+ *
+ * The file starts with "GSTOMXC1" and the number of entries as
+ * guint32, followed by the entries: key length (guint32), key, core
+ * modification time (gint64), number of values (guint32) and the
+ * values (guint32 each). Everything is in host byte order.
+ *
+ * Several processes can probe at the same time, so storing takes a
+ * lock on omx-caps.bin.lock, merges with what is in the file by now
+ * and replaces the file by renaming a temporary one.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <glib/gstdio.h>
+
+#include "gstomxcapcache.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gstomx_debug);
+#define GST_CAT_DEFAULT gstomx_debug
+
+#define GST_OMX_CAP_CACHE_MAGIC "GSTOMXC1"
+#define GST_OMX_CAP_CACHE_MAGIC_LEN 8
+
+typedef struct _GstOMXCapCacheEntry GstOMXCapCacheEntry;
+
+struct _GstOMXCapCacheEntry
+{
+  gint64 core_mtime;
+  GArray *values;               /* guint32 */
+};
+
+static GMutex cache_lock;
+/* Key to GstOMXCapCacheEntry*, NULL until loaded, cache_lock */
+static GHashTable *cache = NULL;
+/* Core library name to its modification time, cache_lock */
+static GHashTable *core_mtimes = NULL;
+
+static void
+gst_omx_cap_cache_entry_free (gpointer data)
+{
+  GstOMXCapCacheEntry *entry = data;
+
+  g_array_unref (entry->values);
+  g_slice_free (GstOMXCapCacheEntry, entry);
+}
+
+static gchar *
+gst_omx_cap_cache_get_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "gstreamer-1.0",
+      "omx-caps.bin", NULL);
+}
+
+static gboolean
+gst_omx_cap_cache_read (const gchar * data, gsize size, gsize * pos,
+    gpointer dest, gsize n)
+{
+  if (size - *pos < n)
+    return FALSE;
+
+  memcpy (dest, data + *pos, n);
+  *pos += n;
+
+  return TRUE;
+}
+
+static GHashTable *
+gst_omx_cap_cache_new_table (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      gst_omx_cap_cache_entry_free);
+}
+
+/* Reads the entries of the cache file into table */
+static void
+gst_omx_cap_cache_read_file (const gchar * filename, GHashTable * table)
+{
+  gchar *contents = NULL;
+  gsize size, pos;
+  guint32 n_entries, i;
+
+  if (!g_file_get_contents (filename, &contents, &size, NULL)) {
+    GST_DEBUG ("No capability cache %s yet", filename);
+    goto done;
+  }
+
+  if (size < GST_OMX_CAP_CACHE_MAGIC_LEN
+      || memcmp (contents, GST_OMX_CAP_CACHE_MAGIC,
+          GST_OMX_CAP_CACHE_MAGIC_LEN) != 0)
+    goto invalid;
+
+  pos = GST_OMX_CAP_CACHE_MAGIC_LEN;
+  if (!gst_omx_cap_cache_read (contents, size, &pos, &n_entries,
+          sizeof (n_entries)))
+    goto invalid;
+
+  for (i = 0; i < n_entries; i++) {
+    GstOMXCapCacheEntry *entry;
+    guint32 key_len, n_values;
+    gint64 core_mtime;
+    gchar *key;
+
+    if (!gst_omx_cap_cache_read (contents, size, &pos, &key_len,
+            sizeof (key_len)) || key_len > size - pos)
+      goto invalid;
+    key = g_strndup (contents + pos, key_len);
+    pos += key_len;
+
+    if (!gst_omx_cap_cache_read (contents, size, &pos, &core_mtime,
+            sizeof (core_mtime))
+        || !gst_omx_cap_cache_read (contents, size, &pos, &n_values,
+            sizeof (n_values))
+        || n_values > (size - pos) / sizeof (guint32)) {
+      g_free (key);
+      goto invalid;
+    }
+
+    entry = g_slice_new (GstOMXCapCacheEntry);
+    entry->core_mtime = core_mtime;
+    entry->values = g_array_sized_new (FALSE, FALSE, sizeof (guint32),
+        n_values);
+    g_array_append_vals (entry->values, contents + pos, n_values);
+    pos += n_values * sizeof (guint32);
+
+    g_hash_table_replace (table, key, entry);
+  }
+
+  GST_DEBUG ("Loaded %u entries from capability cache %s", n_entries,
+      filename);
+  goto done;
+
+invalid:
+  GST_WARNING ("Ignoring invalid capability cache %s", filename);
+  g_hash_table_remove_all (table);
+
+done:
+  g_free (contents);
+}
+
+/* NOTE: Must be called while holding cache_lock */
+static void
+gst_omx_cap_cache_load (void)
+{
+  gchar *filename;
+
+  cache = gst_omx_cap_cache_new_table ();
+  core_mtimes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+
+  filename = gst_omx_cap_cache_get_filename ();
+  gst_omx_cap_cache_read_file (filename, cache);
+  g_free (filename);
+}
+
+static gboolean
+gst_omx_cap_cache_write_all (gint fd, const guint8 * data, gsize len)
+{
+  while (len > 0) {
+    gssize res = write (fd, data, len);
+
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    data += res;
+    len -= res;
+  }
+
+  return TRUE;
+}
+
+static void
+gst_omx_cap_cache_write_file (const gchar * filename, GHashTable * table)
+{
+  GByteArray *data;
+  GHashTableIter iter;
+  gpointer key, value;
+  gchar *tmpname;
+  guint32 n_entries;
+  gint fd;
+
+  data = g_byte_array_new ();
+  g_byte_array_append (data, (const guint8 *) GST_OMX_CAP_CACHE_MAGIC,
+      GST_OMX_CAP_CACHE_MAGIC_LEN);
+  n_entries = g_hash_table_size (table);
+  g_byte_array_append (data, (const guint8 *) &n_entries, sizeof (n_entries));
+
+  g_hash_table_iter_init (&iter, table);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    GstOMXCapCacheEntry *entry = value;
+    guint32 key_len = strlen (key), n_values = entry->values->len;
+
+    g_byte_array_append (data, (const guint8 *) &key_len, sizeof (key_len));
+    g_byte_array_append (data, key, key_len);
+    g_byte_array_append (data, (const guint8 *) &entry->core_mtime,
+        sizeof (entry->core_mtime));
+    g_byte_array_append (data, (const guint8 *) &n_values, sizeof (n_values));
+    g_byte_array_append (data, (const guint8 *) entry->values->data,
+        n_values * sizeof (guint32));
+  }
+
+  /* Readers don't take the lock, they must see either the old
+   * or the new file completely */
+  tmpname = g_strdup_printf ("%s.XXXXXX", filename);
+  fd = g_mkstemp (tmpname);
+  if (fd == -1) {
+    GST_WARNING ("Failed to create %s: %s", tmpname, g_strerror (errno));
+    goto done;
+  }
+
+  if (!gst_omx_cap_cache_write_all (fd, data->data, data->len)) {
+    GST_WARNING ("Failed to write %s: %s", tmpname, g_strerror (errno));
+    close (fd);
+    g_unlink (tmpname);
+    goto done;
+  }
+  close (fd);
+
+  if (g_rename (tmpname, filename) != 0) {
+    GST_WARNING ("Failed to replace capability cache %s: %s", filename,
+        g_strerror (errno));
+    g_unlink (tmpname);
+  }
+
+done:
+  g_free (tmpname);
+  g_byte_array_unref (data);
+}
+
+/* Adds entry for key to the cache file, keeping what other
+ * processes stored since it was loaded, and takes over the
+ * merged entries.
+ *
+ * NOTE: Must be called while holding cache_lock */
+static void
+gst_omx_cap_cache_save (gchar * key, GstOMXCapCacheEntry * entry)
+{
+  GHashTable *table;
+  gchar *filename, *dirname, *lockname;
+  gint lock_fd;
+
+  filename = gst_omx_cap_cache_get_filename ();
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0755);
+
+  lockname = g_strconcat (filename, ".lock", NULL);
+  lock_fd = g_open (lockname, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock_fd == -1 || flock (lock_fd, LOCK_EX) != 0) {
+    GST_WARNING ("Failed to lock capability cache %s: %s", lockname,
+        g_strerror (errno));
+    /* Still use the result in this process */
+    g_hash_table_replace (cache, key, entry);
+    goto done;
+  }
+
+  table = gst_omx_cap_cache_new_table ();
+  gst_omx_cap_cache_read_file (filename, table);
+  g_hash_table_replace (table, key, entry);
+  gst_omx_cap_cache_write_file (filename, table);
+
+  g_hash_table_unref (cache);
+  cache = table;
+
+done:
+  if (lock_fd != -1)
+    close (lock_fd);
+  g_free (lockname);
+  g_free (dirname);
+  g_free (filename);
+}
+
+/* Returns the path of a core that was loaded by library name
+ * from the mappings of the process */
+static gchar *
+gst_omx_cap_cache_find_core (const gchar * name)
+{
+  gchar *maps, *basename, *path = NULL;
+  gchar **lines, **l;
+
+  if (!g_file_get_contents ("/proc/self/maps", &maps, NULL, NULL))
+    return NULL;
+
+  basename = g_path_get_basename (name);
+  lines = g_strsplit (maps, "\n", -1);
+  for (l = lines; *l && !path; l++) {
+    const gchar *file = strchr (*l, '/');
+    gchar *tmp;
+
+    if (!file)
+      continue;
+
+    tmp = g_path_get_basename (file);
+    if (g_str_equal (tmp, basename))
+      path = g_strdup (file);
+    g_free (tmp);
+  }
+
+  g_strfreev (lines);
+  g_free (basename);
+  g_free (maps);
+
+  return path;
+}
+
+/* Returns the modification time of the core library, or -1 if
+ * it can't be found.
+ *
+ * NOTE: Must be called while holding cache_lock */
+static gint64
+gst_omx_cap_cache_get_core_mtime (GstOMXCore * core)
+{
+  const gchar *name = g_module_name (core->module);
+  gint64 *mtime;
+  gchar *path;
+  GStatBuf st;
+
+  mtime = g_hash_table_lookup (core_mtimes, name);
+  if (mtime)
+    return *mtime;
+
+  if (g_path_is_absolute (name))
+    path = g_strdup (name);
+  else
+    path = gst_omx_cap_cache_find_core (name);
+
+  mtime = g_new (gint64, 1);
+  if (path && g_stat (path, &st) == 0) {
+    *mtime = st.st_mtime;
+  } else {
+    GST_DEBUG ("Can't find core %s, not caching its capabilities", name);
+    *mtime = -1;
+  }
+  g_hash_table_insert (core_mtimes, g_strdup (name), mtime);
+  g_free (path);
+
+  return *mtime;
+}
+
+static gchar *
+gst_omx_cap_cache_get_key (GstOMXPort * port, GstOMXCapCacheKind kind)
+{
+  GstOMXComponent *comp = port->comp;
+
+  return g_strdup_printf ("%s:%s:%u:%d", g_module_name (comp->core->module),
+      comp->pool_key, (guint) port->index, kind);
+}
+
+/* Returns a copy of the values of kind stored for port, or NULL if
+ * there are none or the core library changed since they were stored.
+ *
+ * NOTE: Uses cache_lock */
+GArray *
+gst_omx_cap_cache_lookup (GstOMXPort * port, GstOMXCapCacheKind kind)
+{
+  GstOMXCapCacheEntry *entry;
+  GArray *values = NULL;
+  gint64 core_mtime;
+  gchar *key;
+
+  g_return_val_if_fail (port != NULL, NULL);
+
+  g_mutex_lock (&cache_lock);
+  if (!cache)
+    gst_omx_cap_cache_load ();
+
+  core_mtime = gst_omx_cap_cache_get_core_mtime (port->comp->core);
+  key = gst_omx_cap_cache_get_key (port, kind);
+  entry = g_hash_table_lookup (cache, key);
+  if (entry && core_mtime != -1 && entry->core_mtime == core_mtime) {
+    values = g_array_sized_new (FALSE, FALSE, sizeof (guint32),
+        entry->values->len);
+    g_array_append_vals (values, entry->values->data, entry->values->len);
+  }
+  g_mutex_unlock (&cache_lock);
+
+  GST_DEBUG_OBJECT (port->comp->parent, "Capability cache %s for %s",
+      (values ? "hit" : "miss"), key);
+  g_free (key);
+
+  return values;
+}
+
+/* Stores the values of kind probed for port, replacing older ones.
+ * Only complete, successful probes must be stored, empty results
+ * are ignored as they would hide the component's capabilities
+ * until the core library changes.
+ *
+ * NOTE: Uses cache_lock */
+void
+gst_omx_cap_cache_store (GstOMXPort * port, GstOMXCapCacheKind kind,
+    const guint32 * values, guint n_values)
+{
+  GstOMXCapCacheEntry *entry;
+  gint64 core_mtime;
+
+  g_return_if_fail (port != NULL);
+  g_return_if_fail (values != NULL || n_values == 0);
+
+  if (n_values == 0) {
+    GST_DEBUG_OBJECT (port->comp->parent, "Not caching empty probe result");
+    return;
+  }
+
+  g_mutex_lock (&cache_lock);
+  if (!cache)
+    gst_omx_cap_cache_load ();
+
+  core_mtime = gst_omx_cap_cache_get_core_mtime (port->comp->core);
+  if (core_mtime != -1) {
+    entry = g_slice_new (GstOMXCapCacheEntry);
+    entry->core_mtime = core_mtime;
+    entry->values = g_array_sized_new (FALSE, FALSE, sizeof (guint32),
+        n_values);
+    g_array_append_vals (entry->values, values, n_values);
+
+    gst_omx_cap_cache_save (gst_omx_cap_cache_get_key (port, kind), entry);
+  }
+  g_mutex_unlock (&cache_lock);
+}
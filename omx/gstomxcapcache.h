@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_CAP_CACHE_H__
+#define __GST_OMX_CAP_CACHE_H__
+
+#include <gst/gst.h>
+
+#include "gstomx.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+  /* OMX_COLOR_FORMATTYPEs the port supports */
+  GST_OMX_CAP_CACHE_COLOR_FORMATS,
+  /* Pairs of profile and highest level the port supports */
+  GST_OMX_CAP_CACHE_PROFILE_LEVELS
+} GstOMXCapCacheKind;
+
+GArray * gst_omx_cap_cache_lookup (GstOMXPort * port, GstOMXCapCacheKind kind);
+void     gst_omx_cap_cache_store (GstOMXPort * port, GstOMXCapCacheKind kind, const guint32 * values, guint n_values);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_CAP_CACHE_H__ */
@@ -0,0 +1,527 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "gstomxcopy.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gstomx_debug);
+#define GST_CAT_DEFAULT gstomx_debug
+
+/* Planes that are copied with equal source and destination strides are
+ * copied as one block, including the padding between the rows.
+ *
+ * Larger planes are copied with non-temporal stores where available.
+ * The destination is usually not read again by the CPU soon, or only
+ * by another core, so this saves reading every destination cache line
+ * before it is written and evicting the data of everybody else from the
+ * caches. Smaller planes likely stay in the cache and are copied with
+ * memcpy().
+ *
+ * The SIMD kernels are compiled whenever the compiler supports them and
+ * selected at runtime depending on the CPU. GST_OMX_COPY=c|sse2|avx2|neon
+ * in the environment overrides the selection.
+ */
+
+#define NT_THRESHOLD (256 * 1024)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_COPY_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_COPY_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef void (*GstOMXCopyRowFunc) (guint8 * dest, const guint8 * src,
+    gsize n);
+
+static void
+copy_row_c (guint8 * dest, const guint8 * src, gsize n)
+{
+  memcpy (dest, src, n);
+}
+
+#ifdef HAVE_COPY_X86
+__attribute__ ((target ("sse2")))
+static void
+copy_row_sse2 (guint8 * dest, const guint8 * src, gsize n)
+{
+  gsize head = (16 - ((guintptr) dest & 15)) & 15;
+
+  if (n < 64 + head) {
+    memcpy (dest, src, n);
+    return;
+  }
+
+  /* Stores need to be aligned, loads don't */
+  memcpy (dest, src, head);
+  dest += head;
+  src += head;
+  n -= head;
+
+  for (; n >= 64; n -= 64, src += 64, dest += 64) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) src);
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (src + 16));
+    __m128i c = _mm_loadu_si128 ((const __m128i *) (src + 32));
+    __m128i d = _mm_loadu_si128 ((const __m128i *) (src + 48));
+
+    _mm_stream_si128 ((__m128i *) dest, a);
+    _mm_stream_si128 ((__m128i *) (dest + 16), b);
+    _mm_stream_si128 ((__m128i *) (dest + 32), c);
+    _mm_stream_si128 ((__m128i *) (dest + 48), d);
+  }
+  for (; n >= 16; n -= 16, src += 16, dest += 16)
+    _mm_stream_si128 ((__m128i *) dest,
+        _mm_loadu_si128 ((const __m128i *) src));
+  memcpy (dest, src, n);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+copy_row_avx2 (guint8 * dest, const guint8 * src, gsize n)
+{
+  gsize head = (32 - ((guintptr) dest & 31)) & 31;
+
+  if (n < 128 + head) {
+    memcpy (dest, src, n);
+    return;
+  }
+
+  memcpy (dest, src, head);
+  dest += head;
+  src += head;
+  n -= head;
+
+  for (; n >= 128; n -= 128, src += 128, dest += 128) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i *) src);
+    __m256i b = _mm256_loadu_si256 ((const __m256i *) (src + 32));
+    __m256i c = _mm256_loadu_si256 ((const __m256i *) (src + 64));
+    __m256i d = _mm256_loadu_si256 ((const __m256i *) (src + 96));
+
+    _mm256_stream_si256 ((__m256i *) dest, a);
+    _mm256_stream_si256 ((__m256i *) (dest + 32), b);
+    _mm256_stream_si256 ((__m256i *) (dest + 64), c);
+    _mm256_stream_si256 ((__m256i *) (dest + 96), d);
+  }
+  for (; n >= 32; n -= 32, src += 32, dest += 32)
+    _mm256_stream_si256 ((__m256i *) dest,
+        _mm256_loadu_si256 ((const __m256i *) src));
+  memcpy (dest, src, n);
+}
+#endif
+
+#ifdef HAVE_COPY_NEON
+static void
+copy_row_neon (guint8 * dest, const guint8 * src, gsize n)
+{
+  if (n < 64) {
+    memcpy (dest, src, n);
+    return;
+  }
+
+  for (; n >= 64; n -= 64, src += 64, dest += 64) {
+    uint8x16_t a = vld1q_u8 (src);
+    uint8x16_t b = vld1q_u8 (src + 16);
+    uint8x16_t c = vld1q_u8 (src + 32);
+    uint8x16_t d = vld1q_u8 (src + 48);
+
+#ifdef __aarch64__
+    /* There are no intrinsics for the non-temporal pair stores */
+    __asm__ volatile ("stnp %q1, %q2, [%0]\n\t"
+        "stnp %q3, %q4, [%0, #32]"
+        ::"r" (dest), "w" (a), "w" (b), "w" (c), "w" (d)
+        :"memory");
+#else
+    vst1q_u8 (dest, a);
+    vst1q_u8 (dest + 16, b);
+    vst1q_u8 (dest + 32, c);
+    vst1q_u8 (dest + 48, d);
+#endif
+  }
+  memcpy (dest, src, n);
+}
+#endif
+
+/* Makes the non-temporal stores visible to other cores
+ * before the buffer is passed on */
+static void
+copy_fence (GstOMXCopyImpl impl)
+{
+#ifdef HAVE_COPY_X86
+  if (impl == GST_OMX_COPY_IMPL_SSE2 || impl == GST_OMX_COPY_IMPL_AVX2)
+    _mm_sfence ();
+#endif
+#if defined (HAVE_COPY_NEON) && defined (__aarch64__)
+  if (impl == GST_OMX_COPY_IMPL_NEON)
+    __asm__ volatile ("dmb ishst":::"memory");
+#endif
+}
+
+static GstOMXCopyRowFunc
+copy_get_row_func (GstOMXCopyImpl impl)
+{
+  switch (impl) {
+#ifdef HAVE_COPY_X86
+    case GST_OMX_COPY_IMPL_SSE2:
+      return copy_row_sse2;
+    case GST_OMX_COPY_IMPL_AVX2:
+      return copy_row_avx2;
+#endif
+#ifdef HAVE_COPY_NEON
+    case GST_OMX_COPY_IMPL_NEON:
+      return copy_row_neon;
+#endif
+    default:
+      return copy_row_c;
+  }
+}
+
+const gchar *
+gst_omx_copy_impl_get_name (GstOMXCopyImpl impl)
+{
+  switch (impl) {
+    case GST_OMX_COPY_IMPL_C:
+      return "c";
+    case GST_OMX_COPY_IMPL_SSE2:
+      return "sse2";
+    case GST_OMX_COPY_IMPL_AVX2:
+      return "avx2";
+    case GST_OMX_COPY_IMPL_NEON:
+      return "neon";
+    case GST_OMX_COPY_IMPL_AUTO:
+      return "auto";
+  }
+
+  return "unknown";
+}
+
+/* Returns TRUE if impl was compiled in and the CPU supports it */
+gboolean
+gst_omx_copy_impl_is_supported (GstOMXCopyImpl impl)
+{
+  switch (impl) {
+    case GST_OMX_COPY_IMPL_C:
+    case GST_OMX_COPY_IMPL_AUTO:
+      return TRUE;
+#ifdef HAVE_COPY_X86
+    case GST_OMX_COPY_IMPL_SSE2:
+      return __builtin_cpu_supports ("sse2");
+    case GST_OMX_COPY_IMPL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+#ifdef HAVE_COPY_NEON
+    case GST_OMX_COPY_IMPL_NEON:
+      return TRUE;
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+static gpointer
+copy_select_impl (gpointer data)
+{
+  static const GstOMXCopyImpl preferred[] = {
+    GST_OMX_COPY_IMPL_AVX2, GST_OMX_COPY_IMPL_SSE2, GST_OMX_COPY_IMPL_NEON
+  };
+  const gchar *env = g_getenv ("GST_OMX_COPY");
+  GstOMXCopyImpl impl;
+  guint i;
+
+  if (env) {
+    for (impl = GST_OMX_COPY_IMPL_C; impl < GST_OMX_COPY_IMPL_AUTO; impl++) {
+      if (g_str_equal (env, gst_omx_copy_impl_get_name (impl))
+          && gst_omx_copy_impl_is_supported (impl))
+        return GINT_TO_POINTER (impl);
+    }
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (preferred); i++) {
+    if (gst_omx_copy_impl_is_supported (preferred[i]))
+      return GINT_TO_POINTER (preferred[i]);
+  }
+
+  return GINT_TO_POINTER (GST_OMX_COPY_IMPL_C);
+}
+
+/* Returns the kernel to use for impl and a plane of size bytes */
+static GstOMXCopyImpl
+copy_resolve_impl (GstOMXCopyImpl impl, gsize size)
+{
+  static GOnce select_once = G_ONCE_INIT;
+
+  if (impl == GST_OMX_COPY_IMPL_AUTO) {
+    impl = GPOINTER_TO_INT (g_once (&select_once, copy_select_impl, NULL));
+    if (size < NT_THRESHOLD)
+      impl = GST_OMX_COPY_IMPL_C;
+  } else if (!gst_omx_copy_impl_is_supported (impl)) {
+    impl = GST_OMX_COPY_IMPL_C;
+  }
+
+  return impl;
+}
+
+/* Copies rows first_row to last_row - 1 of plane with a resolved impl */
+static void
+copy_rows (GstOMXCopyImpl impl, const GstOMXCopyPlane * plane,
+    gint first_row, gint last_row)
+{
+  GstOMXCopyRowFunc copy_row = copy_get_row_func (impl);
+  guint8 *dest = plane->dest + (gsize) first_row * plane->dest_stride;
+  const guint8 *src = plane->src + (gsize) first_row * plane->src_stride;
+  gint i, height = last_row - first_row;
+
+  if (plane->width == 0 || height <= 0)
+    return;
+
+  if (plane->dest_stride == plane->src_stride) {
+    copy_row (dest, src, (gsize) (height - 1) * plane->src_stride +
+        plane->width);
+  } else {
+    for (i = 0; i < height; i++) {
+      copy_row (dest, src, plane->width);
+      src += plane->src_stride;
+      dest += plane->dest_stride;
+    }
+  }
+
+  copy_fence (impl);
+}
+
+/* Copies height rows of width bytes with impl, which falls back
+ * to memcpy() if it is not supported */
+void
+gst_omx_copy_plane_full (GstOMXCopyImpl impl, guint8 * dest,
+    gint dest_stride, const guint8 * src, gint src_stride, gint width,
+    gint height)
+{
+  GstOMXCopyPlane plane = { dest, dest_stride, src, src_stride, width,
+    height
+  };
+
+  g_return_if_fail (dest != NULL && src != NULL);
+  g_return_if_fail (width >= 0 && height >= 0);
+  g_return_if_fail (dest_stride >= width && src_stride >= width);
+
+  impl = copy_resolve_impl (impl, (gsize) width * height);
+  copy_rows (impl, &plane, 0, height);
+}
+
+/* Copies height rows of width bytes with the best kernel for the
+ * CPU and size */
+void
+gst_omx_copy_plane (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gint width, gint height)
+{
+  gst_omx_copy_plane_full (GST_OMX_COPY_IMPL_AUTO, dest, dest_stride, src,
+      src_stride, width, height);
+}
+
+/* Every thread copies at least this much of a frame, smaller
+ * frames are split between fewer threads */
+#define MIN_BYTES_PER_THREAD (1024 * 1024)
+
+struct _GstOMXCopyPool
+{
+  /* Helper threads, the calling thread copies too */
+  GThread **threads;
+  guint n_threads;
+
+  GMutex lock;
+  GCond work_cond;
+  GCond done_cond;
+  gboolean quit;
+
+  /* Frame that is being copied, lock. Every plane is split into
+   * n_parts bands of rows, part i of all planes is copied together */
+  GstOMXCopyPlane planes[GST_OMX_COPY_MAX_PLANES];
+  GstOMXCopyImpl impls[GST_OMX_COPY_MAX_PLANES];
+  guint n_planes;
+  guint n_parts, next_part, n_done;
+};
+
+static void
+copy_pool_copy_part (GstOMXCopyPool * pool, guint part)
+{
+  guint i;
+
+  for (i = 0; i < pool->n_planes; i++) {
+    const GstOMXCopyPlane *plane = &pool->planes[i];
+
+    copy_rows (pool->impls[i], plane,
+        (gint) ((gint64) plane->height * part / pool->n_parts),
+        (gint) ((gint64) plane->height * (part + 1) / pool->n_parts));
+  }
+}
+
+/* Takes parts until none are left.
+ *
+ * NOTE: Must be called while holding pool->lock */
+static void
+copy_pool_copy_parts_unlocked (GstOMXCopyPool * pool)
+{
+  guint part;
+
+  while (pool->next_part < pool->n_parts) {
+    part = pool->next_part++;
+    g_mutex_unlock (&pool->lock);
+    copy_pool_copy_part (pool, part);
+    g_mutex_lock (&pool->lock);
+
+    if (++pool->n_done == pool->n_parts)
+      g_cond_signal (&pool->done_cond);
+  }
+}
+
+static gpointer
+copy_pool_thread (gpointer data)
+{
+  GstOMXCopyPool *pool = data;
+
+  g_mutex_lock (&pool->lock);
+  while (!pool->quit) {
+    if (pool->next_part < pool->n_parts)
+      copy_pool_copy_parts_unlocked (pool);
+    else
+      g_cond_wait (&pool->work_cond, &pool->lock);
+  }
+  g_mutex_unlock (&pool->lock);
+
+  return NULL;
+}
+
+/* Creates a pool in which n_threads threads, including
+ * the calling one, copy a frame together */
+GstOMXCopyPool *
+gst_omx_copy_pool_new (guint n_threads)
+{
+  GstOMXCopyPool *pool;
+  GError *error = NULL;
+  guint i;
+
+  g_return_val_if_fail (n_threads > 0, NULL);
+
+  pool = g_slice_new0 (GstOMXCopyPool);
+  g_mutex_init (&pool->lock);
+  g_cond_init (&pool->work_cond);
+  g_cond_init (&pool->done_cond);
+
+  pool->threads = g_new0 (GThread *, n_threads);
+  pool->n_threads = 1;
+  for (i = 1; i < n_threads; i++) {
+    pool->threads[i - 1] =
+        g_thread_try_new ("omxcopy", copy_pool_thread, pool, &error);
+    if (!pool->threads[i - 1]) {
+      GST_WARNING ("Failed to create copy thread, using %u: %s",
+          pool->n_threads, error->message);
+      g_clear_error (&error);
+      break;
+    }
+    pool->n_threads++;
+  }
+
+  return pool;
+}
+
+void
+gst_omx_copy_pool_free (GstOMXCopyPool * pool)
+{
+  guint i;
+
+  g_return_if_fail (pool != NULL);
+
+  g_mutex_lock (&pool->lock);
+  pool->quit = TRUE;
+  g_cond_broadcast (&pool->work_cond);
+  g_mutex_unlock (&pool->lock);
+
+  for (i = 0; i < pool->n_threads - 1; i++)
+    g_thread_join (pool->threads[i]);
+  g_free (pool->threads);
+
+  g_cond_clear (&pool->done_cond);
+  g_cond_clear (&pool->work_cond);
+  g_mutex_clear (&pool->lock);
+  g_slice_free (GstOMXCopyPool, pool);
+}
+
+/* Returns the number of threads that copy, including the calling one */
+guint
+gst_omx_copy_pool_get_n_threads (GstOMXCopyPool * pool)
+{
+  g_return_val_if_fail (pool != NULL, 0);
+
+  return pool->n_threads;
+}
+
+/* Copies the planes of a frame with impl, using as many threads
+ * of the pool as are worth it for the size of the frame. Returns
+ * once everything is copied */
+void
+gst_omx_copy_pool_copy_planes (GstOMXCopyPool * pool, GstOMXCopyImpl impl,
+    const GstOMXCopyPlane * planes, guint n_planes)
+{
+  gsize size = 0;
+  guint i, n_parts;
+
+  g_return_if_fail (pool != NULL);
+  g_return_if_fail (planes != NULL || n_planes == 0);
+  g_return_if_fail (n_planes <= GST_OMX_COPY_MAX_PLANES);
+
+  for (i = 0; i < n_planes; i++) {
+    const GstOMXCopyPlane *plane = &planes[i];
+
+    g_return_if_fail (plane->dest != NULL && plane->src != NULL);
+    g_return_if_fail (plane->width >= 0 && plane->height >= 0);
+    g_return_if_fail (plane->dest_stride >= plane->width
+        && plane->src_stride >= plane->width);
+
+    size += (gsize) plane->width * plane->height;
+  }
+
+  n_parts = MIN (pool->n_threads, MAX (size / MIN_BYTES_PER_THREAD, 1));
+
+  g_mutex_lock (&pool->lock);
+  for (i = 0; i < n_planes; i++) {
+    pool->planes[i] = planes[i];
+    pool->impls[i] = copy_resolve_impl (impl,
+        (gsize) planes[i].width * planes[i].height);
+  }
+  pool->n_planes = n_planes;
+  pool->n_parts = n_parts;
+  pool->next_part = 0;
+  pool->n_done = 0;
+
+  /* Wake up one helper per part the calling thread doesn't take */
+  for (i = 1; i < n_parts; i++)
+    g_cond_signal (&pool->work_cond);
+
+  copy_pool_copy_parts_unlocked (pool);
+  while (pool->n_done < pool->n_parts)
+    g_cond_wait (&pool->done_cond, &pool->lock);
+  g_mutex_unlock (&pool->lock);
+}
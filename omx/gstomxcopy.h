@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_COPY_H__
+#define __GST_OMX_COPY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Kernels for copying image planes between buffers with different
+ * strides, like between the OpenMAX buffers and the ones downstream
+ * or upstream provides.
+ */
+typedef enum {
+  /* memcpy() per row */
+  GST_OMX_COPY_IMPL_C,
+  /* Row copies with non-temporal stores */
+  GST_OMX_COPY_IMPL_SSE2,
+  GST_OMX_COPY_IMPL_AVX2,
+  GST_OMX_COPY_IMPL_NEON,
+
+  GST_OMX_COPY_IMPL_AUTO
+} GstOMXCopyImpl;
+
+const gchar * gst_omx_copy_impl_get_name (GstOMXCopyImpl impl);
+gboolean      gst_omx_copy_impl_is_supported (GstOMXCopyImpl impl);
+
+void          gst_omx_copy_plane (guint8 * dest, gint dest_stride, const guint8 * src, gint src_stride, gint width, gint height);
+void          gst_omx_copy_plane_full (GstOMXCopyImpl impl, guint8 * dest, gint dest_stride, const guint8 * src, gint src_stride, gint width, gint height);
+
+#define GST_OMX_COPY_MAX_PLANES 4
+
+typedef struct _GstOMXCopyPlane GstOMXCopyPlane;
+
+struct _GstOMXCopyPlane
+{
+  guint8 *dest;
+  gint dest_stride;
+  const guint8 *src;
+  gint src_stride;
+  gint width, height;
+};
+
+/* Worker threads that copy the planes of a frame together. Frames
+ * that are too small to be worth waking up the workers are copied
+ * by the calling thread alone.
+ *
+ * A pool must only be used by one thread at a time.
+ */
+typedef struct _GstOMXCopyPool GstOMXCopyPool;
+
+GstOMXCopyPool * gst_omx_copy_pool_new (guint n_threads);
+void             gst_omx_copy_pool_free (GstOMXCopyPool * pool);
+guint            gst_omx_copy_pool_get_n_threads (GstOMXCopyPool * pool);
+
+void             gst_omx_copy_pool_copy_planes (GstOMXCopyPool * pool, GstOMXCopyImpl impl, const GstOMXCopyPlane * planes, guint n_planes);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_COPY_H__ */
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Frames are passed to the component in decoding order, which only
+ * differs from the timestamp order within the reordering depth of the
+ * stream, so new entries are inserted close to the tail. Decoders
+ * output in display order and everything older than an output buffer
+ * is taken out, so the frame of the next output buffer is usually the
+ * head. Encoders output in decoding order, their frame is at most the
+ * reordering depth away from the head. Adding and finding are
+ * therefore constant time in practice, without looking at the
+ * other pending frames.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstomx.h"
+#include "gstomxframeindex.h"
+
+#define MAX_FRAME_DIST_TICKS  (5 * OMX_TICKS_PER_SECOND)
+#define MAX_FRAME_DIST_FRAMES (100)
+
+typedef struct _GstOMXFrameIndexEntry GstOMXFrameIndexEntry;
+
+struct _GstOMXFrameIndexEntry
+{
+  GstVideoCodecFrame *frame;
+  guint64 timestamp;
+};
+
+#define ENTRY(l) ((GstOMXFrameIndexEntry *) (l)->data)
+
+static gint
+gst_omx_frame_index_entry_compare (const GstOMXFrameIndexEntry * a,
+    const GstOMXFrameIndexEntry * b)
+{
+  if (a->timestamp != b->timestamp)
+    return a->timestamp < b->timestamp ? -1 : 1;
+  if (a->frame->system_frame_number != b->frame->system_frame_number)
+    return a->frame->system_frame_number <
+        b->frame->system_frame_number ? -1 : 1;
+  return 0;
+}
+
+/* Removes the entry at l and returns its frame reference */
+static GstVideoCodecFrame *
+gst_omx_frame_index_remove_link (GstOMXFrameIndex * index, GList * l)
+{
+  GstOMXFrameIndexEntry *entry = l->data;
+  GstVideoCodecFrame *frame = entry->frame;
+
+  g_queue_delete_link (&index->entries, l);
+  g_slice_free (GstOMXFrameIndexEntry, entry);
+
+  return frame;
+}
+
+void
+gst_omx_frame_index_init (GstOMXFrameIndex * index)
+{
+  g_return_if_fail (index != NULL);
+
+  g_queue_init (&index->entries);
+}
+
+/* Removes all frames */
+void
+gst_omx_frame_index_clear (GstOMXFrameIndex * index)
+{
+  g_return_if_fail (index != NULL);
+
+  while (index->entries.head)
+    gst_video_codec_frame_unref (gst_omx_frame_index_remove_link (index,
+            index->entries.head));
+}
+
+/* Adds frame, which was passed to the component with timestamp
+ * and is not in the index yet */
+void
+gst_omx_frame_index_add (GstOMXFrameIndex * index,
+    GstVideoCodecFrame * frame, guint64 timestamp)
+{
+  GstOMXFrameIndexEntry *entry;
+  GList *l;
+
+  g_return_if_fail (index != NULL);
+  g_return_if_fail (frame != NULL);
+
+  entry = g_slice_new (GstOMXFrameIndexEntry);
+  entry->frame = gst_video_codec_frame_ref (frame);
+  entry->timestamp = timestamp;
+
+  for (l = index->entries.tail; l; l = l->prev) {
+    if (gst_omx_frame_index_entry_compare (ENTRY (l), entry) <= 0)
+      break;
+  }
+
+  if (l)
+    g_queue_insert_after (&index->entries, l, entry);
+  else
+    g_queue_push_head (&index->entries, entry);
+}
+
+/* Removes and returns the frame whose timestamp is closest to
+ * timestamp, the one passed first of several equally close ones,
+ * or NULL if the index is empty.
+ *
+ * Frames passed before it with a lower timestamp that are more than
+ * MAX_FRAME_DIST_TICKS or MAX_FRAME_DIST_FRAMES older will never be
+ * output anymore. They are removed too and prepended to too_old. */
+GstVideoCodecFrame *
+gst_omx_frame_index_take_nearest (GstOMXFrameIndex * index,
+    guint64 timestamp, GList ** too_old)
+{
+  GstOMXFrameIndexEntry *best_entry;
+  GList *l, *next, *prev = NULL, *best_l;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (too_old != NULL, NULL);
+
+  /* l is the first entry with a timestamp not below the one we look
+   * for, prev the last one below it */
+  for (l = index->entries.head; l && ENTRY (l)->timestamp < timestamp;
+      l = l->next)
+    prev = l;
+  if (prev) {
+    /* Of several entries with the same timestamp the one passed first */
+    while (prev->prev
+        && ENTRY (prev->prev)->timestamp == ENTRY (prev)->timestamp)
+      prev = prev->prev;
+  }
+
+  if (!prev) {
+    best_l = l;
+  } else if (!l) {
+    best_l = prev;
+  } else {
+    guint64 diff_prev = timestamp - ENTRY (prev)->timestamp;
+    guint64 diff_next = ENTRY (l)->timestamp - timestamp;
+
+    if (diff_prev != diff_next)
+      best_l = diff_prev < diff_next ? prev : l;
+    else
+      best_l = ENTRY (prev)->frame->system_frame_number <
+          ENTRY (l)->frame->system_frame_number ? prev : l;
+  }
+
+  if (!best_l)
+    return NULL;
+
+  best_entry = best_l->data;
+  for (l = index->entries.head; l != best_l; l = next) {
+    GstOMXFrameIndexEntry *entry = l->data;
+    guint64 diff_ticks, diff_frames;
+
+    next = l->next;
+    if (entry->frame->system_frame_number >=
+        best_entry->frame->system_frame_number)
+      continue;
+
+    if (entry->timestamp == 0 || best_entry->timestamp == 0)
+      diff_ticks = 0;
+    else
+      diff_ticks = best_entry->timestamp - entry->timestamp;
+    diff_frames = best_entry->frame->system_frame_number -
+        entry->frame->system_frame_number;
+
+    if (diff_ticks > MAX_FRAME_DIST_TICKS
+        || diff_frames > MAX_FRAME_DIST_FRAMES)
+      *too_old = g_list_prepend (*too_old,
+          gst_omx_frame_index_remove_link (index, l));
+  }
+
+  return gst_omx_frame_index_remove_link (index, best_l);
+}
+
+/* Removes and returns the frames with a PTS before pts, or the ones
+ * without PTS if pts is GST_CLOCK_TIME_NONE. The timestamps in the
+ * index are the PTS in OpenMAX ticks */
+GList *
+gst_omx_frame_index_take_older (GstOMXFrameIndex * index, GstClockTime pts)
+{
+  GList *l, *next, *frames = NULL;
+  guint64 max_timestamp = G_MAXUINT64;
+
+  g_return_val_if_fail (index != NULL, NULL);
+
+  if (GST_CLOCK_TIME_IS_VALID (pts))
+    max_timestamp = gst_util_uint64_scale (pts, OMX_TICKS_PER_SECOND,
+        GST_SECOND);
+
+  for (l = index->entries.head; l && ENTRY (l)->timestamp <= max_timestamp;
+      l = next) {
+    GstVideoCodecFrame *frame = ENTRY (l)->frame;
+    gboolean older;
+
+    next = l->next;
+    /* GST_CLOCK_TIME_NONE is never before a valid pts */
+    if (GST_CLOCK_TIME_IS_VALID (pts))
+      older = frame->pts < pts;
+    else
+      older = !GST_CLOCK_TIME_IS_VALID (frame->pts);
+
+    if (older)
+      frames = g_list_prepend (frames,
+          gst_omx_frame_index_remove_link (index, l));
+  }
+
+  return g_list_reverse (frames);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_FRAME_INDEX_H__
+#define __GST_OMX_FRAME_INDEX_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/* Frames that were passed to the component, indexed by the OpenMAX
+ * timestamp they were passed with, to find the frame an output buffer
+ * belongs to. The index holds a reference to every frame in it.
+ *
+ * Frames are removed when they are found for an output buffer, when
+ * they are taken out as older than an output buffer, and when the
+ * index is cleared. Frames the element finishes or drops otherwise
+ * must be removed or the index cleared.
+ *
+ * NOTE: Not thread-safe, the elements use it with their stream
+ * lock held
+ */
+typedef struct _GstOMXFrameIndex GstOMXFrameIndex;
+
+struct _GstOMXFrameIndex
+{
+  /* GstOMXFrameIndexEntry, sorted by timestamp and
+   * then by system frame number */
+  GQueue entries;
+};
+
+void                 gst_omx_frame_index_init (GstOMXFrameIndex * index);
+void                 gst_omx_frame_index_clear (GstOMXFrameIndex * index);
+
+void                 gst_omx_frame_index_add (GstOMXFrameIndex * index, GstVideoCodecFrame * frame, guint64 timestamp);
+
+GstVideoCodecFrame * gst_omx_frame_index_take_nearest (GstOMXFrameIndex * index, guint64 timestamp, GList ** too_old);
+GList *              gst_omx_frame_index_take_older (GstOMXFrameIndex * index, GstClockTime pts);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_FRAME_INDEX_H__ */
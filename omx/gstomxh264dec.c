@@ -39,6 +39,8 @@ static gboolean gst_omx_h264_dec_set_format (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
 static gsize gst_omx_h264_dec_copy_frame (GstOMXVideoDec * dec,
     GstBuffer * inbuf, guint offset, GstOMXBuffer * outbuf);
+static gboolean gst_omx_h264_dec_convert_frame (GstOMXVideoDec * dec,
+    guint8 * data, gsize size);
 
 enum
 {
@@ -64,6 +66,8 @@ gst_omx_h264_dec_class_init (GstOMXH264DecClass * klass)
       GST_DEBUG_FUNCPTR (gst_omx_h264_dec_is_format_change);
   videodec_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_h264_dec_set_format);
   videodec_class->copy_frame = GST_DEBUG_FUNCPTR (gst_omx_h264_dec_copy_frame);
+  videodec_class->convert_frame =
+      GST_DEBUG_FUNCPTR (gst_omx_h264_dec_convert_frame);
 
   videodec_class->cdata.default_sink_template_caps = "video/x-h264, "
       "alignment=(string) au, "
@@ -333,3 +337,45 @@ gst_omx_h264_dec_copy_frame (GstOMXVideoDec * dec, GstBuffer * inbuf,
 
   return inbuf_consumed;
 }
+
+/* Transforms AVC into bytestream in place like copy_frame() does while
+ * copying. This only works if the NAL length fields are as long as
+ * the start codes, other frames and broken ones are copied */
+static gboolean
+gst_omx_h264_dec_convert_frame (GstOMXVideoDec * dec, guint8 * data,
+    gsize size)
+{
+  GstOMXH264Dec *self = GST_OMX_H264_DEC (dec);
+  gsize pos, nal_size;
+  guint NAL_unit_type;
+
+  if (self->nal_length_field_size != 4)
+    return FALSE;
+
+  /* Check all NALs before touching anything */
+  for (pos = 0; size - pos >= 4; pos += nal_size + 4) {
+    nal_size = GST_READ_UINT32_BE (data + pos);
+    if (nal_size > size - pos - 4)
+      return FALSE;
+  }
+  if (pos != size)
+    return FALSE;
+
+  for (pos = 0; pos < size; pos += nal_size + 4) {
+    nal_size = GST_READ_UINT32_BE (data + pos);
+
+    /* Check NAL_unit_type */
+    if (nal_size > 0) {
+      NAL_unit_type = data[pos + 4] & 0x1F;
+      if ((1 <= NAL_unit_type) && (NAL_unit_type <= 5))
+        dec->ts_flag = TRUE;    /* increase timestamp (later) */
+    }
+
+    data[pos] = 0x00;
+    data[pos + 1] = 0x00;
+    data[pos + 2] = 0x00;
+    data[pos + 3] = 0x01;
+  }
+
+  return TRUE;
+}
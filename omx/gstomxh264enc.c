@@ -189,6 +189,13 @@ gst_omx_h264_enc_set_format (GstOMXVideoEnc * enc, GstOMXPort * port,
     gst_caps_unref (peercaps);
   }
 
+  if (!gst_omx_video_enc_supports_profile_level (GST_OMX_VIDEO_ENC (self),
+          param.eProfile, param.eLevel)) {
+    GST_WARNING_OBJECT (self, "Profile %d and level %d not listed as "
+        "supported by component, trying anyway", param.eProfile,
+        param.eLevel);
+  }
+
   err =
       gst_omx_component_set_parameter (GST_OMX_VIDEO_ENC (self)->enc,
       OMX_IndexParamVideoProfileLevelCurrent, &param);
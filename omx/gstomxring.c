@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstomxring.h"
+
+/* Every cell carries a sequence number next to the element. For the cell
+ * at position pos it is pos while the cell is free, pos + 1 once an element
+ * was stored and pos + size after the element was taken out again, which
+ * makes the cell free for the next round. Producers and consumers claim
+ * positions with a compare-and-exchange on tail respectively head and then
+ * only touch their own cell.
+ *
+ * Positions are free running 32 bit counters, all comparisons are done on
+ * the signed difference so that wrapping around is harmless.
+ */
+
+#define CACHE_LINE_SIZE 64
+#define CELL_HEADER_SIZE 8
+
+struct _GstOMXRing
+{
+  guint8 *cells;
+  gsize cell_size;
+  gsize elem_size;
+  guint mask;
+
+  /* Next position to push to and to pop from, kept on
+   * their own cache lines to avoid false sharing */
+  guint8 pad0[CACHE_LINE_SIZE];
+  volatile gint tail;
+  guint8 pad1[CACHE_LINE_SIZE - sizeof (gint)];
+  volatile gint head;
+  guint8 pad2[CACHE_LINE_SIZE - sizeof (gint)];
+};
+
+#define RING_CELL_SEQ(ring, pos) \
+    ((volatile gint *) ((ring)->cells + ((pos) & (ring)->mask) * (ring)->cell_size))
+#define RING_CELL_DATA(ring, pos) \
+    ((ring)->cells + ((pos) & (ring)->mask) * (ring)->cell_size + CELL_HEADER_SIZE)
+
+/* Rounds n_elems up to the next power of two */
+GstOMXRing *
+gst_omx_ring_new (gsize elem_size, guint n_elems)
+{
+  GstOMXRing *ring;
+  guint size, i;
+
+  g_return_val_if_fail (elem_size > 0, NULL);
+  g_return_val_if_fail (n_elems > 0 && n_elems <= G_MAXINT / 2, NULL);
+
+  size = 1;
+  while (size < n_elems)
+    size <<= 1;
+
+  ring = g_slice_new0 (GstOMXRing);
+  ring->elem_size = elem_size;
+  ring->cell_size = (CELL_HEADER_SIZE + elem_size + 7) & ~((gsize) 7);
+  ring->mask = size - 1;
+  ring->cells = g_malloc0 (ring->cell_size * size);
+
+  for (i = 0; i < size; i++)
+    *RING_CELL_SEQ (ring, i) = i;
+
+  ring->head = 0;
+  ring->tail = 0;
+
+  return ring;
+}
+
+/* Must only be called once no other thread uses the ring anymore */
+void
+gst_omx_ring_free (GstOMXRing * ring)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_free (ring->cells);
+  g_slice_free (GstOMXRing, ring);
+}
+
+guint
+gst_omx_ring_get_size (GstOMXRing * ring)
+{
+  g_return_val_if_fail (ring != NULL, 0);
+
+  return ring->mask + 1;
+}
+
+/* Copies elem into the ring. Returns FALSE if the ring is full */
+gboolean
+gst_omx_ring_push (GstOMXRing * ring, gconstpointer elem)
+{
+  guint pos;
+  gint diff;
+
+  pos = g_atomic_int_get (&ring->tail);
+  for (;;) {
+    diff = (gint) ((guint) g_atomic_int_get (RING_CELL_SEQ (ring, pos)) - pos);
+
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange (&ring->tail, pos, pos + 1))
+        break;
+    } else if (diff < 0) {
+      /* The consumer of the previous round did not take this cell yet */
+      return FALSE;
+    }
+
+    /* Somebody else claimed the position, try the next one */
+    pos = g_atomic_int_get (&ring->tail);
+  }
+
+  memcpy (RING_CELL_DATA (ring, pos), elem, ring->elem_size);
+  g_atomic_int_set (RING_CELL_SEQ (ring, pos), pos + 1);
+
+  return TRUE;
+}
+
+/* Copies the oldest element of the ring to elem. Returns FALSE if
+ * the ring is empty */
+gboolean
+gst_omx_ring_pop (GstOMXRing * ring, gpointer elem)
+{
+  guint pos;
+  gint diff;
+
+  pos = g_atomic_int_get (&ring->head);
+  for (;;) {
+    diff =
+        (gint) ((guint) g_atomic_int_get (RING_CELL_SEQ (ring, pos)) - (pos +
+            1));
+
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange (&ring->head, pos, pos + 1))
+        break;
+    } else if (diff < 0) {
+      /* Nothing was stored in this cell yet */
+      return FALSE;
+    }
+
+    pos = g_atomic_int_get (&ring->head);
+  }
+
+  memcpy (elem, RING_CELL_DATA (ring, pos), ring->elem_size);
+  g_atomic_int_set (RING_CELL_SEQ (ring, pos), pos + ring->mask + 1);
+
+  return TRUE;
+}
+
+/* Only a snapshot, elements might be pushed or popped concurrently.
+ * An element whose push did not complete yet is not counted, the
+ * pushing thread is still going to notify any waiters after it. */
+gboolean
+gst_omx_ring_is_empty (GstOMXRing * ring)
+{
+  guint pos;
+
+  pos = g_atomic_int_get (&ring->head);
+
+  return (gint) ((guint) g_atomic_int_get (RING_CELL_SEQ (ring,
+              pos)) - (pos + 1)) < 0;
+}
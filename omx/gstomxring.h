@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_RING_H__
+#define __GST_OMX_RING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Bounded queue of fixed size elements that can be used concurrently
+ * from any number of producer and consumer threads without taking
+ * locks or allocating memory. Elements are copied in and out by value.
+ *
+ * Pushing fails instead of blocking if the ring is full and popping
+ * fails if it is empty, waiting is left to the caller.
+ */
+typedef struct _GstOMXRing GstOMXRing;
+
+GstOMXRing *      gst_omx_ring_new (gsize elem_size, guint n_elems);
+void              gst_omx_ring_free (GstOMXRing * ring);
+
+guint             gst_omx_ring_get_size (GstOMXRing * ring);
+
+gboolean          gst_omx_ring_push (GstOMXRing * ring, gconstpointer elem);
+gboolean          gst_omx_ring_pop (GstOMXRing * ring, gpointer elem);
+gboolean          gst_omx_ring_is_empty (GstOMXRing * ring);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_RING_H__ */
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Writes the lifecycle of every GstOMXBuffer to a file in the Chrome
+ * trace event format, which can be loaded in chrome://tracing or
+ * https://ui.perfetto.dev. Enable it with
+ *
+ *   GST_OMX_TRACE_FILE=/tmp/omx.json
+ *
+ * Every element is shown as a process and every port of its component
+ * as a thread of it. Each buffer gets two spans, "port N app" while
+ * the element has it (acquired until released) and "port N component"
+ * while the component has it (released until returned). Things the
+ * element does with a buffer in between, like copying data into it or
+ * pushing it downstream, are instant events on the port's track.
+ *
+ * The file is created when the first component is traced, so that
+ * processes which only load the plugin, like the registry scanner,
+ * don't truncate it. It is written through a large stdio buffer and
+ * only completed when the process exits normally.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gstomxtracefile.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gstomx_debug);
+#define GST_CAT_DEFAULT gstomx_debug
+
+#define GST_OMX_TRACE_FILE_BUFFER_SIZE (1024 * 1024)
+
+typedef struct _GstOMXTraceProcess GstOMXTraceProcess;
+
+struct _GstOMXTraceProcess
+{
+  gint pid;
+  gchar *name;
+  /* Port indexes that already have a thread_name */
+  GHashTable *ports;
+};
+
+gint _gst_omx_trace_file_enabled = FALSE;
+
+static GMutex trace_lock;
+/* Set until the file is opened, protected by trace_lock */
+static gchar *trace_filename;
+static FILE *trace_file;
+static gboolean trace_first_event = TRUE;
+/* GstElement * -> GstOMXTraceProcess *, protected by trace_lock */
+static GHashTable *trace_processes;
+static gint trace_next_pid = 1;
+static guint64 trace_next_span_id = 1;
+
+static void
+gst_omx_trace_process_free (GstOMXTraceProcess * process)
+{
+  g_free (process->name);
+  g_hash_table_unref (process->ports);
+  g_free (process);
+}
+
+/* Returns str escaped for a JSON string. g_strescape() is not enough,
+ * JSON has no octal escapes */
+static gchar *
+gst_omx_trace_file_escape (const gchar * str)
+{
+  GString *escaped = g_string_sized_new (strlen (str));
+
+  for (; *str; str++) {
+    guchar c = *str;
+
+    if (c == '"' || c == '\\')
+      g_string_append_printf (escaped, "\\%c", c);
+    else if (c < 0x20)
+      g_string_append_printf (escaped, "\\u%04x", c);
+    else
+      g_string_append_c (escaped, c);
+  }
+
+  return g_string_free (escaped, FALSE);
+}
+
+/* NOTE: Must be called while holding trace_lock */
+static void
+gst_omx_trace_file_start_event (void)
+{
+  if (trace_first_event) {
+    trace_first_event = FALSE;
+    fputs ("[\n", trace_file);
+  } else {
+    fputs (",\n", trace_file);
+  }
+}
+
+static void
+gst_omx_trace_file_finish (void)
+{
+  g_mutex_lock (&trace_lock);
+  g_atomic_int_set (&_gst_omx_trace_file_enabled, FALSE);
+  if (trace_file) {
+    if (trace_first_event)
+      fputs ("[\n", trace_file);
+    fputs ("\n]\n", trace_file);
+    fclose (trace_file);
+    trace_file = NULL;
+  }
+  g_free (trace_filename);
+  trace_filename = NULL;
+  g_hash_table_unref (trace_processes);
+  trace_processes = NULL;
+  g_mutex_unlock (&trace_lock);
+}
+
+/* Only remembers the file name, it is opened by
+ * gst_omx_trace_file_open_unlocked() once a component is traced */
+void
+gst_omx_trace_file_init (void)
+{
+  const gchar *filename;
+
+  if (g_atomic_int_get (&_gst_omx_trace_file_enabled))
+    return;
+
+  filename = g_getenv ("GST_OMX_TRACE_FILE");
+  if (!filename || *filename == '\0')
+    return;
+
+  trace_filename = g_strdup (filename);
+  trace_processes = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gst_omx_trace_process_free);
+  atexit (gst_omx_trace_file_finish);
+
+  g_atomic_int_set (&_gst_omx_trace_file_enabled, TRUE);
+}
+
+/* Returns TRUE if the trace file is open, opening it on the first call.
+ * If that fails tracing is disabled.
+ *
+ * NOTE: Must be called while holding trace_lock */
+static gboolean
+gst_omx_trace_file_open_unlocked (void)
+{
+  if (trace_file)
+    return TRUE;
+  if (!trace_filename)
+    return FALSE;
+
+  trace_file = fopen (trace_filename, "w");
+  if (!trace_file) {
+    GST_WARNING ("Failed to open trace file %s", trace_filename);
+    g_atomic_int_set (&_gst_omx_trace_file_enabled, FALSE);
+  } else {
+    setvbuf (trace_file, NULL, _IOFBF, GST_OMX_TRACE_FILE_BUFFER_SIZE);
+    GST_INFO ("Writing OpenMAX buffer trace to %s", trace_filename);
+  }
+
+  g_free (trace_filename);
+  trace_filename = NULL;
+
+  return trace_file != NULL;
+}
+
+/* Returns the process for the element owning port's component and
+ * announces the process and the port's thread if they are new.
+ * Components can move between elements when pooled, and element
+ * addresses can be reused, so a renamed element starts a new process.
+ *
+ * NOTE: Must be called while holding trace_lock */
+static GstOMXTraceProcess *
+gst_omx_trace_file_get_process (GstOMXPort * port)
+{
+  GstOMXComponent *comp = port->comp;
+  GstOMXTraceProcess *process;
+  gchar *name, *comp_name;
+
+  name = gst_omx_trace_file_escape (comp->parent ?
+      GST_OBJECT_NAME (comp->parent) : "");
+
+  process = g_hash_table_lookup (trace_processes, comp->parent);
+  if (process && strcmp (process->name, name) != 0) {
+    /* The trace keeps the old process, it's only replaced here */
+    process = NULL;
+  }
+
+  if (!process) {
+    process = g_new0 (GstOMXTraceProcess, 1);
+    process->pid = trace_next_pid++;
+    process->name = name;
+    process->ports = g_hash_table_new (NULL, NULL);
+    g_hash_table_replace (trace_processes, comp->parent, process);
+
+    gst_omx_trace_file_start_event ();
+    fprintf (trace_file, "{\"name\":\"process_name\",\"ph\":\"M\","
+        "\"pid\":%d,\"args\":{\"name\":\"%s\"}}", process->pid, name);
+  } else {
+    g_free (name);
+  }
+
+  if (!g_hash_table_contains (process->ports,
+          GUINT_TO_POINTER (port->index))) {
+    g_hash_table_add (process->ports, GUINT_TO_POINTER (port->index));
+
+    comp_name = gst_omx_trace_file_escape (comp->name);
+    gst_omx_trace_file_start_event ();
+    fprintf (trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\","
+        "\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s port %u %s\"}}",
+        process->pid, port->index, comp_name, port->index,
+        port->port_def.eDir == OMX_DirInput ? "in" : "out");
+    g_free (comp_name);
+  }
+
+  return process;
+}
+
+/* Buffers are allocated again at the same addresses after
+ * reconfigurations, so every span gets an id of its own. A buffer is
+ * only in one span at a time, begin stores the id in it for the end */
+static void
+gst_omx_trace_file_buffer_span (GstOMXPort * port, GstOMXBuffer * buf,
+    const gchar * span, gboolean begin, GstClockTime ts)
+{
+  GstOMXTraceProcess *process;
+
+  g_mutex_lock (&trace_lock);
+  if (!gst_omx_trace_file_open_unlocked ())
+    goto done;
+
+  process = gst_omx_trace_file_get_process (port);
+  if (begin)
+    buf->trace_span_id = trace_next_span_id++;
+
+  gst_omx_trace_file_start_event ();
+  fprintf (trace_file, "{\"name\":\"port %u %s\",\"cat\":\"omx\","
+      "\"ph\":\"%s\",\"id\":\"%" G_GUINT64_FORMAT "\",\"pid\":%d,"
+      "\"tid\":%u,\"ts\":%" G_GUINT64_FORMAT ".%03u,"
+      "\"args\":{\"bytes\":%u}}", port->index, span, begin ? "b" : "e",
+      buf->trace_span_id, process->pid, port->index, ts / 1000,
+      (guint) (ts % 1000), (guint) buf->omx_buf->nFilledLen);
+
+done:
+  g_mutex_unlock (&trace_lock);
+}
+
+/* Starts span for buf at ts, which is a gst_util_get_timestamp () value */
+void
+gst_omx_trace_file_buffer_begin (GstOMXPort * port, GstOMXBuffer * buf,
+    const gchar * span, GstClockTime ts)
+{
+  gst_omx_trace_file_buffer_span (port, buf, span, TRUE, ts);
+}
+
+/* Ends span for buf at ts, which is a gst_util_get_timestamp () value */
+void
+gst_omx_trace_file_buffer_end (GstOMXPort * port, GstOMXBuffer * buf,
+    const gchar * span, GstClockTime ts)
+{
+  gst_omx_trace_file_buffer_span (port, buf, span, FALSE, ts);
+}
+
+/* Marks that event happened to buf now */
+void
+gst_omx_trace_file_buffer_event (GstOMXPort * port, GstOMXBuffer * buf,
+    const gchar * event)
+{
+  GstOMXTraceProcess *process;
+  GstClockTime ts = gst_util_get_timestamp ();
+
+  g_mutex_lock (&trace_lock);
+  if (!gst_omx_trace_file_open_unlocked ())
+    goto done;
+
+  process = gst_omx_trace_file_get_process (port);
+
+  gst_omx_trace_file_start_event ();
+  fprintf (trace_file, "{\"name\":\"%s\",\"cat\":\"omx\",\"ph\":\"i\","
+      "\"s\":\"t\",\"pid\":%d,\"tid\":%u,"
+      "\"ts\":%" G_GUINT64_FORMAT ".%03u,\"args\":{\"buffer\":\"%p\"}}",
+      event, process->pid, port->index, ts / 1000, (guint) (ts % 1000), buf);
+
+done:
+  g_mutex_unlock (&trace_lock);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_TRACE_FILE_H__
+#define __GST_OMX_TRACE_FILE_H__
+
+#include <gst/gst.h>
+
+#include "gstomx.h"
+
+G_BEGIN_DECLS
+
+/* atomic, TRUE if GST_OMX_TRACE_FILE was set when the plugin was
+ * loaded until the file is completed at exit. The functions below
+ * must only be called in that case */
+extern gint _gst_omx_trace_file_enabled;
+
+#define GST_OMX_TRACE_FILE_IS_ENABLED() \
+    G_UNLIKELY (g_atomic_int_get (&_gst_omx_trace_file_enabled))
+
+void gst_omx_trace_file_init (void);
+
+void gst_omx_trace_file_buffer_begin (GstOMXPort * port, GstOMXBuffer * buf, const gchar * span, GstClockTime ts);
+void gst_omx_trace_file_buffer_end (GstOMXPort * port, GstOMXBuffer * buf, const gchar * span, GstClockTime ts);
+void gst_omx_trace_file_buffer_event (GstOMXPort * port, GstOMXBuffer * buf, const gchar * event);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_TRACE_FILE_H__ */
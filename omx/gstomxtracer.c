@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* The omxstats tracer logs what the OpenMAX components are doing as
+ * tracer records: buffers passed to and returned by the components,
+ * state changes and port reconfigurations. Enable it with
+ *
+ *   GST_TRACERS=omxstats GST_DEBUG=GST_TRACER:7
+ *
+ * Tracers can only hook into GStreamer core functions, so gstomx.c
+ * calls the hooks below itself while an omxstats instance exists.
+ * All timestamps are from the monotonic clock in nanoseconds.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstomxtracer.h"
+
+gint _gst_omx_tracer_enabled = 0;
+
+#if GST_CHECK_VERSION (1, 8, 0)
+
+#define GST_TYPE_OMX_STATS_TRACER (gst_omx_stats_tracer_get_type ())
+
+typedef struct _GstOMXStatsTracer GstOMXStatsTracer;
+typedef struct _GstOMXStatsTracerClass GstOMXStatsTracerClass;
+
+struct _GstOMXStatsTracer
+{
+  GstTracer parent;
+};
+
+struct _GstOMXStatsTracerClass
+{
+  GstTracerClass parent_class;
+};
+
+static GType gst_omx_stats_tracer_get_type (void);
+
+G_DEFINE_TYPE (GstOMXStatsTracer, gst_omx_stats_tracer, GST_TYPE_TRACER);
+
+static GstTracerRecord *tr_buffer;
+static GstTracerRecord *tr_state;
+static GstTracerRecord *tr_port;
+
+#define VALUE_FIELD(gtype, desc) \
+    GST_TYPE_STRUCTURE, gst_structure_new ("value", \
+        "type", G_TYPE_GTYPE, gtype, \
+        "description", G_TYPE_STRING, desc, \
+        "flags", GST_TYPE_TRACER_VALUE_FLAGS, GST_TRACER_VALUE_FLAGS_NONE, \
+        NULL)
+
+static void
+gst_omx_stats_tracer_finalize (GObject * object)
+{
+  g_atomic_int_add (&_gst_omx_tracer_enabled, -1);
+
+  G_OBJECT_CLASS (gst_omx_stats_tracer_parent_class)->finalize (object);
+}
+
+static void
+gst_omx_stats_tracer_class_init (GstOMXStatsTracerClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gst_omx_stats_tracer_finalize;
+
+  tr_buffer = gst_tracer_record_new ("omx-buffer.class",
+      "element", VALUE_FIELD (G_TYPE_STRING, "element owning the component"),
+      "component", VALUE_FIELD (G_TYPE_STRING, "OpenMAX component"),
+      "port", VALUE_FIELD (G_TYPE_UINT, "port index"),
+      "event", VALUE_FIELD (G_TYPE_STRING,
+          "released to the component or done by it"),
+      "ts", VALUE_FIELD (G_TYPE_UINT64, "event time in ns"),
+      "latency", VALUE_FIELD (G_TYPE_UINT64,
+          "time the component had the buffer in ns, 0 when released"),
+      "bytes", VALUE_FIELD (G_TYPE_UINT, "filled length of the buffer"),
+      "in-flight", VALUE_FIELD (G_TYPE_UINT,
+          "buffers the component has after the event"), NULL);
+
+  tr_state = gst_tracer_record_new ("omx-state.class",
+      "element", VALUE_FIELD (G_TYPE_STRING, "element owning the component"),
+      "component", VALUE_FIELD (G_TYPE_STRING, "OpenMAX component"),
+      "old-state", VALUE_FIELD (G_TYPE_STRING, "previous state"),
+      "new-state", VALUE_FIELD (G_TYPE_STRING, "state reached"),
+      "ts", VALUE_FIELD (G_TYPE_UINT64, "event time in ns"),
+      "duration", VALUE_FIELD (G_TYPE_UINT64,
+          "time since the state change was requested in ns"), NULL);
+
+  tr_port = gst_tracer_record_new ("omx-port.class",
+      "element", VALUE_FIELD (G_TYPE_STRING, "element owning the component"),
+      "component", VALUE_FIELD (G_TYPE_STRING, "OpenMAX component"),
+      "port", VALUE_FIELD (G_TYPE_UINT, "port index"),
+      "event", VALUE_FIELD (G_TYPE_STRING,
+          "settings-changed by the component or reconfigured by us"),
+      "ts", VALUE_FIELD (G_TYPE_UINT64, "event time in ns"), NULL);
+}
+
+static void
+gst_omx_stats_tracer_init (GstOMXStatsTracer * self)
+{
+  g_atomic_int_inc (&_gst_omx_tracer_enabled);
+}
+
+static const gchar *
+gst_omx_tracer_element_name (GstOMXComponent * comp)
+{
+  return (comp->parent ? GST_OBJECT_NAME (comp->parent) : "");
+}
+
+gboolean
+gst_omx_tracer_register (GstPlugin * plugin)
+{
+  return gst_tracer_register (plugin, "omxstats", GST_TYPE_OMX_STATS_TRACER);
+}
+
+/* NOTE: Called while holding port->lock */
+void
+gst_omx_tracer_buffer_released (GstOMXPort * port, GstOMXBuffer * buf,
+    GstClockTime ts)
+{
+  GstOMXComponent *comp = port->comp;
+
+  gst_tracer_record_log (tr_buffer, gst_omx_tracer_element_name (comp),
+      comp->name, port->index, "released", ts, G_GUINT64_CONSTANT (0),
+      (guint) buf->omx_buf->nFilledLen, port->stats.in_flight);
+}
+
+/* NOTE: Called while holding port->lock */
+void
+gst_omx_tracer_buffer_done (GstOMXPort * port, GstOMXBuffer * buf,
+    GstClockTime ts, GstClockTime latency)
+{
+  GstOMXComponent *comp = port->comp;
+
+  gst_tracer_record_log (tr_buffer, gst_omx_tracer_element_name (comp),
+      comp->name, port->index, "done", ts, latency,
+      (guint) buf->omx_buf->nFilledLen, port->stats.in_flight);
+}
+
+/* NOTE: Called while holding comp->lock */
+void
+gst_omx_tracer_state_changed (GstOMXComponent * comp,
+    OMX_STATETYPE old_state, OMX_STATETYPE new_state, GstClockTime duration)
+{
+  gst_tracer_record_log (tr_state, gst_omx_tracer_element_name (comp),
+      comp->name, gst_omx_state_to_string (old_state),
+      gst_omx_state_to_string (new_state), gst_util_get_timestamp (),
+      duration);
+}
+
+/* NOTE: Called while holding comp->lock */
+void
+gst_omx_tracer_port_settings (GstOMXPort * port, const gchar * event)
+{
+  GstOMXComponent *comp = port->comp;
+
+  gst_tracer_record_log (tr_port, gst_omx_tracer_element_name (comp),
+      comp->name, port->index, event, gst_util_get_timestamp ());
+}
+
+#else /* !GST_CHECK_VERSION (1, 8, 0) */
+
+/* No tracer support in this GStreamer version, the hooks are never
+ * called because _gst_omx_tracer_enabled stays 0 */
+
+gboolean
+gst_omx_tracer_register (GstPlugin * plugin)
+{
+  return TRUE;
+}
+
+void
+gst_omx_tracer_buffer_released (GstOMXPort * port, GstOMXBuffer * buf,
+    GstClockTime ts)
+{
+}
+
+void
+gst_omx_tracer_buffer_done (GstOMXPort * port, GstOMXBuffer * buf,
+    GstClockTime ts, GstClockTime latency)
+{
+}
+
+void
+gst_omx_tracer_state_changed (GstOMXComponent * comp,
+    OMX_STATETYPE old_state, OMX_STATETYPE new_state, GstClockTime duration)
+{
+}
+
+void
+gst_omx_tracer_port_settings (GstOMXPort * port, const gchar * event)
+{
+}
+
+#endif
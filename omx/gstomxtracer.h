@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_TRACER_H__
+#define __GST_OMX_TRACER_H__
+
+#include <gst/gst.h>
+
+#include "gstomx.h"
+
+G_BEGIN_DECLS
+
+/* Number of omxstats tracer instances, the hooks below must only
+ * be called if it is not 0 */
+extern gint _gst_omx_tracer_enabled;
+
+#define GST_OMX_TRACER_IS_ENABLED() \
+    G_UNLIKELY (g_atomic_int_get (&_gst_omx_tracer_enabled) > 0)
+
+gboolean gst_omx_tracer_register (GstPlugin * plugin);
+
+void gst_omx_tracer_buffer_released (GstOMXPort * port, GstOMXBuffer * buf, GstClockTime ts);
+void gst_omx_tracer_buffer_done (GstOMXPort * port, GstOMXBuffer * buf, GstClockTime ts, GstClockTime latency);
+void gst_omx_tracer_state_changed (GstOMXComponent * comp, OMX_STATETYPE old_state, OMX_STATETYPE new_state, GstClockTime duration);
+void gst_omx_tracer_port_settings (GstOMXPort * port, const gchar * event);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_TRACER_H__ */
@@ -28,10 +28,13 @@
 #include <gst/gst.h>
 #include <gst/video/gstvideometa.h>
 #include <gst/video/gstvideopool.h>
+#include <stdlib.h>             /* posix_memalign() */
 #include <string.h>
 #include <unistd.h>             /* getpagesize() */
 
 #include "gstomxvideodec.h"
+#include "gstomxtracefile.h"
+#include "gstomxcapcache.h"
 
 #ifdef HAVE_MMNGRBUF
 #include "gst/allocators/gstdmabuf.h"
@@ -51,6 +54,14 @@ struct _GstOMXMemory
   GstMemory mem;
 
   GstOMXBuffer *buf;
+
+  /* Copy of the content after buf was freed while somebody else still
+   * had this memory, see gst_omx_memory_detach(). Protected by lock,
+   * which also protects n_maps */
+  guint8 *copy;
+  gint n_maps;
+  GMutex lock;
+  GCond unmap_cond;
 };
 
 struct _GstOMXMemoryAllocator
@@ -91,6 +102,9 @@ gst_omx_memory_allocator_free (GstAllocator * allocator, GstMemory * mem)
    * new memory
    */
 
+  g_free (omem->copy);
+  g_mutex_clear (&omem->lock);
+  g_cond_clear (&omem->unmap_cond);
   g_slice_free (GstOMXMemory, omem);
 }
 
@@ -98,13 +112,42 @@ static gpointer
 gst_omx_memory_map (GstMemory * mem, gsize maxsize, GstMapFlags flags)
 {
   GstOMXMemory *omem = (GstOMXMemory *) mem;
+  gpointer data;
+
+  g_mutex_lock (&omem->lock);
+  data = omem->copy ? omem->copy : omem->buf->omx_buf->pBuffer;
+  omem->n_maps++;
+  g_mutex_unlock (&omem->lock);
 
-  return omem->buf->omx_buf->pBuffer;
+  return data;
 }
 
 static void
 gst_omx_memory_unmap (GstMemory * mem)
 {
+  GstOMXMemory *omem = (GstOMXMemory *) mem;
+
+  g_mutex_lock (&omem->lock);
+  omem->n_maps--;
+  g_cond_broadcast (&omem->unmap_cond);
+  g_mutex_unlock (&omem->lock);
+}
+
+/* Moves the content of mem out of its OpenMAX buffer, which is freed
+ * next although somebody else still has mem. Waits until nobody has
+ * mem mapped anymore, the pointers would go into the freed buffer */
+static void
+gst_omx_memory_detach (GstOMXMemory * omem)
+{
+  g_mutex_lock (&omem->lock);
+  while (omem->n_maps > 0)
+    g_cond_wait (&omem->unmap_cond, &omem->lock);
+  if (!omem->copy) {
+    omem->copy = g_malloc (omem->mem.maxsize);
+    memcpy (omem->copy, omem->buf->omx_buf->pBuffer, omem->mem.maxsize);
+    omem->buf = NULL;
+  }
+  g_mutex_unlock (&omem->lock);
 }
 
 static GstMemory *
@@ -147,7 +190,6 @@ gst_omx_memory_allocator_init (GstOMXMemoryAllocator * allocator)
   GST_OBJECT_FLAG_SET (allocator, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
 }
 
-#ifndef HAVE_MMNGRBUF
 static GstMemory *
 gst_omx_memory_allocator_alloc (GstAllocator * allocator, GstMemoryFlags flags,
     GstOMXBuffer * buf, gsize offset, gsize size)
@@ -168,10 +210,13 @@ gst_omx_memory_allocator_alloc (GstAllocator * allocator, GstMemoryFlags flags,
       offset, size);
 
   mem->buf = buf;
+  mem->copy = NULL;
+  mem->n_maps = 0;
+  g_mutex_init (&mem->lock);
+  g_cond_init (&mem->unmap_cond);
 
   return GST_MEMORY_CAST (mem);
 }
-#endif
 
 /* Buffer pool for the buffers of an OpenMAX port.
  *
@@ -258,6 +303,16 @@ struct _GstOMXBufferPool
   /* TRUE if the downstream buffer pool can handle
      "videosink_buffer_creation_request" query */
   gboolean vsink_buf_req_supported;
+
+  /* Output ports: increased whenever the port settings change
+   * while the buffers are kept */
+  gint settings_cookie;
+
+  /* Input ports: number of buffers upstream acquired and did not
+   * pass to the component or give back yet, OBJECT_LOCK. lent_cond
+   * is signalled whenever it decreases */
+  guint n_lent;
+  GCond lent_cond;
 };
 
 struct _GstOMXBufferPoolClass
@@ -267,8 +322,13 @@ struct _GstOMXBufferPoolClass
 
 struct _GstOMXVideoDecBufferData
 {
+  /* Output ports: acquired from the port and not released yet.
+   * Input ports: lent to upstream, OBJECT_LOCK */
   gboolean already_acquired;
 
+  /* Output ports: pool settings_cookie the buffer is laid out for */
+  gint settings_cookie;
+
 #ifdef HAVE_MMNGRBUF
   gint id_export[GST_VIDEO_MAX_PLANES];
 #endif
@@ -293,6 +353,10 @@ gst_omx_buffer_pool_start (GstBufferPool * bpool)
     GST_OBJECT_UNLOCK (pool);
     return FALSE;
   }
+  /* Upstream can stop and start the pool again, all buffers of
+   * input ports are wrapped each time */
+  if (pool->port->port_def.eDir == OMX_DirInput)
+    pool->current_buffer_index = 0;
   GST_OBJECT_UNLOCK (pool);
 
   return
@@ -375,6 +439,14 @@ gst_omx_buffer_pool_set_config (GstBufferPool * bpool, GstStructure * config)
     pool->video_info = info;
   }
 
+  /* Upstream configures pools for input ports, but they always
+   * contain exactly the buffers of the port */
+  if (pool->port && pool->port->port_def.eDir == OMX_DirInput)
+    gst_buffer_pool_config_set_params (config, caps,
+        pool->port->port_def.nBufferSize,
+        pool->port->port_def.nBufferCountActual,
+        pool->port->port_def.nBufferCountActual);
+
   if (pool->caps)
     gst_caps_unref (pool->caps);
   pool->caps = gst_caps_ref (caps);
@@ -406,6 +478,147 @@ wrong_video_caps:
   }
 }
 
+/* Returns a new buffer for the output buffer omx_buf, laid out for
+ * the current port settings */
+static GstBuffer *
+gst_omx_buffer_pool_wrap_output_buffer (GstOMXBufferPool * pool,
+    GstOMXBuffer * omx_buf)
+{
+  GstBuffer *buf;
+  gsize offset[4] = { 0, };
+  gint stride[4] = { 0, };
+  gsize plane_size[4] = { 0, };
+#ifndef HAVE_MMNGRBUF
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (pool->element);
+  guint n_planes;
+  gint i;
+#endif
+
+  switch (pool->video_info.finfo->format) {
+    case GST_VIDEO_FORMAT_I420:
+      offset[0] = 0;
+      stride[0] = pool->port->port_def.format.video.nStride;
+      offset[1] = stride[0] * pool->port->port_def.format.video.nSliceHeight;
+      stride[1] = pool->port->port_def.format.video.nStride / 2;
+      offset[2] =
+          offset[1] +
+          stride[1] * (pool->port->port_def.format.video.nSliceHeight / 2);
+      stride[2] = pool->port->port_def.format.video.nStride / 2;
+      plane_size[0] = pool->port->port_def.format.video.nStride *
+          pool->port->port_def.format.video.nFrameHeight;
+      plane_size[1] = plane_size[2] = plane_size[0] / 4;
+
+#ifndef HAVE_MMNGRBUF
+      n_planes = 3;
+#endif
+      break;
+    case GST_VIDEO_FORMAT_NV12:
+      offset[0] = 0;
+      stride[0] = pool->port->port_def.format.video.nStride;
+      offset[1] = stride[0] * pool->port->port_def.format.video.nSliceHeight;
+      stride[1] = pool->port->port_def.format.video.nStride;
+      plane_size[0] = pool->port->port_def.format.video.nStride *
+          pool->port->port_def.format.video.nFrameHeight;
+      plane_size[1] = plane_size[0] / 2;
+
+#ifndef HAVE_MMNGRBUF
+      n_planes = 2;
+#endif
+      break;
+    default:
+      g_assert_not_reached ();
+      break;
+  }
+
+  buf = gst_buffer_new ();
+
+#ifndef HAVE_MMNGRBUF
+  if (self->use_dmabuf == FALSE)
+    for (i = 0; i < n_planes; i++)
+      gst_buffer_append_memory (buf,
+          gst_omx_memory_allocator_alloc (pool->allocator, 0, omx_buf,
+              offset[i], plane_size[i]));
+#endif
+
+  if (pool->add_videometa)
+    gst_buffer_add_video_meta_full (buf, GST_VIDEO_FRAME_FLAG_NONE,
+        GST_VIDEO_INFO_FORMAT (&pool->video_info),
+        GST_VIDEO_INFO_WIDTH (&pool->video_info),
+        GST_VIDEO_INFO_HEIGHT (&pool->video_info),
+        GST_VIDEO_INFO_N_PLANES (&pool->video_info), offset, stride);
+
+  return buf;
+}
+
+/* Replaces buf, which was laid out for older port settings, by a new
+ * buffer for the current ones. Exported dmabufs are released, the
+ * caller exports them again for the new layout
+ *
+ * NOTE: Must only be called while the pool has buf */
+static GstBuffer *
+gst_omx_buffer_pool_rewrap_output_buffer (GstOMXBufferPool * pool,
+    GstBuffer * buf, GstOMXBuffer * omx_buf)
+{
+  GstOMXVideoDecBufferData *vdbuf_data =
+      (GstOMXVideoDecBufferData *) omx_buf->private_data;
+  GstBuffer *new_buf;
+#ifdef HAVE_MMNGRBUF
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (pool->element);
+  gint i;
+#endif
+
+  GST_DEBUG_OBJECT (pool, "Updating buffer %p for the new port settings",
+      buf);
+
+  g_ptr_array_remove (pool->buffers, buf);
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buf),
+      gst_omx_buffer_data_quark, NULL, NULL);
+  gst_buffer_unref (buf);
+
+#ifdef HAVE_MMNGRBUF
+  if (self->use_dmabuf) {
+    for (i = 0; i < GST_VIDEO_MAX_PLANES; i++) {
+      if (vdbuf_data->id_export[i] >= 0)
+        mmngr_export_end_in_user (vdbuf_data->id_export[i]);
+      vdbuf_data->id_export[i] = -1;
+    }
+  }
+#endif
+
+  new_buf = gst_omx_buffer_pool_wrap_output_buffer (pool, omx_buf);
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (new_buf),
+      gst_omx_buffer_data_quark, omx_buf, NULL);
+  g_ptr_array_add (pool->buffers, new_buf);
+  vdbuf_data->settings_cookie = pool->settings_cookie;
+
+  return new_buf;
+}
+
+/* Takes over caps for the buffers the pool already has, after the
+ * port settings changed without reallocating them. A pool can't be
+ * configured again while it is active. Every buffer is laid out for
+ * the new settings the next time it is acquired, the ones downstream
+ * still has keep the old layout until then */
+static gboolean
+gst_omx_buffer_pool_update_caps (GstOMXBufferPool * pool, GstCaps * caps)
+{
+  GstVideoInfo info;
+
+  if (!caps || !gst_video_info_from_caps (&info, caps)) {
+    GST_WARNING_OBJECT (pool,
+        "failed getting geometry from caps %" GST_PTR_FORMAT, caps);
+    return FALSE;
+  }
+
+  GST_OBJECT_LOCK (pool);
+  gst_caps_replace (&pool->caps, caps);
+  pool->video_info = info;
+  pool->settings_cookie++;
+  GST_OBJECT_UNLOCK (pool);
+
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
     GstBuffer ** buffer, GstBufferPoolAcquireParams * params)
@@ -421,7 +634,20 @@ gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
   omx_buf = g_ptr_array_index (pool->port->buffers, pool->current_buffer_index);
   g_return_val_if_fail (omx_buf != NULL, GST_FLOW_ERROR);
 
-  if (pool->other_pool) {
+  if (pool->port->port_def.eDir == OMX_DirInput) {
+    GstOMXVideoDecBufferData *vdbuf_data;
+
+    /* Upstream writes the frame straight into the OpenMAX memory */
+    buf = gst_buffer_new ();
+    gst_buffer_append_memory (buf,
+        gst_omx_memory_allocator_alloc (pool->allocator, 0, omx_buf, 0,
+            omx_buf->omx_buf->nAllocLen));
+
+    g_ptr_array_add (pool->buffers, buf);
+
+    vdbuf_data = g_slice_new0 (GstOMXVideoDecBufferData);
+    omx_buf->private_data = (void *) vdbuf_data;
+  } else if (pool->other_pool) {
     guint i, n;
 
     buf = g_ptr_array_index (pool->buffers, pool->current_buffer_index);
@@ -452,73 +678,18 @@ gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
       }
     }
   } else {
-    gsize offset[4] = { 0, };
-    gint stride[4] = { 0, };
-    gsize plane_size[4] = { 0, };
-#ifndef HAVE_MMNGRBUF
-    guint n_planes;
-#endif
-    gint i;
     GstOMXVideoDecBufferData *vdbuf_data;
-
-    switch (pool->video_info.finfo->format) {
-      case GST_VIDEO_FORMAT_I420:
-        offset[0] = 0;
-        stride[0] = pool->port->port_def.format.video.nStride;
-        offset[1] = stride[0] * pool->port->port_def.format.video.nSliceHeight;
-        stride[1] = pool->port->port_def.format.video.nStride / 2;
-        offset[2] =
-            offset[1] +
-            stride[1] * (pool->port->port_def.format.video.nSliceHeight / 2);
-        stride[2] = pool->port->port_def.format.video.nStride / 2;
-        plane_size[0] = pool->port->port_def.format.video.nStride *
-            pool->port->port_def.format.video.nFrameHeight;
-        plane_size[1] = plane_size[2] = plane_size[0] / 4;
-
-#ifndef HAVE_MMNGRBUF
-        n_planes = 3;
-#endif
-        break;
-      case GST_VIDEO_FORMAT_NV12:
-        offset[0] = 0;
-        stride[0] = pool->port->port_def.format.video.nStride;
-        offset[1] = stride[0] * pool->port->port_def.format.video.nSliceHeight;
-        stride[1] = pool->port->port_def.format.video.nStride;
-        plane_size[0] = pool->port->port_def.format.video.nStride *
-            pool->port->port_def.format.video.nFrameHeight;
-        plane_size[1] = plane_size[0] / 2;
-
-#ifndef HAVE_MMNGRBUF
-        n_planes = 2;
-#endif
-        break;
-      default:
-        g_assert_not_reached ();
-        break;
-    }
-
-    buf = gst_buffer_new ();
-
-#ifndef HAVE_MMNGRBUF
-    if (self->use_dmabuf == FALSE)
-      for (i = 0; i < n_planes; i++)
-        gst_buffer_append_memory (buf,
-            gst_omx_memory_allocator_alloc (pool->allocator, 0, omx_buf,
-                offset[i], plane_size[i]));
+#ifdef HAVE_MMNGRBUF
+    gint i;
 #endif
 
+    buf = gst_omx_buffer_pool_wrap_output_buffer (pool, omx_buf);
     g_ptr_array_add (pool->buffers, buf);
 
-    if (pool->add_videometa)
-      gst_buffer_add_video_meta_full (buf, GST_VIDEO_FRAME_FLAG_NONE,
-          GST_VIDEO_INFO_FORMAT (&pool->video_info),
-          GST_VIDEO_INFO_WIDTH (&pool->video_info),
-          GST_VIDEO_INFO_HEIGHT (&pool->video_info),
-          GST_VIDEO_INFO_N_PLANES (&pool->video_info), offset, stride);
-
     /* Initialize an already_acquired flag */
     vdbuf_data = g_slice_new (GstOMXVideoDecBufferData);
     vdbuf_data->already_acquired = FALSE;
+    vdbuf_data->settings_cookie = pool->settings_cookie;
 #ifdef HAVE_MMNGRBUF
     if (self->use_dmabuf)
       for (i = 0; i < GST_VIDEO_MAX_PLANES; i++)
@@ -561,15 +732,19 @@ gst_omx_buffer_pool_free_buffer (GstBufferPool * bpool, GstBuffer * buffer)
   omx_buf =
       gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer),
       gst_omx_buffer_data_quark);
+  /* Input buffers upstream still had when the port was freed
+   * are detached from it already */
+  if (omx_buf) {
 #ifdef HAVE_MMNGRBUF
-  if (self->use_dmabuf) {
-    vdbuf_data = (GstOMXVideoDecBufferData *) omx_buf->private_data;
-    for (i = 0; i < GST_VIDEO_MAX_PLANES; i++)
-      if (vdbuf_data->id_export[i] >= 0)
-        mmngr_export_end_in_user (vdbuf_data->id_export[i]);
-  }
+    if (self->use_dmabuf && pool->port->port_def.eDir == OMX_DirOutput) {
+      vdbuf_data = (GstOMXVideoDecBufferData *) omx_buf->private_data;
+      for (i = 0; i < GST_VIDEO_MAX_PLANES; i++)
+        if (vdbuf_data->id_export[i] >= 0)
+          mmngr_export_end_in_user (vdbuf_data->id_export[i]);
+    }
 #endif
-  g_slice_free (GstOMXVideoDecBufferData, omx_buf->private_data);
+    g_slice_free (GstOMXVideoDecBufferData, omx_buf->private_data);
+  }
 
   gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buffer),
       gst_omx_buffer_data_quark, NULL, NULL);
@@ -666,6 +841,163 @@ gst_omx_buffer_pool_export_dmabuf (GstOMXBufferPool * pool,
 }
 #endif
 
+/* Upstream that pushes from another thread than the one that stops
+ * the pool only flushes the pool, which does not wake up threads
+ * waiting for the port. They look at the pool this often */
+#define INPUT_POOL_POLL_INTERVAL (100 * GST_MSECOND)
+
+static void
+gst_omx_buffer_pool_unlend (GstOMXBufferPool * pool,
+    GstOMXVideoDecBufferData * vdbuf_data)
+{
+  GST_OBJECT_LOCK (pool);
+  g_assert (pool->n_lent > 0);
+  pool->n_lent--;
+  if (vdbuf_data)
+    vdbuf_data->already_acquired = FALSE;
+  g_cond_broadcast (&pool->lent_cond);
+  GST_OBJECT_UNLOCK (pool);
+}
+
+/* Acquires any buffer of the input port that is available to be
+ * filled by upstream. One buffer is never lent to upstream, so that
+ * the element can always get one for codec data and frames it has
+ * to copy */
+static GstFlowReturn
+gst_omx_buffer_pool_acquire_input_buffer (GstOMXBufferPool * pool,
+    GstBuffer ** buffer)
+{
+  GstBufferPool *bpool = GST_BUFFER_POOL_CAST (pool);
+  GstOMXAcquireBufferReturn acq_ret;
+  GstOMXVideoDecBufferData *vdbuf_data;
+  GstOMXBuffer *omx_buf = NULL;
+  GstBuffer *buf = NULL;
+  gsize offset, maxsize;
+  guint i;
+
+  GST_OBJECT_LOCK (pool);
+  while (pool->n_lent + 1 >= pool->port->port_def.nBufferCountActual) {
+    if (GST_BUFFER_POOL_IS_FLUSHING (bpool) || pool->deactivated) {
+      GST_OBJECT_UNLOCK (pool);
+      return GST_FLOW_FLUSHING;
+    }
+    g_cond_wait_until (&pool->lent_cond, GST_OBJECT_GET_LOCK (pool),
+        g_get_monotonic_time () + INPUT_POOL_POLL_INTERVAL / GST_USECOND);
+  }
+  pool->n_lent++;
+  GST_OBJECT_UNLOCK (pool);
+
+  do {
+    if (GST_BUFFER_POOL_IS_FLUSHING (bpool) || pool->deactivated) {
+      acq_ret = GST_OMX_ACQUIRE_BUFFER_FLUSHING;
+      break;
+    }
+    acq_ret = gst_omx_port_acquire_buffer_timeout (pool->port, &omx_buf,
+        INPUT_POOL_POLL_INTERVAL);
+
+    /* The element reconfigures the port from its streaming thread.
+     * Either the port gets buffers again or this pool is replaced,
+     * so don't fail upstream */
+    if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+      GST_OBJECT_LOCK (pool);
+      g_cond_wait_until (&pool->lent_cond, GST_OBJECT_GET_LOCK (pool),
+          g_get_monotonic_time () + INPUT_POOL_POLL_INTERVAL / GST_USECOND);
+      GST_OBJECT_UNLOCK (pool);
+    }
+  } while (acq_ret == GST_OMX_ACQUIRE_BUFFER_TIMEOUT
+      || acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE);
+
+  if (acq_ret != GST_OMX_ACQUIRE_BUFFER_OK || !omx_buf) {
+    gst_omx_buffer_pool_unlend (pool, NULL);
+    return acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING ? GST_FLOW_FLUSHING :
+        GST_FLOW_ERROR;
+  }
+
+  for (i = 0; i < pool->buffers->len; i++) {
+    GstBuffer *tmp = g_ptr_array_index (pool->buffers, i);
+
+    if (gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (tmp),
+            gst_omx_buffer_data_quark) == omx_buf) {
+      buf = tmp;
+      break;
+    }
+  }
+
+  omx_buf->omx_buf->nOffset = 0;
+  omx_buf->omx_buf->nFilledLen = 0;
+  omx_buf->omx_buf->nFlags = 0;
+
+  if (!buf) {
+    GST_ERROR_OBJECT (pool, "OpenMAX buffer %p is not in the pool", omx_buf);
+    gst_omx_port_return_buffers (pool->port, &omx_buf, 1);
+    gst_omx_buffer_pool_unlend (pool, NULL);
+    return GST_FLOW_ERROR;
+  }
+
+  /* Upstream might have changed the size last time */
+  gst_buffer_get_sizes (buf, &offset, &maxsize);
+  if (offset != 0 || gst_buffer_get_size (buf) != maxsize)
+    gst_buffer_resize (buf, -(gssize) offset, maxsize);
+
+  vdbuf_data = (GstOMXVideoDecBufferData *) omx_buf->private_data;
+  GST_OBJECT_LOCK (pool);
+  vdbuf_data->already_acquired = TRUE;
+  GST_OBJECT_UNLOCK (pool);
+
+  *buffer = buf;
+
+  return GST_FLOW_OK;
+}
+
+/* Cuts the input buffers upstream still holds off the OpenMAX buffers,
+ * which are freed next. Their memory keeps a copy of what upstream
+ * wrote so far, the buffers themselves stay as they are, and
+ * free_buffer() doesn't touch the OpenMAX buffers for them. Waiting
+ * for upstream to give them back could block for ever, upstream
+ * usually does that by pushing them into the thread freeing them.
+ *
+ * NOTE: The pool must be deactivated already */
+static void
+gst_omx_buffer_pool_detach_lent_buffers (GstOMXBufferPool * pool)
+{
+  GstOMXVideoDecBufferData *vdbuf_data;
+  GstOMXBuffer *omx_buf;
+  guint i, j, n;
+
+  GST_OBJECT_LOCK (pool);
+  for (i = 0; i < pool->buffers->len && pool->n_lent > 0; i++) {
+    GstBuffer *buf = g_ptr_array_index (pool->buffers, i);
+
+    omx_buf =
+        gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buf),
+        gst_omx_buffer_data_quark);
+    if (!omx_buf)
+      continue;
+
+    vdbuf_data = (GstOMXVideoDecBufferData *) omx_buf->private_data;
+    if (!vdbuf_data->already_acquired)
+      continue;
+
+    GST_DEBUG_OBJECT (pool, "Detaching buffer %p upstream still holds", buf);
+
+    n = gst_buffer_n_memory (buf);
+    for (j = 0; j < n; j++) {
+      GstMemory *mem = gst_buffer_peek_memory (buf, j);
+
+      if (GST_IS_OMX_MEMORY_ALLOCATOR (mem->allocator))
+        gst_omx_memory_detach ((GstOMXMemory *) mem);
+    }
+
+    gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buf),
+        gst_omx_buffer_data_quark, NULL, NULL);
+    g_slice_free (GstOMXVideoDecBufferData, vdbuf_data);
+    omx_buf->private_data = NULL;
+    pool->n_lent--;
+  }
+  g_cond_broadcast (&pool->lent_cond);
+  GST_OBJECT_UNLOCK (pool);
+}
+
 static GstFlowReturn
 gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
     GstBuffer ** buffer, GstBufferPoolAcquireParams * params)
@@ -675,6 +1007,10 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
   GstOMXVideoDec *self;
   self = GST_OMX_VIDEO_DEC (pool->element);
 
+  /* Upstream can still have the pool after the port was freed */
+  if (pool->deactivated)
+    return GST_FLOW_FLUSHING;
+
   if (pool->port->port_def.eDir == OMX_DirOutput) {
     GstBuffer *buf;
     GstOMXBuffer *omx_buf;
@@ -693,6 +1029,8 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
         gst_omx_buffer_data_quark);
 
     vdbuf_data = (GstOMXVideoDecBufferData *) omx_buf->private_data;
+    if (vdbuf_data->settings_cookie != pool->settings_cookie)
+      buf = gst_omx_buffer_pool_rewrap_output_buffer (pool, buf, omx_buf);
 #ifdef HAVE_MMNGRBUF
     if (self->use_dmabuf)
     {
@@ -770,7 +1108,7 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
           GST_META_FLAG_SET (new_meta, GST_META_FLAG_POOLED);
         }
 
-        g_ptr_array_remove_index (pool->buffers, pool->current_buffer_index);
+        g_ptr_array_remove (pool->buffers, buf);
 
         gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (buf),
             gst_omx_buffer_data_quark, NULL, NULL);
@@ -793,10 +1131,7 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
 
     ret = GST_FLOW_OK;
   } else {
-    /* Acquire any buffer that is available to be filled by upstream */
-    ret =
-        GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->acquire_buffer
-        (bpool, buffer, params);
+    ret = gst_omx_buffer_pool_acquire_input_buffer (pool, buffer);
   }
 
   return ret;
@@ -820,8 +1155,12 @@ gst_omx_buffer_pool_release_buffer (GstBufferPool * bpool, GstBuffer * buffer)
 
     vdbuf_data = (GstOMXVideoDecBufferData *) omx_buf->private_data;
 
-    if (pool->port->port_def.eDir == OMX_DirOutput && !omx_buf->used &&
-        vdbuf_data->already_acquired) {
+    if (pool->port->port_def.eDir == OMX_DirOutput
+        && !g_atomic_int_get (&omx_buf->used)
+        && vdbuf_data->already_acquired) {
+      if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+        gst_omx_trace_file_buffer_event (pool->port, omx_buf, "freed");
+
       /* Release back to the port, can be filled again */
       err = gst_omx_port_release_buffer (pool->port, omx_buf);
       if (err != OMX_ErrorNone) {
@@ -830,24 +1169,14 @@ gst_omx_buffer_pool_release_buffer (GstBufferPool * bpool, GstBuffer * buffer)
                 gst_omx_error_to_string (err), err));
       }
       vdbuf_data->already_acquired = FALSE;
-    } else if (pool->port->port_def.eDir == OMX_DirInput && !omx_buf->used) {
-      /* TODO: Implement.
-       *
-       * If not used (i.e. was not passed to the component) this should do
-       * the same as EmptyBufferDone.
-       * If it is used (i.e. was passed to the component) this should do
-       * nothing until EmptyBufferDone.
-       *
-       * EmptyBufferDone should release the buffer to the pool so it can
-       * be allocated again
-       *
-       * Needs something to call back here in EmptyBufferDone, like keeping
-       * a ref on the buffer in GstOMXBuffer until EmptyBufferDone... which
-       * would ensure that the buffer is always unused when this is called.
-       */
-      g_assert_not_reached ();
-      GST_BUFFER_POOL_CLASS (gst_omx_buffer_pool_parent_class)->release_buffer
-          (bpool, buffer);
+    } else if (pool->port->port_def.eDir == OMX_DirInput
+        && vdbuf_data->already_acquired) {
+      /* Upstream dropped it without passing it to the component. It
+       * only goes back to the port, from where it is acquired again.
+       * Buffers that were passed to the component don't need anything
+       * here, they go back to the port with EmptyBufferDone */
+      gst_omx_port_return_buffers (pool->port, &omx_buf, 1);
+      gst_omx_buffer_pool_unlend (pool, vdbuf_data);
     }
   }
 }
@@ -877,6 +1206,8 @@ gst_omx_buffer_pool_finalize (GObject * object)
     gst_caps_unref (pool->caps);
   pool->caps = NULL;
 
+  g_cond_clear (&pool->lent_cond);
+
   G_OBJECT_CLASS (gst_omx_buffer_pool_parent_class)->finalize (object);
 }
 
@@ -903,6 +1234,7 @@ static void
 gst_omx_buffer_pool_init (GstOMXBufferPool * pool)
 {
   pool->buffers = g_ptr_array_new ();
+  g_cond_init (&pool->lent_cond);
 #ifdef HAVE_MMNGRBUF
   pool->allocator = gst_dmabuf_allocator_new ();
 #else
@@ -922,19 +1254,16 @@ gst_omx_buffer_pool_new (GstElement * element, GstOMXComponent * component,
   pool->port = port;
   pool->vsink_buf_req_supported = FALSE;
 
-  return GST_BUFFER_POOL (pool);
-}
-
-typedef struct _BufferIdentification BufferIdentification;
-struct _BufferIdentification
-{
-  guint64 timestamp;
-};
+#ifdef HAVE_MMNGRBUF
+  /* Buffers for upstream always wrap the OpenMAX memory */
+  if (port->port_def.eDir == OMX_DirInput) {
+    gst_object_unref (pool->allocator);
+    pool->allocator = g_object_new (gst_omx_memory_allocator_get_type (),
+        NULL);
+  }
+#endif
 
-static void
-buffer_identification_free (BufferIdentification * id)
-{
-  g_slice_free (BufferIdentification, id);
+  return GST_BUFFER_POOL (pool);
 }
 
 /* prototypes */
@@ -957,15 +1286,22 @@ static GstFlowReturn gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
 static GstFlowReturn gst_omx_video_dec_finish (GstVideoDecoder * decoder);
 static gboolean gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec,
     GstQuery * query);
+static gboolean gst_omx_video_dec_propose_allocation (GstVideoDecoder * bdec,
+    GstQuery * query);
 static gboolean gst_omx_video_dec_negotiate2 (GstVideoDecoder * decoder);
 
 static GstFlowReturn gst_omx_video_dec_drain (GstOMXVideoDec * self,
     gboolean is_eos);
+static gboolean gst_omx_video_dec_wait_executing (GstOMXVideoDec * self);
 
 static OMX_ERRORTYPE gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec *
     self);
 static OMX_ERRORTYPE gst_omx_video_dec_deallocate_output_buffers (GstOMXVideoDec
     * self);
+static OMX_ERRORTYPE gst_omx_video_dec_allocate_input_buffers (GstOMXVideoDec *
+    self);
+static OMX_ERRORTYPE gst_omx_video_dec_deallocate_input_buffers (GstOMXVideoDec
+    * self);
 static void gst_omx_video_dec_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
 static void gst_omx_video_dec_get_property (GObject * object, guint prop_id,
@@ -977,7 +1313,11 @@ enum
   PROP_0,
   PROP_NO_COPY,
   PROP_USE_DMABUF,
-  PROP_NO_REORDER
+  PROP_IMPORT_DMABUF,
+  PROP_NO_REORDER,
+  PROP_MAX_RECOVERIES,
+  PROP_COPY_THREADS,
+  PROP_STATS
 };
 
 /* class initialization */
@@ -1036,6 +1376,8 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
   video_decoder_class->finish = GST_DEBUG_FUNCPTR (gst_omx_video_dec_finish);
   video_decoder_class->decide_allocation =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_decide_allocation);
+  video_decoder_class->propose_allocation =
+      GST_DEBUG_FUNCPTR (gst_omx_video_dec_propose_allocation);
   video_decoder_class->negotiate =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_negotiate2);
 
@@ -1052,11 +1394,37 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
         "Whether or not to transfer decoded data using dmabuf",
         TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
         GST_PARAM_MUTABLE_READY));
+#ifdef HAVE_MMNGRBUF
+  g_object_class_install_property (gobject_class, PROP_IMPORT_DMABUF,
+      g_param_spec_boolean ("import-dmabuf", "Import dmabuf",
+          "Whether or not to pass dmabuf input buffers to the component "
+          "without copy, the component has to accept input buffers that "
+          "point to different memory every time",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+#endif
   g_object_class_install_property (gobject_class, PROP_NO_REORDER,
         g_param_spec_boolean ("no-reorder", "Use video frame without reordering",
           "Whether or not to use video frame reordering",
           FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
            GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MAX_RECOVERIES,
+      g_param_spec_uint ("max-recoveries", "Max recoveries",
+          "How often in a row the component is reset after a hardware or "
+          "stream error before failing, decoding resumes with the next "
+          "sync frame (0 = fail right away)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_COPY_THREADS,
+      g_param_spec_uint ("copy-threads", "Copy threads",
+          "Number of threads that copy large output frames into downstream "
+          "buffers when they can't be pushed without copy (0 = one per CPU)",
+          0, GST_OMX_VIDEO_DEC_MAX_COPY_THREADS, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Buffer latency and throughput statistics of the OpenMAX ports",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
   klass->copy_frame = gst_omx_video_dec_copy_frame;
 }
@@ -1073,6 +1441,8 @@ gst_omx_video_dec_init (GstOMXVideoDec * self)
   self->use_dmabuf = TRUE;
 #endif
   self->no_reorder = FALSE;
+  self->copy_threads = 1;
+  gst_omx_frame_index_init (&self->frames);
 }
 
 static gboolean
@@ -1087,9 +1457,12 @@ gst_omx_video_dec_open (GstVideoDecoder * decoder)
   self->dec =
       gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
       klass->cdata.component_name, klass->cdata.component_role,
-      klass->cdata.hacks);
+      klass->cdata.hacks, klass->cdata.pool_size,
+      klass->cdata.pool_idle_timeout, klass->cdata.admission_priority,
+      klass->cdata.admission_timeout);
   self->started = FALSE;
   self->set_format_done = FALSE;
+  self->executing_pending = FALSE;
 
   if (!self->dec)
     return FALSE;
@@ -1148,7 +1521,7 @@ gst_omx_video_dec_shutdown (GstOMXVideoDec * self)
       gst_omx_component_get_state (self->dec, 5 * GST_SECOND);
     }
     gst_omx_component_set_state (self->dec, OMX_StateLoaded);
-    gst_omx_port_deallocate_buffers (self->dec_in_port);
+    gst_omx_video_dec_deallocate_input_buffers (self);
     gst_omx_video_dec_deallocate_output_buffers (self);
     if (state > OMX_StateLoaded)
       gst_omx_component_get_state (self->dec, 5 * GST_SECOND);
@@ -1167,14 +1540,18 @@ gst_omx_video_dec_close (GstVideoDecoder * decoder)
   if (!gst_omx_video_dec_shutdown (self))
     return FALSE;
 
+  /* The stats property reads the ports */
+  GST_OBJECT_LOCK (self);
   self->dec_in_port = NULL;
   self->dec_out_port = NULL;
+  GST_OBJECT_UNLOCK (self);
   if (self->dec)
     gst_omx_component_free (self->dec);
   self->dec = NULL;
 
   self->started = FALSE;
   self->set_format_done = FALSE;
+  self->executing_pending = FALSE;
 
   GST_DEBUG_OBJECT (self, "Closed decoder");
 
@@ -1188,6 +1565,7 @@ gst_omx_video_dec_finalize (GObject * object)
 
   g_mutex_clear (&self->drain_lock);
   g_cond_clear (&self->drain_cond);
+  gst_omx_frame_index_clear (&self->frames);
 
   G_OBJECT_CLASS (gst_omx_video_dec_parent_class)->finalize (object);
 }
@@ -1213,10 +1591,8 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
-      if (self->dec_in_port)
-        gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, TRUE);
-      if (self->dec_out_port)
-        gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, TRUE);
+      if (self->dec)
+        gst_omx_component_set_flushing (self->dec, 5 * GST_SECOND, TRUE);
 
       g_mutex_lock (&self->drain_lock);
       self->draining = FALSE;
@@ -1256,90 +1632,26 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
-#define MAX_FRAME_DIST_TICKS  (5 * OMX_TICKS_PER_SECOND)
-#define MAX_FRAME_DIST_FRAMES (100)
-
 static GstVideoCodecFrame *
 _find_nearest_frame (GstOMXVideoDec * self, GstOMXBuffer * buf)
 {
-  GList *l, *best_l = NULL;
-  GList *finish_frames = NULL;
-  GstVideoCodecFrame *best = NULL;
-  guint64 best_timestamp = 0;
-  guint64 best_diff = G_MAXUINT64;
-  BufferIdentification *best_id = NULL;
-  GList *frames;
-
-  frames = gst_video_decoder_get_frames (GST_VIDEO_DECODER (self));
-
-  for (l = frames; l; l = l->next) {
-    GstVideoCodecFrame *tmp = l->data;
-    BufferIdentification *id = gst_video_codec_frame_get_user_data (tmp);
-    guint64 timestamp, diff;
-
-    /* This happens for frames that were just added but
-     * which were not passed to the component yet. Ignore
-     * them here!
-     */
-    if (!id)
-      continue;
-
-    timestamp = id->timestamp;
-
-    if (timestamp > buf->omx_buf->nTimeStamp)
-      diff = timestamp - buf->omx_buf->nTimeStamp;
-    else
-      diff = buf->omx_buf->nTimeStamp - timestamp;
-
-    if (best == NULL || diff < best_diff) {
-      best = tmp;
-      best_timestamp = timestamp;
-      best_diff = diff;
-      best_l = l;
-      best_id = id;
-
-      /* For frames without timestamp we simply take the first frame */
-      if ((buf->omx_buf->nTimeStamp == 0 && timestamp == 0) || diff == 0)
-        break;
-    }
-  }
-
-  if (best_id) {
-    for (l = frames; l && l != best_l; l = l->next) {
-      GstVideoCodecFrame *tmp = l->data;
-      BufferIdentification *id = gst_video_codec_frame_get_user_data (tmp);
-      guint64 diff_ticks, diff_frames;
-
-      /* This happens for frames that were just added but
-       * which were not passed to the component yet. Ignore
-       * them here!
-       */
-      if (!id)
-        continue;
-
-      if (id->timestamp > best_timestamp)
-        break;
-
-      if (id->timestamp == 0 || best_timestamp == 0)
-        diff_ticks = 0;
-      else
-        diff_ticks = best_timestamp - id->timestamp;
-      diff_frames = best->system_frame_number - tmp->system_frame_number;
-
-      if (diff_ticks > MAX_FRAME_DIST_TICKS
-          || diff_frames > MAX_FRAME_DIST_FRAMES) {
-        finish_frames =
-            g_list_prepend (finish_frames, gst_video_codec_frame_ref (tmp));
-      }
-    }
+  GstVideoCodecFrame *best;
+  GList *too_old = NULL, *l;
+  gint64 prof = GST_OMX_PROFILE_START ();
+
+  best = gst_omx_frame_index_take_nearest (&self->frames,
+      buf->omx_buf->nTimeStamp, &too_old);
+
+  if (too_old) {
+    GST_WARNING_OBJECT (self, "Dropping %u frames the component will not "
+        "output anymore", g_list_length (too_old));
+    for (l = too_old; l; l = l->next)
+      gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), l->data);
+    g_list_free (too_old);
   }
 
-
-  if (best)
-    gst_video_codec_frame_ref (best);
-
-  g_list_foreach (frames, (GFunc) gst_video_codec_frame_unref, NULL);
-  g_list_free (frames);
+  gst_omx_port_profile_add (self->dec_out_port,
+      GST_OMX_PROFILE_FIND_NEAREST_FRAME, prof);
 
   return best;
 }
@@ -1354,6 +1666,8 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
   OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->dec_out_port->port_def;
   gboolean ret = FALSE;
   GstVideoFrame frame;
+  GstOMXCopyPlane planes[3];
+  gint64 prof = GST_OMX_PROFILE_START ();
 
   if (vinfo->width != port_def->format.video.nFrameWidth ||
       vinfo->height != port_def->format.video.nFrameHeight) {
@@ -1367,7 +1681,7 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
 
   switch (vinfo->finfo->format) {
     case GST_VIDEO_FORMAT_I420:{
-      gint i, j, height, width;
+      gint i, height, width;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
 
@@ -1403,18 +1717,21 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
         height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, i);
         width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, i);
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          src += src_stride;
-          dest += dest_stride;
-        }
+        planes[i].dest = dest;
+        planes[i].dest_stride = dest_stride;
+        planes[i].src = src;
+        planes[i].src_stride = src_stride;
+        planes[i].width = width;
+        planes[i].height = height;
       }
+      gst_omx_copy_pool_copy_planes (self->copy_pool, GST_OMX_COPY_IMPL_AUTO,
+          planes, 3);
       gst_video_frame_unmap (&frame);
       ret = TRUE;
       break;
     }
     case GST_VIDEO_FORMAT_NV12:{
-      gint i, j, height, width;
+      gint i, height, width;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
 
@@ -1446,12 +1763,15 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
         height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, i);
         width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, i) * (i == 0 ? 1 : 2);
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          src += src_stride;
-          dest += dest_stride;
-        }
+        planes[i].dest = dest;
+        planes[i].dest_stride = dest_stride;
+        planes[i].src = src;
+        planes[i].src_stride = src_stride;
+        planes[i].width = width;
+        planes[i].height = height;
       }
+      gst_omx_copy_pool_copy_planes (self->copy_pool, GST_OMX_COPY_IMPL_AUTO,
+          planes, 2);
       gst_video_frame_unmap (&frame);
       ret = TRUE;
       break;
@@ -1476,6 +1796,9 @@ done:
 
   gst_video_codec_state_unref (state);
 
+  gst_omx_port_profile_add (self->dec_out_port, GST_OMX_PROFILE_FILL_BUFFER,
+      prof);
+
   return ret;
 }
 
@@ -1682,16 +2005,280 @@ gst_omx_video_dec_deallocate_output_buffers (GstOMXVideoDec * self)
   return err;
 }
 
-static void GstOMXBufCallbackfunc (struct GstOMXBufferCallback *release)
+#ifdef HAVE_MMNGRBUF
+typedef struct
 {
-  gint i;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  gint import_id;
+} GstOMXVideoDecImport;
 
-  if (!release)
-    return;
+static void
+gst_omx_video_dec_import_free (GstOMXVideoDecImport * import)
+{
+  gst_buffer_unmap (import->buffer, &import->map);
+  mmngr_import_end_in_user (import->import_id);
+  gst_buffer_unref (import->buffer);
+  g_slice_free (GstOMXVideoDecImport, import);
+}
+#endif
 
-  if (release->buf != NULL) {
-    gst_omx_port_release_buffer (release->out_port, release->buf);
-  }
+/* private_data of the input buffers while importing dmabufs */
+typedef struct
+{
+  /* Registered with OMX_UseBuffer() */
+  gpointer memory;
+#ifdef HAVE_MMNGRBUF
+  /* Frame the buffer points to, until the component returned it */
+  GstOMXVideoDecImport *import;
+#endif
+} GstOMXVideoDecInputData;
+
+/* Points an input buffer that carried an imported frame back to the
+ * memory it was registered with and releases the import */
+static void
+gst_omx_video_dec_restore_input_buffer (GstOMXBuffer * buf)
+{
+  GstOMXVideoDecInputData *data = buf->private_data;
+
+  if (!data)
+    return;
+
+  buf->omx_buf->pBuffer = data->memory;
+#ifdef HAVE_MMNGRBUF
+  if (data->import)
+    gst_omx_video_dec_import_free (data->import);
+  data->import = NULL;
+#endif
+}
+
+#ifdef HAVE_MMNGRBUF
+/* Releases the frame as soon as the component returned the buffer, so
+ * that upstream gets it back even if we don't need another input
+ * buffer for a while. Upstream pools are often small and would stall
+ * otherwise
+ *
+ * NOTE: Called from the component's callback */
+static void
+gst_omx_video_dec_input_buffer_done (GstOMXPort * port, GstOMXBuffer * buf,
+    gpointer user_data)
+{
+  gst_omx_video_dec_restore_input_buffer (buf);
+}
+#endif
+
+/* Same for buffers that never reached the component, e.g. because
+ * they were given back to the port after a failure */
+static void
+gst_omx_video_dec_restore_input_memory (GstOMXVideoDec * self,
+    GstOMXBuffer ** bufs, guint n_bufs)
+{
+  guint i;
+
+  if (!self->in_port_memory)
+    return;
+
+  for (i = 0; i < n_bufs; i++) {
+    if (bufs[i])
+      gst_omx_video_dec_restore_input_buffer (bufs[i]);
+  }
+}
+
+/* Allocates the buffers of the input port. For importing dmabufs the
+ * memory is allocated here and registered with OMX_UseBuffer(), so that
+ * the buffers can point to imported memory instead for a frame. If the
+ * component does not accept that, it allocates the buffers itself and
+ * all frames are copied */
+static OMX_ERRORTYPE
+gst_omx_video_dec_allocate_input_buffers (GstOMXVideoDec * self)
+{
+#ifdef HAVE_MMNGRBUF
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  OMX_ERRORTYPE err;
+  gsize align;
+  guint i;
+
+  g_assert (self->in_port_memory == NULL);
+
+  if (self->import_dmabuf) {
+    gst_omx_port_get_port_definition (self->dec_in_port, &port_def);
+    align = MAX (port_def.nBufferAlignment, sizeof (gpointer));
+    if (align & (align - 1))
+      goto no_import;
+
+    for (i = 0; i < port_def.nBufferCountActual; i++) {
+      gpointer mem;
+
+      if (posix_memalign (&mem, align, port_def.nBufferSize) != 0)
+        goto no_memory;
+      self->in_port_memory = g_list_append (self->in_port_memory, mem);
+    }
+
+    err = gst_omx_port_use_buffers (self->dec_in_port, self->in_port_memory);
+    if (err != OMX_ErrorNone) {
+      GST_WARNING_OBJECT (self, "Component does not accept our input "
+          "memory: %s (0x%08x)", gst_omx_error_to_string (err), err);
+      goto no_memory;
+    }
+
+    /* Remember the memory while the buffers point elsewhere */
+    for (i = 0; i < self->dec_in_port->buffers->len; i++) {
+      GstOMXBuffer *buf = g_ptr_array_index (self->dec_in_port->buffers, i);
+      GstOMXVideoDecInputData *data;
+
+      data = g_slice_new0 (GstOMXVideoDecInputData);
+      data->memory = buf->omx_buf->pBuffer;
+      buf->private_data = data;
+    }
+    gst_omx_port_set_buffer_done_func (self->dec_in_port,
+        gst_omx_video_dec_input_buffer_done, self);
+
+    return OMX_ErrorNone;
+
+  no_memory:
+    g_list_free_full (self->in_port_memory, free);
+    self->in_port_memory = NULL;
+  no_import:
+    GST_WARNING_OBJECT (self, "Can't import dmabufs, copying all frames");
+  }
+#endif
+
+  return gst_omx_port_allocate_buffers (self->dec_in_port);
+}
+
+#ifdef HAVE_MMNGRBUF
+/* Points buf to the input buffer of frame if that is a single dmabuf
+ * the component can read directly. Returns FALSE if the frame has to be
+ * copied instead.
+ *
+ * The dmabuf stays imported and mapped until the component returned
+ * buf, see gst_omx_video_dec_input_buffer_done().
+ */
+static gboolean
+gst_omx_video_dec_import_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame, GstOMXBuffer * buf)
+{
+  GstBuffer *inbuf = frame->input_buffer;
+  GstOMXVideoDecInputData *data = buf->private_data;
+  GstOMXVideoDecImport *import;
+  GstMemory *mem;
+  gsize offset, size;
+  size_t import_size;
+  unsigned long phys_addr;
+  guint32 align;
+  gint import_id;
+
+  if (!self->in_port_memory || !data)
+    return FALSE;
+
+  g_assert (data->import == NULL);
+
+  if (gst_buffer_n_memory (inbuf) != 1)
+    return FALSE;
+  mem = gst_buffer_peek_memory (inbuf, 0);
+  if (!gst_is_dmabuf_memory (mem))
+    return FALSE;
+
+  size = gst_buffer_get_size (inbuf);
+  gst_memory_get_sizes (mem, &offset, NULL);
+  if (size > buf->omx_buf->nAllocLen) {
+    GST_LOG_OBJECT (self, "Frame too large to import, copying it");
+    return FALSE;
+  }
+
+  if (mmngr_import_start_in_user (&import_id, &import_size, &phys_addr,
+          gst_dmabuf_memory_get_fd (mem)) != R_MM_OK) {
+    GST_LOG_OBJECT (self, "Failed to import dmabuf, copying the frame");
+    return FALSE;
+  }
+
+  align = self->dec_in_port->port_def.nBufferAlignment;
+  if (offset + size > import_size
+      || (align > 1 && (phys_addr + offset) % align != 0)) {
+    GST_LOG_OBJECT (self, "Frame at 0x%08lx is not aligned to %u bytes, "
+        "copying it", phys_addr + (unsigned long) offset, align);
+    mmngr_import_end_in_user (import_id);
+    return FALSE;
+  }
+
+  import = g_slice_new (GstOMXVideoDecImport);
+  if (!gst_buffer_map (inbuf, &import->map, GST_MAP_READ)) {
+    mmngr_import_end_in_user (import_id);
+    g_slice_free (GstOMXVideoDecImport, import);
+    return FALSE;
+  }
+  import->buffer = gst_buffer_ref (inbuf);
+  import->import_id = import_id;
+  data->import = import;
+
+  buf->omx_buf->pBuffer = import->map.data;
+  buf->omx_buf->nOffset = 0;
+  buf->omx_buf->nFilledLen = size;
+
+  GST_LOG_OBJECT (self, "Imported frame at 0x%08lx",
+      phys_addr + (unsigned long) offset);
+
+  return TRUE;
+}
+#endif
+
+/* NOTE: Buffers of the input pool that upstream still holds can't be
+ * used anymore afterwards, like the ones of the output pool */
+static OMX_ERRORTYPE
+gst_omx_video_dec_deallocate_input_buffers (GstOMXVideoDec * self)
+{
+  OMX_ERRORTYPE err;
+  GPtrArray *buffers = self->dec_in_port->buffers;
+
+  if (self->in_port_pool) {
+    /* Wakes up upstream if it waits for a buffer */
+    GST_OMX_BUFFER_POOL (self->in_port_pool)->deactivated = TRUE;
+    gst_omx_buffer_pool_detach_lent_buffers (GST_OMX_BUFFER_POOL
+        (self->in_port_pool));
+    gst_buffer_pool_set_active (self->in_port_pool, FALSE);
+    gst_object_unref (self->in_port_pool);
+    self->in_port_pool = NULL;
+
+    /* Upstream has to ask for the pool of the new buffers */
+    gst_pad_push_event (GST_VIDEO_DECODER_SINK_PAD (self),
+        gst_event_new_reconfigure ());
+  }
+
+  if (buffers && self->in_port_memory) {
+    guint i;
+
+    gst_omx_video_dec_restore_input_memory (self,
+        (GstOMXBuffer **) buffers->pdata, buffers->len);
+    for (i = 0; i < buffers->len; i++) {
+      GstOMXBuffer *buf = g_ptr_array_index (buffers, i);
+
+      g_slice_free (GstOMXVideoDecInputData, buf->private_data);
+      buf->private_data = NULL;
+    }
+  }
+
+  err = gst_omx_port_deallocate_buffers (self->dec_in_port);
+  gst_omx_port_set_buffer_done_func (self->dec_in_port, NULL, NULL);
+
+  g_list_free_full (self->in_port_memory, free);
+  self->in_port_memory = NULL;
+
+  return err;
+}
+
+static void GstOMXBufCallbackfunc (struct GstOMXBufferCallback *release)
+{
+  gint i;
+
+  if (!release)
+    return;
+
+  if (release->buf != NULL) {
+    if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+      gst_omx_trace_file_buffer_event (release->out_port, release->buf,
+          "freed");
+    gst_omx_port_release_buffer (release->out_port, release->buf);
+  }
 
   g_free (release);
 }
@@ -1799,46 +2386,27 @@ gst_omx_video_dec_create_buffer_from_omx_output (GstOMXVideoDec * self,
 
 static void
 gst_omx_video_dec_clean_older_frames (GstOMXVideoDec * self,
-    GstOMXBuffer * buf, GList * frames)
+    GstOMXBuffer * buf)
 {
-  GList *l;
+  GList *frames, *l;
   GstClockTime timestamp;
 
   timestamp = gst_util_uint64_scale (buf->omx_buf->nTimeStamp, GST_SECOND,
       OMX_TICKS_PER_SECOND);
 
-  if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
-    /* We could release all frames stored with pts < timestamp since the
-     * decoder will likely output frames in display order */
-    for (l = frames; l; l = l->next) {
-      GstVideoCodecFrame *tmp = l->data;
-
-      if (tmp->pts < timestamp) {
-        gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
-        GST_LOG_OBJECT (self,
-            "discarding ghost frame %p (#%d) PTS:%" GST_TIME_FORMAT " DTS:%"
-            GST_TIME_FORMAT, tmp, tmp->system_frame_number,
-            GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
-      } else {
-        gst_video_codec_frame_unref (tmp);
-      }
-    }
-  } else {
-    /* We will release all frames with invalid timestamp because we don't even
-     * know if they will be output some day. */
-    for (l = frames; l; l = l->next) {
-      GstVideoCodecFrame *tmp = l->data;
-
-      if (!GST_CLOCK_TIME_IS_VALID (tmp->pts)) {
-        gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
-        GST_LOG_OBJECT (self,
-            "discarding frame %p (#%d) with invalid PTS:%" GST_TIME_FORMAT
-            " DTS:%" GST_TIME_FORMAT, tmp, tmp->system_frame_number,
-            GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
-      } else {
-        gst_video_codec_frame_unref (tmp);
-      }
-    }
+  /* We could release all frames stored with pts < timestamp since the
+   * decoder will likely output frames in display order. If the timestamp
+   * is invalid we release all frames with invalid timestamp because we
+   * don't even know if they will be output some day. */
+  frames = gst_omx_frame_index_take_older (&self->frames, timestamp);
+  for (l = frames; l; l = l->next) {
+    GstVideoCodecFrame *tmp = l->data;
+
+    GST_LOG_OBJECT (self,
+        "discarding ghost frame %p (#%d) PTS:%" GST_TIME_FORMAT " DTS:%"
+        GST_TIME_FORMAT, tmp, tmp->system_frame_number,
+        GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
   }
 
   g_list_free (frames);
@@ -1855,6 +2423,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
   GstClockTimeDiff deadline;
   OMX_ERRORTYPE err;
   GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  gint64 prof;
 
   acq_return = gst_omx_port_acquire_buffer (port, &buf);
   if (acq_return == GST_OMX_ACQUIRE_BUFFER_ERROR) {
@@ -1870,11 +2439,21 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     GstVideoCodecState *state;
     OMX_PARAM_PORTDEFINITIONTYPE port_def;
     GstVideoFormat format;
+    gboolean in_place = FALSE;
 
     GST_DEBUG_OBJECT (self, "Port settings have changed, updating caps");
 
-    /* Reallocate all buffers */
+    /* Keep the buffers if they fit the new settings. Our pool takes
+     * the new caps in decide_allocation() and lays its buffers out
+     * for them when they are acquired next */
     if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE
+        && gst_omx_port_can_reconfigure_in_place (port)) {
+      GST_DEBUG_OBJECT (self, "Reusing the output buffers");
+      in_place = TRUE;
+    }
+
+    /* Reallocate all buffers */
+    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE && !in_place
         && gst_omx_port_is_enabled (port)) {
       err = gst_omx_port_set_enabled (port, FALSE);
       if (err != OMX_ErrorNone)
@@ -1952,13 +2531,15 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     GST_VIDEO_DECODER_STREAM_UNLOCK (self);
 
     if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
-      err = gst_omx_video_dec_allocate_output_buffers (self);
-      if (err != OMX_ErrorNone)
-        goto reconfigure_error;
-
-      err = gst_omx_port_populate (port);
-      if (err != OMX_ErrorNone)
-        goto reconfigure_error;
+      if (!in_place) {
+        err = gst_omx_video_dec_allocate_output_buffers (self);
+        if (err != OMX_ErrorNone)
+          goto reconfigure_error;
+
+        err = gst_omx_port_populate (port);
+        if (err != OMX_ErrorNone)
+          goto reconfigure_error;
+      }
 
       err = gst_omx_port_mark_reconfigured (port);
       if (err != OMX_ErrorNone)
@@ -1999,8 +2580,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     /* Only clean older frames in reorder mode. Do not clean in
      * no_reorder mode, as in that mode the output frames are not in
      * display order */
-    gst_omx_video_dec_clean_older_frames (self, buf,
-        gst_video_decoder_get_frames (GST_VIDEO_DECODER (self)));
+    gst_omx_video_dec_clean_older_frames (self, buf);
 
   if (frame
       && (deadline = gst_video_decoder_get_max_decode_time
@@ -2056,6 +2636,8 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         gst_omx_port_release_buffer (port, buf);
         goto invalid_buffer;
       }
+      if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+        gst_omx_trace_file_buffer_event (port, buf, "pushed");
       buf = NULL;
     } else {
       outbuf =
@@ -2065,9 +2647,15 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         gst_omx_port_release_buffer (port, buf);
         goto invalid_buffer;
       }
+      if (GST_OMX_TRACE_FILE_IS_ENABLED ()) {
+        gst_omx_trace_file_buffer_event (port, buf, "copied");
+        gst_omx_trace_file_buffer_event (port, buf, "pushed");
+      }
     }
 
+    prof = GST_OMX_PROFILE_START ();
     flow_ret = gst_pad_push (GST_VIDEO_DECODER_SRC_PAD (self), outbuf);
+    gst_omx_port_profile_add (port, GST_OMX_PROFILE_FINISH_AND_PUSH, prof);
   } else if (buf->omx_buf->nFilledLen > 0) {
     if (self->out_port_pool) {
       gint i, n;
@@ -2101,8 +2689,12 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         gst_omx_port_release_buffer (port, buf);
         goto invalid_buffer;
       }
+      if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+        gst_omx_trace_file_buffer_event (port, buf, "pushed");
+      prof = GST_OMX_PROFILE_START ();
       flow_ret =
           gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+      gst_omx_port_profile_add (port, GST_OMX_PROFILE_FINISH_AND_PUSH, prof);
       frame = NULL;
       buf = NULL;
     } else {
@@ -2123,8 +2715,12 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
           goto flow_error;
         }
         gst_buffer_ref (frame->output_buffer);
+        if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+          gst_omx_trace_file_buffer_event (port, buf, "pushed");
+        prof = GST_OMX_PROFILE_START ();
         flow_ret =
             gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+        gst_omx_port_profile_add (port, GST_OMX_PROFILE_FINISH_AND_PUSH, prof);
         gst_buffer_unref (frame->output_buffer);
         frame = NULL;
         buf = NULL;
@@ -2145,9 +2741,15 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
             gst_omx_port_release_buffer (port, buf);
             goto invalid_buffer;
           }
+          if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+            gst_omx_trace_file_buffer_event (port, buf, "copied");
         }
+        if (GST_OMX_TRACE_FILE_IS_ENABLED ())
+          gst_omx_trace_file_buffer_event (port, buf, "pushed");
+        prof = GST_OMX_PROFILE_START ();
         flow_ret =
             gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+        gst_omx_port_profile_add (port, GST_OMX_PROFILE_FINISH_AND_PUSH, prof);
         frame = NULL;
       }
     }
@@ -2157,6 +2759,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
   }
 
   GST_DEBUG_OBJECT (self, "Read frame from component");
+  g_atomic_int_set (&self->n_recoveries, 0);
 
   GST_DEBUG_OBJECT (self, "Finished frame: %s", gst_flow_get_name (flow_ret));
 
@@ -2177,6 +2780,26 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
 component_error:
   {
+    if (self->max_recoveries > 0
+        && gst_omx_error_is_recoverable (gst_omx_component_get_last_error
+            (self->dec))) {
+      /* _handle_frame() replaces the component with the next frame */
+      GST_WARNING_OBJECT (self, "Component in error state %s (0x%08x), "
+          "waiting for recovery",
+          gst_omx_component_get_last_error_string (self->dec),
+          gst_omx_component_get_last_error (self->dec));
+      gst_pad_pause_task (GST_VIDEO_DECODER_SRC_PAD (self));
+
+      /* The EOS buffer won't come out anymore */
+      g_mutex_lock (&self->drain_lock);
+      if (self->draining) {
+        self->draining = FALSE;
+        g_cond_broadcast (&self->drain_cond);
+      }
+      g_mutex_unlock (&self->drain_lock);
+      return;
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->dec),
@@ -2302,6 +2925,10 @@ gst_omx_video_dec_start (GstVideoDecoder * decoder)
   self->eos = FALSE;
   self->downstream_flow_ret = GST_FLOW_OK;
 
+  /* copy-threads can only change in NULL and READY */
+  self->copy_pool = gst_omx_copy_pool_new (self->copy_threads ?
+      self->copy_threads : g_get_num_processors ());
+
   return TRUE;
 }
 
@@ -2309,13 +2936,17 @@ static gboolean
 gst_omx_video_dec_stop (GstVideoDecoder * decoder)
 {
   GstOMXVideoDec *self;
+  gboolean ret;
 
   self = GST_OMX_VIDEO_DEC (decoder);
 
   GST_DEBUG_OBJECT (self, "Stopping decoder");
 
-  gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, TRUE);
+  /* Don't change the state while going to Executing. Everything
+   * is still shut down if the component did not get there */
+  ret = gst_omx_video_dec_wait_executing (self);
+
+  gst_omx_component_set_flushing (self->dec, 5 * GST_SECOND, TRUE);
 
   gst_pad_stop_task (GST_VIDEO_DECODER_SRC_PAD (decoder));
 
@@ -2333,15 +2964,21 @@ gst_omx_video_dec_stop (GstVideoDecoder * decoder)
 
   gst_omx_component_get_state (self->dec, 5 * GST_SECOND);
 
+  gst_omx_frame_index_clear (&self->frames);
   gst_buffer_replace (&self->codec_data, NULL);
 
+  /* The output loop that copies frames has stopped */
+  if (self->copy_pool)
+    gst_omx_copy_pool_free (self->copy_pool);
+  self->copy_pool = NULL;
+
   if (self->input_state)
     gst_video_codec_state_unref (self->input_state);
   self->input_state = NULL;
 
   GST_DEBUG_OBJECT (self, "Stopped decoder");
 
-  return TRUE;
+  return ret;
 }
 
 typedef struct
@@ -2356,20 +2993,19 @@ video_negotiation_map_free (VideoNegotiationMap * m)
   g_slice_free (VideoNegotiationMap, m);
 }
 
-static GList *
-gst_omx_video_dec_get_supported_colorformats (GstOMXVideoDec * self)
+/* Probes which of the color formats in format_list the output port
+ * supports by trying to set them */
+static GArray *
+gst_omx_video_dec_probe_colorformats (GstOMXVideoDec * self,
+    const VideoNegotiationMap * format_list, guint n_formats)
 {
   GstOMXPort *port = self->dec_out_port;
   OMX_VIDEO_PARAM_PORTFORMATTYPE param;
   OMX_ERRORTYPE err;
-  GList *negotiation_map = NULL;
+  GArray *formats;
+  guint32 type;
   gint i;
   OMX_COLOR_FORMATTYPE format_org;
-  VideoNegotiationMap *m;
-  const VideoNegotiationMap format_list[] = {
-    {GST_VIDEO_FORMAT_NV12, OMX_COLOR_FormatYUV420SemiPlanar},
-    {GST_VIDEO_FORMAT_I420, OMX_COLOR_FormatYUV420Planar},
-  };
 
   GST_OMX_INIT_STRUCT (&param);
   param.nPortIndex = port->index;
@@ -2385,15 +3021,14 @@ gst_omx_video_dec_get_supported_colorformats (GstOMXVideoDec * self)
   /* temporary save original format type */
   format_org = param.eColorFormat;
 
-  for (i = 0; i < sizeof (format_list) / sizeof (VideoNegotiationMap); i++) {
+  formats = g_array_new (FALSE, FALSE, sizeof (guint32));
+  for (i = 0; i < n_formats; i++) {
     param.eColorFormat = format_list[i].type;
     err = gst_omx_component_set_parameter (self->dec,
         OMX_IndexParamVideoPortFormat, &param);
     if (err == OMX_ErrorNone) {
-      m = g_slice_new (VideoNegotiationMap);
-      m->format = format_list[i].format;
-      m->type = format_list[i].type;
-      negotiation_map = g_list_append (negotiation_map, m);
+      type = format_list[i].type;
+      g_array_append_val (formats, type);
       GST_DEBUG_OBJECT (self, "Component supports (%d)", param.eColorFormat);
     }
   }
@@ -2406,6 +3041,47 @@ gst_omx_video_dec_get_supported_colorformats (GstOMXVideoDec * self)
     GST_ERROR_OBJECT (self,
         "Failed to seetting video port format (err info: %s (0x%08x))",
         gst_omx_error_to_string (err), err);
+  else if (formats->len > 0)
+    gst_omx_cap_cache_store (port, GST_OMX_CAP_CACHE_COLOR_FORMATS,
+        (const guint32 *) formats->data, formats->len);
+
+  return formats;
+}
+
+static GList *
+gst_omx_video_dec_get_supported_colorformats (GstOMXVideoDec * self)
+{
+  GList *negotiation_map = NULL;
+  GArray *formats;
+  gint i, j;
+  VideoNegotiationMap *m;
+  const VideoNegotiationMap format_list[] = {
+    {GST_VIDEO_FORMAT_NV12, OMX_COLOR_FormatYUV420SemiPlanar},
+    {GST_VIDEO_FORMAT_I420, OMX_COLOR_FormatYUV420Planar},
+  };
+
+  /* Trying the formats needs several calls into the component,
+   * do this only once per component and core library */
+  formats = gst_omx_cap_cache_lookup (self->dec_out_port,
+      GST_OMX_CAP_CACHE_COLOR_FORMATS);
+  if (!formats)
+    formats = gst_omx_video_dec_probe_colorformats (self, format_list,
+        G_N_ELEMENTS (format_list));
+  if (!formats)
+    return NULL;
+
+  for (i = 0; i < G_N_ELEMENTS (format_list); i++) {
+    for (j = 0; j < formats->len; j++) {
+      if (g_array_index (formats, guint32, j) == format_list[i].type) {
+        m = g_slice_new (VideoNegotiationMap);
+        m->format = format_list[i].format;
+        m->type = format_list[i].type;
+        negotiation_map = g_list_append (negotiation_map, m);
+        break;
+      }
+    }
+  }
+  g_array_unref (formats);
 
   return negotiation_map;
 }
@@ -2559,6 +3235,67 @@ gst_omx_video_dec_align_uv_offset_to_page (GstOMXVideoDec * self,
 }
 #endif /* ENABLE_NV12_PAGE_ALIGN */
 
+/* Waits until the component reached Executing if set_format() started
+ * that transition. The component changes its state on its own after
+ * the command, so this only collects the result. Posts an error and
+ * returns FALSE if it did not get there.
+ *
+ * NOTE: Must be called with the GST_VIDEO_DECODER_STREAM_LOCK held,
+ * or when the streaming thread is stopped */
+static gboolean
+gst_omx_video_dec_wait_executing (GstOMXVideoDec * self)
+{
+  OMX_STATETYPE state;
+
+  if (!self->executing_pending)
+    return TRUE;
+  self->executing_pending = FALSE;
+
+  state = gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
+  if (state != OMX_StateExecuting) {
+    GST_ELEMENT_ERROR (self, LIBRARY, INIT, (NULL),
+        ("Failed to bring the component to Executing state: %s (0x%08x)",
+            gst_omx_component_get_last_error_string (self->dec),
+            gst_omx_component_get_last_error (self->dec)));
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Component reached Executing state");
+
+  return TRUE;
+}
+
+/* Passes the output buffers to the component and starts the srcpad
+ * loop once the component reached Executing after set_format(). Buffers
+ * can only be passed to components in Executing state.
+ *
+ * NOTE: Must be called with the GST_VIDEO_DECODER_STREAM_LOCK held */
+static gboolean
+gst_omx_video_dec_start_executing (GstOMXVideoDec * self)
+{
+  if (!self->executing_pending)
+    return TRUE;
+
+  if (!gst_omx_video_dec_wait_executing (self))
+    return FALSE;
+
+  if (gst_omx_port_populate (self->dec_out_port) != OMX_ErrorNone) {
+    GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
+        ("Failed to pass the output buffers to the component: %s (0x%08x)",
+            gst_omx_component_get_last_error_string (self->dec),
+            gst_omx_component_get_last_error (self->dec)));
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Starting task");
+
+  self->downstream_flow_ret = GST_FLOW_OK;
+  gst_pad_start_task (GST_VIDEO_DECODER_SRC_PAD (self),
+      (GstTaskFunction) gst_omx_video_dec_loop, self, NULL);
+
+  return TRUE;
+}
+
 static gboolean
 gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     GstVideoCodecState * state)
@@ -2579,6 +3316,10 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
 
   GST_DEBUG_OBJECT (self, "Setting new caps %" GST_PTR_FORMAT, state->caps);
 
+  /* New caps before the first frame */
+  if (!gst_omx_video_dec_start_executing (self))
+    return FALSE;
+
   gst_omx_port_get_port_definition (self->dec_in_port, &port_def);
 
   /* Check if the caps change is a real format change or if only irrelevant
@@ -2644,7 +3385,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
       if (gst_omx_port_wait_buffers_released (self->dec_out_port,
               1 * GST_SECOND) != OMX_ErrorNone)
         return FALSE;
-      if (gst_omx_port_deallocate_buffers (self->dec_in_port) != OMX_ErrorNone)
+      if (gst_omx_video_dec_deallocate_input_buffers (self) != OMX_ErrorNone)
         return FALSE;
       if (gst_omx_video_dec_deallocate_output_buffers (self) != OMX_ErrorNone)
         return FALSE;
@@ -2695,7 +3436,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   if (needs_disable) {
     if (gst_omx_port_set_enabled (self->dec_in_port, TRUE) != OMX_ErrorNone)
       return FALSE;
-    if (gst_omx_port_allocate_buffers (self->dec_in_port) != OMX_ErrorNone)
+    if (gst_omx_video_dec_allocate_input_buffers (self) != OMX_ErrorNone)
       return FALSE;
     if (gst_omx_port_wait_enabled (self->dec_in_port,
             5 * GST_SECOND) != OMX_ErrorNone)
@@ -2725,7 +3466,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
       return FALSE;
 
     /* Need to allocate buffers to reach Idle state */
-    if (gst_omx_port_allocate_buffers (self->dec_in_port) != OMX_ErrorNone)
+    if (gst_omx_video_dec_allocate_input_buffers (self) != OMX_ErrorNone)
       return FALSE;
 
     if (self->use_dmabuf)
@@ -2740,23 +3481,16 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
             GST_CLOCK_TIME_NONE) != OMX_StateIdle)
       return FALSE;
 
+    /* The component goes to Executing until the first frame, which
+     * passes the output buffers and starts the srcpad loop then */
     if (gst_omx_component_set_state (self->dec,
             OMX_StateExecuting) != OMX_ErrorNone)
       return FALSE;
-
-    if (gst_omx_component_get_state (self->dec,
-            GST_CLOCK_TIME_NONE) != OMX_StateExecuting)
-      return FALSE;
+    self->executing_pending = TRUE;
   }
 
   /* Unset flushing to allow ports to accept data again */
-  gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, FALSE);
-  gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, FALSE);
-
-  if (!needs_disable) {
-    if (gst_omx_port_populate (self->dec_out_port) != OMX_ErrorNone)
-      return FALSE;
-  }
+  gst_omx_component_set_flushing (self->dec, 5 * GST_SECOND, FALSE);
 
   if (gst_omx_component_get_last_error (self->dec) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (self, "Component in error state: %s (0x%08x)",
@@ -2765,13 +3499,17 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     return FALSE;
   }
 
+  self->set_format_done = TRUE;
+
+  if (self->executing_pending)
+    return TRUE;
+
   /* Start the srcpad loop again */
   GST_DEBUG_OBJECT (self, "Starting task again");
 
   self->downstream_flow_ret = GST_FLOW_OK;
   gst_pad_start_task (GST_VIDEO_DECODER_SRC_PAD (self),
       (GstTaskFunction) gst_omx_video_dec_loop, decoder, NULL);
-  self->set_format_done = TRUE;
 
   return TRUE;
 }
@@ -2787,8 +3525,12 @@ gst_omx_video_dec_flush (GstVideoDecoder * decoder, gboolean hard)
 
   GST_DEBUG_OBJECT (self, "Flushing decoder");
 
-  gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, TRUE);
+  /* The output buffers are passed and the srcpad loop started below
+   * instead of with the first frame */
+  if (!gst_omx_video_dec_wait_executing (self))
+    return FALSE;
+
+  gst_omx_component_set_flushing (self->dec, 5 * GST_SECOND, TRUE);
 
   /* Wait until the srcpad loop is finished,
    * unlock GST_VIDEO_DECODER_STREAM_LOCK to prevent deadlocks
@@ -2798,8 +3540,10 @@ gst_omx_video_dec_flush (GstVideoDecoder * decoder, gboolean hard)
   GST_PAD_STREAM_UNLOCK (GST_VIDEO_DECODER_SRC_PAD (self));
   GST_VIDEO_DECODER_STREAM_LOCK (self);
 
-  gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, FALSE);
-  gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, FALSE);
+  /* The base class drops all pending frames after this */
+  gst_omx_frame_index_clear (&self->frames);
+
+  gst_omx_component_set_flushing (self->dec, 5 * GST_SECOND, FALSE);
   gst_omx_port_populate (self->dec_out_port);
 
   /* Start the srcpad loop again */
@@ -2815,6 +3559,131 @@ gst_omx_video_dec_flush (GstVideoDecoder * decoder, gboolean hard)
   return TRUE;
 }
 
+/* Replaces the component after an error it can recover from with a
+ * new one that is configured for the current input format. The frames
+ * that were passed to the old component are dropped, decoding resumes
+ * with the next sync frame.
+ *
+ * NOTE: Must be called with the GST_VIDEO_DECODER_STREAM_LOCK held */
+static gboolean
+gst_omx_video_dec_recover (GstOMXVideoDec * self, GstVideoCodecFrame * frame)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (self);
+  GstVideoCodecState *state;
+  GList *frames, *l;
+  gboolean ret = FALSE;
+  guint n_recoveries;
+
+  if (!self->input_state)
+    return FALSE;
+
+  n_recoveries = g_atomic_int_add (&self->n_recoveries, 1) + 1;
+  GST_ELEMENT_WARNING (self, LIBRARY, FAILED, (NULL),
+      ("OpenMAX component in error state %s (0x%08x), replacing it "
+          "(%u of %u)", gst_omx_component_get_last_error_string (self->dec),
+          gst_omx_component_get_last_error (self->dec), n_recoveries,
+          self->max_recoveries));
+
+  state = gst_video_codec_state_ref (self->input_state);
+
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+  gst_omx_video_dec_stop (decoder);
+  gst_omx_video_dec_close (decoder);
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  frames = gst_video_decoder_get_frames (decoder);
+  for (l = frames; l; l = l->next) {
+    GstVideoCodecFrame *tmp = l->data;
+
+    if (tmp != frame)
+      gst_video_decoder_drop_frame (decoder, tmp);
+    else
+      gst_video_codec_frame_unref (tmp);
+  }
+  g_list_free (frames);
+
+  if (!gst_omx_video_dec_open (decoder))
+    goto done;
+  gst_omx_video_dec_start (decoder);
+  if (!gst_omx_video_dec_set_format (decoder, state))
+    goto done;
+
+  /* Don't wait for the next regular sync frame if upstream
+   * can produce one right away */
+  gst_pad_push_event (GST_VIDEO_DECODER_SINK_PAD (self),
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
+          TRUE, 0));
+
+  GST_INFO_OBJECT (self, "Replaced the component, waiting for a sync frame");
+  ret = TRUE;
+
+done:
+  gst_video_codec_state_unref (state);
+
+  return ret;
+}
+
+/* Returns the buffer of the input port that upstream wrote the frame
+ * into if it can be passed to the component as it is or after
+ * convert_frame(), with nOffset set to the start of the frame, or NULL
+ * if the frame has to be copied. The buffer is owned by the caller
+ * afterwards, like one that was acquired from the port.
+ *
+ * The frame keeps a buffer without memory with the metadata of the
+ * input buffer, so that upstream can acquire the input buffer again
+ * as soon as the component is done with it */
+static GstOMXBuffer *
+gst_omx_video_dec_take_filled_buffer (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  GstBuffer *inbuf = frame->input_buffer;
+  GstOMXVideoDecBufferData *vdbuf_data;
+  GstOMXBuffer *omx_buf;
+  GstMemory *mem;
+  gsize offset, size;
+
+  if (!self->in_port_pool || inbuf->pool != self->in_port_pool)
+    return NULL;
+
+  /* Nobody else may look at the memory anymore */
+  if (!gst_buffer_is_writable (inbuf) || gst_buffer_n_memory (inbuf) != 1)
+    return NULL;
+
+  omx_buf =
+      gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (inbuf),
+      gst_omx_buffer_data_quark);
+  mem = gst_buffer_peek_memory (inbuf, 0);
+  if (!omx_buf || !GST_IS_OMX_MEMORY_ALLOCATOR (mem->allocator)
+      || ((GstOMXMemory *) mem)->buf != omx_buf)
+    return NULL;
+
+  vdbuf_data = (GstOMXVideoDecBufferData *) omx_buf->private_data;
+  if (!vdbuf_data->already_acquired)
+    return NULL;
+
+  size = gst_buffer_get_sizes (inbuf, &offset, NULL);
+  if (klass->copy_frame != gst_omx_video_dec_copy_frame
+      && !klass->convert_frame (self,
+          omx_buf->omx_buf->pBuffer + offset, size))
+    return NULL;
+
+  omx_buf->omx_buf->nOffset = offset;
+  omx_buf->omx_buf->nFilledLen = 0;
+  omx_buf->omx_buf->nFlags = 0;
+
+  gst_omx_buffer_pool_unlend (GST_OMX_BUFFER_POOL (self->in_port_pool),
+      vdbuf_data);
+
+  frame->input_buffer = gst_buffer_new ();
+  gst_buffer_copy_into (frame->input_buffer, inbuf,
+      GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS |
+      GST_BUFFER_COPY_META, 0, 0);
+  gst_buffer_unref (inbuf);
+
+  return omx_buf;
+}
+
 static GstFlowReturn
 gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     GstVideoCodecFrame * frame)
@@ -2823,16 +3692,25 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
   GstOMXVideoDec *self;
   GstOMXVideoDecClass *klass;
   GstOMXPort *port;
-  GstOMXBuffer *buf;
-  GstBuffer *codec_data = NULL;
-  guint offset = 0, size;
+  GstOMXBuffer *buf, *filled_buf;
+  GstBuffer *codec_data;
+  guint offset, size;
   GstClockTime timestamp, duration;
   OMX_ERRORTYPE err;
   gsize inbuf_consumed;
+  gint64 prof;
+  gboolean filled, codec_data_queued;
 
   self = GST_OMX_VIDEO_DEC (decoder);
   klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
 
+  /* Starts over with the new component after a recovery */
+retry:
+  filled_buf = NULL;
+  codec_data = NULL;
+  offset = 0;
+  filled = FALSE;
+
   self->ts_flag = FALSE;  /* reset this flag for each buffer */
 
   GST_DEBUG_OBJECT (self, "Handling frame");
@@ -2848,6 +3726,11 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     return GST_FLOW_OK;
   }
 
+  if (!gst_omx_video_dec_start_executing (self)) {
+    gst_video_codec_frame_unref (frame);
+    return GST_FLOW_ERROR;
+  }
+
 
   /* Workaround for timestamp issue */
   if (!GST_CLOCK_TIME_IS_VALID (frame->pts) &&
@@ -2877,12 +3760,38 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
   port = self->dec_in_port;
 
   size = gst_buffer_get_size (frame->input_buffer);
+
+  /* Upstream wrote the frame into one of our input buffers. Codec
+   * data needs another buffer in front of it and is sent with the
+   * copying code, which is not worth it for a single frame */
+  if (!self->codec_data && size > 0)
+    filled_buf = gst_omx_video_dec_take_filled_buffer (self, frame);
+  filled = (filled_buf != NULL);
+
   while (offset < size) {
+    GstOMXBuffer *bufs[GST_OMX_MAX_BUFFER_BATCH];
+    guint i, n_bufs, n_chunks, chunk_size;
+
+    /* Take the buffers for the codec data and all remaining
+     * chunks of the frame at once */
+    chunk_size = MAX (port->port_def.nBufferSize, 1);
+    n_chunks = (size - offset + chunk_size - 1) / chunk_size;
+    if (self->codec_data)
+      n_chunks++;
+    n_chunks = MIN (n_chunks, G_N_ELEMENTS (bufs));
+
     /* Make sure to release the base class stream lock, otherwise
      * _loop() can't call _finish_frame() and we might block forever
      * because no input buffers are released */
     GST_VIDEO_DECODER_STREAM_UNLOCK (self);
-    acq_ret = gst_omx_port_acquire_buffer (port, &buf);
+    if (filled_buf) {
+      bufs[0] = filled_buf;
+      n_bufs = 1;
+      filled_buf = NULL;
+      acq_ret = GST_OMX_ACQUIRE_BUFFER_OK;
+    } else {
+      acq_ret = gst_omx_port_acquire_buffers (port, bufs, n_chunks, &n_bufs);
+    }
 
     if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
       GST_VIDEO_DECODER_STREAM_LOCK (self);
@@ -2904,7 +3813,7 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
         goto reconfigure_error;
       }
 
-      err = gst_omx_port_deallocate_buffers (port);
+      err = gst_omx_video_dec_deallocate_input_buffers (self);
       if (err != OMX_ErrorNone) {
         GST_VIDEO_DECODER_STREAM_LOCK (self);
         goto reconfigure_error;
@@ -2922,7 +3831,7 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
         goto reconfigure_error;
       }
 
-      err = gst_omx_port_allocate_buffers (port);
+      err = gst_omx_video_dec_allocate_input_buffers (self);
       if (err != OMX_ErrorNone) {
         GST_VIDEO_DECODER_STREAM_LOCK (self);
         goto reconfigure_error;
@@ -2946,116 +3855,147 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     }
     GST_VIDEO_DECODER_STREAM_LOCK (self);
 
-    g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && buf != NULL);
-
-    if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
-      gst_omx_port_release_buffer (port, buf);
-      goto full_buffer;
-    }
+    g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && n_bufs > 0);
+    gst_omx_video_dec_restore_input_memory (self, bufs, n_bufs);
 
     if (self->downstream_flow_ret != GST_FLOW_OK) {
-      gst_omx_port_release_buffer (port, buf);
+      gst_omx_port_return_buffers (port, bufs, n_bufs);
       goto flow_error;
     }
 
-    if (self->codec_data) {
-      GST_DEBUG_OBJECT (self, "Passing codec data to the component");
+    /* Buffers that are not needed in the end are given back to the
+     * port afterwards. If something fails on the way, the whole batch
+     * is given back and the codec data is sent with the next frame */
+    codec_data_queued = FALSE;
+    for (i = 0; i < n_bufs && offset < size; i++) {
+      buf = bufs[i];
+      g_assert (buf != NULL);
+
+      if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
+        gst_omx_port_return_buffers (port, bufs, n_bufs);
+        goto full_buffer;
+      }
 
-      codec_data = self->codec_data;
+      if (self->codec_data && !codec_data_queued) {
+        GST_DEBUG_OBJECT (self, "Passing codec data to the component");
 
-      if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <
-          gst_buffer_get_size (codec_data)) {
-        gst_omx_port_release_buffer (port, buf);
-        goto too_large_codec_data;
-      }
+        codec_data = self->codec_data;
 
-      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_CODECCONFIG;
-      buf->omx_buf->nFilledLen = gst_buffer_get_size (codec_data);
-      gst_buffer_extract (codec_data, 0,
-          buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
-          buf->omx_buf->nFilledLen);
+        if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <
+            gst_buffer_get_size (codec_data)) {
+          gst_omx_port_return_buffers (port, bufs, n_bufs);
+          goto too_large_codec_data;
+        }
 
-      if (GST_CLOCK_TIME_IS_VALID (timestamp))
-        buf->omx_buf->nTimeStamp =
-            gst_util_uint64_scale (timestamp, OMX_TICKS_PER_SECOND, GST_SECOND);
-      else
-        buf->omx_buf->nTimeStamp = 0;
-      buf->omx_buf->nTickCount = 0;
+        buf->omx_buf->nFlags |= OMX_BUFFERFLAG_CODECCONFIG;
+        buf->omx_buf->nFilledLen = gst_buffer_get_size (codec_data);
+        gst_buffer_extract (codec_data, 0,
+            buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
+            buf->omx_buf->nFilledLen);
 
-      self->started = TRUE;
-      err = gst_omx_port_release_buffer (port, buf);
-      gst_buffer_replace (&self->codec_data, NULL);
-      if (err != OMX_ErrorNone)
-        goto release_error;
-      /* Acquire new buffer for the actual frame */
-      continue;
-    }
+        if (GST_CLOCK_TIME_IS_VALID (timestamp))
+          buf->omx_buf->nTimeStamp =
+              gst_util_uint64_scale (timestamp, OMX_TICKS_PER_SECOND,
+              GST_SECOND);
+        else
+          buf->omx_buf->nTimeStamp = 0;
+        buf->omx_buf->nTickCount = 0;
 
-    /* Now handle the frame */
-    GST_DEBUG_OBJECT (self, "Passing frame offset %d to the component", offset);
+        codec_data_queued = TRUE;
+        /* Use the next buffer for the actual frame */
+        continue;
+      }
 
-    inbuf_consumed = klass->copy_frame (self, frame->input_buffer, offset, buf);
-    if (inbuf_consumed < 0) {
-      GST_ERROR_OBJECT (self, "Failed to copy an input frame");
-      self->downstream_flow_ret = GST_FLOW_ERROR;
-      goto flow_error;
-    }
+      /* Now handle the frame */
+      GST_DEBUG_OBJECT (self, "Passing frame offset %d to the component",
+          offset);
 
-    if (timestamp != GST_CLOCK_TIME_NONE) {
-      self->last_upstream_ts = timestamp;
-    } else {
-      /* Video stream does not provide timestamp, try calculate */
-      /* Skip calculate if the buffer does not contains any meaningful
-       * data (ts_flag = FALSE ) */
-      if (offset == 0 && self->ts_flag) {
-        if (duration != GST_CLOCK_TIME_NONE )
-          /* In case timestamp is invalid. may use duration to calculate
-           * timestamp */
-          self->last_upstream_ts += duration;
-        else
-          /* Use default fps value as last resort */
-          self->last_upstream_ts += gst_util_uint64_scale (1,
-                GST_SECOND, DEFAULT_FRAME_PER_SECOND);
+      if (filled) {
+        /* Already in the buffer */
+        buf->omx_buf->nFilledLen = size;
+        inbuf_consumed = size;
+#ifdef HAVE_MMNGRBUF
+      } else if (offset == 0
+          && klass->copy_frame == gst_omx_video_dec_copy_frame
+          && gst_omx_video_dec_import_frame (self, frame, buf)) {
+        inbuf_consumed = size;
+        filled = TRUE;
+#endif
+      } else {
+        prof = GST_OMX_PROFILE_START ();
+        inbuf_consumed =
+            klass->copy_frame (self, frame->input_buffer, offset, buf);
+        gst_omx_port_profile_add (port, GST_OMX_PROFILE_COPY_FRAME, prof);
+      }
+      if (inbuf_consumed < 0) {
+        GST_ERROR_OBJECT (self, "Failed to copy an input frame");
+        gst_omx_port_return_buffers (port, bufs, n_bufs);
+        self->downstream_flow_ret = GST_FLOW_ERROR;
+        goto flow_error;
+      }
+      if (GST_OMX_TRACE_FILE_IS_ENABLED () && !filled)
+        gst_omx_trace_file_buffer_event (port, buf, "copied");
 
-        timestamp = self->last_upstream_ts;
-        frame->pts = timestamp;
+      if (timestamp != GST_CLOCK_TIME_NONE) {
+        self->last_upstream_ts = timestamp;
+      } else {
+        /* Video stream does not provide timestamp, try calculate */
+        /* Skip calculate if the buffer does not contains any meaningful
+         * data (ts_flag = FALSE ) */
+        if (offset == 0 && self->ts_flag) {
+          if (duration != GST_CLOCK_TIME_NONE )
+            /* In case timestamp is invalid. may use duration to calculate
+             * timestamp */
+            self->last_upstream_ts += duration;
+          else
+            /* Use default fps value as last resort */
+            self->last_upstream_ts += gst_util_uint64_scale (1,
+                  GST_SECOND, DEFAULT_FRAME_PER_SECOND);
+
+          timestamp = self->last_upstream_ts;
+          frame->pts = timestamp;
+        }
       }
-    }
 
-    buf->omx_buf->nTimeStamp =
-      gst_util_uint64_scale (timestamp, OMX_TICKS_PER_SECOND, GST_SECOND);
+      buf->omx_buf->nTimeStamp =
+        gst_util_uint64_scale (timestamp, OMX_TICKS_PER_SECOND, GST_SECOND);
 
-    buf->omx_buf->nTickCount =
-          gst_util_uint64_scale (inbuf_consumed, duration, size);
+      buf->omx_buf->nTickCount =
+            gst_util_uint64_scale (inbuf_consumed, duration, size);
 
-    if (offset == 0) {
-      BufferIdentification *id = g_slice_new0 (BufferIdentification);
+      if (offset == 0) {
+        if (GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+          buf->omx_buf->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
 
-      if (GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
-        buf->omx_buf->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
+        gst_omx_frame_index_add (&self->frames, frame,
+            buf->omx_buf->nTimeStamp);
+      }
 
-      id->timestamp = buf->omx_buf->nTimeStamp;
-      gst_video_codec_frame_set_user_data (frame, id,
-          (GDestroyNotify) buffer_identification_free);
-    }
+      /* TODO: Set flags
+       *   - OMX_BUFFERFLAG_DECODEONLY for buffers that are outside
+       *     the segment
+       */
 
-    /* TODO: Set flags
-     *   - OMX_BUFFERFLAG_DECODEONLY for buffers that are outside
-     *     the segment
-     */
+      offset += inbuf_consumed;
 
-    offset += inbuf_consumed;
+      if (offset == size)
+        buf->omx_buf->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
 
-    if (offset == size)
-      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+      if (GST_BUFFER_FLAG_IS_SET (frame->input_buffer, GST_BUFFER_FLAG_HEADER))
+        buf->omx_buf->nFlags |= OMX_BUFFERFLAG_CODECCONFIG;
 
-    if (GST_BUFFER_FLAG_IS_SET (frame->input_buffer, GST_BUFFER_FLAG_HEADER))
-      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_CODECCONFIG;
+      self->started = TRUE;
+    }
 
-    self->started = TRUE;
-    err = gst_omx_port_release_buffer (port, buf);
+    gst_omx_port_return_buffers (port, bufs + i, n_bufs - i);
+    err = gst_omx_port_release_buffers (port, bufs, i);
     if (err != OMX_ErrorNone)
       goto release_error;
+
+    if (codec_data_queued) {
+      gst_buffer_replace (&self->codec_data, NULL);
+      self->started = TRUE;
+    }
   }
 
   gst_video_codec_frame_unref (frame);
@@ -3092,6 +4032,18 @@ too_large_codec_data:
 
 component_error:
   {
+    if (g_atomic_int_get (&self->n_recoveries) < self->max_recoveries
+        && gst_omx_error_is_recoverable (gst_omx_component_get_last_error
+            (self->dec))) {
+      if (gst_omx_video_dec_recover (self, frame))
+        goto retry;
+
+      gst_video_codec_frame_unref (frame);
+      GST_ELEMENT_ERROR (self, LIBRARY, INIT, (NULL),
+          ("Failed to replace the OpenMAX component after an error"));
+      return GST_FLOW_ERROR;
+    }
+
     gst_video_codec_frame_unref (frame);
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
@@ -3179,6 +4131,7 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self, gboolean is_eos)
         acq_ret);
     return GST_FLOW_ERROR;
   }
+  gst_omx_video_dec_restore_input_memory (self, &buf, 1);
 
   g_mutex_lock (&self->drain_lock);
   self->draining = TRUE;
@@ -3219,6 +4172,69 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self, gboolean is_eos)
   return GST_FLOW_OK;
 }
 
+/* Offers upstream a pool with the buffers of the input port, frames
+ * that upstream writes into them are passed to the component without
+ * copying them again */
+static gboolean
+gst_omx_video_dec_propose_allocation (GstVideoDecoder * bdec, GstQuery * query)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (bdec);
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  GstOMXPort *port;
+  GstStructure *config;
+  GstBufferPool *pool;
+  GstCaps *caps;
+  guint n_buffers;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  port = self->dec_in_port;
+
+  /* Subclasses that convert the stream while copying it need to
+   * keep copying unless they can convert it in place, and imported
+   * dmabufs don't need a pool */
+  if (!caps || !port || port->tunneled || self->in_port_memory
+      || (klass->copy_frame != gst_omx_video_dec_copy_frame
+          && !klass->convert_frame))
+    goto done;
+
+  /* The buffers are allocated in set_format(), and one of them
+   * is never lent to upstream */
+  n_buffers = port->port_def.nBufferCountActual;
+  if (n_buffers < 2 || !port->buffers || port->buffers->len != n_buffers)
+    goto done;
+
+  if (!self->in_port_pool) {
+    pool = gst_omx_buffer_pool_new (GST_ELEMENT_CAST (self), self->dec, port);
+    GST_OMX_BUFFER_POOL (pool)->allocating = TRUE;
+
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps,
+        port->port_def.nBufferSize, n_buffers, n_buffers);
+    if (!gst_buffer_pool_set_config (pool, config)) {
+      GST_INFO_OBJECT (self, "Failed to set config on input pool");
+      gst_object_unref (pool);
+      goto done;
+    }
+
+    self->in_port_pool = pool;
+  }
+
+  GST_DEBUG_OBJECT (self, "Offering input pool with %u buffers of %u bytes",
+      n_buffers - 1, (guint) port->port_def.nBufferSize);
+  gst_query_add_allocation_pool (query, self->in_port_pool,
+      port->port_def.nBufferSize, 0, n_buffers - 1);
+
+done:
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+
+  return
+      GST_VIDEO_DECODER_CLASS
+      (gst_omx_video_dec_parent_class)->propose_allocation (bdec, query);
+}
+
 static gboolean
 gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
 {
@@ -3243,27 +4259,37 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
       update_pool = TRUE;
     }
 
-    /* Set pool parameters to our own configuration */
-    config = gst_buffer_pool_get_config (self->out_port_pool);
+    gst_query_parse_allocation (query, &caps, NULL);
 
-    gst_buffer_pool_config_add_option (config,
-        GST_BUFFER_POOL_OPTION_VIDEO_META);
+    if (gst_buffer_pool_is_active (self->out_port_pool)) {
+      /* The port settings changed in place, keep the buffers */
+      if (!gst_omx_buffer_pool_update_caps (GST_OMX_BUFFER_POOL
+              (self->out_port_pool), caps)) {
+        GST_ERROR_OBJECT (self, "Failed to update caps of internal pool");
+        return FALSE;
+      }
+    } else {
+      /* Set pool parameters to our own configuration */
+      config = gst_buffer_pool_get_config (self->out_port_pool);
 
-    gst_query_parse_allocation (query, &caps, NULL);
-    gst_buffer_pool_config_set_params (config, caps,
-        self->dec_out_port->port_def.nBufferSize,
-        self->dec_out_port->port_def.nBufferCountActual,
-        self->dec_out_port->port_def.nBufferCountActual);
+      gst_buffer_pool_config_add_option (config,
+          GST_BUFFER_POOL_OPTION_VIDEO_META);
 
-    if (!gst_buffer_pool_set_config (self->out_port_pool, config)) {
-      GST_ERROR_OBJECT (self, "Failed to set config on internal pool");
-      gst_object_unref (self->out_port_pool);
-      self->out_port_pool = NULL;
-      return FALSE;
-    }
+      gst_buffer_pool_config_set_params (config, caps,
+          self->dec_out_port->port_def.nBufferSize,
+          self->dec_out_port->port_def.nBufferCountActual,
+          self->dec_out_port->port_def.nBufferCountActual);
 
-    GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = TRUE;
-    gst_buffer_pool_set_active (self->out_port_pool, TRUE);
+      if (!gst_buffer_pool_set_config (self->out_port_pool, config)) {
+        GST_ERROR_OBJECT (self, "Failed to set config on internal pool");
+        gst_object_unref (self->out_port_pool);
+        self->out_port_pool = NULL;
+        return FALSE;
+      }
+
+      GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = TRUE;
+      gst_buffer_pool_set_active (self->out_port_pool, TRUE);
+    }
 
     /* This video buffer pool created below will not be used, just setting to
      * the gstvideodecoder class through a query, because it is
@@ -3326,9 +4352,20 @@ gst_omx_video_dec_set_property (GObject * object, guint prop_id,
     case PROP_USE_DMABUF:
       self->use_dmabuf = g_value_get_boolean (value);
       break;
+#ifdef HAVE_MMNGRBUF
+    case PROP_IMPORT_DMABUF:
+      self->import_dmabuf = g_value_get_boolean (value);
+      break;
+#endif
     case PROP_NO_REORDER:
       self->no_reorder = g_value_get_boolean (value);
       break;
+    case PROP_MAX_RECOVERIES:
+      self->max_recoveries = g_value_get_uint (value);
+      break;
+    case PROP_COPY_THREADS:
+      self->copy_threads = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -3347,9 +4384,27 @@ gst_omx_video_dec_get_property (GObject * object, guint prop_id,
     case PROP_USE_DMABUF:
       g_value_set_boolean (value, self->use_dmabuf);
       break;
+#ifdef HAVE_MMNGRBUF
+    case PROP_IMPORT_DMABUF:
+      g_value_set_boolean (value, self->import_dmabuf);
+      break;
+#endif
     case PROP_NO_REORDER:
       g_value_set_boolean (value, self->no_reorder);
       break;
+    case PROP_MAX_RECOVERIES:
+      g_value_set_uint (value, self->max_recoveries);
+      break;
+    case PROP_COPY_THREADS:
+      g_value_set_uint (value, self->copy_threads);
+      break;
+    case PROP_STATS:
+      GST_OBJECT_LOCK (self);
+      g_value_take_boxed (value,
+          gst_omx_port_get_stats_structure (self->dec_in_port,
+              self->dec_out_port));
+      GST_OBJECT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
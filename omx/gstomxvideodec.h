@@ -27,9 +27,13 @@
 #include <gst/video/gstvideodecoder.h>
 
 #include "gstomx.h"
+#include "gstomxcopy.h"
+#include "gstomxframeindex.h"
 
 G_BEGIN_DECLS
 
+#define GST_OMX_VIDEO_DEC_MAX_COPY_THREADS 64
+
 #define GST_TYPE_OMX_VIDEO_DEC \
   (gst_omx_video_dec_get_type())
 #define GST_OMX_VIDEO_DEC(obj) \
@@ -64,9 +68,16 @@ struct _GstOMXVideoDec
   gboolean started;
 
   gboolean set_format_done;
+  /* TRUE while the component goes to Executing after set_format(), the
+   * output port is populated and the srcpad loop started once it got
+   * there. GST_VIDEO_DECODER_STREAM_LOCK */
+  gboolean executing_pending;
 
   GstClockTime last_upstream_ts;
 
+  /* Frames passed to the component, GST_VIDEO_DECODER_STREAM_LOCK */
+  GstOMXFrameIndex frames;
+
   /* Draining state */
   GMutex drain_lock;
   GCond drain_cond;
@@ -82,6 +93,14 @@ struct _GstOMXVideoDec
   /* Set TRUE to transfer decoded data using dmabuf */
   gboolean use_dmabuf;
 
+  /* Set TRUE to pass dmabuf input buffers to the component without
+   * copying them. in_port_memory is the memory registered with
+   * OMX_UseBuffer() for the input buffers then, which frames that
+   * can't be imported are copied into. NULL if the component
+   * allocated the input buffers */
+  gboolean import_dmabuf;
+  GList *in_port_memory;
+
   /* Set TRUE to not using frame reorder */
   gboolean no_reorder;
 
@@ -90,6 +109,19 @@ struct _GstOMXVideoDec
    * by video stream) */
   gboolean ts_flag;
 
+  /* Number of times in a row the component is replaced after an
+   * error it can recover from before failing, 0 to fail right away */
+  guint max_recoveries;
+  /* atomic, replacements since the component last produced output.
+   * The srcpad loop resets it */
+  guint n_recoveries;
+
+  /* Threads copying output frames that can't be pushed without
+   * copy, 0 for one per CPU. Large frames are split between them.
+   * The pool exists between start() and stop() */
+  guint copy_threads;
+  GstOMXCopyPool *copy_pool;
+
   GstFlowReturn downstream_flow_ret;
 };
 
@@ -103,6 +135,10 @@ struct _GstOMXVideoDecClass
   gboolean (*set_format)       (GstOMXVideoDec * self, GstOMXPort * port, GstVideoCodecState * state);
   GstFlowReturn (*prepare_frame)   (GstOMXVideoDec * self, GstVideoCodecFrame *frame);
   gsize (*copy_frame) (GstOMXVideoDec * self, GstBuffer * inbuf, guint offset, GstOMXBuffer * outbuf);
+  /* For subclasses with their own copy_frame: does its conversion on
+   * size bytes of a frame upstream wrote into an input buffer, without
+   * changing the size. FALSE if the frame has to be copied */
+  gboolean (*convert_frame) (GstOMXVideoDec * self, guint8 * data, gsize size);
 };
 
 GType gst_omx_video_dec_get_type (void);
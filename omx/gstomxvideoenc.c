@@ -28,6 +28,8 @@
 #include <string.h>
 
 #include "gstomxvideoenc.h"
+#include "gstomxcapcache.h"
+#include "gstomxcopy.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_omx_video_enc_debug_category);
 #define GST_CAT_DEFAULT gst_omx_video_enc_debug_category
@@ -56,18 +58,6 @@ gst_omx_video_enc_control_rate_get_type (void)
   return qtype;
 }
 
-typedef struct _BufferIdentification BufferIdentification;
-struct _BufferIdentification
-{
-  guint64 timestamp;
-};
-
-static void
-buffer_identification_free (BufferIdentification * id)
-{
-  g_slice_free (BufferIdentification, id);
-}
-
 /* prototypes */
 static void gst_omx_video_enc_finalize (GObject * object);
 static void gst_omx_video_enc_set_property (GObject * object, guint prop_id,
@@ -109,7 +99,9 @@ enum
   PROP_TARGET_BITRATE,
   PROP_QUANT_I_FRAMES,
   PROP_QUANT_P_FRAMES,
-  PROP_QUANT_B_FRAMES
+  PROP_QUANT_B_FRAMES,
+  PROP_MAX_RECOVERIES,
+  PROP_STATS
 };
 
 /* FIXME: Better defaults */
@@ -118,6 +110,7 @@ enum
 #define GST_OMX_VIDEO_ENC_QUANT_I_FRAMES_DEFAULT (0xffffffff)
 #define GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT (0xffffffff)
 #define GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT (0xffffffff)
+#define GST_OMX_VIDEO_ENC_MAX_RECOVERIES_DEFAULT (0)
 
 /* class initialization */
 
@@ -176,6 +169,19 @@ gst_omx_video_enc_class_init (GstOMXVideoEncClass * klass)
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
           GST_PARAM_MUTABLE_READY));
 
+  g_object_class_install_property (gobject_class, PROP_MAX_RECOVERIES,
+      g_param_spec_uint ("max-recoveries", "Max recoveries",
+          "How often in a row the component is reset after a hardware or "
+          "stream error before failing, encoding resumes with a sync frame "
+          "(0 = fail right away)",
+          0, G_MAXUINT, GST_OMX_VIDEO_ENC_MAX_RECOVERIES_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Buffer latency and throughput statistics of the OpenMAX ports",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_video_enc_change_state);
 
@@ -210,9 +216,11 @@ gst_omx_video_enc_init (GstOMXVideoEnc * self)
   self->quant_i_frames = GST_OMX_VIDEO_ENC_QUANT_I_FRAMES_DEFAULT;
   self->quant_p_frames = GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT;
   self->quant_b_frames = GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT;
+  self->max_recoveries = GST_OMX_VIDEO_ENC_MAX_RECOVERIES_DEFAULT;
 
   g_mutex_init (&self->drain_lock);
   g_cond_init (&self->drain_cond);
+  gst_omx_frame_index_init (&self->frames);
 }
 
 static gboolean
@@ -225,7 +233,9 @@ gst_omx_video_enc_open (GstVideoEncoder * encoder)
   self->enc =
       gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
       klass->cdata.component_name, klass->cdata.component_role,
-      klass->cdata.hacks);
+      klass->cdata.hacks, klass->cdata.pool_size,
+      klass->cdata.pool_idle_timeout, klass->cdata.admission_priority,
+      klass->cdata.admission_timeout);
   self->started = FALSE;
 
   if (!self->enc)
@@ -396,8 +406,11 @@ gst_omx_video_enc_close (GstVideoEncoder * encoder)
   if (!gst_omx_video_enc_shutdown (self))
     return FALSE;
 
+  /* The stats property reads the ports */
+  GST_OBJECT_LOCK (self);
   self->enc_in_port = NULL;
   self->enc_out_port = NULL;
+  GST_OBJECT_UNLOCK (self);
   if (self->enc)
     gst_omx_component_free (self->enc);
   self->enc = NULL;
@@ -412,6 +425,7 @@ gst_omx_video_enc_finalize (GObject * object)
 
   g_mutex_clear (&self->drain_lock);
   g_cond_clear (&self->drain_cond);
+  gst_omx_frame_index_clear (&self->frames);
 
   G_OBJECT_CLASS (gst_omx_video_enc_parent_class)->finalize (object);
 }
@@ -453,6 +467,9 @@ gst_omx_video_enc_set_property (GObject * object, guint prop_id,
     case PROP_QUANT_B_FRAMES:
       self->quant_b_frames = g_value_get_uint (value);
       break;
+    case PROP_MAX_RECOVERIES:
+      self->max_recoveries = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -481,6 +498,16 @@ gst_omx_video_enc_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_QUANT_B_FRAMES:
       g_value_set_uint (value, self->quant_b_frames);
       break;
+    case PROP_MAX_RECOVERIES:
+      g_value_set_uint (value, self->max_recoveries);
+      break;
+    case PROP_STATS:
+      GST_OBJECT_LOCK (self);
+      g_value_take_boxed (value,
+          gst_omx_port_get_stats_structure (self->enc_in_port,
+              self->enc_out_port));
+      GST_OBJECT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -509,10 +536,8 @@ gst_omx_video_enc_change_state (GstElement * element, GstStateChange transition)
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
-      if (self->enc_in_port)
-        gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
-      if (self->enc_out_port)
-        gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+      if (self->enc)
+        gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, TRUE);
 
       g_mutex_lock (&self->drain_lock);
       self->draining = FALSE;
@@ -552,96 +577,26 @@ gst_omx_video_enc_change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
-#define MAX_FRAME_DIST_TICKS  (5 * OMX_TICKS_PER_SECOND)
-#define MAX_FRAME_DIST_FRAMES (100)
-
 static GstVideoCodecFrame *
 _find_nearest_frame (GstOMXVideoEnc * self, GstOMXBuffer * buf)
 {
-  GList *l, *best_l = NULL;
-  GList *finish_frames = NULL;
-  GstVideoCodecFrame *best = NULL;
-  guint64 best_timestamp = 0;
-  guint64 best_diff = G_MAXUINT64;
-  BufferIdentification *best_id = NULL;
-  GList *frames;
+  GstVideoCodecFrame *best;
+  GList *too_old = NULL, *l;
+  gint64 prof = GST_OMX_PROFILE_START ();
 
-  frames = gst_video_encoder_get_frames (GST_VIDEO_ENCODER (self));
+  best = gst_omx_frame_index_take_nearest (&self->frames,
+      buf->omx_buf->nTimeStamp, &too_old);
 
-  for (l = frames; l; l = l->next) {
-    GstVideoCodecFrame *tmp = l->data;
-    BufferIdentification *id = gst_video_codec_frame_get_user_data (tmp);
-    guint64 timestamp, diff;
-
-    /* This happens for frames that were just added but
-     * which were not passed to the component yet. Ignore
-     * them here!
-     */
-    if (!id)
-      continue;
-
-    timestamp = id->timestamp;
-
-    if (timestamp > buf->omx_buf->nTimeStamp)
-      diff = timestamp - buf->omx_buf->nTimeStamp;
-    else
-      diff = buf->omx_buf->nTimeStamp - timestamp;
-
-    if (best == NULL || diff < best_diff) {
-      best = tmp;
-      best_timestamp = timestamp;
-      best_diff = diff;
-      best_l = l;
-      best_id = id;
-
-      /* For frames without timestamp we simply take the first frame */
-      if ((buf->omx_buf->nTimeStamp == 0 && timestamp == 0) || diff == 0)
-        break;
-    }
-  }
-
-  if (best_id) {
-    for (l = frames; l && l != best_l; l = l->next) {
-      GstVideoCodecFrame *tmp = l->data;
-      BufferIdentification *id = gst_video_codec_frame_get_user_data (tmp);
-      guint64 diff_ticks, diff_frames;
-
-      /* This happens for frames that were just added but
-       * which were not passed to the component yet. Ignore
-       * them here!
-       */
-      if (!id)
-        continue;
-
-      if (id->timestamp > best_timestamp)
-        break;
-
-      if (id->timestamp == 0 || best_timestamp == 0)
-        diff_ticks = 0;
-      else
-        diff_ticks = best_timestamp - id->timestamp;
-      diff_frames = best->system_frame_number - tmp->system_frame_number;
-
-      if (diff_ticks > MAX_FRAME_DIST_TICKS
-          || diff_frames > MAX_FRAME_DIST_FRAMES) {
-        finish_frames =
-            g_list_prepend (finish_frames, gst_video_codec_frame_ref (tmp));
-      }
-    }
-  }
-
-  if (finish_frames) {
+  if (too_old) {
     g_warning ("Too old frames, bug in encoder -- please file a bug");
-    for (l = finish_frames; l; l = l->next) {
+    for (l = too_old; l; l = l->next) {
       gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (self), l->data);
     }
+    g_list_free (too_old);
   }
 
-  if (best)
-    gst_video_codec_frame_ref (best);
-
-  g_list_foreach (frames, (GFunc) gst_video_codec_frame_unref, NULL);
-  g_list_free (frames);
+  gst_omx_port_profile_add (self->enc_out_port,
+      GST_OMX_PROFILE_FIND_NEAREST_FRAME, prof);
 
   return best;
 }
@@ -652,6 +607,7 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
 {
   GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
   GstFlowReturn flow_ret = GST_FLOW_OK;
+  gint64 prof;
 
   if ((buf->omx_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
       && buf->omx_buf->nFilledLen > 0) {
@@ -718,6 +674,7 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
         GST_BUFFER_FLAG_SET (outbuf, GST_BUFFER_FLAG_DELTA_UNIT);
     }
 
+    prof = GST_OMX_PROFILE_START ();
     if (frame) {
       frame->output_buffer = outbuf;
       flow_ret =
@@ -726,8 +683,11 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
       GST_ERROR_OBJECT (self, "No corresponding frame found");
       flow_ret = gst_pad_push (GST_VIDEO_ENCODER_SRC_PAD (self), outbuf);
     }
+    gst_omx_port_profile_add (port, GST_OMX_PROFILE_FINISH_AND_PUSH, prof);
   } else if (frame != NULL) {
+    prof = GST_OMX_PROFILE_START ();
     flow_ret = gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (self), frame);
+    gst_omx_port_profile_add (port, GST_OMX_PROFILE_FINISH_AND_PUSH, prof);
   }
 
   return flow_ret;
@@ -866,6 +826,7 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
   self->downstream_flow_ret = flow_ret;
 
   GST_DEBUG_OBJECT (self, "Read frame from component");
+  g_atomic_int_set (&self->n_recoveries, 0);
 
   if (flow_ret != GST_FLOW_OK)
     goto flow_error;
@@ -876,6 +837,26 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
 
 component_error:
   {
+    if (self->max_recoveries > 0
+        && gst_omx_error_is_recoverable (gst_omx_component_get_last_error
+            (self->enc))) {
+      /* _handle_frame() replaces the component with the next frame */
+      GST_WARNING_OBJECT (self, "Component in error state %s (0x%08x), "
+          "waiting for recovery",
+          gst_omx_component_get_last_error_string (self->enc),
+          gst_omx_component_get_last_error (self->enc));
+      gst_pad_pause_task (GST_VIDEO_ENCODER_SRC_PAD (self));
+
+      /* The EOS buffer won't come out anymore */
+      g_mutex_lock (&self->drain_lock);
+      if (self->draining) {
+        self->draining = FALSE;
+        g_cond_broadcast (&self->drain_cond);
+      }
+      g_mutex_unlock (&self->drain_lock);
+      return;
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->enc),
@@ -995,8 +976,7 @@ gst_omx_video_enc_stop (GstVideoEncoder * encoder)
 
   GST_DEBUG_OBJECT (self, "Stopping encoder");
 
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+  gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, TRUE);
 
   gst_pad_stop_task (GST_VIDEO_ENCODER_SRC_PAD (encoder));
 
@@ -1018,6 +998,8 @@ gst_omx_video_enc_stop (GstVideoEncoder * encoder)
 
   gst_omx_component_get_state (self->enc, 5 * GST_SECOND);
 
+  gst_omx_frame_index_clear (&self->frames);
+
   return TRUE;
 }
 
@@ -1033,14 +1015,16 @@ video_negotiation_map_free (VideoNegotiationMap * m)
   g_slice_free (VideoNegotiationMap, m);
 }
 
-static GList *
-gst_omx_video_enc_get_supported_colorformats (GstOMXVideoEnc * self)
+/* Enumerates the color formats the input port supports */
+static GArray *
+gst_omx_video_enc_probe_colorformats (GstOMXVideoEnc * self)
 {
   GstOMXPort *port = self->enc_in_port;
   GstVideoCodecState *state = self->input_state;
   OMX_VIDEO_PARAM_PORTFORMATTYPE param;
   OMX_ERRORTYPE err;
-  GList *negotiation_map = NULL;
+  GArray *formats;
+  guint32 type;
   gint old_index;
 
   GST_OMX_INIT_STRUCT (&param);
@@ -1051,10 +1035,9 @@ gst_omx_video_enc_get_supported_colorformats (GstOMXVideoEnc * self)
   else
     param.xFramerate = (state->info.fps_n << 16) / (state->info.fps_d);
 
+  formats = g_array_new (FALSE, FALSE, sizeof (guint32));
   old_index = -1;
   do {
-    VideoNegotiationMap *m, *m_extra;
-
     err =
         gst_omx_component_get_parameter (self->enc,
         OMX_IndexParamVideoPortFormat, &param);
@@ -1067,47 +1050,143 @@ gst_omx_video_enc_get_supported_colorformats (GstOMXVideoEnc * self)
       break;
 
     if (err == OMX_ErrorNone || err == OMX_ErrorNoMore) {
-      switch (param.eColorFormat) {
-        case OMX_COLOR_FormatYUV420Planar:
-        case OMX_COLOR_FormatYUV420PackedPlanar:
-          m = g_slice_new (VideoNegotiationMap);
-          m->format = GST_VIDEO_FORMAT_I420;
-          m->type = param.eColorFormat;
-          negotiation_map = g_list_append (negotiation_map, m);
-          GST_DEBUG_OBJECT (self, "Component supports I420 (%d) at index %d",
-              param.eColorFormat, param.nIndex);
-          break;
-        case OMX_COLOR_FormatYUV420SemiPlanar:
-        {
-          m = g_slice_new (VideoNegotiationMap);
-          m->format = GST_VIDEO_FORMAT_NV12;
-          m->type = param.eColorFormat;
-          negotiation_map = g_list_append (negotiation_map, m);
-          GST_DEBUG_OBJECT (self, "Component supports NV12 (%d) at index %d",
-              param.eColorFormat, param.nIndex);
-        }
-        {
-          m_extra = g_slice_new (VideoNegotiationMap);
-          m_extra->format = GST_VIDEO_FORMAT_NV16;
-          m_extra->type = param.eColorFormat;
-          negotiation_map = g_list_append (negotiation_map, m_extra);
-          GST_DEBUG_OBJECT (self, "Component supports NV16 (%d) at index %d",
-              param.eColorFormat, param.nIndex);
-        }
-          break;
-        default:
-          GST_DEBUG_OBJECT (self,
-              "Component supports unsupported color format %d at index %d",
-              param.eColorFormat, param.nIndex);
-          break;
-      }
+      type = param.eColorFormat;
+      g_array_append_val (formats, type);
     }
     old_index = param.nIndex++;
   } while (err == OMX_ErrorNone);
 
+  /* Only a complete enumeration ends with OMX_ErrorNoMore, or with
+   * the Bellagio workaround above */
+  if ((err == OMX_ErrorNone || err == OMX_ErrorNoMore) && formats->len > 0)
+    gst_omx_cap_cache_store (port, GST_OMX_CAP_CACHE_COLOR_FORMATS,
+        (const guint32 *) formats->data, formats->len);
+
+  return formats;
+}
+
+static GList *
+gst_omx_video_enc_get_supported_colorformats (GstOMXVideoEnc * self)
+{
+  GList *negotiation_map = NULL;
+  GArray *formats;
+  guint i;
+
+  /* Enumerating the formats needs a call into the component per
+   * format, do this only once per component and core library */
+  formats = gst_omx_cap_cache_lookup (self->enc_in_port,
+      GST_OMX_CAP_CACHE_COLOR_FORMATS);
+  if (!formats)
+    formats = gst_omx_video_enc_probe_colorformats (self);
+
+  for (i = 0; i < formats->len; i++) {
+    OMX_COLOR_FORMATTYPE type = g_array_index (formats, guint32, i);
+    VideoNegotiationMap *m, *m_extra;
+
+    switch (type) {
+      case OMX_COLOR_FormatYUV420Planar:
+      case OMX_COLOR_FormatYUV420PackedPlanar:
+        m = g_slice_new (VideoNegotiationMap);
+        m->format = GST_VIDEO_FORMAT_I420;
+        m->type = type;
+        negotiation_map = g_list_append (negotiation_map, m);
+        GST_DEBUG_OBJECT (self, "Component supports I420 (%d) at index %d",
+            type, i);
+        break;
+      case OMX_COLOR_FormatYUV420SemiPlanar:
+      {
+        m = g_slice_new (VideoNegotiationMap);
+        m->format = GST_VIDEO_FORMAT_NV12;
+        m->type = type;
+        negotiation_map = g_list_append (negotiation_map, m);
+        GST_DEBUG_OBJECT (self, "Component supports NV12 (%d) at index %d",
+            type, i);
+      }
+      {
+        m_extra = g_slice_new (VideoNegotiationMap);
+        m_extra->format = GST_VIDEO_FORMAT_NV16;
+        m_extra->type = type;
+        negotiation_map = g_list_append (negotiation_map, m_extra);
+        GST_DEBUG_OBJECT (self, "Component supports NV16 (%d) at index %d",
+            type, i);
+      }
+        break;
+      default:
+        GST_DEBUG_OBJECT (self,
+            "Component supports unsupported color format %d at index %d",
+            type, i);
+        break;
+    }
+  }
+  g_array_unref (formats);
+
   return negotiation_map;
 }
 
+/* Returns FALSE if the output port's list of supported profiles
+ * and levels doesn't contain profile at level. Only complete lists
+ * are trusted, TRUE is returned if the component doesn't tell or the
+ * query failed half way */
+gboolean
+gst_omx_video_enc_supports_profile_level (GstOMXVideoEnc * self,
+    OMX_U32 profile, OMX_U32 level)
+{
+  GstOMXPort *port = self->enc_out_port;
+  OMX_VIDEO_PARAM_PROFILELEVELTYPE param;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  GArray *profile_levels;
+  gboolean complete = TRUE;
+  gboolean ret;
+  guint32 value;
+  guint i;
+
+  /* Only complete lists are cached */
+  profile_levels = gst_omx_cap_cache_lookup (port,
+      GST_OMX_CAP_CACHE_PROFILE_LEVELS);
+  if (!profile_levels) {
+    profile_levels = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+    GST_OMX_INIT_STRUCT (&param);
+    param.nPortIndex = port->index;
+
+    /* Components return the highest level for every profile */
+    for (param.nProfileIndex = 0; param.nProfileIndex < 64;
+        param.nProfileIndex++) {
+      err = gst_omx_component_get_parameter (self->enc,
+          OMX_IndexParamVideoProfileLevelQuerySupported, &param);
+      if (err != OMX_ErrorNone)
+        break;
+
+      GST_DEBUG_OBJECT (self, "Component supports profile %u up to level %u",
+          (guint) param.eProfile, (guint) param.eLevel);
+      value = param.eProfile;
+      g_array_append_val (profile_levels, value);
+      value = param.eLevel;
+      g_array_append_val (profile_levels, value);
+    }
+
+    complete = (err == OMX_ErrorNone || err == OMX_ErrorNoMore)
+        && profile_levels->len > 0;
+    if (complete)
+      gst_omx_cap_cache_store (port, GST_OMX_CAP_CACHE_PROFILE_LEVELS,
+          (const guint32 *) profile_levels->data, profile_levels->len);
+    else
+      GST_DEBUG_OBJECT (self, "Incomplete profile/level list: %s (0x%08x)",
+          gst_omx_error_to_string (err), err);
+  }
+
+  /* Levels of all codecs are increasing flags */
+  ret = !complete;
+  for (i = 0; i + 1 < profile_levels->len && !ret; i += 2) {
+    if (g_array_index (profile_levels, guint32, i) == profile
+        && g_array_index (profile_levels, guint32, i + 1) >= level)
+      ret = TRUE;
+  }
+  g_array_unref (profile_levels);
+
+  return ret;
+}
+
 static gboolean
 gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
     GstVideoCodecState * state)
@@ -1319,8 +1398,7 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
   }
 
   /* Unset flushing to allow ports to accept data again */
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, FALSE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, FALSE);
+  gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, FALSE);
 
   if (gst_omx_component_get_last_error (self->enc) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (self, "Component in error state: %s (0x%08x)",
@@ -1351,8 +1429,7 @@ gst_omx_video_enc_reset (GstVideoEncoder * encoder, gboolean hard)
 
   GST_DEBUG_OBJECT (self, "Resetting encoder");
 
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, TRUE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, TRUE);
+  gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, TRUE);
 
   /* Wait until the srcpad loop is finished,
    * unlock GST_VIDEO_ENCODER_STREAM_LOCK to prevent deadlocks
@@ -1362,8 +1439,10 @@ gst_omx_video_enc_reset (GstVideoEncoder * encoder, gboolean hard)
   GST_PAD_STREAM_UNLOCK (GST_VIDEO_ENCODER_SRC_PAD (self));
   GST_VIDEO_ENCODER_STREAM_LOCK (self);
 
-  gst_omx_port_set_flushing (self->enc_in_port, 5 * GST_SECOND, FALSE);
-  gst_omx_port_set_flushing (self->enc_out_port, 5 * GST_SECOND, FALSE);
+  /* The base class drops all pending frames after this */
+  gst_omx_frame_index_clear (&self->frames);
+
+  gst_omx_component_set_flushing (self->enc, 5 * GST_SECOND, FALSE);
   gst_omx_port_populate (self->enc_out_port);
 
   /* Start the srcpad loop again */
@@ -1385,6 +1464,7 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
   OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->enc_in_port->port_def;
   gboolean ret = FALSE;
   GstVideoFrame frame;
+  gint64 prof = GST_OMX_PROFILE_START ();
 
   if (info->width != port_def->format.video.nFrameWidth ||
       info->height != port_def->format.video.nFrameHeight) {
@@ -1408,7 +1488,7 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
 
   switch (info->finfo->format) {
     case GST_VIDEO_FORMAT_I420:{
-      gint i, j, height, width;
+      gint i, height, width;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
 
@@ -1459,19 +1539,15 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
           break;
         }
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          outbuf->omx_buf->nFilledLen += dest_stride;
-          src += src_stride;
-          dest += dest_stride;
-        }
+        gst_omx_copy_plane (dest, dest_stride, src, src_stride, width, height);
+        outbuf->omx_buf->nFilledLen += dest_stride * height;
       }
       gst_video_frame_unmap (&frame);
       ret = TRUE;
       break;
     }
     case GST_VIDEO_FORMAT_NV12:{
-      gint i, j, height, width;
+      gint i, height, width;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
 
@@ -1517,12 +1593,8 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
           break;
         }
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, width);
-          outbuf->omx_buf->nFilledLen += dest_stride;
-          src += src_stride;
-          dest += dest_stride;
-        }
+        gst_omx_copy_plane (dest, dest_stride, src, src_stride, width, height);
+        outbuf->omx_buf->nFilledLen += dest_stride * height;
 
       }
       gst_video_frame_unmap (&frame);
@@ -1530,7 +1602,7 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
       break;
     }
     case GST_VIDEO_FORMAT_NV16:{
-      gint i, j, height, width;
+      gint i, height, width;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
 
@@ -1575,22 +1647,14 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
           ret = FALSE;
           break;
         }
-        /* Convert NV16 to NV12 */
-        if (i==0)
-          for (j = 0; j < height; j++) {
-            memcpy (dest, src, width);
-            outbuf->omx_buf->nFilledLen += dest_stride;
-            src += src_stride;
-            dest += dest_stride;
-          }
-        if (i==1)
-          for (j = 0; j < height; j++) {
-            src += src_stride;
-            memcpy (dest, src, width);
-            outbuf->omx_buf->nFilledLen += dest_stride;
-            src += src_stride;
-            dest += dest_stride;
-          }
+        /* Convert NV16 to NV12 by only taking every second chroma row */
+        if (i == 0)
+          gst_omx_copy_plane (dest, dest_stride, src, src_stride, width,
+              height);
+        else
+          gst_omx_copy_plane (dest, dest_stride, src + src_stride,
+              2 * src_stride, width, height);
+        outbuf->omx_buf->nFilledLen += dest_stride * height;
       }
       gst_video_frame_unmap (&frame);
       ret = TRUE;
@@ -1606,6 +1670,68 @@ done:
 
   gst_video_codec_state_unref (state);
 
+  gst_omx_port_profile_add (self->enc_in_port, GST_OMX_PROFILE_FILL_BUFFER,
+      prof);
+
+  return ret;
+}
+
+/* Replaces the component after an error it can recover from with a
+ * new one that is configured for the current input format. The frames
+ * that were passed to the old component are dropped, the new one
+ * starts with a sync frame.
+ *
+ * NOTE: Must be called with the GST_VIDEO_ENCODER_STREAM_LOCK held */
+static gboolean
+gst_omx_video_enc_recover (GstOMXVideoEnc * self, GstVideoCodecFrame * frame)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (self);
+  GstVideoCodecState *state;
+  GList *frames, *l;
+  gboolean ret = FALSE;
+  guint n_recoveries;
+
+  if (!self->input_state)
+    return FALSE;
+
+  n_recoveries = g_atomic_int_add (&self->n_recoveries, 1) + 1;
+  GST_ELEMENT_WARNING (self, LIBRARY, FAILED, (NULL),
+      ("OpenMAX component in error state %s (0x%08x), replacing it "
+          "(%u of %u)", gst_omx_component_get_last_error_string (self->enc),
+          gst_omx_component_get_last_error (self->enc), n_recoveries,
+          self->max_recoveries));
+
+  state = gst_video_codec_state_ref (self->input_state);
+
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (self);
+  gst_omx_video_enc_stop (encoder);
+  gst_omx_video_enc_close (encoder);
+  GST_VIDEO_ENCODER_STREAM_LOCK (self);
+
+  /* Frames without output buffer are dropped */
+  frames = gst_video_encoder_get_frames (encoder);
+  for (l = frames; l; l = l->next) {
+    GstVideoCodecFrame *tmp = l->data;
+
+    if (tmp != frame)
+      gst_video_encoder_finish_frame (encoder, tmp);
+    else
+      gst_video_codec_frame_unref (tmp);
+  }
+  g_list_free (frames);
+
+  if (!gst_omx_video_enc_open (encoder))
+    goto done;
+  gst_omx_video_enc_start (encoder);
+  if (!gst_omx_video_enc_set_format (encoder, state))
+    goto done;
+
+  GST_INFO_OBJECT (self, "Replaced the component");
+  ret = TRUE;
+
+done:
+  gst_video_codec_state_unref (state);
+
   return ret;
 }
 
@@ -1613,7 +1739,7 @@ static GstFlowReturn
 gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame)
 {
-  GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
+  GstOMXAcquireBufferReturn acq_ret;
   GstOMXVideoEnc *self;
   GstOMXPort *port;
   GstOMXBuffer *buf;
@@ -1621,6 +1747,10 @@ gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
 
   self = GST_OMX_VIDEO_ENC (encoder);
 
+  /* Starts over with the new component after a recovery */
+retry:
+  acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
+
   GST_DEBUG_OBJECT (self, "Handling frame");
 
   if (self->eos) {
@@ -1637,7 +1767,6 @@ gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
   port = self->enc_in_port;
 
   while (acq_ret != GST_OMX_ACQUIRE_BUFFER_OK) {
-    BufferIdentification *id;
     GstClockTime timestamp, duration;
 
     /* Make sure to release the base class stream lock, otherwise
@@ -1761,10 +1890,7 @@ gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
       self->last_upstream_ts += duration;
     }
 
-    id = g_slice_new0 (BufferIdentification);
-    id->timestamp = buf->omx_buf->nTimeStamp;
-    gst_video_codec_frame_set_user_data (frame, id,
-        (GDestroyNotify) buffer_identification_free);
+    gst_omx_frame_index_add (&self->frames, frame, buf->omx_buf->nTimeStamp);
 
     self->started = TRUE;
     err = gst_omx_port_release_buffer (port, buf);
@@ -1795,6 +1921,18 @@ flow_error:
 
 component_error:
   {
+    if (g_atomic_int_get (&self->n_recoveries) < self->max_recoveries
+        && gst_omx_error_is_recoverable (gst_omx_component_get_last_error
+            (self->enc))) {
+      if (gst_omx_video_enc_recover (self, frame))
+        goto retry;
+
+      GST_ELEMENT_ERROR (self, LIBRARY, INIT, (NULL),
+          ("Failed to replace the OpenMAX component after an error"));
+      gst_video_codec_frame_unref (frame);
+      return GST_FLOW_ERROR;
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->enc),
@@ -26,6 +26,7 @@
 #include <gst/video/gstvideoencoder.h>
 
 #include "gstomx.h"
+#include "gstomxframeindex.h"
 
 G_BEGIN_DECLS
 
@@ -61,6 +62,9 @@ struct _GstOMXVideoEnc
 
   GstClockTime last_upstream_ts;
 
+  /* Frames passed to the component, GST_VIDEO_ENCODER_STREAM_LOCK */
+  GstOMXFrameIndex frames;
+
   /* Draining state */
   GMutex drain_lock;
   GCond drain_cond;
@@ -76,6 +80,11 @@ struct _GstOMXVideoEnc
   guint32 quant_i_frames;
   guint32 quant_p_frames;
   guint32 quant_b_frames;
+  guint max_recoveries;
+
+  /* atomic, component replacements since it last produced output.
+   * The srcpad loop resets it */
+  guint n_recoveries;
 
   GstFlowReturn downstream_flow_ret;
 };
@@ -93,6 +102,8 @@ struct _GstOMXVideoEncClass
 
 GType gst_omx_video_enc_get_type (void);
 
+gboolean gst_omx_video_enc_supports_profile_level (GstOMXVideoEnc * self, OMX_U32 profile, OMX_U32 level);
+
 G_END_DECLS
 
 #endif /* __GST_OMX_VIDEO_ENC_H__ */
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Measures the plane copy kernels of gstomxcopy.c as used when the
+ * decoder copies its output into downstream buffers and the encoder
+ * its input into OpenMAX buffers.
+ *
+ * 720p, 1080p and 4K frames in I420 and NV12 are copied with every
+ * kernel the CPU supports, once from a source with a larger stride
+ * than the destination (like from a decoder with aligned strides) and
+ * once with equal strides. Source and destination rotate between
+ * several frames so that they don't stay in the caches.
+ *
+ * Afterwards the same frames are copied with the best kernel by
+ * GstOMXCopyPool with 1, 2, 4 and 8 threads, like the "copy-threads"
+ * property of the decoders does.
+ *
+ * Usage: omxcopybench [frames]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gstomxcopy.h"
+
+/* Used by gstomxcopy.c */
+GST_DEBUG_CATEGORY (gstomx_debug);
+
+#define DEFAULT_FRAMES 200
+#define N_BUFFERS 4
+/* Additional source stride in the strided case */
+#define STRIDE_PADDING 128
+
+typedef struct
+{
+  const gchar *name;
+  gint width, height;
+} Resolution;
+
+static const Resolution resolutions[] = {
+  {"720p", 1280, 720},
+  {"1080p", 1920, 1080},
+  {"4K", 3840, 2160}
+};
+
+typedef struct
+{
+  const gchar *name;
+  /* Number of planes, width of the chroma planes in bytes and
+   * height of the chroma planes relative to the frame */
+  gint n_planes;
+  gint chroma_width_div, chroma_width_mul, chroma_height_div;
+} Format;
+
+static const Format formats[] = {
+  {"I420", 3, 2, 1, 2},
+  {"NV12", 2, 2, 2, 2}
+};
+
+static const guint n_threads[] = { 1, 2, 4, 8 };
+
+/* Copies one frame plane by plane, or with pool if not NULL. The
+ * planes are stored one after the other with the given luma strides */
+static void
+copy_frame (GstOMXCopyImpl impl, GstOMXCopyPool * pool,
+    const Format * format, gint width, gint height, guint8 * dest,
+    gint dest_stride, const guint8 * src, gint src_stride)
+{
+  GstOMXCopyPlane planes[GST_OMX_COPY_MAX_PLANES];
+  gint i, w, h, ss, ds;
+
+  for (i = 0; i < format->n_planes; i++) {
+    if (i == 0) {
+      w = width;
+      h = height;
+      ss = src_stride;
+      ds = dest_stride;
+    } else {
+      w = width / format->chroma_width_div * format->chroma_width_mul;
+      h = height / format->chroma_height_div;
+      ss = src_stride / format->chroma_width_div * format->chroma_width_mul;
+      ds = dest_stride / format->chroma_width_div * format->chroma_width_mul;
+    }
+
+    planes[i].dest = dest;
+    planes[i].dest_stride = ds;
+    planes[i].src = src;
+    planes[i].src_stride = ss;
+    planes[i].width = w;
+    planes[i].height = h;
+    src += (gsize) ss * h;
+    dest += (gsize) ds * h;
+  }
+
+  if (pool) {
+    gst_omx_copy_pool_copy_planes (pool, impl, planes, format->n_planes);
+  } else {
+    for (i = 0; i < format->n_planes; i++)
+      gst_omx_copy_plane_full (impl, planes[i].dest, planes[i].dest_stride,
+          planes[i].src, planes[i].src_stride, planes[i].width,
+          planes[i].height);
+  }
+}
+
+static gsize
+frame_size (const Format * format, gint stride, gint height)
+{
+  return (gsize) stride * height + (format->n_planes - 1) *
+      ((gsize) stride / format->chroma_width_div * format->chroma_width_mul *
+      (height / format->chroma_height_div));
+}
+
+static void
+run (GstOMXCopyImpl impl, GstOMXCopyPool * pool, const Format * format,
+    const Resolution * res, gboolean strided, guint n_frames)
+{
+  gint dest_stride = res->width;
+  gint src_stride = res->width + (strided ? STRIDE_PADDING : 0);
+  gsize src_size = frame_size (format, src_stride, res->height);
+  gsize dest_size = frame_size (format, dest_stride, res->height);
+  guint8 *src[N_BUFFERS], *dest[N_BUFFERS];
+  gint64 start, elapsed;
+  gdouble bytes;
+  guint i;
+
+  for (i = 0; i < N_BUFFERS; i++) {
+    src[i] = g_malloc (src_size);
+    dest[i] = g_malloc (dest_size);
+    memset (src[i], i, src_size);
+    /* Fault the pages in before measuring */
+    memset (dest[i], 0, dest_size);
+  }
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n_frames; i++)
+    copy_frame (impl, pool, format, res->width, res->height,
+        dest[i % N_BUFFERS], dest_stride, src[i % N_BUFFERS], src_stride);
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+  bytes = (gdouble) frame_size (format, res->width, res->height) * n_frames;
+  if (pool)
+    g_print ("%-6s %-5s %-8s %7u %10.3f %10.1f\n", format->name, res->name,
+        strided ? "strided" : "equal", gst_omx_copy_pool_get_n_threads (pool),
+        elapsed / 1000.0 / n_frames, bytes / elapsed);
+  else
+    g_print ("%-6s %-5s %-8s %-7s %10.3f %10.1f\n", format->name, res->name,
+        strided ? "strided" : "equal", gst_omx_copy_impl_get_name (impl),
+        elapsed / 1000.0 / n_frames, bytes / elapsed);
+
+  for (i = 0; i < N_BUFFERS; i++) {
+    g_free (src[i]);
+    g_free (dest[i]);
+  }
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  guint n_frames = DEFAULT_FRAMES;
+  GstOMXCopyImpl impl;
+  guint i, j, k, l;
+
+  gst_init (&argc, &argv);
+  GST_DEBUG_CATEGORY_INIT (gstomx_debug, "omx", 0, "gst-omx");
+
+  if (argc > 1 && (n_frames = atoi (argv[1])) == 0) {
+    g_printerr ("Usage: %s [frames]\n", argv[0]);
+    return -1;
+  }
+
+  g_print ("%-6s %-5s %-8s %-7s %10s %10s\n", "format", "size", "strides",
+      "impl", "ms/frame", "MB/s");
+
+  for (i = 0; i < G_N_ELEMENTS (formats); i++) {
+    for (j = 0; j < G_N_ELEMENTS (resolutions); j++) {
+      for (k = 0; k < 2; k++) {
+        for (impl = GST_OMX_COPY_IMPL_C; impl <= GST_OMX_COPY_IMPL_AUTO;
+            impl++) {
+          if (gst_omx_copy_impl_is_supported (impl))
+            run (impl, NULL, &formats[i], &resolutions[j], k == 0, n_frames);
+        }
+      }
+    }
+  }
+
+  g_print ("\n%-6s %-5s %-8s %-7s %10s %10s\n", "format", "size", "strides",
+      "threads", "ms/frame", "MB/s");
+
+  for (l = 0; l < G_N_ELEMENTS (n_threads); l++) {
+    GstOMXCopyPool *pool = gst_omx_copy_pool_new (n_threads[l]);
+
+    for (i = 0; i < G_N_ELEMENTS (formats); i++) {
+      for (j = 0; j < G_N_ELEMENTS (resolutions); j++)
+        run (GST_OMX_COPY_IMPL_AUTO, pool, &formats[i], &resolutions[j], TRUE,
+            n_frames);
+    }
+
+    gst_omx_copy_pool_free (pool);
+  }
+
+  return 0;
+}
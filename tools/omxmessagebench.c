@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Measures the latency between an OpenMAX callback posting a message
+ * and a streaming thread picking it up, for the old GQueue + mutex +
+ * broadcast scheme and for the lock-free message ring used by
+ * GstOMXComponent now.
+ *
+ * One thread plays the component's callback thread and posts an
+ * EmptyBufferDone and a FillBufferDone message per frame, two threads
+ * play the input and output streaming threads which wait for messages
+ * and handle them while holding the component lock, like
+ * gst_omx_port_acquire_buffer() does.
+ *
+ * Usage: omxmessagebench [frames] [frame interval in us]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gstomxring.h"
+
+typedef struct
+{
+  guint seq;
+  gint64 posted;
+} BenchMessage;
+
+typedef struct
+{
+  gboolean use_ring;
+  guint n_messages;
+  gulong interval;
+
+  /* Plays comp->lock */
+  GMutex lock;
+
+  GMutex messages_lock;
+  GCond messages_cond;
+  GQueue messages;
+  GstOMXRing *ring;
+  volatile gint n_waiters;
+
+  volatile gint n_handled;
+  gint64 *latencies;
+  gint64 post_time;
+} Bench;
+
+static gint64
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((gint64) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void
+post_message (Bench * bench, guint seq)
+{
+  BenchMessage msg;
+
+  msg.seq = seq;
+  msg.posted = now_ns ();
+
+  if (bench->use_ring) {
+    while (!gst_omx_ring_push (bench->ring, &msg))
+      g_thread_yield ();
+    if (g_atomic_int_get (&bench->n_waiters) > 0) {
+      g_mutex_lock (&bench->messages_lock);
+      g_cond_broadcast (&bench->messages_cond);
+      g_mutex_unlock (&bench->messages_lock);
+    }
+  } else {
+    g_mutex_lock (&bench->messages_lock);
+    g_queue_push_tail (&bench->messages, g_slice_dup (BenchMessage, &msg));
+    g_cond_broadcast (&bench->messages_cond);
+    g_mutex_unlock (&bench->messages_lock);
+  }
+
+  bench->post_time += now_ns () - msg.posted;
+}
+
+/* Call with bench->lock */
+static void
+handle_messages (Bench * bench)
+{
+  BenchMessage msg, *tmp;
+
+  if (bench->use_ring) {
+    while (gst_omx_ring_pop (bench->ring, &msg)) {
+      bench->latencies[msg.seq] = now_ns () - msg.posted;
+      g_atomic_int_inc (&bench->n_handled);
+    }
+  } else {
+    g_mutex_lock (&bench->messages_lock);
+    while ((tmp = g_queue_pop_head (&bench->messages))) {
+      g_mutex_unlock (&bench->messages_lock);
+      bench->latencies[tmp->seq] = now_ns () - tmp->posted;
+      g_atomic_int_inc (&bench->n_handled);
+      g_slice_free (BenchMessage, tmp);
+      g_mutex_lock (&bench->messages_lock);
+    }
+    g_mutex_unlock (&bench->messages_lock);
+  }
+}
+
+/* Call with bench->lock */
+static void
+wait_message (Bench * bench)
+{
+  if (bench->use_ring) {
+    g_atomic_int_inc (&bench->n_waiters);
+    g_mutex_lock (&bench->messages_lock);
+    if (gst_omx_ring_is_empty (bench->ring)
+        && g_atomic_int_get (&bench->n_handled) < bench->n_messages) {
+      g_mutex_unlock (&bench->lock);
+      g_cond_wait (&bench->messages_cond, &bench->messages_lock);
+      g_mutex_unlock (&bench->messages_lock);
+      g_mutex_lock (&bench->lock);
+    } else {
+      g_mutex_unlock (&bench->messages_lock);
+    }
+    g_atomic_int_add (&bench->n_waiters, -1);
+  } else {
+    g_mutex_lock (&bench->messages_lock);
+    g_mutex_unlock (&bench->lock);
+    if (g_queue_is_empty (&bench->messages)
+        && g_atomic_int_get (&bench->n_handled) < bench->n_messages)
+      g_cond_wait (&bench->messages_cond, &bench->messages_lock);
+    g_mutex_unlock (&bench->messages_lock);
+    g_mutex_lock (&bench->lock);
+  }
+}
+
+static gpointer
+streaming_thread (gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_mutex_lock (&bench->lock);
+  while (g_atomic_int_get (&bench->n_handled) < bench->n_messages) {
+    handle_messages (bench);
+    if (g_atomic_int_get (&bench->n_handled) < bench->n_messages)
+      wait_message (bench);
+  }
+  g_mutex_unlock (&bench->lock);
+
+  /* Wake up the other streaming thread */
+  g_mutex_lock (&bench->messages_lock);
+  g_cond_broadcast (&bench->messages_cond);
+  g_mutex_unlock (&bench->messages_lock);
+
+  return NULL;
+}
+
+static gpointer
+callback_thread (gpointer user_data)
+{
+  Bench *bench = user_data;
+  guint i;
+
+  for (i = 0; i < bench->n_messages; i += 2) {
+    post_message (bench, i);
+    post_message (bench, i + 1);
+    if (bench->interval)
+      g_usleep (bench->interval);
+  }
+
+  return NULL;
+}
+
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  gint64 la = *(const gint64 *) a, lb = *(const gint64 *) b;
+
+  return (la > lb) - (la < lb);
+}
+
+static void
+run (gboolean use_ring, guint n_frames, gulong interval)
+{
+  Bench bench;
+  GThread *threads[3];
+  gint64 start, total, sum = 0;
+  guint i;
+
+  memset (&bench, 0, sizeof (bench));
+  bench.use_ring = use_ring;
+  bench.n_messages = n_frames * 2;
+  bench.interval = interval;
+  g_mutex_init (&bench.lock);
+  g_mutex_init (&bench.messages_lock);
+  g_cond_init (&bench.messages_cond);
+  g_queue_init (&bench.messages);
+  /* Same sizing as GstOMXComponent: a couple of buffers per port
+   * plus some room for control events */
+  bench.ring = gst_omx_ring_new (sizeof (BenchMessage), 2 * (2 * 8) + 16);
+  bench.latencies = g_new0 (gint64, bench.n_messages);
+
+  start = now_ns ();
+  threads[0] = g_thread_new ("input", streaming_thread, &bench);
+  threads[1] = g_thread_new ("output", streaming_thread, &bench);
+  threads[2] = g_thread_new ("callback", callback_thread, &bench);
+  for (i = 0; i < G_N_ELEMENTS (threads); i++)
+    g_thread_join (threads[i]);
+  total = now_ns () - start;
+
+  for (i = 0; i < bench.n_messages; i++)
+    sum += bench.latencies[i];
+  qsort (bench.latencies, bench.n_messages, sizeof (gint64), compare_latency);
+
+  g_print ("%-6s %10.1f %10.1f %10.1f %10.1f %10.1f %12.0f\n",
+      (use_ring ? "ring" : "queue"),
+      (gdouble) sum / bench.n_messages / 1000.0,
+      bench.latencies[bench.n_messages / 2] / 1000.0,
+      bench.latencies[(bench.n_messages * 99) / 100] / 1000.0,
+      bench.latencies[bench.n_messages - 1] / 1000.0,
+      (gdouble) bench.post_time / bench.n_messages / 1000.0,
+      bench.n_messages / (total / 1000000000.0));
+
+  g_free (bench.latencies);
+  gst_omx_ring_free (bench.ring);
+  g_queue_clear (&bench.messages);
+  g_cond_clear (&bench.messages_cond);
+  g_mutex_clear (&bench.messages_lock);
+  g_mutex_clear (&bench.lock);
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  guint n_frames = 100000;
+  gulong interval = 0;
+
+  if (argc > 1)
+    n_frames = MAX (1, atoi (argv[1]));
+  if (argc > 2)
+    interval = atol (argv[2]);
+
+  g_print ("%u frames, %lu us between frames\n", n_frames, interval);
+  g_print ("%-6s %10s %10s %10s %10s %10s %12s\n", "mode", "mean(us)",
+      "p50(us)", "p99(us)", "max(us)", "post(us)", "msgs/s");
+
+  run (FALSE, n_frames, interval);
+  run (TRUE, n_frames, interval);
+
+  return 0;
+}
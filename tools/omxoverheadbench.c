@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Measures the CPU overhead of the elements themselves by running
+ * them as fast as possible against the stub core from omxstub.c,
+ * whose components take no time per buffer.
+ *
+ * Every element of the omx plugin (or the ones given on the command
+ * line) runs in 1, 4 and 16 concurrent pipelines of the form
+ *   appsrc ! element ! fakesink sync=false
+ * each of which processes the given number of frames. Reported are
+ * the output frames per second of one instance, the process CPU time
+ * and context switches per frame, and the thread CPU time per frame
+ * spent in the profiled sections of the elements (see
+ * GstOMXProfileSection), all summed up over all instances.
+ *
+ * Usage, from the top build directory:
+ *   GST_OMX_CONFIG_DIR=config/stub tools/omxoverheadbench [frames [element ...]]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define DEFAULT_FRAMES 1000
+#define VIDEO_WIDTH 1920
+#define VIDEO_HEIGHT 1080
+#define BITSTREAM_SIZE 4096
+#define AAC_FRAME_SIZE 512
+/* 1024 stereo S16 samples */
+#define PCM_FRAME_SIZE (1024 * 2 * 2)
+
+static const guint n_instances[] = { 1, 4, 16 };
+
+/* Profiled sections as named in the "stats" property */
+static const gchar *sections[] = {
+  "acquire", "release", "fill-buffer", "copy-frame", "find-nearest-frame",
+  "finish-and-push"
+};
+
+typedef struct
+{
+  GstElement *pipeline;
+  GstElement *element;
+  GstBuffer *data;
+  GstClockTime duration;
+  guint n_frames, n_pushed;
+  gint n_out;
+} Instance;
+
+/* An avcC with one SPS and PPS and 4 byte NAL lengths, enough for
+ * the stub core which doesn't look at the data */
+static const guint8 avc_codec_data[] = {
+  0x01, 0x42, 0x00, 0x1e, 0xff, 0xe1, 0x00, 0x04, 0x67, 0x42, 0x00, 0x1e,
+  0x01, 0x00, 0x02, 0x68, 0xce
+};
+
+static void
+need_data (GstElement * src, guint length, gpointer user_data)
+{
+  Instance *inst = user_data;
+  GstFlowReturn ret;
+  GstBuffer *buf;
+
+  if (inst->n_pushed >= inst->n_frames) {
+    g_signal_emit_by_name (src, "end-of-stream", &ret);
+    return;
+  }
+
+  /* Shares the memory with the template buffer */
+  buf = gst_buffer_copy (inst->data);
+  GST_BUFFER_PTS (buf) = inst->n_pushed * inst->duration;
+  GST_BUFFER_DURATION (buf) = inst->duration;
+  inst->n_pushed++;
+
+  g_signal_emit_by_name (src, "push-buffer", buf, &ret);
+  gst_buffer_unref (buf);
+}
+
+static GstPadProbeReturn
+count_buffer (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  Instance *inst = user_data;
+
+  g_atomic_int_inc (&inst->n_out);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstCaps *
+get_sink_template_caps (GstElementFactory * factory)
+{
+  const GList *l;
+
+  for (l = gst_element_factory_get_static_pad_templates (factory); l;
+      l = l->next) {
+    GstStaticPadTemplate *templ = l->data;
+
+    if (templ->direction == GST_PAD_SINK)
+      return gst_static_pad_template_get_caps (templ);
+  }
+
+  return NULL;
+}
+
+/* Creates the input caps and a template input buffer for factory */
+static GstCaps *
+make_input (GstElementFactory * factory, GstBuffer ** data,
+    GstClockTime * duration)
+{
+  const gchar *klass =
+      gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+  gboolean video = strstr (klass, "Video") != NULL;
+  GstCaps *caps, *templ;
+  GstStructure *s;
+  GstMapInfo map;
+  gsize size;
+
+  if (strstr (klass, "Encoder")) {
+    if (video) {
+      caps = gst_caps_new_simple ("video/x-raw",
+          "format", G_TYPE_STRING, "NV12",
+          "width", G_TYPE_INT, VIDEO_WIDTH,
+          "height", G_TYPE_INT, VIDEO_HEIGHT,
+          "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+      size = VIDEO_WIDTH * VIDEO_HEIGHT * 3 / 2;
+    } else {
+      caps = gst_caps_new_simple ("audio/x-raw",
+          "format", G_TYPE_STRING, "S16LE",
+          "layout", G_TYPE_STRING, "interleaved",
+          "rate", G_TYPE_INT, 48000, "channels", G_TYPE_INT, 2, NULL);
+      size = PCM_FRAME_SIZE;
+    }
+  } else {
+    templ = get_sink_template_caps (factory);
+    if (!templ || gst_caps_is_empty (templ) || gst_caps_is_any (templ)) {
+      if (templ)
+        gst_caps_unref (templ);
+      return NULL;
+    }
+    caps = gst_caps_copy_nth (templ, 0);
+    gst_caps_unref (templ);
+
+    s = gst_caps_get_structure (caps, 0);
+    if (video) {
+      gst_structure_set (s, "width", G_TYPE_INT, VIDEO_WIDTH,
+          "height", G_TYPE_INT, VIDEO_HEIGHT,
+          "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+      size = BITSTREAM_SIZE;
+    } else {
+      gst_structure_set (s, "rate", G_TYPE_INT, 48000,
+          "channels", G_TYPE_INT, 2, NULL);
+      if (gst_structure_has_field (s, "stream-format"))
+        gst_structure_fixate_field_string (s, "stream-format", "adts");
+      size = AAC_FRAME_SIZE;
+    }
+
+    if (gst_structure_has_name (s, "video/x-h264")) {
+      GstBuffer *codec_data = gst_buffer_new_allocate (NULL,
+          sizeof (avc_codec_data), NULL);
+
+      gst_buffer_fill (codec_data, 0, avc_codec_data, sizeof (avc_codec_data));
+      gst_structure_set (s, "stream-format", G_TYPE_STRING, "avc",
+          "alignment", G_TYPE_STRING, "au",
+          "codec_data", GST_TYPE_BUFFER, codec_data, NULL);
+      gst_buffer_unref (codec_data);
+    }
+    caps = gst_caps_fixate (caps);
+  }
+
+  *data = gst_buffer_new_allocate (NULL, size, NULL);
+  gst_buffer_map (*data, &map, GST_MAP_WRITE);
+  memset (map.data, 0x80, map.size);
+  if (gst_structure_has_name (gst_caps_get_structure (caps, 0),
+          "video/x-h264")) {
+    /* One IDR slice with a 4 byte length */
+    GST_WRITE_UINT32_BE (map.data, size - 4);
+    map.data[4] = 0x65;
+  }
+  gst_buffer_unmap (*data, &map);
+
+  *duration = video ? GST_SECOND / 30 :
+      gst_util_uint64_scale (1024, GST_SECOND, 48000);
+
+  return caps;
+}
+
+static gboolean
+setup_instance (Instance * inst, GstElementFactory * factory, GstCaps * caps,
+    GstBuffer * data, GstClockTime duration, guint n_frames)
+{
+  GstElement *src, *sink;
+  GstPad *pad;
+
+  memset (inst, 0, sizeof (Instance));
+  inst->pipeline = gst_pipeline_new (NULL);
+  src = gst_element_factory_make ("appsrc", NULL);
+  inst->element = gst_element_factory_create (factory, NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  if (!src || !inst->element || !sink) {
+    g_printerr ("Failed to create elements\n");
+    return FALSE;
+  }
+
+  g_object_set (src, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+  g_object_set (sink, "sync", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (inst->pipeline), src, inst->element, sink, NULL);
+  if (!gst_element_link_many (src, inst->element, sink, NULL)) {
+    g_printerr ("Failed to link %s\n", GST_OBJECT_NAME (factory));
+    return FALSE;
+  }
+
+  inst->data = gst_buffer_ref (data);
+  inst->duration = duration;
+  inst->n_frames = n_frames;
+  g_signal_connect (src, "need-data", G_CALLBACK (need_data), inst);
+
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, count_buffer, inst,
+      NULL);
+  gst_object_unref (pad);
+
+  return TRUE;
+}
+
+/* Adds the profiled time of all sections of inst's element to times */
+static void
+add_profile (Instance * inst, guint64 * times)
+{
+  static const gchar *prefixes[] = { "in", "out" };
+  GstStructure *s = NULL;
+  guint64 value;
+  gchar *name;
+  guint i, j;
+
+  g_object_get (inst->element, "stats", &s, NULL);
+  if (!s)
+    return;
+
+  for (i = 0; i < G_N_ELEMENTS (sections); i++) {
+    for (j = 0; j < G_N_ELEMENTS (prefixes); j++) {
+      name = g_strdup_printf ("%s-profile-%s-ns", prefixes[j], sections[i]);
+      if (gst_structure_get_uint64 (s, name, &value))
+        times[i] += value;
+      g_free (name);
+    }
+  }
+
+  gst_structure_free (s);
+}
+
+static gdouble
+timeval_to_us (const struct timeval *tv)
+{
+  return tv->tv_sec * 1e6 + tv->tv_usec;
+}
+
+static gboolean
+run (GstElementFactory * factory, guint n, guint n_frames)
+{
+  Instance *insts;
+  GstBuffer *data = NULL;
+  GstClockTime duration;
+  GstCaps *caps;
+  struct rusage before, after;
+  guint64 times[G_N_ELEMENTS (sections)] = { 0, };
+  guint64 total = 0;
+  gint64 start, elapsed;
+  gdouble cpu, ctxsw;
+  gboolean ret = FALSE;
+  guint i;
+
+  caps = make_input (factory, &data, &duration);
+  if (!caps) {
+    g_printerr ("No input caps for %s\n", GST_OBJECT_NAME (factory));
+    return FALSE;
+  }
+
+  insts = g_new0 (Instance, n);
+  for (i = 0; i < n; i++) {
+    if (!setup_instance (&insts[i], factory, caps, data, duration, n_frames))
+      goto done;
+  }
+
+  getrusage (RUSAGE_SELF, &before);
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < n; i++) {
+    if (gst_element_set_state (insts[i].pipeline,
+            GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+      g_printerr ("Failed to start %s\n", GST_OBJECT_NAME (factory));
+      goto done;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    GstBus *bus = gst_element_get_bus (insts[i].pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+        GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+    gst_object_unref (bus);
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+      GError *err = NULL;
+
+      gst_message_parse_error (msg, &err, NULL);
+      g_printerr ("%s failed: %s\n", GST_OBJECT_NAME (factory), err->message);
+      g_error_free (err);
+      gst_message_unref (msg);
+      goto done;
+    }
+    gst_message_unref (msg);
+  }
+
+  elapsed = g_get_monotonic_time () - start;
+  getrusage (RUSAGE_SELF, &after);
+
+  for (i = 0; i < n; i++) {
+    total += g_atomic_int_get (&insts[i].n_out);
+    add_profile (&insts[i], times);
+  }
+
+  if (total == 0) {
+    g_printerr ("%s produced no output\n", GST_OBJECT_NAME (factory));
+    goto done;
+  }
+
+  cpu = timeval_to_us (&after.ru_utime) - timeval_to_us (&before.ru_utime)
+      + timeval_to_us (&after.ru_stime) - timeval_to_us (&before.ru_stime);
+  ctxsw = (after.ru_nvcsw - before.ru_nvcsw)
+      + (after.ru_nivcsw - before.ru_nivcsw);
+
+  g_print ("%-20s %4u %8" G_GUINT64_FORMAT " %10.1f %9.2f %8.2f",
+      GST_OBJECT_NAME (factory), n, total,
+      (gdouble) total / n / (elapsed / 1e6), cpu / total, ctxsw / total);
+  for (i = 0; i < G_N_ELEMENTS (sections); i++)
+    g_print (" %9.0f", (gdouble) times[i] / total);
+  g_print ("\n");
+
+  ret = TRUE;
+
+done:
+  for (i = 0; i < n; i++) {
+    if (!insts[i].pipeline)
+      continue;
+    gst_element_set_state (insts[i].pipeline, GST_STATE_NULL);
+    gst_object_unref (insts[i].pipeline);
+    if (insts[i].data)
+      gst_buffer_unref (insts[i].data);
+  }
+  g_free (insts);
+  gst_buffer_unref (data);
+  gst_caps_unref (caps);
+
+  return ret;
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  GList *features = NULL, *l;
+  guint n_frames = DEFAULT_FRAMES;
+  gint i, failed = 0;
+  guint j;
+
+  /* Make the elements count the CPU time of their sections */
+  g_setenv ("GST_OMX_PROFILE", "1", TRUE);
+  g_setenv ("GST_OMX_STUB_LATENCY", "0", TRUE);
+
+  gst_init (&argc, &argv);
+
+  if (argc > 1 && (n_frames = atoi (argv[1])) == 0) {
+    g_printerr ("Usage: %s [frames [element ...]]\n", argv[0]);
+    return -1;
+  }
+
+  if (!g_getenv ("GST_OMX_CONFIG_DIR"))
+    g_printerr ("GST_OMX_CONFIG_DIR is not set, not using the stub core?\n");
+
+  if (argc > 2) {
+    for (i = 2; i < argc; i++) {
+      GstElementFactory *factory = gst_element_factory_find (argv[i]);
+
+      if (!factory) {
+        g_printerr ("No element %s\n", argv[i]);
+        return -1;
+      }
+      features = g_list_append (features, factory);
+    }
+  } else {
+    features = gst_registry_get_feature_list_by_plugin (gst_registry_get (),
+        "omx");
+  }
+
+  g_print ("%-20s %4s %8s %10s %9s %8s", "element", "inst", "frames",
+      "fps/inst", "cpu-us/f", "ctxsw/f");
+  for (j = 0; j < G_N_ELEMENTS (sections); j++)
+    g_print (" %9.9s", sections[j]);
+  g_print ("\n%-61s(ns of thread CPU time per frame)\n", "");
+
+  for (l = features; l; l = l->next) {
+    if (!GST_IS_ELEMENT_FACTORY (l->data))
+      continue;
+    for (j = 0; j < G_N_ELEMENTS (n_instances); j++) {
+      if (!run (l->data, n_instances[j], n_frames))
+        failed++;
+    }
+  }
+
+  gst_plugin_feature_list_free (features);
+
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Measures the time from starting a pipeline in NULL state until the
+ * first buffer arrives at its sink, which covers opening the OpenMAX
+ * component, the state changes and the buffer allocation.
+ *
+ * The pipeline is started and stopped again for the given number of
+ * runs. The first run always creates a new component, the following
+ * ones take it from the core's component pool if the element has a
+ * pool-size set in gstomx.conf. Run it once with and once without
+ * pool-size (e.g. by pointing GST_OMX_CONFIG_DIR to a different
+ * gstomx.conf) to compare both.
+ *
+ * Usage: omxstartbench runs pipeline-description
+ *
+ * The pipeline must contain an element named "sink", e.g.
+ *   omxstartbench 20 "filesrc location=in.h264 ! h264parse ! omxh264dec \
+ *       ! fakesink name=sink"
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <stdlib.h>
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gboolean got_buffer;
+  gint64 first_buffer;
+} Run;
+
+static GstPadProbeReturn
+first_buffer_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  Run *run = user_data;
+
+  g_mutex_lock (&run->lock);
+  if (!run->got_buffer) {
+    run->first_buffer = g_get_monotonic_time ();
+    run->got_buffer = TRUE;
+    g_cond_signal (&run->cond);
+  }
+  g_mutex_unlock (&run->lock);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Returns the open-to-first-frame time in microseconds, -1 on error */
+static gint64
+run_once (GstElement * pipeline)
+{
+  GstElement *sink;
+  GstPad *pad;
+  GstBus *bus;
+  GstMessage *msg;
+  Run run;
+  gint64 start, ret = -1;
+
+  g_mutex_init (&run.lock);
+  g_cond_init (&run.cond);
+  run.got_buffer = FALSE;
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, first_buffer_probe,
+      &run, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+
+  bus = gst_element_get_bus (pipeline);
+
+  start = g_get_monotonic_time ();
+  if (gst_element_set_state (pipeline,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    goto done;
+
+  g_mutex_lock (&run.lock);
+  while (!run.got_buffer) {
+    g_mutex_unlock (&run.lock);
+
+    /* Stop early if the pipeline fails */
+    msg =
+        gst_bus_timed_pop_filtered (bus, 10 * GST_MSECOND,
+        GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+    if (msg) {
+      g_printerr ("Pipeline stopped before the first buffer (%s)\n",
+          GST_MESSAGE_TYPE_NAME (msg));
+      gst_message_unref (msg);
+      goto done;
+    }
+
+    g_mutex_lock (&run.lock);
+  }
+  ret = run.first_buffer - start;
+  g_mutex_unlock (&run.lock);
+
+done:
+  /* Closes the element and frees or pools the component */
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_set_flushing (bus, TRUE);
+  gst_bus_set_flushing (bus, FALSE);
+  gst_object_unref (bus);
+
+  g_cond_clear (&run.cond);
+  g_mutex_clear (&run.lock);
+
+  return ret;
+}
+
+static gint
+compare_time (gconstpointer a, gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return (ta > tb) - (ta < tb);
+}
+
+gint
+main (gint argc, gchar ** argv)
+{
+  GstElement *pipeline, *sink;
+  GError *err = NULL;
+  gint64 *times, sum = 0;
+  gint i, n_runs;
+
+  gst_init (&argc, &argv);
+
+  if (argc != 3 || (n_runs = atoi (argv[1])) < 2) {
+    g_printerr ("Usage: %s runs pipeline-description\n", argv[0]);
+    return -1;
+  }
+
+  pipeline = gst_parse_launch (argv[2], &err);
+  if (!pipeline) {
+    g_printerr ("Failed to create pipeline: %s\n", err->message);
+    g_error_free (err);
+    return -1;
+  }
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  if (!sink) {
+    g_printerr ("Pipeline has no element named 'sink'\n");
+    gst_object_unref (pipeline);
+    return -1;
+  }
+  gst_object_unref (sink);
+
+  times = g_new0 (gint64, n_runs);
+  for (i = 0; i < n_runs; i++) {
+    times[i] = run_once (pipeline);
+    if (times[i] < 0) {
+      g_printerr ("Run %d failed\n", i);
+      g_free (times);
+      gst_object_unref (pipeline);
+      return -1;
+    }
+    g_print ("run %3d: %8.2f ms\n", i, times[i] / 1000.0);
+  }
+
+  /* Everything but the first run can use a pooled component */
+  for (i = 1; i < n_runs; i++)
+    sum += times[i];
+  qsort (times + 1, n_runs - 1, sizeof (gint64), compare_time);
+
+  g_print ("%-6s %10s %10s %10s %10s\n", "", "first(ms)", "mean(ms)",
+      "p50(ms)", "max(ms)");
+  g_print ("%-6s %10.2f %10.2f %10.2f %10.2f\n", "open", times[0] / 1000.0,
+      (gdouble) sum / (n_runs - 1) / 1000.0,
+      times[1 + (n_runs - 1) / 2] / 1000.0, times[n_runs - 1] / 1000.0);
+
+  g_free (times);
+  gst_object_unref (pipeline);
+
+  return 0;
+}
@@ -0,0 +1,1418 @@
+/*
+ * Copyright (C) 2015, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* A software OpenMAX IL core that stands in for real hardware, so the
+ * plugin can be profiled and load-tested on any Linux machine. Its
+ * components implement the state machine, buffer handling and port
+ * reconfiguration like a real component but don't decode or encode
+ * anything: every input buffer with data produces one output buffer
+ * with synthetic content (a moving NV12 or I420 gradient for video
+ * decoders, silence for audio decoders, zeros for encoders).
+ *
+ * Components:
+ *   OMX.stub.video_decoder   video_decoder.{avc,mpeg4,mpeg2,h263,wmv,
+ *                            vp8,theora,mjpeg}
+ *   OMX.stub.video_encoder   video_encoder.{avc,mpeg4,h263}
+ *   OMX.stub.audio_decoder   audio_decoder.aac
+ *   OMX.stub.audio_encoder   audio_encoder.aac
+ *
+ * Environment variables, read by OMX_Init():
+ *   GST_OMX_STUB_LATENCY           time each buffer takes, in microseconds
+ *                                  (default 0)
+ *   GST_OMX_STUB_BUFFERS           nBufferCountMin of all ports (default 4)
+ *   GST_OMX_STUB_WIDTH/HEIGHT      default video frame size (1920x1080)
+ *   GST_OMX_STUB_SETTINGS_CHANGED  0 to never emit OMX_EventPortSettingsChanged
+ *                                  from video decoders, 1 to emit it on the
+ *                                  first frame (default) and N to also emit
+ *                                  it every N frames
+ *   GST_OMX_STUB_SETTINGS_IN_PLACE 1 to keep producing output with the
+ *                                  allocated buffers after a settings
+ *                                  change (default, see the
+ *                                  port-settings-changed-in-place hack), 0
+ *                                  to stop output until the output port
+ *                                  was disabled
+ *
+ * config/stub/gstomx.conf registers elements for all components, use
+ * it from the top build directory, as the core path in it is relative,
+ * with
+ *   GST_OMX_CONFIG_DIR=config/stub gst-launch-1.0 ...
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef GST_OMX_STRUCT_PACKING
+# if GST_OMX_STRUCT_PACKING == 1
+#  pragma pack(1)
+# elif GST_OMX_STRUCT_PACKING == 2
+#  pragma pack(2)
+# elif GST_OMX_STRUCT_PACKING == 4
+#  pragma pack(4)
+# elif GST_OMX_STRUCT_PACKING == 8
+#  pragma pack(8)
+# else
+#  error "Unsupported struct packing value"
+# endif
+#endif
+
+#include <OMX_Core.h>
+#include <OMX_Component.h>
+
+#ifdef GST_OMX_STRUCT_PACKING
+#pragma pack()
+#endif
+
+#define STUB_INIT_STRUCT(st) G_STMT_START { \
+  memset ((st), 0, sizeof (*(st))); \
+  (st)->nSize = sizeof (*(st)); \
+  (st)->nVersion.s.nVersionMajor = OMX_VERSION_MAJOR; \
+  (st)->nVersion.s.nVersionMinor = OMX_VERSION_MINOR; \
+  (st)->nVersion.s.nRevision = OMX_VERSION_REVISION; \
+  (st)->nVersion.s.nStep = OMX_VERSION_STEP; \
+} G_STMT_END
+
+#define STUB_ROUND_UP_16(x) (((x) + 15) & ~15)
+
+#define STUB_N_PORTS 2
+#define STUB_IN_PORT 0
+#define STUB_OUT_PORT 1
+
+/* Sizes of compressed and audio buffers */
+#define STUB_VIDEO_BITSTREAM_SIZE (512 * 1024)
+#define STUB_AUDIO_BUFFER_SIZE (8 * 1024)
+/* 1024 stereo S16 samples */
+#define STUB_PCM_FRAME_SIZE (1024 * 2 * 2)
+#define STUB_AAC_FRAME_SIZE 512
+#define STUB_SYNC_INTERVAL 30
+
+typedef enum
+{
+  STUB_VIDEO_DECODER,
+  STUB_VIDEO_ENCODER,
+  STUB_AUDIO_DECODER,
+  STUB_AUDIO_ENCODER
+} StubKind;
+
+typedef struct
+{
+  const gchar *role;
+  OMX_VIDEO_CODINGTYPE coding;
+} StubRole;
+
+typedef struct
+{
+  const gchar *name;
+  StubKind kind;
+  const StubRole *roles;
+} StubComponentInfo;
+
+static const StubRole video_decoder_roles[] = {
+  {"video_decoder.avc", OMX_VIDEO_CodingAVC},
+  {"video_decoder.mpeg4", OMX_VIDEO_CodingMPEG4},
+  {"video_decoder.mpeg2", OMX_VIDEO_CodingMPEG2},
+  {"video_decoder.h263", OMX_VIDEO_CodingH263},
+  {"video_decoder.wmv", OMX_VIDEO_CodingWMV},
+  {"video_decoder.vp8", OMX_VIDEO_CodingAutoDetect},
+  {"video_decoder.theora", OMX_VIDEO_CodingAutoDetect},
+  {"video_decoder.mjpeg", OMX_VIDEO_CodingMJPEG},
+  {NULL, 0}
+};
+
+static const StubRole video_encoder_roles[] = {
+  {"video_encoder.avc", OMX_VIDEO_CodingAVC},
+  {"video_encoder.mpeg4", OMX_VIDEO_CodingMPEG4},
+  {"video_encoder.h263", OMX_VIDEO_CodingH263},
+  {NULL, 0}
+};
+
+static const StubRole audio_decoder_roles[] = {
+  {"audio_decoder.aac", OMX_VIDEO_CodingUnused},
+  {NULL, 0}
+};
+
+static const StubRole audio_encoder_roles[] = {
+  {"audio_encoder.aac", OMX_VIDEO_CodingUnused},
+  {NULL, 0}
+};
+
+static const StubComponentInfo stub_components[] = {
+  {"OMX.stub.video_decoder", STUB_VIDEO_DECODER, video_decoder_roles},
+  {"OMX.stub.video_encoder", STUB_VIDEO_ENCODER, video_encoder_roles},
+  {"OMX.stub.audio_decoder", STUB_AUDIO_DECODER, audio_decoder_roles},
+  {"OMX.stub.audio_encoder", STUB_AUDIO_ENCODER, audio_encoder_roles},
+};
+
+typedef struct
+{
+  OMX_PARAM_PORTDEFINITIONTYPE def;
+  /* Buffers passed to us with EmptyThisBuffer/FillThisBuffer */
+  GQueue queue;
+  guint n_allocated;
+} StubPort;
+
+typedef struct
+{
+  OMX_COMMANDTYPE cmd;
+  OMX_U32 param;
+} StubCommand;
+
+typedef struct
+{
+  OMX_COMPONENTTYPE *handle;
+  const StubComponentInfo *info;
+  const StubRole *role;
+
+  OMX_CALLBACKTYPE callbacks;
+  OMX_PTR app_data;
+
+  /* Everything below is protected by lock */
+  GMutex lock;
+  GCond cond;
+  GThread *thread;
+  gboolean running;
+
+  OMX_STATETYPE state;
+  StubPort ports[STUB_N_PORTS];
+  GQueue commands;
+  /* Parameters and configs without special handling, keyed by
+   * index and port, see stub_param_key() */
+  GHashTable *params;
+
+  /* Input buffers with data processed so far */
+  guint64 n_frames;
+  /* n_frames when the last port settings change was signalled */
+  guint64 settings_changed_frame;
+  /* Output is stopped until the output port is disabled */
+  gboolean settings_changed;
+} StubComponent;
+
+/* Configuration, set by OMX_Init() */
+static gint stub_init_count = 0;
+static GMutex stub_init_lock;
+static gulong stub_latency = 0;
+static guint stub_buffers = 4;
+static guint stub_width = 1920;
+static guint stub_height = 1080;
+static guint stub_settings_changed_interval = 1;
+static gboolean stub_settings_in_place = TRUE;
+
+static guint
+stub_getenv_uint (const gchar * name, guint def)
+{
+  const gchar *value = g_getenv (name);
+
+  if (!value || *value == '\0')
+    return def;
+
+  return (guint) strtoul (value, NULL, 10);
+}
+
+static gboolean
+stub_is_video (StubComponent * stub)
+{
+  return stub->info->kind == STUB_VIDEO_DECODER
+      || stub->info->kind == STUB_VIDEO_ENCODER;
+}
+
+/* Returns TRUE if port carries raw frames or samples */
+static gboolean
+stub_port_is_raw (StubComponent * stub, OMX_U32 index)
+{
+  switch (stub->info->kind) {
+    case STUB_VIDEO_DECODER:
+    case STUB_AUDIO_DECODER:
+      return index == STUB_OUT_PORT;
+    case STUB_VIDEO_ENCODER:
+    case STUB_AUDIO_ENCODER:
+    default:
+      return index == STUB_IN_PORT;
+  }
+}
+
+/* Updates nStride, nSliceHeight and nBufferSize after the
+ * frame size or format of a video port changed.
+ *
+ * NOTE: Must be called while holding stub->lock */
+static void
+stub_update_video_port (StubComponent * stub, StubPort * port)
+{
+  OMX_VIDEO_PORTDEFINITIONTYPE *video = &port->def.format.video;
+  OMX_U32 size;
+
+  if (!stub_port_is_raw (stub, port->def.nPortIndex)) {
+    size = STUB_VIDEO_BITSTREAM_SIZE;
+  } else {
+    if (video->nStride < (OMX_S32) video->nFrameWidth)
+      video->nStride = STUB_ROUND_UP_16 (video->nFrameWidth);
+    if (video->nSliceHeight < video->nFrameHeight)
+      video->nSliceHeight = STUB_ROUND_UP_16 (video->nFrameHeight);
+    size = video->nStride * video->nSliceHeight * 3 / 2;
+  }
+
+  port->def.nBufferSize = MAX (port->def.nBufferSize, size);
+}
+
+static void
+stub_init_port (StubComponent * stub, OMX_U32 index)
+{
+  StubPort *port = &stub->ports[index];
+  OMX_PARAM_PORTDEFINITIONTYPE *def = &port->def;
+
+  STUB_INIT_STRUCT (def);
+  def->nPortIndex = index;
+  def->eDir = (index == STUB_IN_PORT) ? OMX_DirInput : OMX_DirOutput;
+  def->nBufferCountMin = stub_buffers;
+  def->nBufferCountActual = stub_buffers;
+  def->bEnabled = OMX_TRUE;
+  def->bPopulated = OMX_FALSE;
+  def->bBuffersContiguous = OMX_FALSE;
+  def->nBufferAlignment = 16;
+
+  if (stub_is_video (stub)) {
+    OMX_VIDEO_PORTDEFINITIONTYPE *video = &def->format.video;
+
+    def->eDomain = OMX_PortDomainVideo;
+    video->cMIMEType = (OMX_STRING) "video/x-raw";
+    video->nFrameWidth = stub_width;
+    video->nFrameHeight = stub_height;
+    video->xFramerate = 30 << 16;
+    if (stub_port_is_raw (stub, index)) {
+      video->eCompressionFormat = OMX_VIDEO_CodingUnused;
+      video->eColorFormat = OMX_COLOR_FormatYUV420SemiPlanar;
+    } else {
+      video->eCompressionFormat = stub->role->coding;
+      video->eColorFormat = OMX_COLOR_FormatUnused;
+      video->nBitrate = 2000000;
+    }
+    stub_update_video_port (stub, port);
+  } else {
+    OMX_AUDIO_PORTDEFINITIONTYPE *audio = &def->format.audio;
+
+    def->eDomain = OMX_PortDomainAudio;
+    def->nBufferSize = STUB_AUDIO_BUFFER_SIZE;
+    if (stub_port_is_raw (stub, index)) {
+      audio->cMIMEType = (OMX_STRING) "audio/x-raw";
+      audio->eEncoding = OMX_AUDIO_CodingPCM;
+    } else {
+      audio->cMIMEType = (OMX_STRING) "audio/mpeg";
+      audio->eEncoding = OMX_AUDIO_CodingAAC;
+    }
+  }
+
+  g_queue_init (&port->queue);
+}
+
+static guint64
+stub_param_key (OMX_INDEXTYPE index, OMX_PTR param)
+{
+  /* All OpenMAX parameter structures that belong to a port start
+   * with nSize, nVersion and nPortIndex */
+  OMX_U32 port = 0;
+
+  if (*(OMX_U32 *) param >= 3 * sizeof (OMX_U32))
+    port = ((OMX_U32 *) param)[2];
+
+  return ((guint64) index << 32) | port;
+}
+
+/* NOTE: Must be called while holding stub->lock */
+static void
+stub_store_param (StubComponent * stub, OMX_INDEXTYPE index, OMX_PTR param)
+{
+  guint64 *key = g_new (guint64, 1);
+
+  *key = stub_param_key (index, param);
+  g_hash_table_replace (stub->params, key,
+      g_memdup (param, *(OMX_U32 *) param));
+}
+
+/* NOTE: Must be called while holding stub->lock */
+static OMX_ERRORTYPE
+stub_load_param (StubComponent * stub, OMX_INDEXTYPE index, OMX_PTR param)
+{
+  guint64 key = stub_param_key (index, param);
+  gpointer stored;
+  OMX_U32 size;
+
+  stored = g_hash_table_lookup (stub->params, &key);
+  if (!stored)
+    return OMX_ErrorUnsupportedIndex;
+
+  size = MIN (*(OMX_U32 *) param, *(OMX_U32 *) stored);
+  memcpy (param, stored, size);
+
+  return OMX_ErrorNone;
+}
+
+static void
+stub_init_params (StubComponent * stub)
+{
+  OMX_AUDIO_PARAM_PCMMODETYPE pcm;
+  OMX_AUDIO_PARAM_AACPROFILETYPE aac;
+  OMX_VIDEO_PARAM_BITRATETYPE bitrate;
+  OMX_VIDEO_PARAM_QUANTIZATIONTYPE quant;
+
+  switch (stub->info->kind) {
+    case STUB_VIDEO_ENCODER:
+      STUB_INIT_STRUCT (&bitrate);
+      bitrate.nPortIndex = STUB_OUT_PORT;
+      bitrate.eControlRate = OMX_Video_ControlRateVariable;
+      bitrate.nTargetBitrate = 2000000;
+      stub_store_param (stub, OMX_IndexParamVideoBitrate, &bitrate);
+
+      STUB_INIT_STRUCT (&quant);
+      quant.nPortIndex = STUB_OUT_PORT;
+      quant.nQpI = quant.nQpP = quant.nQpB = 20;
+      stub_store_param (stub, OMX_IndexParamVideoQuantization, &quant);
+      break;
+    case STUB_AUDIO_DECODER:
+    case STUB_AUDIO_ENCODER:
+      STUB_INIT_STRUCT (&pcm);
+      pcm.nPortIndex = stub->info->kind == STUB_AUDIO_DECODER ?
+          STUB_OUT_PORT : STUB_IN_PORT;
+      pcm.nChannels = 2;
+      pcm.eNumData = OMX_NumericalDataSigned;
+      pcm.eEndian = OMX_EndianLittle;
+      pcm.bInterleaved = OMX_TRUE;
+      pcm.nBitPerSample = 16;
+      pcm.nSamplingRate = 48000;
+      pcm.ePCMMode = OMX_AUDIO_PCMModeLinear;
+      pcm.eChannelMapping[0] = OMX_AUDIO_ChannelLF;
+      pcm.eChannelMapping[1] = OMX_AUDIO_ChannelRF;
+      stub_store_param (stub, OMX_IndexParamAudioPcm, &pcm);
+
+      STUB_INIT_STRUCT (&aac);
+      aac.nPortIndex = stub->info->kind == STUB_AUDIO_DECODER ?
+          STUB_IN_PORT : STUB_OUT_PORT;
+      aac.nChannels = 2;
+      aac.nSampleRate = 48000;
+      aac.nBitRate = 128000;
+      aac.nFrameLength = 1024;
+      aac.eAACProfile = OMX_AUDIO_AACObjectLC;
+      aac.eAACStreamFormat = OMX_AUDIO_AACStreamFormatMP4ADTS;
+      aac.eChannelMode = OMX_AUDIO_ChannelModeStereo;
+      stub_store_param (stub, OMX_IndexParamAudioAac, &aac);
+      break;
+    case STUB_VIDEO_DECODER:
+    default:
+      break;
+  }
+}
+
+/* Calls into the application must happen without holding stub->lock,
+ * it might call back into the component from there */
+static void
+stub_event (StubComponent * stub, OMX_EVENTTYPE event, OMX_U32 data1,
+    OMX_U32 data2)
+{
+  g_mutex_unlock (&stub->lock);
+  stub->callbacks.EventHandler (stub->handle, stub->app_data, event, data1,
+      data2, NULL);
+  g_mutex_lock (&stub->lock);
+}
+
+/* NOTE: Must be called while holding stub->lock */
+static void
+stub_buffer_done (StubComponent * stub, OMX_BUFFERHEADERTYPE * buf,
+    OMX_DIRTYPE dir)
+{
+  g_mutex_unlock (&stub->lock);
+  if (dir == OMX_DirInput)
+    stub->callbacks.EmptyBufferDone (stub->handle, stub->app_data, buf);
+  else
+    stub->callbacks.FillBufferDone (stub->handle, stub->app_data, buf);
+  g_mutex_lock (&stub->lock);
+}
+
+/* Returns all buffers queued on port to the application, returns
+ * the number of buffers that were returned.
+ *
+ * NOTE: Must be called while holding stub->lock */
+static guint
+stub_return_buffers (StubComponent * stub, StubPort * port)
+{
+  OMX_BUFFERHEADERTYPE *buf;
+  guint n = 0;
+
+  while ((buf = g_queue_pop_head (&port->queue))) {
+    if (port->def.eDir == OMX_DirOutput) {
+      buf->nFilledLen = 0;
+      buf->nOffset = 0;
+      buf->nFlags = 0;
+    }
+    stub_buffer_done (stub, buf, port->def.eDir);
+    n++;
+  }
+
+  return n;
+}
+
+static gboolean
+stub_port_matches (OMX_U32 param, guint index)
+{
+  return param == OMX_ALL || param == index;
+}
+
+/* NOTE: Must be called while holding stub->lock */
+static gboolean
+stub_port_is_populated (StubPort * port)
+{
+  return port->n_allocated >= port->def.nBufferCountActual;
+}
+
+/* Tries to execute the first queued command. Returns FALSE if
+ * there was no command or it has to wait for buffers to be
+ * allocated or freed.
+ *
+ * NOTE: Must be called while holding stub->lock */
+static gboolean
+stub_handle_command (StubComponent * stub)
+{
+  StubCommand *cmd = g_queue_peek_head (&stub->commands);
+  gboolean progress = FALSE;
+  guint i;
+
+  if (!cmd)
+    return FALSE;
+
+  switch (cmd->cmd) {
+    case OMX_CommandStateSet:{
+      OMX_STATETYPE target = cmd->param;
+
+      if (target == stub->state) {
+        g_free (g_queue_pop_head (&stub->commands));
+        stub_event (stub, OMX_EventError, OMX_ErrorSameState, 0);
+        return TRUE;
+      }
+
+      if (target == OMX_StateIdle && stub->state == OMX_StateLoaded) {
+        for (i = 0; i < STUB_N_PORTS; i++) {
+          if (stub->ports[i].def.bEnabled &&
+              !stub_port_is_populated (&stub->ports[i]))
+            return FALSE;
+        }
+      } else if (target == OMX_StateLoaded && stub->state == OMX_StateIdle) {
+        for (i = 0; i < STUB_N_PORTS; i++) {
+          if (stub->ports[i].n_allocated > 0)
+            return FALSE;
+        }
+      } else if (target == OMX_StateIdle) {
+        for (i = 0; i < STUB_N_PORTS; i++)
+          stub_return_buffers (stub, &stub->ports[i]);
+      } else if (target == OMX_StateInvalid) {
+        stub->state = OMX_StateInvalid;
+        g_free (g_queue_pop_head (&stub->commands));
+        stub_event (stub, OMX_EventError, OMX_ErrorInvalidState, 0);
+        return TRUE;
+      }
+
+      for (i = 0; i < STUB_N_PORTS; i++)
+        stub->ports[i].def.bPopulated =
+            stub_port_is_populated (&stub->ports[i]);
+      stub->state = target;
+      g_free (g_queue_pop_head (&stub->commands));
+      stub_event (stub, OMX_EventCmdComplete, OMX_CommandStateSet, target);
+      return TRUE;
+    }
+    case OMX_CommandFlush:
+      g_queue_pop_head (&stub->commands);
+      for (i = 0; i < STUB_N_PORTS; i++) {
+        if (!stub_port_matches (cmd->param, i))
+          continue;
+        stub_return_buffers (stub, &stub->ports[i]);
+        stub_event (stub, OMX_EventCmdComplete, OMX_CommandFlush, i);
+      }
+      g_free (cmd);
+      return TRUE;
+    case OMX_CommandPortDisable:
+      for (i = 0; i < STUB_N_PORTS; i++) {
+        if (!stub_port_matches (cmd->param, i))
+          continue;
+        stub->ports[i].def.bEnabled = OMX_FALSE;
+        if (i == STUB_OUT_PORT)
+          stub->settings_changed = FALSE;
+        if (stub_return_buffers (stub, &stub->ports[i]) > 0)
+          progress = TRUE;
+        if (stub->ports[i].n_allocated > 0)
+          return progress;
+      }
+
+      g_queue_pop_head (&stub->commands);
+      for (i = 0; i < STUB_N_PORTS; i++) {
+        if (!stub_port_matches (cmd->param, i))
+          continue;
+        stub->ports[i].def.bPopulated = OMX_FALSE;
+        stub_event (stub, OMX_EventCmdComplete, OMX_CommandPortDisable, i);
+      }
+      g_free (cmd);
+      return TRUE;
+    case OMX_CommandPortEnable:
+      for (i = 0; i < STUB_N_PORTS; i++) {
+        if (!stub_port_matches (cmd->param, i))
+          continue;
+        stub->ports[i].def.bEnabled = OMX_TRUE;
+        if (stub->state != OMX_StateLoaded &&
+            !stub_port_is_populated (&stub->ports[i]))
+          return FALSE;
+      }
+
+      g_queue_pop_head (&stub->commands);
+      for (i = 0; i < STUB_N_PORTS; i++) {
+        if (!stub_port_matches (cmd->param, i))
+          continue;
+        stub->ports[i].def.bPopulated =
+            stub_port_is_populated (&stub->ports[i]);
+        stub_event (stub, OMX_EventCmdComplete, OMX_CommandPortEnable, i);
+      }
+      g_free (cmd);
+      return TRUE;
+    case OMX_CommandMarkBuffer:
+    default:{
+      StubCommand done = *cmd;
+
+      g_free (g_queue_pop_head (&stub->commands));
+      stub_event (stub, OMX_EventCmdComplete, done.cmd, done.param);
+      return TRUE;
+    }
+  }
+}
+
+/* Fills a raw video buffer with a gradient that moves with every frame */
+static void
+stub_fill_video_frame (StubComponent * stub,
+    const OMX_VIDEO_PORTDEFINITIONTYPE * video, OMX_BUFFERHEADERTYPE * buf)
+{
+  guint8 *data = buf->pBuffer + buf->nOffset;
+  gsize avail = buf->nAllocLen - buf->nOffset, y_size, size;
+  guint y, stride = video->nStride, height = video->nFrameHeight;
+  guint8 value = stub->n_frames & 0xff;
+
+  y_size = (gsize) stride * video->nSliceHeight;
+  size = MIN (y_size * 3 / 2, avail);
+
+  for (y = 0; y < height && (y + 1) * stride <= size; y++)
+    memset (data + y * stride, (guint8) (y + value), video->nFrameWidth);
+
+  /* Gray chroma, for I420 both planes follow each other too */
+  if (size > y_size)
+    memset (data + y_size, 128, size - y_size);
+
+  buf->nFilledLen = size;
+}
+
+/* Fills the output buffer for an input buffer with data, video is
+ * the output port's format when the buffers were taken.
+ *
+ * NOTE: Called without holding stub->lock */
+static void
+stub_fill_output (StubComponent * stub,
+    const OMX_VIDEO_PORTDEFINITIONTYPE * video, OMX_BUFFERHEADERTYPE * inbuf,
+    OMX_BUFFERHEADERTYPE * outbuf)
+{
+  gsize size;
+
+  outbuf->nOffset = 0;
+  outbuf->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+
+  switch (stub->info->kind) {
+    case STUB_VIDEO_DECODER:
+      stub_fill_video_frame (stub, video, outbuf);
+      break;
+    case STUB_VIDEO_ENCODER:
+      size = MIN (outbuf->nAllocLen, MAX (inbuf->nFilledLen / 50, 16));
+      memset (outbuf->pBuffer, 0, size);
+      outbuf->nFilledLen = size;
+      if (stub->n_frames % STUB_SYNC_INTERVAL == 0)
+        outbuf->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
+      break;
+    case STUB_AUDIO_DECODER:
+      size = MIN (outbuf->nAllocLen, STUB_PCM_FRAME_SIZE);
+      memset (outbuf->pBuffer, 0, size);
+      outbuf->nFilledLen = size;
+      break;
+    case STUB_AUDIO_ENCODER:
+    default:
+      size = MIN (outbuf->nAllocLen, STUB_AAC_FRAME_SIZE);
+      memset (outbuf->pBuffer, 0, size);
+      outbuf->nFilledLen = size;
+      break;
+  }
+}
+
+/* NOTE: Must be called while holding stub->lock */
+static gboolean
+stub_settings_change_due (StubComponent * stub)
+{
+  if (stub->info->kind != STUB_VIDEO_DECODER
+      || stub_settings_changed_interval == 0
+      || stub->settings_changed_frame == stub->n_frames)
+    return FALSE;
+
+  return stub->n_frames == 0 || (stub_settings_changed_interval > 1
+      && stub->n_frames % stub_settings_changed_interval == 0);
+}
+
+/* Processes the first queued input buffer if possible. Returns
+ * FALSE if there was nothing to do.
+ *
+ * NOTE: Must be called while holding stub->lock */
+static gboolean
+stub_process (StubComponent * stub)
+{
+  StubPort *in_port = &stub->ports[STUB_IN_PORT];
+  StubPort *out_port = &stub->ports[STUB_OUT_PORT];
+  OMX_BUFFERHEADERTYPE *inbuf, *outbuf = NULL;
+  OMX_VIDEO_PORTDEFINITIONTYPE video;
+  gboolean has_data, eos;
+
+  if (stub->state != OMX_StateExecuting || !in_port->def.bEnabled)
+    return FALSE;
+
+  inbuf = g_queue_peek_head (&in_port->queue);
+  if (!inbuf)
+    return FALSE;
+
+  has_data = inbuf->nFilledLen > 0
+      && !(inbuf->nFlags & OMX_BUFFERFLAG_CODECCONFIG);
+  eos = (inbuf->nFlags & OMX_BUFFERFLAG_EOS) != 0;
+
+  if (has_data && stub_settings_change_due (stub)) {
+    stub->settings_changed_frame = stub->n_frames;
+    /* The frame size never changes, so the allocated buffers
+     * always fit the new settings */
+    stub->settings_changed = !stub_settings_in_place;
+    stub_event (stub, OMX_EventPortSettingsChanged, STUB_OUT_PORT,
+        OMX_IndexParamPortDefinition);
+    return TRUE;
+  }
+
+  if (has_data || eos) {
+    if (stub->settings_changed || !out_port->def.bEnabled
+        || g_queue_is_empty (&out_port->queue))
+      return FALSE;
+    outbuf = g_queue_pop_head (&out_port->queue);
+  }
+  g_queue_pop_head (&in_port->queue);
+  video = out_port->def.format.video;
+
+  g_mutex_unlock (&stub->lock);
+
+  if (stub_latency > 0)
+    g_usleep (stub_latency);
+
+  if (outbuf) {
+    if (has_data) {
+      stub_fill_output (stub, &video, inbuf, outbuf);
+    } else {
+      outbuf->nOffset = 0;
+      outbuf->nFilledLen = 0;
+      outbuf->nFlags = 0;
+    }
+    outbuf->nTimeStamp = inbuf->nTimeStamp;
+    if (eos)
+      outbuf->nFlags |= OMX_BUFFERFLAG_EOS;
+  }
+
+  inbuf->nOffset = 0;
+  inbuf->nFilledLen = 0;
+  stub->callbacks.EmptyBufferDone (stub->handle, stub->app_data, inbuf);
+  if (outbuf)
+    stub->callbacks.FillBufferDone (stub->handle, stub->app_data, outbuf);
+  if (eos)
+    stub->callbacks.EventHandler (stub->handle, stub->app_data,
+        OMX_EventBufferFlag, STUB_OUT_PORT, OMX_BUFFERFLAG_EOS, NULL);
+
+  g_mutex_lock (&stub->lock);
+  if (has_data)
+    stub->n_frames++;
+
+  return TRUE;
+}
+
+static gpointer
+stub_thread (gpointer data)
+{
+  StubComponent *stub = data;
+
+  g_mutex_lock (&stub->lock);
+  while (stub->running) {
+    if (stub_handle_command (stub))
+      continue;
+    if (stub_process (stub))
+      continue;
+    g_cond_wait (&stub->cond, &stub->lock);
+  }
+  g_mutex_unlock (&stub->lock);
+
+  return NULL;
+}
+
+#define STUB_FROM_HANDLE(h) \
+    ((StubComponent *) ((OMX_COMPONENTTYPE *) (h))->pComponentPrivate)
+
+static OMX_ERRORTYPE
+stub_get_component_version (OMX_HANDLETYPE handle, OMX_STRING name,
+    OMX_VERSIONTYPE * component_version, OMX_VERSIONTYPE * spec_version,
+    OMX_UUIDTYPE * uuid)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+
+  g_strlcpy (name, stub->info->name, OMX_MAX_STRINGNAME_SIZE);
+  component_version->nVersion = 0;
+  component_version->s.nVersionMajor = 1;
+  spec_version->s.nVersionMajor = OMX_VERSION_MAJOR;
+  spec_version->s.nVersionMinor = OMX_VERSION_MINOR;
+  spec_version->s.nRevision = OMX_VERSION_REVISION;
+  spec_version->s.nStep = OMX_VERSION_STEP;
+  if (uuid)
+    memset (uuid, 0, sizeof (OMX_UUIDTYPE));
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_send_command (OMX_HANDLETYPE handle, OMX_COMMANDTYPE cmd,
+    OMX_U32 param, OMX_PTR cmd_data)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+  StubCommand *command;
+
+  if ((cmd == OMX_CommandFlush || cmd == OMX_CommandPortDisable
+          || cmd == OMX_CommandPortEnable) && param != OMX_ALL
+      && param >= STUB_N_PORTS)
+    return OMX_ErrorBadPortIndex;
+
+  command = g_new (StubCommand, 1);
+  command->cmd = cmd;
+  command->param = param;
+
+  g_mutex_lock (&stub->lock);
+  g_queue_push_tail (&stub->commands, command);
+  g_cond_signal (&stub->cond);
+  g_mutex_unlock (&stub->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_get_parameter (OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+    OMX_PTR param)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  g_mutex_lock (&stub->lock);
+  switch (index) {
+    case OMX_IndexParamPortDefinition:{
+      OMX_PARAM_PORTDEFINITIONTYPE *def = param;
+
+      if (def->nPortIndex >= STUB_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      memcpy (def, &stub->ports[def->nPortIndex].def, sizeof (*def));
+      break;
+    }
+    case OMX_IndexParamVideoInit:
+    case OMX_IndexParamAudioInit:
+    case OMX_IndexParamImageInit:
+    case OMX_IndexParamOtherInit:{
+      OMX_PORT_PARAM_TYPE *ports = param;
+      gboolean video = (index == OMX_IndexParamVideoInit);
+      gboolean audio = (index == OMX_IndexParamAudioInit);
+
+      ports->nStartPortNumber = 0;
+      ports->nPorts = ((video && stub_is_video (stub))
+          || (audio && !stub_is_video (stub))) ? STUB_N_PORTS : 0;
+      break;
+    }
+    case OMX_IndexParamVideoPortFormat:{
+      OMX_VIDEO_PARAM_PORTFORMATTYPE *format = param;
+      StubPort *port;
+
+      if (!stub_is_video (stub)) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      if (format->nPortIndex >= STUB_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      port = &stub->ports[format->nPortIndex];
+
+      format->xFramerate = port->def.format.video.xFramerate;
+      if (stub_port_is_raw (stub, format->nPortIndex)) {
+        static const OMX_COLOR_FORMATTYPE formats[] = {
+          OMX_COLOR_FormatYUV420SemiPlanar, OMX_COLOR_FormatYUV420Planar
+        };
+
+        if (format->nIndex >= G_N_ELEMENTS (formats)) {
+          err = OMX_ErrorNoMore;
+          break;
+        }
+        format->eCompressionFormat = OMX_VIDEO_CodingUnused;
+        format->eColorFormat = (format->nIndex == 0) ?
+            port->def.format.video.eColorFormat : formats[format->nIndex];
+      } else {
+        if (format->nIndex > 0) {
+          err = OMX_ErrorNoMore;
+          break;
+        }
+        format->eCompressionFormat = port->def.format.video.eCompressionFormat;
+        format->eColorFormat = OMX_COLOR_FormatUnused;
+      }
+      break;
+    }
+    case OMX_IndexParamStandardComponentRole:{
+      OMX_PARAM_COMPONENTROLETYPE *role = param;
+
+      g_strlcpy ((gchar *) role->cRole, stub->role->role,
+          OMX_MAX_STRINGNAME_SIZE);
+      break;
+    }
+    default:
+      err = stub_load_param (stub, index, param);
+      break;
+  }
+  g_mutex_unlock (&stub->lock);
+
+  return err;
+}
+
+/* NOTE: Must be called while holding stub->lock */
+static OMX_ERRORTYPE
+stub_set_port_definition (StubComponent * stub,
+    OMX_PARAM_PORTDEFINITIONTYPE * def)
+{
+  StubPort *port, *out_port = &stub->ports[STUB_OUT_PORT];
+
+  if (def->nPortIndex >= STUB_N_PORTS)
+    return OMX_ErrorBadPortIndex;
+  port = &stub->ports[def->nPortIndex];
+
+  if (def->nBufferCountActual < port->def.nBufferCountMin)
+    return OMX_ErrorBadParameter;
+  port->def.nBufferCountActual = def->nBufferCountActual;
+  port->def.nBufferSize = MAX (port->def.nBufferSize, def->nBufferSize);
+
+  if (stub_is_video (stub)) {
+    OMX_VIDEO_PORTDEFINITIONTYPE *video = &port->def.format.video;
+
+    video->nFrameWidth = def->format.video.nFrameWidth;
+    video->nFrameHeight = def->format.video.nFrameHeight;
+    video->nStride = def->format.video.nStride;
+    video->nSliceHeight = def->format.video.nSliceHeight;
+    video->xFramerate = def->format.video.xFramerate;
+    video->nBitrate = def->format.video.nBitrate;
+    if (stub_port_is_raw (stub, def->nPortIndex)
+        && (def->format.video.eColorFormat == OMX_COLOR_FormatYUV420Planar
+            || def->format.video.eColorFormat ==
+            OMX_COLOR_FormatYUV420SemiPlanar))
+      video->eColorFormat = def->format.video.eColorFormat;
+    stub_update_video_port (stub, port);
+
+    /* The output follows the frame size of the input */
+    if (def->nPortIndex == STUB_IN_PORT && video->nFrameWidth > 0
+        && video->nFrameHeight > 0 && !out_port->def.bPopulated) {
+      out_port->def.format.video.nFrameWidth = video->nFrameWidth;
+      out_port->def.format.video.nFrameHeight = video->nFrameHeight;
+      out_port->def.format.video.xFramerate = video->xFramerate;
+      stub_update_video_port (stub, out_port);
+    }
+  }
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_set_parameter (OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+    OMX_PTR param)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  const StubRole *role;
+
+  g_mutex_lock (&stub->lock);
+  switch (index) {
+    case OMX_IndexParamPortDefinition:
+      err = stub_set_port_definition (stub, param);
+      break;
+    case OMX_IndexParamVideoPortFormat:{
+      OMX_VIDEO_PARAM_PORTFORMATTYPE *format = param;
+      StubPort *port;
+
+      if (!stub_is_video (stub)) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      if (format->nPortIndex >= STUB_N_PORTS) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      port = &stub->ports[format->nPortIndex];
+
+      if (stub_port_is_raw (stub, format->nPortIndex)) {
+        if (format->eColorFormat != OMX_COLOR_FormatYUV420SemiPlanar
+            && format->eColorFormat != OMX_COLOR_FormatYUV420Planar) {
+          err = OMX_ErrorUnsupportedSetting;
+          break;
+        }
+        port->def.format.video.eColorFormat = format->eColorFormat;
+      } else if (format->eCompressionFormat !=
+          port->def.format.video.eCompressionFormat) {
+        err = OMX_ErrorUnsupportedSetting;
+      }
+      break;
+    }
+    case OMX_IndexParamStandardComponentRole:{
+      OMX_PARAM_COMPONENTROLETYPE *role_param = param;
+
+      err = OMX_ErrorUnsupportedSetting;
+      for (role = stub->info->roles; role->role; role++) {
+        if (strcmp ((const gchar *) role_param->cRole, role->role) == 0) {
+          stub->role = role;
+          if (stub_is_video (stub)) {
+            guint i = stub->info->kind == STUB_VIDEO_DECODER ?
+                STUB_IN_PORT : STUB_OUT_PORT;
+            stub->ports[i].def.format.video.eCompressionFormat = role->coding;
+          }
+          err = OMX_ErrorNone;
+          break;
+        }
+      }
+      break;
+    }
+    default:
+      stub_store_param (stub, index, param);
+      break;
+  }
+  g_mutex_unlock (&stub->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+stub_get_config (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+  OMX_ERRORTYPE err;
+
+  g_mutex_lock (&stub->lock);
+  err = stub_load_param (stub, index, config);
+  g_mutex_unlock (&stub->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+stub_set_config (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+
+  g_mutex_lock (&stub->lock);
+  stub_store_param (stub, index, config);
+  g_mutex_unlock (&stub->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_get_extension_index (OMX_HANDLETYPE handle, OMX_STRING name,
+    OMX_INDEXTYPE * index)
+{
+  return OMX_ErrorUnsupportedIndex;
+}
+
+static OMX_ERRORTYPE
+stub_get_state (OMX_HANDLETYPE handle, OMX_STATETYPE * state)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+
+  g_mutex_lock (&stub->lock);
+  *state = stub->state;
+  g_mutex_unlock (&stub->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_component_tunnel_request (OMX_HANDLETYPE handle, OMX_U32 port,
+    OMX_HANDLETYPE tunneled_comp, OMX_U32 tunneled_port,
+    OMX_TUNNELSETUPTYPE * tunnel_setup)
+{
+  return OMX_ErrorNotImplemented;
+}
+
+static OMX_ERRORTYPE
+stub_add_buffer (StubComponent * stub, OMX_BUFFERHEADERTYPE ** buffer,
+    OMX_U32 port_index, OMX_PTR app_private, OMX_U32 size, OMX_U8 * data)
+{
+  OMX_BUFFERHEADERTYPE *buf;
+  StubPort *port;
+
+  if (port_index >= STUB_N_PORTS)
+    return OMX_ErrorBadPortIndex;
+
+  buf = g_new0 (OMX_BUFFERHEADERTYPE, 1);
+  STUB_INIT_STRUCT (buf);
+  buf->nAllocLen = size;
+  buf->pAppPrivate = app_private;
+  if (data) {
+    buf->pBuffer = data;
+  } else {
+    buf->pBuffer = g_malloc0 (size);
+    /* Marks that the memory is ours */
+    buf->pPlatformPrivate = buf->pBuffer;
+  }
+  if (port_index == STUB_IN_PORT) {
+    buf->nInputPortIndex = port_index;
+    buf->nOutputPortIndex = OMX_ALL;
+  } else {
+    buf->nInputPortIndex = OMX_ALL;
+    buf->nOutputPortIndex = port_index;
+  }
+
+  g_mutex_lock (&stub->lock);
+  port = &stub->ports[port_index];
+  port->n_allocated++;
+  g_cond_signal (&stub->cond);
+  g_mutex_unlock (&stub->lock);
+
+  *buffer = buf;
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_use_buffer (OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE ** buffer,
+    OMX_U32 port_index, OMX_PTR app_private, OMX_U32 size, OMX_U8 * data)
+{
+  g_return_val_if_fail (data != NULL, OMX_ErrorBadParameter);
+
+  return stub_add_buffer (STUB_FROM_HANDLE (handle), buffer, port_index,
+      app_private, size, data);
+}
+
+static OMX_ERRORTYPE
+stub_allocate_buffer (OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE ** buffer,
+    OMX_U32 port_index, OMX_PTR app_private, OMX_U32 size)
+{
+  return stub_add_buffer (STUB_FROM_HANDLE (handle), buffer, port_index,
+      app_private, size, NULL);
+}
+
+static OMX_ERRORTYPE
+stub_free_buffer (OMX_HANDLETYPE handle, OMX_U32 port_index,
+    OMX_BUFFERHEADERTYPE * buf)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+
+  if (port_index >= STUB_N_PORTS)
+    return OMX_ErrorBadPortIndex;
+
+  g_mutex_lock (&stub->lock);
+  stub->ports[port_index].n_allocated--;
+  stub->ports[port_index].def.bPopulated = OMX_FALSE;
+  g_cond_signal (&stub->cond);
+  g_mutex_unlock (&stub->lock);
+
+  g_free (buf->pPlatformPrivate);
+  g_free (buf);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_queue_buffer (StubComponent * stub, OMX_U32 port_index,
+    OMX_BUFFERHEADERTYPE * buf)
+{
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  g_mutex_lock (&stub->lock);
+  if (stub->state != OMX_StateExecuting && stub->state != OMX_StatePause
+      && stub->state != OMX_StateIdle) {
+    err = OMX_ErrorIncorrectStateOperation;
+  } else {
+    g_queue_push_tail (&stub->ports[port_index].queue, buf);
+    g_cond_signal (&stub->cond);
+  }
+  g_mutex_unlock (&stub->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+stub_empty_this_buffer (OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE * buf)
+{
+  return stub_queue_buffer (STUB_FROM_HANDLE (handle), STUB_IN_PORT, buf);
+}
+
+static OMX_ERRORTYPE
+stub_fill_this_buffer (OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE * buf)
+{
+  return stub_queue_buffer (STUB_FROM_HANDLE (handle), STUB_OUT_PORT, buf);
+}
+
+static OMX_ERRORTYPE
+stub_set_callbacks (OMX_HANDLETYPE handle, OMX_CALLBACKTYPE * callbacks,
+    OMX_PTR app_data)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+
+  stub->callbacks = *callbacks;
+  stub->app_data = app_data;
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_component_deinit (OMX_HANDLETYPE handle)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+  guint i;
+
+  g_mutex_lock (&stub->lock);
+  stub->running = FALSE;
+  g_cond_signal (&stub->cond);
+  g_mutex_unlock (&stub->lock);
+  g_thread_join (stub->thread);
+
+  for (i = 0; i < STUB_N_PORTS; i++)
+    g_queue_clear (&stub->ports[i].queue);
+  g_queue_foreach (&stub->commands, (GFunc) g_free, NULL);
+  g_queue_clear (&stub->commands);
+  g_hash_table_unref (stub->params);
+  g_cond_clear (&stub->cond);
+  g_mutex_clear (&stub->lock);
+  g_free (stub);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+stub_use_egl_image (OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE ** buffer,
+    OMX_U32 port_index, OMX_PTR app_private, void *egl_image)
+{
+  return OMX_ErrorNotImplemented;
+}
+
+static OMX_ERRORTYPE
+stub_component_role_enum (OMX_HANDLETYPE handle, OMX_U8 * role,
+    OMX_U32 index)
+{
+  StubComponent *stub = STUB_FROM_HANDLE (handle);
+  guint i;
+
+  for (i = 0; stub->info->roles[i].role; i++) {
+    if (i == index) {
+      g_strlcpy ((gchar *) role, stub->info->roles[i].role,
+          OMX_MAX_STRINGNAME_SIZE);
+      return OMX_ErrorNone;
+    }
+  }
+
+  return OMX_ErrorNoMore;
+}
+
+static const StubComponentInfo *
+stub_find_component (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (stub_components); i++) {
+    if (strcmp (stub_components[i].name, name) == 0)
+      return &stub_components[i];
+  }
+
+  return NULL;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_Init (void)
+{
+  g_mutex_lock (&stub_init_lock);
+  if (stub_init_count++ == 0) {
+    stub_latency = stub_getenv_uint ("GST_OMX_STUB_LATENCY", 0);
+    stub_buffers = MAX (stub_getenv_uint ("GST_OMX_STUB_BUFFERS", 4), 1);
+    stub_width = stub_getenv_uint ("GST_OMX_STUB_WIDTH", 1920);
+    stub_height = stub_getenv_uint ("GST_OMX_STUB_HEIGHT", 1080);
+    stub_settings_changed_interval =
+        stub_getenv_uint ("GST_OMX_STUB_SETTINGS_CHANGED", 1);
+    stub_settings_in_place =
+        stub_getenv_uint ("GST_OMX_STUB_SETTINGS_IN_PLACE", 1) != 0;
+  }
+  g_mutex_unlock (&stub_init_lock);
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_Deinit (void)
+{
+  g_mutex_lock (&stub_init_lock);
+  if (stub_init_count > 0)
+    stub_init_count--;
+  g_mutex_unlock (&stub_init_lock);
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_ComponentNameEnum (OMX_STRING name, OMX_U32 length, OMX_U32 index)
+{
+  if (index >= G_N_ELEMENTS (stub_components))
+    return OMX_ErrorNoMore;
+
+  g_strlcpy (name, stub_components[index].name, length);
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_GetHandle (OMX_HANDLETYPE * handle, OMX_STRING name, OMX_PTR app_data,
+    OMX_CALLBACKTYPE * callbacks)
+{
+  const StubComponentInfo *info;
+  OMX_COMPONENTTYPE *comp;
+  StubComponent *stub;
+  guint i;
+
+  if (!handle || !name || !callbacks)
+    return OMX_ErrorBadParameter;
+
+  info = stub_find_component (name);
+  if (!info)
+    return OMX_ErrorComponentNotFound;
+
+  stub = g_new0 (StubComponent, 1);
+  stub->info = info;
+  stub->role = &info->roles[0];
+  stub->callbacks = *callbacks;
+  stub->app_data = app_data;
+  stub->state = OMX_StateLoaded;
+  stub->settings_changed_frame = G_MAXUINT64;
+  stub->params = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+      g_free);
+  g_mutex_init (&stub->lock);
+  g_cond_init (&stub->cond);
+  g_queue_init (&stub->commands);
+  for (i = 0; i < STUB_N_PORTS; i++)
+    stub_init_port (stub, i);
+  stub_init_params (stub);
+
+  comp = g_new0 (OMX_COMPONENTTYPE, 1);
+  STUB_INIT_STRUCT (comp);
+  comp->pComponentPrivate = stub;
+  comp->pApplicationPrivate = app_data;
+  comp->GetComponentVersion = stub_get_component_version;
+  comp->SendCommand = stub_send_command;
+  comp->GetParameter = stub_get_parameter;
+  comp->SetParameter = stub_set_parameter;
+  comp->GetConfig = stub_get_config;
+  comp->SetConfig = stub_set_config;
+  comp->GetExtensionIndex = stub_get_extension_index;
+  comp->GetState = stub_get_state;
+  comp->ComponentTunnelRequest = stub_component_tunnel_request;
+  comp->UseBuffer = stub_use_buffer;
+  comp->AllocateBuffer = stub_allocate_buffer;
+  comp->FreeBuffer = stub_free_buffer;
+  comp->EmptyThisBuffer = stub_empty_this_buffer;
+  comp->FillThisBuffer = stub_fill_this_buffer;
+  comp->SetCallbacks = stub_set_callbacks;
+  comp->ComponentDeInit = stub_component_deinit;
+  comp->UseEGLImage = stub_use_egl_image;
+  comp->ComponentRoleEnum = stub_component_role_enum;
+  stub->handle = comp;
+
+  stub->running = TRUE;
+  stub->thread = g_thread_new (info->name, stub_thread, stub);
+
+  *handle = comp;
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_FreeHandle (OMX_HANDLETYPE handle)
+{
+  OMX_COMPONENTTYPE *comp = handle;
+
+  if (!comp)
+    return OMX_ErrorBadParameter;
+
+  stub_component_deinit (comp);
+  g_free (comp);
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_SetupTunnel (OMX_HANDLETYPE output, OMX_U32 port_output,
+    OMX_HANDLETYPE input, OMX_U32 port_input)
+{
+  return OMX_ErrorNotImplemented;
+}
+
+OMX_API OMX_ERRORTYPE
+OMX_GetComponentsOfRole (OMX_STRING role, OMX_U32 * num_comps,
+    OMX_U8 ** comp_names)
+{
+  const StubRole *r;
+  OMX_U32 i, n = 0;
+
+  for (i = 0; i < G_N_ELEMENTS (stub_components); i++) {
+    for (r = stub_components[i].roles; r->role; r++) {
+      if (strcmp (r->role, role) != 0)
+        continue;
+      if (comp_names && n < *num_comps)
+        g_strlcpy ((gchar *) comp_names[n], stub_components[i].name,
+            OMX_MAX_STRINGNAME_SIZE);
+      n++;
+      break;
+    }
+  }
+  *num_comps = n;
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE
+OMX_GetRolesOfComponent (OMX_STRING comp_name, OMX_U32 * num_roles,
+    OMX_U8 ** roles)
+{
+  const StubComponentInfo *info = stub_find_component (comp_name);
+  OMX_U32 n;
+
+  if (!info)
+    return OMX_ErrorComponentNotFound;
+
+  for (n = 0; info->roles[n].role; n++) {
+    if (roles && n < *num_roles)
+      g_strlcpy ((gchar *) roles[n], info->roles[n].role,
+          OMX_MAX_STRINGNAME_SIZE);
+  }
+  *num_roles = n;
+
+  return OMX_ErrorNone;
+}